@@ -0,0 +1,313 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * worker thread that applies block actions off the caller's thread
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#include <chrono>
+#include <set>
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "block_action_queue.h"
+#include "block_aggregator.h"
+#include "ip_addr_controller.h"
+#include "shared_config.h"
+
+
+BlockActionQueue::BlockActionQueue(const std::string &loc,
+		size_t xlock,
+		bool enforce,
+		bool dbg,
+		size_t max_p,
+		size_t max_b)
+	: db_loc(loc), iptables_xlock(xlock), do_enforce(enforce), debug(dbg),
+	  max_pending(max_p), max_batch(max_b), subnet_threshold(0),
+	  data_base_shared_memory(nullptr), whitelist_shm(NULL), aggregated_shm(NULL),
+	  in_flight(0), stopping(false), started(false),
+	  completion(NULL), completion_ctx(NULL) {
+
+	memset(&stats, 0, sizeof(stats));
+}
+
+
+BlockActionQueue *BlockActionQueue::Create(const std::string &db_loc,
+		size_t iptables_xlock,
+		bool do_enforce,
+		bool use_shared_memory,
+		bool debug,
+		size_t max_pending,
+		size_t max_batch) {
+
+	if (max_pending == 0 || max_batch == 0)
+		return nullptr;
+
+	BlockActionQueue *queue = new BlockActionQueue(db_loc, iptables_xlock, do_enforce, debug, max_pending, max_batch);
+	if (queue->init(use_shared_memory) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR block action queue [Create]");
+		delete queue;
+		queue = nullptr;
+	}
+	return queue;
+}
+
+
+int32_t BlockActionQueue::init(bool use_shared_memory) {
+
+	if (use_shared_memory) {
+		data_base_shared_memory = DataBase::create();
+		if (data_base_shared_memory == nullptr)
+			return 1;
+	}
+	whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
+	aggregated_shm = SharedIpConfig::Create(GARGOYLE_AGGREGATED_SHM_NAME, GARGOYLE_AGGREGATED_SHM_SZ);
+
+	/*
+	 * signals go to the producer threads only, a handler that
+	 * ran on the worker could never stop or join it
+	 */
+	sigset_t all_sigs, old_sigs;
+	sigfillset(&all_sigs);
+	pthread_sigmask(SIG_BLOCK, &all_sigs, &old_sigs);
+	worker = std::thread(&BlockActionQueue::run, this);
+	pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+	started = true;
+	return 0;
+}
+
+
+BlockActionQueue::~BlockActionQueue() {
+
+	Stop(true);
+
+	if (whitelist_shm)
+		delete whitelist_shm;
+	if (aggregated_shm)
+		delete aggregated_shm;
+	if (data_base_shared_memory != nullptr)
+		delete data_base_shared_memory;
+}
+
+
+int32_t BlockActionQueue::Enqueue(const std::string &the_ip, int detection_type, const std::string &config_file_id) {
+
+	if (the_ip.size() == 0)
+		return 1;
+
+	std::unique_lock<std::mutex> lk(mtx);
+
+	if (stopping) {
+		stats.rejected++;
+		return 1;
+	}
+
+	std::map<std::string, Request>::iterator it = pending.find(the_ip);
+	if (it != pending.end()) {
+		/*
+		 * keep the first specific reason we saw, a later
+		 * generic (0) request adds nothing to it
+		 */
+		if (it->second.detection_type == 0 && detection_type > 0) {
+			it->second.detection_type = detection_type;
+			it->second.config_file_id = config_file_id;
+		}
+		stats.merged++;
+		return 0;
+	}
+
+	if (order.size() >= max_pending) {
+		stats.rejected++;
+		if (debug) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG, "Block queue full, caller applies inline:", the_ip.c_str());
+		}
+		return 1;
+	}
+
+	Request req;
+	req.detection_type = detection_type;
+	req.config_file_id = config_file_id;
+	pending.insert(std::make_pair(the_ip, req));
+	order.push_back(the_ip);
+
+	stats.enqueued++;
+	if (order.size() > stats.max_depth)
+		stats.max_depth = order.size();
+
+	lk.unlock();
+	work_cv.notify_one();
+	return 0;
+}
+
+
+void BlockActionQueue::SetCompletion(Completion cb, void *ctx) {
+
+	std::lock_guard<std::mutex> lk(mtx);
+	completion = cb;
+	completion_ctx = ctx;
+}
+
+
+void BlockActionQueue::SetSubnetThreshold(size_t threshold) {
+
+	std::lock_guard<std::mutex> lk(mtx);
+	subnet_threshold = threshold;
+}
+
+
+void BlockActionQueue::Flush() {
+
+	std::unique_lock<std::mutex> lk(mtx);
+	idle_cv.wait(lk, [this]{ return (order.empty() && in_flight == 0) || !started; });
+}
+
+
+void BlockActionQueue::Stop(bool drain) {
+
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (!started)
+			return;
+		stopping = true;
+		if (!drain) {
+			order.clear();
+			pending.clear();
+		}
+	}
+	work_cv.notify_all();
+	worker.join();
+
+	std::lock_guard<std::mutex> lk(mtx);
+	started = false;
+	idle_cv.notify_all();
+
+	if (debug) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu", GARGOYLE_DEBUG,
+				"Block queue enqueued:", stats.enqueued, "merged:", stats.merged, "rejected:", stats.rejected,
+				"processed:", stats.processed, "failed:", stats.failed, "batches:", stats.batches,
+				"max depth:", stats.max_depth);
+	}
+}
+
+
+BlockActionQueue::Stats BlockActionQueue::GetStats() {
+
+	std::lock_guard<std::mutex> lk(mtx);
+	return stats;
+}
+
+
+void BlockActionQueue::run() {
+
+	std::deque<std::pair<std::string, Request> > batch;
+
+	while (true) {
+
+		std::unique_lock<std::mutex> lk(mtx);
+		work_cv.wait(lk, [this]{ return stopping || !order.empty(); });
+
+		if (order.empty() && stopping)
+			break;
+
+		/*
+		 * detections tend to arrive in bursts (one scan trips
+		 * several rules), give the burst a moment to land so
+		 * it shares one chain listing
+		 */
+		if (!stopping && order.size() < max_batch) {
+			work_cv.wait_for(lk, std::chrono::milliseconds(GARGOYLE_BLOCK_QUEUE_LINGER_MS),
+					[this]{ return stopping || order.size() >= max_batch; });
+		}
+
+		while (!order.empty() && batch.size() < max_batch) {
+			std::map<std::string, Request>::iterator it = pending.find(order.front());
+			batch.push_back(std::make_pair(it->first, it->second));
+			pending.erase(it);
+			order.pop_front();
+		}
+		in_flight = batch.size();
+		lk.unlock();
+
+		applyBatch(batch);
+		batch.clear();
+
+		lk.lock();
+		in_flight = 0;
+		stats.batches++;
+		if (order.empty())
+			idle_cv.notify_all();
+	}
+}
+
+
+void BlockActionQueue::applyBatch(std::deque<std::pair<std::string, Request> > &batch) {
+
+	std::set<std::string> chain_entries;
+	get_chain_entries(chain_entries, iptables_xlock);
+
+	for (std::deque<std::pair<std::string, Request> >::iterator it = batch.begin(); it != batch.end(); ++it) {
+
+		int host_ix = do_block_actions(it->first,
+			it->second.detection_type,
+			db_loc,
+			iptables_xlock,
+			do_enforce,
+			(void *)whitelist_shm,
+			debug,
+			it->second.config_file_id,
+			data_base_shared_memory,
+			chain_entries
+		);
+
+		if (host_ix > 0)
+			chain_entries.insert(it->first);
+
+		Completion cb;
+		void *cb_ctx;
+		{
+			std::lock_guard<std::mutex> lk(mtx);
+			if (host_ix > 0)
+				stats.processed++;
+			else
+				stats.failed++;
+			cb = completion;
+			cb_ctx = completion_ctx;
+		}
+
+		if (cb)
+			cb(it->first, it->second.detection_type, host_ix, cb_ctx);
+	}
+
+	size_t threshold;
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		threshold = subnet_threshold;
+	}
+	if (threshold > 0 && do_enforce)
+		aggregate_chain_rules(aggregated_shm, whitelist_shm, threshold, iptables_xlock, debug);
+}
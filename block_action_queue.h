@@ -0,0 +1,152 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * worker thread that applies block actions off the caller's thread
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef _BLOCKACTIONQUEUE_H__
+#define _BLOCKACTIONQUEUE_H__
+
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <stdint.h>
+
+#include "data_base.h"
+#include "gargoyle_config_vals.h"
+
+
+class SharedIpConfig;
+
+
+/*
+ * Bounded queue in front of do_block_actions.
+ *
+ * Producers (nflog callback, log tail handlers, analysis loops)
+ * only pay for an Enqueue. A single worker thread drains the
+ * queue in batches: the chain is listed once per batch and every
+ * ip in the batch is then run through do_block_actions against
+ * that listing. An ip that is already pending is merged into the
+ * pending request instead of being queued twice.
+ *
+ * The worker attaches its own shared memory handles (DB tables,
+ * whitelist and aggregated addrs) the same way another process
+ * would, so it never shares per-handle state with the producer
+ * thread.
+ *
+ * With a subnet threshold set, every batch ends with a subnet
+ * aggregation pass over the chain (see block_aggregator.h).
+ */
+class BlockActionQueue {
+
+	public:
+
+	// called on the worker thread once an ip has been processed,
+	// host_ix is what do_block_actions returned
+	typedef void (*Completion)(const std::string &, int, int, void *);
+
+	struct Stats {
+		size_t enqueued;
+		size_t merged;
+		size_t rejected;
+		size_t processed;
+		size_t failed;
+		size_t batches;
+		size_t max_depth;
+	};
+
+	static BlockActionQueue *Create(const std::string &db_loc,
+									size_t iptables_xlock,
+									bool do_enforce,
+									bool use_shared_memory,
+									bool debug,
+									size_t max_pending = GARGOYLE_BLOCK_QUEUE_MAX_PENDING,
+									size_t max_batch = GARGOYLE_BLOCK_QUEUE_MAX_BATCH);
+	~BlockActionQueue();
+
+	/*
+	 * return 0 = queued (or merged with a pending request)
+	 * return 1 = not queued, queue full or stopped
+	 */
+	int32_t Enqueue(const std::string &the_ip, int detection_type, const std::string &config_file_id = "");
+	void SetCompletion(Completion cb, void *ctx);
+	// 0 (the default) leaves every block as its own /32 rule
+	void SetSubnetThreshold(size_t threshold);
+	// blocks until everything queued so far has been applied
+	void Flush();
+	/*
+	 * stops the worker, pending requests are applied first if drain
+	 * is set. joins the worker, so never from a signal handler
+	 */
+	void Stop(bool drain);
+	Stats GetStats();
+
+	private:
+
+	struct Request {
+		int detection_type;
+		std::string config_file_id;
+	};
+
+	BlockActionQueue(const std::string &, size_t, bool, bool, size_t, size_t);
+	int32_t init(bool use_shared_memory);
+	void run();
+	void applyBatch(std::deque<std::pair<std::string, Request> > &);
+
+	std::string db_loc;
+	size_t iptables_xlock;
+	bool do_enforce;
+	bool debug;
+	size_t max_pending;
+	size_t max_batch;
+	size_t subnet_threshold;
+
+	DataBase *data_base_shared_memory;
+	SharedIpConfig *whitelist_shm;
+	SharedIpConfig *aggregated_shm;
+
+	std::mutex mtx;
+	std::condition_variable work_cv;
+	std::condition_variable idle_cv;
+	std::deque<std::string> order;
+	std::map<std::string, Request> pending;
+	size_t in_flight;
+	bool stopping;
+	bool started;
+	std::thread worker;
+
+	Completion completion;
+	void *completion_ctx;
+	Stats stats;
+};
+
+
+#endif // _BLOCKACTIONQUEUE_H__
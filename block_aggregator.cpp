@@ -0,0 +1,398 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * collapses blocked addrs into subnet rules in GARGOYLE_Input_Chain
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#include <algorithm>
+#include <map>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+#include "block_aggregator.h"
+#include "iptables_wrapper_api.h"
+#include "shared_config.h"
+
+
+static uint32_t prefix_mask(uint8_t len) {
+	return len == 0 ? 0 : 0xffffffffu << (32 - len);
+}
+
+
+static uint32_t prefix_last(uint32_t addr, uint8_t len) {
+	return addr | ~prefix_mask(len);
+}
+
+
+// number of entries of the sorted vector v that fall in [lo, hi]
+static size_t count_in_range(const std::vector<uint32_t> &v, uint32_t lo, uint32_t hi) {
+	return std::upper_bound(v.begin(), v.end(), hi) - std::lower_bound(v.begin(), v.end(), lo);
+}
+
+
+/*
+ * covers the blocked addrs inside addr/len without covering a
+ * hole, splitting in half until each piece is hole free. a piece
+ * holding a single blocked addr is left as that /32
+ */
+static void cover_prefix(const std::vector<uint32_t> &blocked,
+		const std::vector<uint32_t> &holes,
+		uint32_t addr,
+		uint8_t len,
+		std::vector<BlockPrefix> &out) {
+
+	uint32_t last = prefix_last(addr, len);
+	size_t n = count_in_range(blocked, addr, last);
+
+	if (n == 0)
+		return;
+
+	if (n == 1) {
+		BlockPrefix p = { *std::lower_bound(blocked.begin(), blocked.end(), addr), 32 };
+		out.push_back(p);
+		return;
+	}
+
+	if (count_in_range(holes, addr, last) == 0) {
+		BlockPrefix p = { addr, len };
+		out.push_back(p);
+		return;
+	}
+
+	cover_prefix(blocked, holes, addr, len + 1, out);
+	cover_prefix(blocked, holes, addr | (1u << (31 - len)), len + 1, out);
+}
+
+
+std::vector<BlockPrefix> compute_block_prefixes(const std::vector<uint32_t> &blocked_in,
+		const std::vector<uint32_t> &holes_in,
+		size_t threshold,
+		uint8_t group_len,
+		uint8_t min_len) {
+
+	std::vector<BlockPrefix> out;
+
+	if (group_len > 32 || min_len > group_len)
+		return out;
+
+	std::vector<uint32_t> blocked(blocked_in);
+	std::sort(blocked.begin(), blocked.end());
+	blocked.erase(std::unique(blocked.begin(), blocked.end()), blocked.end());
+
+	std::vector<uint32_t> holes(holes_in);
+	std::sort(holes.begin(), holes.end());
+	holes.erase(std::unique(holes.begin(), holes.end()), holes.end());
+
+	std::vector<uint32_t>::const_iterator it = blocked.begin();
+	while (it != blocked.end()) {
+
+		uint32_t group = *it & prefix_mask(group_len);
+		std::vector<uint32_t>::const_iterator group_end = std::upper_bound(it, blocked.cend(), prefix_last(group, group_len));
+
+		if (threshold > 0 && (size_t)(group_end - it) > threshold) {
+			cover_prefix(blocked, holes, group, group_len, out);
+		} else {
+			for (; it != group_end; ++it) {
+				BlockPrefix p = { *it, 32 };
+				out.push_back(p);
+			}
+		}
+		it = group_end;
+	}
+
+	/*
+	 * two whole sibling aggregates make their parent. children
+	 * never overlap a hole so neither does the parent, and
+	 * going from the longest prefix up lets a merged parent
+	 * merge again
+	 */
+	std::set<BlockPrefix> merged(out.begin(), out.end());
+	for (int len = group_len; len > min_len; len--) {
+
+		std::set<BlockPrefix>::iterator m = merged.begin();
+		while (m != merged.end()) {
+
+			if (m->len != len || (m->addr & (1u << (32 - len)))) {
+				++m;
+				continue;
+			}
+
+			BlockPrefix sibling = { m->addr | (1u << (32 - len)), (uint8_t)len };
+			std::set<BlockPrefix>::iterator s = merged.find(sibling);
+			if (s == merged.end()) {
+				++m;
+				continue;
+			}
+
+			BlockPrefix parent = { m->addr, (uint8_t)(len - 1) };
+			merged.erase(s);
+			m = merged.erase(m);
+			merged.insert(parent);
+		}
+	}
+
+	return std::vector<BlockPrefix>(merged.begin(), merged.end());
+}
+
+
+std::string block_prefix_to_string(const BlockPrefix &p) {
+
+	struct in_addr a;
+	a.s_addr = htonl(p.addr);
+
+	char buf[INET_ADDRSTRLEN + 4];
+	inet_ntop(AF_INET, &a, buf, INET_ADDRSTRLEN);
+	if (p.len < 32)
+		snprintf(buf + strlen(buf), 4, "/%u", (unsigned) p.len);
+
+	return std::string(buf);
+}
+
+
+int parse_block_prefix(const std::string &s, BlockPrefix &p) {
+
+	std::string addr = s;
+	unsigned long len = 32;
+
+	size_t slash = s.find('/');
+	if (slash != std::string::npos) {
+		char *end;
+		len = strtoul(s.c_str() + slash + 1, &end, 10);
+		if (*end != '\0' || end == s.c_str() + slash + 1 || len > 32)
+			return 1;
+		addr = s.substr(0, slash);
+	}
+
+	struct in_addr a;
+	if (inet_pton(AF_INET, addr.c_str(), &a) != 1)
+		return 1;
+
+	p.len = (uint8_t) len;
+	p.addr = ntohl(a.s_addr) & prefix_mask(p.len);
+	return 0;
+}
+
+
+static int collect_drop_rule(const struct iptables_rule_entry *entry, void *ctx) {
+
+	std::vector<BlockPrefix> *rules = (std::vector<BlockPrefix> *) ctx;
+
+	BlockPrefix p;
+	if (strcmp(entry->target, "DROP") == 0 && parse_block_prefix(entry->source, p) == 0)
+		rules->push_back(p);
+	return 0;
+}
+
+
+/*
+ * pscand, the analysis daemon, the monitor and unblockip all run
+ * passes, one at a time or each would work from a chain listing
+ * the others are busy changing. returns the fd to close, or -1
+ */
+static int aggregate_lock() {
+
+	int fd = open(GARGOYLE_AGGREGATE_LOCK_FILE, O_RDONLY | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	while (flock(fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			close(fd);
+			return -1;
+		}
+	}
+	return fd;
+}
+
+
+static void get_host_order_addrs(SharedIpConfig *shm, std::vector<uint32_t> &out) {
+
+	if (!shm)
+		return;
+
+	std::vector<in_addr_t> addrs;
+	if (shm->GetAll(addrs) < 0)
+		return;
+
+	for (std::vector<in_addr_t>::const_iterator it = addrs.begin(); it != addrs.end(); ++it)
+		out.push_back(ntohl(*it));
+}
+
+
+// the prefix in sorted, non overlapping v that contains addr, or NULL
+static const BlockPrefix *covering_prefix(const std::vector<BlockPrefix> &v, uint32_t addr) {
+
+	BlockPrefix key = { addr, 32 };
+	std::vector<BlockPrefix>::const_iterator it = std::upper_bound(v.begin(), v.end(), key);
+	if (it == v.begin())
+		return NULL;
+	--it;
+	if ((addr & prefix_mask(it->len)) == it->addr)
+		return &(*it);
+	return NULL;
+}
+
+
+static int aggregate_chain_rules_locked(SharedIpConfig *aggregated_shm,
+		SharedIpConfig *whitelist_shm,
+		size_t threshold,
+		size_t iptables_xlock,
+		bool debug) {
+
+	std::vector<BlockPrefix> rules;
+	iptables_for_each_rule_in_chain(GARGOYLE_CHAIN_NAME, collect_drop_rule, &rules, iptables_xlock);
+
+	std::vector<uint32_t> blocked;
+	std::set<BlockPrefix> in_chain;
+	for (std::vector<BlockPrefix>::const_iterator it = rules.begin(); it != rules.end(); ++it) {
+		if (it->len == 32)
+			blocked.push_back(it->addr);
+		in_chain.insert(*it);
+	}
+
+	std::vector<uint32_t> aggregated;
+	get_host_order_addrs(aggregated_shm, aggregated);
+	blocked.insert(blocked.end(), aggregated.begin(), aggregated.end());
+
+	std::vector<uint32_t> holes;
+	get_host_order_addrs(whitelist_shm, holes);
+
+	std::vector<BlockPrefix> wanted = compute_block_prefixes(blocked, holes, threshold);
+
+	/*
+	 * add first, nothing that is blocked now may pass while
+	 * rules are swapped. if an add fails leave everything else
+	 * alone, the next pass starts over from the chain
+	 */
+	size_t added = 0;
+	for (std::vector<BlockPrefix>::const_iterator it = wanted.begin(); it != wanted.end(); ++it) {
+
+		if (in_chain.count(*it))
+			continue;
+
+		std::string src = block_prefix_to_string(*it);
+		if (iptables_add_drop_rule_to_chain(GARGOYLE_CHAIN_NAME, src.c_str(), iptables_xlock) != 0) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_ERROR, "Subnet aggregation could not add:", src.c_str());
+			return 1;
+		}
+		added++;
+		if (debug) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s %s %s", GARGOYLE_DEBUG, "Added source: ", src.c_str(), "to Chain: ", GARGOYLE_CHAIN_NAME);
+		}
+	}
+
+	std::sort(aggregated.begin(), aggregated.end());
+	std::sort(blocked.begin(), blocked.end());
+	blocked.erase(std::unique(blocked.begin(), blocked.end()), blocked.end());
+
+	for (std::vector<uint32_t>::const_iterator it = blocked.begin(); it != blocked.end(); ++it) {
+
+		const BlockPrefix *p = covering_prefix(wanted, *it);
+		bool covered = p && p->len < 32;
+		bool was_covered = std::binary_search(aggregated.begin(), aggregated.end(), *it);
+
+		if (covered == was_covered)
+			continue;
+
+		BlockPrefix host = { *it, 32 };
+		if (covered)
+			aggregated_shm->Add(block_prefix_to_string(host));
+		else
+			aggregated_shm->Remove(block_prefix_to_string(host));
+	}
+
+	/*
+	 * by source, not by the line numbers listed above, those
+	 * have moved with every add and delete made since
+	 */
+	std::vector<BlockPrefix> stale;
+	for (std::vector<BlockPrefix>::const_iterator it = rules.begin(); it != rules.end(); ++it) {
+		if (!std::binary_search(wanted.begin(), wanted.end(), *it))
+			stale.push_back(*it);
+	}
+
+	for (std::vector<BlockPrefix>::const_iterator it = stale.begin(); it != stale.end(); ++it) {
+		std::string src = block_prefix_to_string(*it);
+		iptables_delete_drop_rule_by_source(GARGOYLE_CHAIN_NAME, src.c_str(), iptables_xlock);
+	}
+
+	if (debug && (added || stale.size())) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s %zu %s %zu", GARGOYLE_DEBUG, "Subnet aggregation rules added:",
+				added, "removed:", stale.size(), "now:", rules.size() + added - stale.size());
+	}
+
+	return 0;
+}
+
+
+int aggregate_chain_rules(SharedIpConfig *aggregated_shm,
+		SharedIpConfig *whitelist_shm,
+		size_t threshold,
+		size_t iptables_xlock,
+		bool debug) {
+
+	if (!aggregated_shm)
+		return 1;
+
+	int lock_fd = aggregate_lock();
+	if (lock_fd < 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_ERROR, "Subnet aggregation could not lock:", GARGOYLE_AGGREGATE_LOCK_FILE);
+		return 1;
+	}
+
+	int ret = aggregate_chain_rules_locked(aggregated_shm, whitelist_shm, threshold, iptables_xlock, debug);
+	close(lock_fd);
+	return ret;
+}
+
+
+bool is_aggregated(const std::string &the_ip, SharedIpConfig *aggregated_shm) {
+
+	bool result = false;
+	if (aggregated_shm)
+		aggregated_shm->Contains(the_ip, &result);
+	return result;
+}
+
+
+void clear_aggregated(SharedIpConfig *aggregated_shm) {
+
+	std::vector<uint32_t> addrs;
+	get_host_order_addrs(aggregated_shm, addrs);
+
+	for (std::vector<uint32_t>::const_iterator it = addrs.begin(); it != addrs.end(); ++it) {
+		BlockPrefix host = { *it, 32 };
+		aggregated_shm->Remove(block_prefix_to_string(host));
+	}
+}
@@ -0,0 +1,110 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * collapses blocked addrs into subnet rules in GARGOYLE_Input_Chain
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef _BLOCKAGGREGATOR_H__
+#define _BLOCKAGGREGATOR_H__
+
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "gargoyle_config_vals.h"
+
+
+class SharedIpConfig;
+
+
+/*
+ * One source prefix in GARGOYLE_CHAIN_NAME, addr is in host
+ * byte order with the host bits cleared. len 32 is a plain ip.
+ */
+struct BlockPrefix {
+	uint32_t addr;
+	uint8_t len;
+
+	bool operator<(const BlockPrefix &o) const {
+		return addr != o.addr ? addr < o.addr : len < o.len;
+	}
+};
+
+
+/*
+ * Works out the smallest set of source prefixes that drops every
+ * addr in blocked.
+ *
+ * A /group_len with more than threshold blocked addrs is replaced
+ * by one prefix, or by the fewest sub prefixes that keep every addr
+ * in holes (whitelist) out of it. Neighbouring aggregates are then
+ * merged upwards, never past /min_len. Blocked addrs in a /group_len
+ * at or below the threshold stay as /32's.
+ *
+ * blocked and holes are host byte order, any order, dupes ok.
+ */
+std::vector<BlockPrefix> compute_block_prefixes(const std::vector<uint32_t> &blocked,
+												const std::vector<uint32_t> &holes,
+												size_t threshold,
+												uint8_t group_len = GARGOYLE_AGGREGATE_PREFIX_LEN,
+												uint8_t min_len = GARGOYLE_AGGREGATE_MIN_PREFIX_LEN);
+
+// "a.b.c.d" for a /32, "a.b.c.d/len" otherwise (the iptables -L form)
+std::string block_prefix_to_string(const BlockPrefix &);
+// return 0 = ok, 1 = not a valid ipv4 addr or prefix
+int parse_block_prefix(const std::string &, BlockPrefix &);
+
+/*
+ * Brings GARGOYLE_CHAIN_NAME in line with compute_block_prefixes.
+ *
+ * The blocked set is every /32 DROP rule in the chain plus every
+ * addr in aggregated_shm, the addrs that are blocked but currently
+ * only covered by a subnet rule. New subnet rules are added before
+ * the /32's they replace are deleted, and a subnet rule that is no
+ * longer justified (members unblocked, or a member whitelisted) is
+ * split back into its remaining /32's. aggregated_shm is kept in
+ * step so other processes can tell an aggregated addr from one
+ * that is not blocked at all. Passes from different processes take
+ * turns on GARGOYLE_AGGREGATE_LOCK_FILE.
+ *
+ * return 0 = ok (nothing to do is ok), 1 = chain left as it was
+ */
+int aggregate_chain_rules(SharedIpConfig *aggregated_shm,
+						SharedIpConfig *whitelist_shm,
+						size_t threshold,
+						size_t iptables_xlock,
+						bool debug);
+
+// true if the_ip is blocked by way of a subnet rule rather than its own
+bool is_aggregated(const std::string &the_ip, SharedIpConfig *aggregated_shm);
+// forget every aggregated addr, for when the chain itself is flushed
+void clear_aggregated(SharedIpConfig *aggregated_shm);
+
+
+#endif // _BLOCKAGGREGATOR_H__
@@ -0,0 +1,297 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * worker thread that coalesces hit and detection writes to the SQLite DB
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#include <chrono>
+
+#include <pthread.h>
+#include <signal.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "hit_write_behind.h"
+#include "sqlite_wrapper_api.h"
+
+
+HitWriteBehind::HitWriteBehind(const std::string &loc, size_t interval_ms, size_t max_d)
+	: db_loc(loc), flush_interval_ms(interval_ms), max_dirty(max_d),
+	  failed_flushes(0), flush_now(false), writing(false), stopping(false), started(false) {
+
+	memset(&stats, 0, sizeof(stats));
+}
+
+
+HitWriteBehind *HitWriteBehind::Create(const std::string &db_loc,
+		size_t flush_interval_ms,
+		size_t max_dirty) {
+
+	// a zero interval means write through, no worker
+	if (flush_interval_ms == 0 || max_dirty == 0)
+		return nullptr;
+
+	HitWriteBehind *wb = new HitWriteBehind(db_loc, flush_interval_ms, max_dirty);
+	/*
+	 * keep signals off the worker, its handler only flags
+	 * main, which then flushes and stops us from its own thread
+	 */
+	sigset_t all_sigs, old_sigs;
+	sigfillset(&all_sigs);
+	pthread_sigmask(SIG_BLOCK, &all_sigs, &old_sigs);
+	wb->worker = std::thread(&HitWriteBehind::run, wb);
+	pthread_sigmask(SIG_SETMASK, &old_sigs, NULL);
+	wb->started = true;
+	return wb;
+}
+
+
+HitWriteBehind::~HitWriteBehind() {
+
+	Stop();
+}
+
+
+size_t HitWriteBehind::dirty() const {
+
+	return hits.size() + detections.size();
+}
+
+
+/*
+ * caller holds mtx, decides whether a row that is not in the
+ * dirty map yet may be added to it
+ */
+int32_t HitWriteBehind::admit(bool is_new) {
+
+	if (stopping) {
+		stats.rejected++;
+		return 1;
+	}
+	if (!is_new) {
+		stats.coalesced++;
+		return 0;
+	}
+
+	size_t d = dirty();
+	if (d >= max_dirty) {
+		/*
+		 * a flush that is already running swapped out its own
+		 * copy, so this map is refilling faster than the disk
+		 * keeps up, let the caller write through
+		 */
+		if (writing) {
+			stats.rejected++;
+			return 1;
+		}
+		work_cv.notify_one();
+	}
+	if (d + 1 > stats.max_dirty)
+		stats.max_dirty = d + 1;
+	return 0;
+}
+
+
+int32_t HitWriteBehind::AddHit(const std::string &the_ip, int the_port, int the_cnt) {
+
+	if (the_ip.size() == 0 || the_port <= 0 || the_cnt <= 0)
+		return 1;
+
+	std::pair<std::string, int> key(the_ip, the_port);
+	std::lock_guard<std::mutex> lk(mtx);
+
+	HitMap::iterator it = hits.find(key);
+	if (admit(it == hits.end()) != 0)
+		return 1;
+
+	if (it != hits.end())
+		it->second += the_cnt;
+	else
+		hits.insert(std::make_pair(key, the_cnt));
+	stats.hits++;
+	return 0;
+}
+
+
+int32_t HitWriteBehind::AddDetection(int host_ix, int tstamp) {
+
+	if (host_ix <= 0)
+		return 1;
+
+	std::lock_guard<std::mutex> lk(mtx);
+
+	DetectionMap::iterator it = detections.find(host_ix);
+	if (admit(it == detections.end()) != 0)
+		return 1;
+
+	// detected_hosts keeps one row per host, the first one wins
+	if (it == detections.end())
+		detections.insert(std::make_pair(host_ix, tstamp));
+	stats.detections++;
+	return 0;
+}
+
+
+bool HitWriteBehind::IsDetectionPending(int host_ix) {
+
+	std::lock_guard<std::mutex> lk(mtx);
+	return detections.count(host_ix) > 0 || (writing && flushing_detections.count(host_ix) > 0);
+}
+
+
+void HitWriteBehind::Flush() {
+
+	std::unique_lock<std::mutex> lk(mtx);
+	flush_now = true;
+	work_cv.notify_one();
+	idle_cv.wait(lk, [this]{ return (dirty() == 0 && !writing) || !started; });
+}
+
+
+void HitWriteBehind::Stop() {
+
+	{
+		std::lock_guard<std::mutex> lk(mtx);
+		if (!started)
+			return;
+		stopping = true;
+	}
+	work_cv.notify_all();
+	worker.join();
+
+	std::lock_guard<std::mutex> lk(mtx);
+	started = false;
+	idle_cv.notify_all();
+
+	syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu %s %zu", INFO_SYSLOG,
+			"write-behind hits:", stats.hits, "coalesced:", stats.coalesced, "detections:", stats.detections,
+			"rejected:", stats.rejected, "rows written:", stats.rows_written, "failed:", stats.failed,
+			"retried:", stats.retried, "flushes:", stats.flushes, "max dirty:", stats.max_dirty);
+}
+
+
+HitWriteBehind::Stats HitWriteBehind::GetStats() {
+
+	std::lock_guard<std::mutex> lk(mtx);
+	return stats;
+}
+
+
+void HitWriteBehind::run() {
+
+	while (true) {
+
+		std::unique_lock<std::mutex> lk(mtx);
+		work_cv.wait_for(lk, std::chrono::milliseconds(flush_interval_ms),
+				[this]{ return stopping || flush_now || dirty() >= max_dirty; });
+		flush_now = false;
+
+		if (dirty() == 0) {
+			idle_cv.notify_all();
+			if (stopping)
+				break;
+			continue;
+		}
+
+		// producers carry on into empty maps while this batch is written
+		flushing_hits.swap(hits);
+		flushing_detections.swap(detections);
+		writing = true;
+		lk.unlock();
+
+		// the batch is only read until writing goes back to false
+		int32_t rolled_back = write(flushing_hits, flushing_detections);
+
+		lk.lock();
+		if (!rolled_back) {
+			failed_flushes = 0;
+		} else if (++failed_flushes < GARGOYLE_WRITE_BEHIND_MAX_RETRIES) {
+			requeue();
+		} else {
+			size_t lost = flushing_hits.size() + flushing_detections.size();
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s %zu %s", GARGOYLE_ERROR, "write-behind dropped", lost,
+					"rows after", failed_flushes, "failed flushes");
+			stats.failed += lost;
+			failed_flushes = 0;
+		}
+		flushing_hits.clear();
+		flushing_detections.clear();
+		writing = false;
+		stats.flushes++;
+		if (dirty() == 0)
+			idle_cv.notify_all();
+	}
+}
+
+
+/*
+ * caller holds mtx, puts a rolled back batch back in front of
+ * whatever producers recorded while it was being written
+ */
+void HitWriteBehind::requeue() {
+
+	for (HitMap::const_iterator it = flushing_hits.begin(); it != flushing_hits.end(); ++it)
+		hits[it->first] += it->second;
+
+	// the batch has the earlier detection, the first one wins
+	for (DetectionMap::const_iterator it = flushing_detections.begin(); it != flushing_detections.end(); ++it)
+		detections[it->first] = it->second;
+
+	stats.retried += flushing_hits.size() + flushing_detections.size();
+}
+
+
+int32_t HitWriteBehind::write(HitMap &batch_hits, DetectionMap &batch_detections) {
+
+	size_t written = 0;
+	size_t failed = 0;
+
+	bool in_transaction = (sqlite_begin_transaction(db_loc.c_str()) == 0);
+
+	for (HitMap::const_iterator it = batch_hits.begin(); it != batch_hits.end(); ++it) {
+		if (sqlite_upsert_host_port_hit(it->first.first.c_str(), it->first.second, it->second, db_loc.c_str()) > 0)
+			written++;
+		else
+			failed++;
+	}
+
+	for (DetectionMap::const_iterator it = batch_detections.begin(); it != batch_detections.end(); ++it) {
+		// non zero is mostly a host that is already in detected_hosts
+		if (sqlite_add_detected_host(it->first, it->second, db_loc.c_str()) == 0)
+			written++;
+	}
+
+	// rolled back means none of it is on disk, so all of it can go again
+	if (in_transaction && sqlite_commit_transaction(db_loc.c_str()) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s", INFO_SYSLOG, "write-behind flush of", batch_hits.size() + batch_detections.size(), "rows rolled back");
+		return 1;
+	}
+
+	std::lock_guard<std::mutex> lk(mtx);
+	stats.rows_written += written;
+	stats.failed += failed;
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * worker thread that coalesces hit and detection writes to the SQLite DB
+ *
+ * Copyright (c) 2017 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef _HITWRITEBEHIND_H__
+#define _HITWRITEBEHIND_H__
+
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <stdint.h>
+
+#include "gargoyle_config_vals.h"
+
+
+/*
+ * Write-behind cache in front of the SQLite hit and detection writes.
+ *
+ * Producers (nflog callback, log tail handlers, the block worker)
+ * only update an in memory dirty map: a pending hit delta per
+ * (ip addr, port) and the first detection timestamp per host_ix.
+ * A single worker thread writes the map out in one transaction
+ * every flush interval, or sooner once the map holds max_dirty
+ * rows, so N hits on one row between flushes cost one UPDATE.
+ *
+ * hosts_table.last_seen is kept by the triggers on hosts_ports_hits
+ * and so moves once per flush rather than once per hit.
+ *
+ * A flush whose transaction is rolled back goes back into the dirty
+ * map and is retried with the next one. Its rows only count as failed
+ * once GARGOYLE_WRITE_BEHIND_MAX_RETRIES flushes in a row were lost.
+ *
+ * Only meant for the SQLite backend, the shared memory DB is
+ * already in memory.
+ */
+class HitWriteBehind {
+
+	public:
+
+	struct Stats {
+		size_t hits;
+		size_t coalesced;
+		size_t detections;
+		size_t rejected;
+		size_t rows_written;
+		size_t failed;
+		size_t retried;
+		size_t flushes;
+		size_t max_dirty;
+	};
+
+	static HitWriteBehind *Create(const std::string &db_loc,
+								size_t flush_interval_ms = GARGOYLE_WRITE_BEHIND_INTERVAL_MS,
+								size_t max_dirty = GARGOYLE_WRITE_BEHIND_MAX_DIRTY);
+	~HitWriteBehind();
+
+	/*
+	 * return 0 = recorded, it goes to disk with the next flush
+	 * return 1 = not recorded (a flush is running and the dirty
+	 *            map is full, or stopped), caller writes it through
+	 */
+	int32_t AddHit(const std::string &the_ip, int the_port, int the_cnt);
+	int32_t AddDetection(int host_ix, int tstamp);
+	// true when a detection for host_ix is recorded but not on disk yet
+	bool IsDetectionPending(int host_ix);
+	// blocks until everything recorded so far is on disk
+	void Flush();
+	// writes out whatever is pending and stops the worker, joins it so never from a signal handler
+	void Stop();
+	Stats GetStats();
+
+	private:
+
+	typedef std::map<std::pair<std::string, int>, int> HitMap;
+	typedef std::map<int, int> DetectionMap;
+
+	HitWriteBehind(const std::string &, size_t, size_t);
+	void run();
+	// return 0 = done with the batch, 1 = rolled back, nothing written
+	int32_t write(HitMap &, DetectionMap &);
+	void requeue();
+	size_t dirty() const;
+	int32_t admit(bool is_new);
+
+	std::string db_loc;
+	size_t flush_interval_ms;
+	size_t max_dirty;
+
+	std::mutex mtx;
+	std::condition_variable work_cv;
+	std::condition_variable idle_cv;
+	HitMap hits;
+	DetectionMap detections;
+	// batch the worker is writing out, swapped out of the two above
+	HitMap flushing_hits;
+	DetectionMap flushing_detections;
+	// flushes rolled back in a row
+	size_t failed_flushes;
+	bool flush_now;
+	bool writing;
+	bool stopping;
+	bool started;
+	std::thread worker;
+
+	Stats stats;
+};
+
+
+#endif // _HITWRITEBEHIND_H__
@@ -27,6 +27,7 @@
  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *****************************************************************************/
+#include <set>
 #include <sstream>
 
 #include <syslog.h>
@@ -38,6 +39,17 @@
 #include "gargoyle_config_vals.h"
 #include "config_variables.h"
 #include "shared_config.h"
+#include "hit_write_behind.h"
+
+
+static HitWriteBehind *write_behind = nullptr;
+
+
+void set_write_behind(HitWriteBehind *wb) {
+
+	write_behind = wb;
+}
+
 
 int add_ip_to_hosts_table(const std::string &the_ip, const std::string &db_loc, bool debug, DataBase *data_base_shared_memory) {
 
@@ -70,26 +82,17 @@ int add_ip_to_hosts_table(const std::string &the_ip, const std::string &db_loc,
 			// Return the state of this operation not the FK of the record if this has been inserted
 			added_host_ix = data_base_shared_memory->hosts->INSERT(record);
 			if(added_host_ix == 0){
-				char result[SMALL_DEST_BUF];
-				memset(result, 0, SMALL_DEST_BUF);
-				string query = "SELECT ix FROM hosts_table WHERE host=" + the_ip;
-				if((added_host_ix = data_base_shared_memory->hosts->SELECT(result, query)) != -1){
-					added_host_ix = atol(result);
-				}
+				added_host_ix = data_base_shared_memory->hosts->findHostIx(the_ip.c_str());
 			}
 		}else{
-			added_host_ix = sqlite_add_host(the_ip.c_str(), db_loc.c_str());
+			// returns the existing ix if the_ip is already there
+			added_host_ix = sqlite_upsert_host(the_ip.c_str(), db_loc.c_str());
 		}
 		// already exists
 		if (added_host_ix == -1) {
 			// get existing index
 			if(data_base_shared_memory != nullptr){
-				char result[SMALL_DEST_BUF];
-				memset(result, 0, SMALL_DEST_BUF);
-				string query = "SELECT ix FROM hosts_table WHERE host=" + the_ip;
-				if((added_host_ix = data_base_shared_memory->hosts->SELECT(result, query)) != -1){
-					added_host_ix = atol(result);
-				}
+				added_host_ix = data_base_shared_memory->hosts->findHostIx(the_ip.c_str());
 			}else{
 				added_host_ix = sqlite_get_host_ix(the_ip.c_str(), db_loc.c_str());
 			}
@@ -99,7 +102,26 @@ int add_ip_to_hosts_table(const std::string &the_ip, const std::string &db_loc,
 }
 
 
-int do_block_actions(const std::string &the_ip,
+/*
+ * iptables_for_each_rule_in_chain callback, gathers the
+ * source addr of every rule into the std::set at ctx
+ */
+static int collect_rule_source(const struct iptables_rule_entry *entry, void *ctx) {
+
+	std::set<std::string> *entries = (std::set<std::string> *) ctx;
+	if (entry->source[0])
+		entries->insert(entry->source);
+	return 0;
+}
+
+
+size_t get_chain_entries(std::set<std::string> &chain_entries, size_t iptables_xlock) {
+
+	return iptables_for_each_rule_in_chain(GARGOYLE_CHAIN_NAME, collect_rule_source, &chain_entries, iptables_xlock);
+}
+
+
+static int do_block_actions_impl(const std::string &the_ip,
 		int detection_type,
 		const std::string &db_loc,
 		size_t iptables_xlock,
@@ -107,19 +129,15 @@ int do_block_actions(const std::string &the_ip,
 		void *g_shared_mem,
 		bool debug,
 		const std::string &config_file_id,
-		DataBase *data_base_shared_memory
+		DataBase *data_base_shared_memory,
+		const std::set<std::string> *chain_entries
 		) {
 
 	int host_ix;
 	host_ix = 0;
 
 	if(data_base_shared_memory != nullptr){
-		char result[SMALL_DEST_BUF];
-		memset(result, 0, SMALL_DEST_BUF);
-		string query = "SELECT ix FROM hosts_table WHERE host=" + the_ip;
-		if((host_ix = data_base_shared_memory->hosts->SELECT(result, query)) != -1){
-			host_ix = atol(result);
-		}
+		host_ix = data_base_shared_memory->hosts->findHostIx(the_ip.c_str());
 	}else{
 		host_ix = sqlite_get_host_ix(the_ip.c_str(), db_loc.c_str());
 	}
@@ -140,7 +158,15 @@ int do_block_actions(const std::string &the_ip,
 		// if this ip is not whitelisted
 		if (!is_white_listed(the_ip, g_shared_mem)) {
 
-			size_t rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, the_ip.c_str(), iptables_xlock);
+			/*
+			 * a caller that already listed the chain only needs
+			 * to know whether the ip is in it, not where
+			 */
+			size_t rule_ix;
+			if (chain_entries)
+				rule_ix = chain_entries->count(the_ip);
+			else
+				rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, the_ip.c_str(), iptables_xlock);
 			if (debug) {
 				syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zd %s %s", GARGOYLE_DEBUG, "Iptables rule IX: ", rule_ix, "in Chain: ", GARGOYLE_CHAIN_NAME);
 			}
@@ -179,14 +205,11 @@ int do_block_actions(const std::string &the_ip,
 					 */
 					int ix;
 					if(data_base_shared_memory != nullptr){
-						char result[SMALL_DEST_BUF];
-						memset(result, 0, SMALL_DEST_BUF);
-						string query = "SELECT ix FROM detected_hosts WHERE host_ix=" + host_ix;
-						if((ix = data_base_shared_memory->detected_hosts->SELECT(result, query)) != -1){
-							ix = atol(result);
-						}
+						ix = data_base_shared_memory->detected_hosts->findByHostIx(host_ix);
 					}else{
 						ix = sqlite_is_host_detected(host_ix, db_loc.c_str());
+						if (ix == 0 && write_behind && write_behind->IsDetectionPending(host_ix))
+							ix = host_ix;
 					}
 					if (do_enforce && ix == 0) {
 						ret = iptables_add_drop_rule_to_chain(GARGOYLE_CHAIN_NAME, the_ip.c_str(), iptables_xlock);
@@ -224,15 +247,7 @@ int do_block_actions(const std::string &the_ip,
 						}
 
 						// add to DB
-						size_t adh;
-						if(data_base_shared_memory != nullptr){
-							Detected_Hosts_Record record;
-							record.host_ix = host_ix;
-							record.timestamp = tstamp;
-							adh = data_base_shared_memory->detected_hosts->INSERT(record);
-						}else{
-							adh = sqlite_add_detected_host(host_ix, (size_t)tstamp, db_loc.c_str());
-						}
+						size_t adh = add_to_detected_hosts(host_ix, tstamp, db_loc, data_base_shared_memory);
 
 						if (debug) {
 							if (adh != 0) {
@@ -263,6 +278,39 @@ int do_block_actions(const std::string &the_ip,
 }
 
 
+int do_block_actions(const std::string &the_ip,
+		int detection_type,
+		const std::string &db_loc,
+		size_t iptables_xlock,
+		bool do_enforce,
+		void *g_shared_mem,
+		bool debug,
+		const std::string &config_file_id,
+		DataBase *data_base_shared_memory
+		) {
+
+	return do_block_actions_impl(the_ip, detection_type, db_loc, iptables_xlock, do_enforce,
+			g_shared_mem, debug, config_file_id, data_base_shared_memory, NULL);
+}
+
+
+int do_block_actions(const std::string &the_ip,
+		int detection_type,
+		const std::string &db_loc,
+		size_t iptables_xlock,
+		bool do_enforce,
+		void *g_shared_mem,
+		bool debug,
+		const std::string &config_file_id,
+		DataBase *data_base_shared_memory,
+		const std::set<std::string> &chain_entries
+		) {
+
+	return do_block_actions_impl(the_ip, detection_type, db_loc, iptables_xlock, do_enforce,
+			g_shared_mem, debug, config_file_id, data_base_shared_memory, &chain_entries);
+}
+
+
 int add_to_hosts_port_table(const std::string &the_ip,
 	int the_port,
 	int the_cnt,
@@ -272,69 +320,56 @@ int add_to_hosts_port_table(const std::string &the_ip,
 
 	int host_ix;
 	host_ix = 0;
-	if(data_base_shared_memory != nullptr){
-		char result[SMALL_DEST_BUF];
-		memset(result, 0, SMALL_DEST_BUF);
-		string query = "SELECT ix FROM hosts_table WHERE host=" + the_ip;
-		if((host_ix = data_base_shared_memory->hosts->SELECT(result, query)) != -1){
-			host_ix = atol(result);
-		}
-	}else{
-		host_ix = sqlite_get_host_ix(the_ip.c_str(), db_loc.c_str());
+
+	if (data_base_shared_memory == nullptr) {
+		/*
+		 * host and host/port row are created or bumped
+		 * by a single upsert each, on one connection,
+		 * coalesced with other hits on the same row when
+		 * there is a write-behind cache
+		 */
+		if (write_behind && write_behind->AddHit(the_ip, the_port, the_cnt) == 0)
+			return 0;
+		sqlite_upsert_host_port_hit(the_ip.c_str(), the_port, the_cnt, db_loc.c_str());
+		return 0;
 	}
 
+	host_ix = data_base_shared_memory->hosts->findHostIx(the_ip.c_str());
+
 	if (host_ix == 0){
 		host_ix = add_ip_to_hosts_table(the_ip, db_loc, debug, data_base_shared_memory);
 
 	}
 	//std::cout << "HOST IX: " << host_ix << std::endl;
 
-	/*
-	 * call get_host_port_hit to see if the ip addr/port combo
-	 * already exists in the DB. if it does then call the update
-	 * function, otherwise add the data into a new record
-	 */
+	// adds the ip addr/port row or bumps the existing one
 	if (host_ix > 0 && the_port > 0 && the_cnt > 0) {
+		data_base_shared_memory->hosts_ports_hits->addHits(host_ix, the_port, the_cnt);
+	}
 
-		int resp;
-		//number of hits registered in the DB
-		if(data_base_shared_memory != nullptr){
-			char query[SQL_CMD_MAX];
-			sprintf(query, "SELECT hit_count FROM hosts_ports_hits WHERE host_ix=%d AND port_number=%d", host_ix, the_port);
-			char result[SMALL_DEST_BUF];
-			memset(result, 0, SMALL_DEST_BUF);
-			if((resp = data_base_shared_memory->hosts_ports_hits->SELECT(result, query)) != -1){
-				resp = atol(result);
-			}
-			Hosts_Ports_Hits_Record record;
-			// new record
-			if(resp == -1){
-				record.ix = 0;
-				record.host_ix = host_ix;
-				record.port_number = the_port;
-				record.hit_count = the_cnt;
-				data_base_shared_memory->hosts_ports_hits->INSERT(record);
-			}else if (resp >= 1) {
-				int u_cnt = resp + the_cnt;
-				record.host_ix = host_ix;
-				record.port_number = the_port;
-				record.hit_count = u_cnt;
-				data_base_shared_memory->hosts_ports_hits->UPDATE(record);
-			}
-		}else{
-			resp = sqlite_get_host_port_hit(host_ix, the_port, db_loc.c_str());
-			// new record
-			if (resp == 0) {
-				sqlite_add_host_port_hit(host_ix, the_port, the_cnt, db_loc.c_str());
-			} else if (resp >= 1) {
-				int u_cnt = resp + the_cnt;
-				sqlite_update_host_port_hit(host_ix, the_port, u_cnt, db_loc.c_str());
-			}
-		}
+	return 0;
+}
 
+
+/*
+ * return 0 = ok, the row is in (or on its way to) detected_hosts
+ * anything else = not ok
+ */
+int add_to_detected_hosts(int host_ix,
+	int tstamp,
+	const std::string &db_loc,
+	DataBase *data_base_shared_memory) {
+
+	if (data_base_shared_memory != nullptr) {
+		Detected_Hosts_Record record;
+		record.host_ix = host_ix;
+		record.timestamp = tstamp;
+		return data_base_shared_memory->detected_hosts->INSERT(record);
 	}
 
-	return 0;
+	if (write_behind && write_behind->AddDetection(host_ix, tstamp) == 0)
+		return 0;
+	return sqlite_add_detected_host(host_ix, (size_t)tstamp, db_loc.c_str());
 }
 
 
@@ -416,8 +451,7 @@ int do_host_remove_actions(const std::string &the_ip,
 
 	// delete all records for this host_ix from hosts_ports_hits table
 	if(data_base_shared_memory != nullptr){
-		string query = "DELETE FROM hosts_ports_hits WHERE host_ix=" + host_ix;
-		data_base_shared_memory->hosts_ports_hits->DELETE(query);
+		data_base_shared_memory->hosts_ports_hits->deleteByHostIx(host_ix);
 	}else{
 		sqlite_remove_host_ports_all(host_ix, db_loc.c_str());
 	}
@@ -31,12 +31,22 @@
 #define _IPADDRCONTROLLER_H__
 
 
+#include <set>
 #include <string>
 #include "data_base.h"
 
+class HitWriteBehind;
+
+
+/*
+ * hit and detection writes to the SQLite DB go through this
+ * write-behind cache when one is set, nullptr writes through
+ */
+void set_write_behind(HitWriteBehind *);
 
 int add_ip_to_hosts_table(const std::string &, const std::string &, bool, DataBase *);
 int add_to_hosts_port_table(const std::string &, int, int, const std::string &, bool, DataBase *);
+int add_to_detected_hosts(int, int, const std::string &, DataBase *);
 
 int do_block_actions(const std::string &,
                     int,
@@ -48,6 +58,23 @@ int do_block_actions(const std::string &,
                     const std::string &,
 					DataBase *
                     );
+/*
+ * same as above but takes the set of source addrs already in
+ * GARGOYLE_CHAIN_NAME (see get_chain_entries) instead of listing
+ * the chain again, for callers blocking several ip's in a row
+ */
+int do_block_actions(const std::string &,
+                    int,
+                    const std::string &,
+                    size_t,
+                    bool,
+                    void *,
+                    bool,
+                    const std::string &,
+					DataBase *,
+					const std::set<std::string> &
+                    );
+size_t get_chain_entries(std::set<std::string> &, size_t);
 int do_host_remove_actions(const std::string &, int, const std::string &, int, int, DataBase *);
 
 void do_report_action_output(const std::string &, int, int, int, int);
@@ -73,7 +73,7 @@ bool LogTail::Initialize(const std::string& name) {
 	return Initialize();
 }
 
-bool LogTail::Process(volatile bool & stop) {
+bool LogTail::Process(volatile sig_atomic_t & stop) {
 	_pre();
 	while (!stop) {
 		if (!_consume_file(stop)) break;
@@ -95,7 +95,7 @@ void LogTail::_post() {
 	_fin = NULL;
 }
 
-bool LogTail::_consume_file(volatile bool & stop) {
+bool LogTail::_consume_file(volatile sig_atomic_t & stop) {
 	const int lineMax = 1024;
 	std::string line(lineMax, '\0');
 
@@ -109,7 +109,7 @@ bool LogTail::_consume_file(volatile bool & stop) {
 	return !stop;
 }
 
-bool LogTail::_wait_file(volatile bool & stop) {
+bool LogTail::_wait_file(volatile sig_atomic_t & stop) {
 	int fd = inotify_init();
 	if (-1==fd) return false;
 
@@ -130,7 +130,8 @@ bool LogTail::_wait_file(volatile bool & stop) {
 
 	off_t loc = ftell(_fin);
 	bool done = false;
-	while (!done) {
+	// a signal breaks the inotify read below, so stop gets looked at
+	while (!done && !stop) {
 		int poll_num = poll(&fds, 1, -1);
 		if (poll_num > 0) {
 			/* use 1 page */
@@ -28,6 +28,7 @@
  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *****************************************************************************/
 #ifndef _LOGTAIL_H_
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -58,7 +59,7 @@ public:
 
 	bool Initialize();
 	bool Initialize(const std::string& name);
-	bool Process(volatile bool & stop);
+	bool Process(volatile sig_atomic_t & stop);
 	
 	virtual void OnLine(const std::string& line) {}
 	virtual void OnFollow() {}
@@ -68,8 +69,8 @@ private:
 
 	void _pre(off_t loc = 0);
 	void _post();
-	bool _consume_file(volatile bool & stop);
-	bool _wait_file(volatile bool & stop);
+	bool _consume_file(volatile sig_atomic_t & stop);
+	bool _wait_file(volatile sig_atomic_t & stop);
 
 	std::string _name;
 	FILE *_fin;
@@ -0,0 +1,524 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * kernel side drop of blocked sources through an XDP program and LPM map
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef USE_BPF
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/syscall.h>
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+
+#include "bpf_drop.h"
+#include "gargoyle_config_vals.h"
+
+
+// key layout the LPM trie expects, addr in network byte order
+struct bpf_drop_key {
+	uint32_t prefixlen;
+	uint32_t addr;
+};
+
+
+
+static int sys_bpf(int cmd, union bpf_attr *attr) {
+	return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+static struct bpf_insn insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+
+	struct bpf_insn i;
+	memset(&i, 0, sizeof(i));
+	i.code = code;
+	i.dst_reg = dst;
+	i.src_reg = src;
+	i.off = off;
+	i.imm = imm;
+	return i;
+}
+
+
+static int parse_key(const char *the_src, struct bpf_drop_key *key) {
+
+	char a[INET_ADDRSTRLEN];
+	unsigned long bits = 32;
+
+	const char *slash = strchr(the_src, '/');
+	if (slash) {
+		char *end;
+		size_t a_len = slash - the_src;
+		if (a_len >= sizeof(a))
+			return 1;
+		bits = strtoul(slash + 1, &end, 10);
+		if (*end != '\0' || end == slash + 1 || bits > 32)
+			return 1;
+		memcpy(a, the_src, a_len);
+		a[a_len] = '\0';
+	} else {
+		snprintf(a, sizeof(a), "%s", the_src);
+	}
+
+	struct in_addr in;
+	if (inet_pton(AF_INET, a, &in) != 1)
+		return 1;
+
+	key->prefixlen = bits;
+	key->addr = in.s_addr & (bits ? htonl(0xffffffffu << (32 - bits)) : 0);
+	return 0;
+}
+
+
+static void format_key(const struct bpf_drop_key *key, char *dst, size_t sz_dst) {
+
+	struct in_addr in;
+	in.s_addr = key->addr;
+
+	char a[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &in, a, sizeof(a));
+	if (key->prefixlen == 32)
+		snprintf(dst, sz_dst, "%s", a);
+	else
+		snprintf(dst, sz_dst, "%s/%u", a, key->prefixlen);
+}
+
+
+int bpf_drop_create_map(void) {
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_type = BPF_MAP_TYPE_LPM_TRIE;
+	attr.key_size = sizeof(struct bpf_drop_key);
+	// packets dropped per entry
+	attr.value_size = sizeof(uint64_t);
+	attr.max_entries = GARGOYLE_BPF_MAP_MAX_ENTRIES;
+	attr.map_flags = BPF_F_NO_PREALLOC;
+
+	int fd = sys_bpf(BPF_MAP_CREATE, &attr);
+	if (fd < 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR bpf map create from function [%s]: %s", __func__, strerror(errno));
+	return fd;
+}
+
+
+/*
+ * the equivalent of:
+ *
+ *	if (data + 34 > data_end || eth->h_proto != htons(ETH_P_IP))
+ *		return XDP_PASS;
+ *	key = { 32, ip->saddr };
+ *	if ((hits = bpf_map_lookup_elem(map, &key))) {
+ *		__sync_fetch_and_add(hits, 1);
+ *		return XDP_DROP;
+ *	}
+ *	return XDP_PASS;
+ *
+ * hand assembled so building gargoyle needs no BPF toolchain
+ */
+int bpf_drop_create_prog(int map_fd) {
+
+	struct bpf_insn prog[] = {
+		/* 0 */ insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0),
+		/* 1 */ insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0),
+		/* 2 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0),
+		/* 3 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, ETH_HLEN + 20),
+		/* 4 */ insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 15, 0),
+		/* 5 */ insn(BPF_LDX | BPF_MEM | BPF_H, BPF_REG_5, BPF_REG_2, 12, 0),
+		/* 6 */ insn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, 13, htons(ETH_P_IP)),
+		/* 7 */ insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_5, BPF_REG_2, ETH_HLEN + 12, 0),
+		/* 8 */ insn(BPF_ST | BPF_MEM | BPF_W, BPF_REG_10, 0, -8, 32),
+		/* 9 */ insn(BPF_STX | BPF_MEM | BPF_W, BPF_REG_10, BPF_REG_5, -4, 0),
+		/* 10 */ insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd),
+		/* 11 */ insn(0, 0, 0, 0, 0),
+		/* 12 */ insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_2, BPF_REG_10, 0, 0),
+		/* 13 */ insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_2, 0, 0, -8),
+		/* 14 */ insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+		/* 15 */ insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_0, 0, 4, 0),
+		/* 16 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_1, 0, 0, 1),
+		/* 17 */ insn(BPF_STX | BPF_ATOMIC | BPF_DW, BPF_REG_0, BPF_REG_1, 0, BPF_ADD),
+		/* 18 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_DROP),
+		/* 19 */ insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+		/* 20 */ insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS),
+		/* 21 */ insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	};
+
+	char log[4096];
+	*log = 0;
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.prog_type = BPF_PROG_TYPE_XDP;
+	attr.insns = (uint64_t)(unsigned long) prog;
+	attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+	attr.license = (uint64_t)(unsigned long) "Dual BSD/GPL";
+	attr.log_buf = (uint64_t)(unsigned long) log;
+	attr.log_size = sizeof(log);
+	attr.log_level = 1;
+
+	int fd = sys_bpf(BPF_PROG_LOAD, &attr);
+	if (fd < 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR bpf prog load from function [%s]: %s %s", __func__, strerror(errno), log);
+	return fd;
+}
+
+
+size_t bpf_drop_map_add(int map_fd, const char *the_src) {
+
+	struct bpf_drop_key key;
+	if (parse_key(the_src, &key) != 0)
+		return 1;
+
+	uint64_t hits = 0;
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uint64_t)(unsigned long) &key;
+	attr.value = (uint64_t)(unsigned long) &hits;
+	// an existing entry keeps its hit count
+	attr.flags = BPF_NOEXIST;
+
+	if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) == 0 || errno == EEXIST)
+		return 0;
+	return 1;
+}
+
+
+size_t bpf_drop_map_delete(int map_fd, const char *the_src) {
+
+	struct bpf_drop_key key;
+	if (parse_key(the_src, &key) != 0)
+		return 1;
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	attr.key = (uint64_t)(unsigned long) &key;
+
+	return sys_bpf(BPF_MAP_DELETE_ELEM, &attr) == 0 ? 0 : 1;
+}
+
+
+static int open_pinned_map(void) {
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uint64_t)(unsigned long) GARGOYLE_BPF_MAP_PIN;
+	return sys_bpf(BPF_OBJ_GET, &attr);
+}
+
+
+static int pin_obj(int fd, const char *path) {
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (uint64_t)(unsigned long) path;
+	attr.bpf_fd = fd;
+
+	if (sys_bpf(BPF_OBJ_PIN, &attr) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR bpf pin from function [%s]: %s %s", __func__, path, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+
+static int key_compare(const void *a, const void *b) {
+
+	const struct bpf_drop_key *ka = (const struct bpf_drop_key *) a;
+	const struct bpf_drop_key *kb = (const struct bpf_drop_key *) b;
+	uint32_t aa = ntohl(ka->addr), ab = ntohl(kb->addr);
+
+	if (aa != ab)
+		return aa < ab ? -1 : 1;
+	if (ka->prefixlen != kb->prefixlen)
+		return ka->prefixlen < kb->prefixlen ? -1 : 1;
+	return 0;
+}
+
+
+/*
+ * every key in the map, sorted so that rule numbers handed out
+ * by bpf_drop_for_each mean the same thing to bpf_drop_delete_at.
+ * *keys is malloc'd, returns the count or -1
+ */
+static ssize_t get_sorted_keys(int map_fd, struct bpf_drop_key **keys) {
+
+	size_t cap = 256;
+	size_t n = 0;
+	*keys = (struct bpf_drop_key *) malloc(cap * sizeof(struct bpf_drop_key));
+	if (!*keys)
+		return -1;
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.map_fd = map_fd;
+	// a NULL key asks for the first one
+	attr.key = 0;
+
+	while (1) {
+		if (n == cap) {
+			struct bpf_drop_key *grown = (struct bpf_drop_key *) realloc(*keys, 2 * cap * sizeof(struct bpf_drop_key));
+			if (!grown) {
+				free(*keys);
+				return -1;
+			}
+			*keys = grown;
+			cap *= 2;
+			// the previous key moved along with the buffer
+			if (n > 0)
+				attr.key = (uint64_t)(unsigned long) &(*keys)[n - 1];
+		}
+
+		attr.next_key = (uint64_t)(unsigned long) &(*keys)[n];
+		if (sys_bpf(BPF_MAP_GET_NEXT_KEY, &attr) != 0)
+			break;
+		attr.key = attr.next_key;
+		n++;
+	}
+
+	qsort(*keys, n, sizeof(struct bpf_drop_key), key_compare);
+	return n;
+}
+
+
+size_t bpf_drop_load(const char *ifname) {
+
+	unsigned int ifindex = if_nametoindex(ifname);
+	if (ifindex == 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR bpf from function [%s]: no such interface %s", __func__, ifname);
+		return 1;
+	}
+
+	// left over from a run that did not exit cleanly
+	bpf_drop_unload();
+
+	int map_fd = bpf_drop_create_map();
+	if (map_fd < 0)
+		return 1;
+
+	int prog_fd = bpf_drop_create_prog(map_fd);
+	if (prog_fd < 0) {
+		close(map_fd);
+		return 1;
+	}
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.link_create.prog_fd = prog_fd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_XDP;
+	attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+
+	int link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+	if (link_fd < 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR bpf attach from function [%s]: %s %s", __func__, ifname, strerror(errno));
+		close(prog_fd);
+		close(map_fd);
+		return 1;
+	}
+
+	/*
+	 * the link is pinned as well, so like the iptables chain the
+	 * drops outlive a gargoyle_pscand that dies without cleaning
+	 * up. the map pin goes last, it is what switches everyone over
+	 */
+	size_t ret = 0;
+	if (pin_obj(link_fd, GARGOYLE_BPF_LINK_PIN) != 0 || pin_obj(map_fd, GARGOYLE_BPF_MAP_PIN) != 0) {
+		unlink(GARGOYLE_BPF_LINK_PIN);
+		ret = 1;
+	}
+
+	// the pins hold the references from here on
+	close(link_fd);
+	close(prog_fd);
+	close(map_fd);
+	return ret;
+}
+
+
+void bpf_drop_unload(void) {
+
+	// removing the map pin first sends everyone back to iptables
+	unlink(GARGOYLE_BPF_MAP_PIN);
+	// dropping the last reference to the link detaches the program
+	unlink(GARGOYLE_BPF_LINK_PIN);
+}
+
+
+int bpf_drop_is_active(void) {
+
+	return access(GARGOYLE_BPF_MAP_PIN, F_OK) == 0;
+}
+
+
+size_t bpf_drop_add(const char *the_src) {
+
+	int map_fd = open_pinned_map();
+	if (map_fd < 0)
+		return 1;
+
+	size_t ret = bpf_drop_map_add(map_fd, the_src);
+	close(map_fd);
+	return ret;
+}
+
+
+size_t bpf_drop_delete(const char *the_src) {
+
+	int map_fd = open_pinned_map();
+	if (map_fd < 0)
+		return 1;
+
+	size_t ret = bpf_drop_map_delete(map_fd, the_src);
+	close(map_fd);
+	return ret;
+}
+
+
+size_t bpf_drop_delete_at(size_t rule_index, char *the_src, size_t sz_src) {
+
+	if (rule_index == 0)
+		return 1;
+
+	int map_fd = open_pinned_map();
+	if (map_fd < 0)
+		return 1;
+
+	size_t ret = 1;
+	struct bpf_drop_key *keys;
+	ssize_t n = get_sorted_keys(map_fd, &keys);
+	if (n >= 0) {
+		if (rule_index <= (size_t) n) {
+			union bpf_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.map_fd = map_fd;
+			attr.key = (uint64_t)(unsigned long) &keys[rule_index - 1];
+			ret = sys_bpf(BPF_MAP_DELETE_ELEM, &attr) == 0 ? 0 : 1;
+			if (ret == 0 && the_src)
+				format_key(&keys[rule_index - 1], the_src, sz_src);
+		}
+		free(keys);
+	}
+	close(map_fd);
+	return ret;
+}
+
+
+size_t bpf_drop_flush(void) {
+
+	int map_fd = open_pinned_map();
+	if (map_fd < 0)
+		return 1;
+
+	struct bpf_drop_key *keys;
+	ssize_t n = get_sorted_keys(map_fd, &keys);
+	if (n >= 0) {
+		union bpf_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = map_fd;
+		ssize_t i;
+		for (i = 0; i < n; i++) {
+			attr.key = (uint64_t)(unsigned long) &keys[i];
+			sys_bpf(BPF_MAP_DELETE_ELEM, &attr);
+		}
+		free(keys);
+	}
+	close(map_fd);
+	return n >= 0 ? 0 : 1;
+}
+
+
+/*
+ * entry->line mimics "iptables -L -n -v --line-numbers" enough for
+ * the callers that match on it, the pkts column is the per entry
+ * drop count kept by the program
+ */
+size_t bpf_drop_for_each(iptables_rule_cb cb, void *ctx) {
+
+	if (!cb)
+		return 1;
+
+	int map_fd = open_pinned_map();
+	if (map_fd < 0)
+		return 1;
+
+	struct bpf_drop_key *keys;
+	ssize_t n = get_sorted_keys(map_fd, &keys);
+	if (n < 0) {
+		close(map_fd);
+		return 1;
+	}
+
+	struct iptables_rule_entry entry;
+	char line[IPTABLES_LINE_SZ];
+	union bpf_attr attr;
+	ssize_t i;
+
+	for (i = 0; i < n; i++) {
+
+		uint64_t hits = 0;
+		memset(&attr, 0, sizeof(attr));
+		attr.map_fd = map_fd;
+		attr.key = (uint64_t)(unsigned long) &keys[i];
+		attr.value = (uint64_t)(unsigned long) &hits;
+		sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+
+		entry.line_number = i + 1;
+		snprintf(entry.target, IPTABLES_TARGET_SZ, "%s", "DROP");
+		format_key(&keys[i], entry.source, IPTABLES_ADDR_SZ);
+
+		snprintf(line, sizeof(line), "%-4zu %-8llu %-10s %-4s --  %-20s %-20s\n",
+				entry.line_number, (unsigned long long) hits, entry.target, "all", entry.source, "0.0.0.0/0");
+		entry.line = line;
+
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	free(keys);
+	close(map_fd);
+	return 0;
+}
+
+#endif // USE_BPF
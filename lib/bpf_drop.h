@@ -0,0 +1,96 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * kernel side drop of blocked sources through an XDP program and LPM map
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef __gargoylebpfdrop__H_
+#define __gargoylebpfdrop__H_
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "iptables_wrapper_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Optional enforcement backend for GARGOYLE_CHAIN_NAME.
+ *
+ * gargoyle_pscand loads a small XDP program (generic/skb mode, so
+ * any NIC works) on one interface. The program looks the ipv4
+ * source of every packet up in an LPM trie of blocked prefixes and
+ * drops on a hit, ahead of conntrack and the whole netfilter path.
+ *
+ * The map is pinned at GARGOYLE_BPF_MAP_PIN (and the XDP link at
+ * GARGOYLE_BPF_LINK_PIN, so the program stays attached without the
+ * process that loaded it). While the map pin exists
+ * iptables_wrapper_api makes every GARGOYLE_CHAIN_NAME rule change
+ * in the map as well as in the chain, and lists the chain from the
+ * map, so the other daemons and tools follow along without any
+ * changes of their own. The chain keeps dropping on every other
+ * interface, lo included, the program only sees the one.
+ *
+ * return 0 = ok, 1 = not ok, unless stated otherwise
+ */
+size_t bpf_drop_load(const char *);
+void bpf_drop_unload(void);
+// 1 if the pinned map exists
+int bpf_drop_is_active(void);
+
+/*
+ * same semantics as their iptables_* counterparts, on the pinned map.
+ * rule numbers follow the sorted order of the map, not the order the
+ * entries were added in, so an add may renumber every rule after it.
+ * only use a number from a listing nothing was added to since.
+ */
+size_t bpf_drop_add(const char *);
+size_t bpf_drop_delete(const char *);
+// the source of the deleted entry is copied to the buffer, if given
+size_t bpf_drop_delete_at(size_t, char *, size_t);
+size_t bpf_drop_flush(void);
+size_t bpf_drop_for_each(iptables_rule_cb, void *);
+
+/*
+ * building blocks of bpf_drop_load, exposed so the program can be
+ * exercised through BPF_PROG_TEST_RUN without attaching it anywhere
+ * (see test/bpf_drop_test.cpp). they return an fd, or -1
+ */
+int bpf_drop_create_map(void);
+int bpf_drop_create_prog(int);
+size_t bpf_drop_map_add(int, const char *);
+size_t bpf_drop_map_delete(int, const char *);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // __gargoylebpfdrop__H_
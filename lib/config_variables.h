@@ -49,6 +49,20 @@ using namespace std;
  * 	gargoyle_pscand_monitor
  * 	gargoyle_lscand_ssh_bruteforce
  * 	enforce
+ * 	subnet_block_threshold
+ * 	bpf_interface
+ * 	sqlite_busy_timeout
+ * 	sqlite_mmap_size
+ * 	sqlite_cache_size
+ * 	sqlite_flush_interval
+ * 	sqlite_flush_rows
+ * 	sqlite_rollup_after
+ * 	sqlite_retention
+ * 	sqlite_size_target
+ * 	sqlite_hit_history
+ * 	sqlite_snapshot_interval
+ * 	shared_memory_table_size
+ * 	shared_memory_snapshot_interval
  * 	ports_to_ignore
  * 	hot_ports
  * 	log_entity
@@ -217,6 +231,182 @@ public:
 	}
 
 
+	size_t get_subnet_block_threshold() {
+
+		/*
+		 * more than this many blocked addrs in one /24 get
+		 * collapsed into a single subnet rule, 0 = disabled
+		 */
+		string subnet_threshold = "subnet_block_threshold";
+		size_t ret = 0;
+
+		if ( key_vals.find(subnet_threshold) != key_vals.end() ) {
+			sscanf(key_vals[subnet_threshold].c_str(), "%zu", &ret);
+		}
+		return ret;
+	}
+
+
+	string get_bpf_interface() {
+
+		// empty = keep enforcing through iptables
+		string bpf_interface = "bpf_interface";
+		if ( key_vals.find(bpf_interface) == key_vals.end() ) {
+			return "";
+		} else {
+			return key_vals[bpf_interface];
+		}
+	}
+
+
+	/*
+	 * SQLite connection tuning, -1 = key not set,
+	 * keep the built in default
+	 */
+	long get_sqlite_busy_timeout() {
+
+		string busy_timeout = "sqlite_busy_timeout";
+		long ret = -1;
+
+		if ( key_vals.find(busy_timeout) != key_vals.end() ) {
+			sscanf(key_vals[busy_timeout].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_mmap_size() {
+
+		string mmap_size = "sqlite_mmap_size";
+		long ret = -1;
+
+		if ( key_vals.find(mmap_size) != key_vals.end() ) {
+			sscanf(key_vals[mmap_size].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_cache_size() {
+
+		string cache_size = "sqlite_cache_size";
+		long ret = -1;
+
+		if ( key_vals.find(cache_size) != key_vals.end() ) {
+			sscanf(key_vals[cache_size].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_flush_interval() {
+
+		string flush_interval = "sqlite_flush_interval";
+		long ret = -1;
+
+		if ( key_vals.find(flush_interval) != key_vals.end() ) {
+			sscanf(key_vals[flush_interval].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_flush_rows() {
+
+		string flush_rows = "sqlite_flush_rows";
+		long ret = -1;
+
+		if ( key_vals.find(flush_rows) != key_vals.end() ) {
+			sscanf(key_vals[flush_rows].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_rollup_after() {
+
+		string rollup_after = "sqlite_rollup_after";
+		long ret = -1;
+
+		if ( key_vals.find(rollup_after) != key_vals.end() ) {
+			sscanf(key_vals[rollup_after].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_retention() {
+
+		string retention = "sqlite_retention";
+		long ret = -1;
+
+		if ( key_vals.find(retention) != key_vals.end() ) {
+			sscanf(key_vals[retention].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_size_target() {
+
+		string size_target = "sqlite_size_target";
+		long ret = -1;
+
+		if ( key_vals.find(size_target) != key_vals.end() ) {
+			sscanf(key_vals[size_target].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_hit_history() {
+
+		string hit_history = "sqlite_hit_history";
+		long ret = 0;
+
+		if ( key_vals.find(hit_history) != key_vals.end() ) {
+			sscanf(key_vals[hit_history].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_sqlite_snapshot_interval() {
+
+		string snapshot_interval = "sqlite_snapshot_interval";
+		long ret = 0;
+
+		if ( key_vals.find(snapshot_interval) != key_vals.end() ) {
+			sscanf(key_vals[snapshot_interval].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_shared_memory_table_size() {
+
+		string table_size = "shared_memory_table_size";
+		long ret = -1;
+
+		if ( key_vals.find(table_size) != key_vals.end() ) {
+			sscanf(key_vals[table_size].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
+	long get_shared_memory_snapshot_interval() {
+
+		string snapshot_interval = "shared_memory_snapshot_interval";
+		long ret = -1;
+
+		if ( key_vals.find(snapshot_interval) != key_vals.end() ) {
+			sscanf(key_vals[snapshot_interval].c_str(), "%ld", &ret);
+		}
+		return ret;
+	}
+
+
 	string get_ports_to_ignore() {
 
 		string ports_to_ignore = "ports_to_ignore";
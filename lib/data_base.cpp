@@ -31,6 +31,8 @@
 #include "data_base.h"
 #include "gargoyle_config_vals.h"
 
+#include <arpa/inet.h>
+#include <stddef.h>
 #include <syslog.h>
 
 #include <string>
@@ -38,17 +40,49 @@
 #include <cstring>
 #include <cstdio>
 #include <algorithm>
-#include <list>
+#include <vector>
 
 using namespace std;
 
 
-DataBase::DataBase(){
-    black_ip_list = Black_IP_List_Table::CREATE(GARGOYLE_BLACK_IP_LIST_TABLE_NAME, GARGOYLE_BLACK_IP_LIST_TABLE_SIZE);
-    detected_hosts = Detected_Hosts_Table::CREATE(GARGOYLE_DETECTED_HOSTS_TABLE_NAME, GARGOYLE_DETECTED_HOSTS_TABLE_SIZE);
-    hosts_ports_hits = Hosts_Ports_Hits_Table::CREATE(GARGOYLE_HOSTS_PORTS_HITS_TABLE_NAME, GARGOYLE_HOSTS_PORTS_HITS_TABLE_SIZE);
-    hosts = Hosts_Table::CREATE(GARGOYLE_HOSTS_TABLE_NAME, GARGOYLE_HOSTS_TABLE_SIZE);
-    ignore_ip_list = Ignore_IP_List_Table::CREATE(GARGOYLE_IGNORE_IP_LIST_TABLE_NAME, GARGOYLE_IGNORE_IP_LIST_TABLE_SIZE);
+// index keys, see SharedMemoryTable::findByKey
+static uint64_t hit_key(uint32_t host_ix, uint32_t port){
+    return ((uint64_t)host_ix << 32) | port;
+}
+
+static uint64_t host_key(const char *host){
+    struct in_addr addr;
+    if(inet_pton(AF_INET, host, &addr) == 1){
+        return addr.s_addr;
+    }
+    // FNV-1a, top bit set so it never equals an addr
+    uint64_t key = 0xcbf29ce484222325ULL;
+    for(; *host; host++){
+        key = (key ^ (unsigned char)*host) * 0x100000001b3ULL;
+    }
+    return key | (1ULL << 63);
+}
+
+/*
+ * folds one field of record into a table schema, see
+ * SharedMemoryTable::schema. each schema starts from the key its index
+ * is built on, the index is shared too
+ */
+#define SCHEMA_FIELD(hash, record, field) \
+    schemaField(hash, #field, offsetof(record, field), sizeof(((record *)0)->field))
+
+
+DataBase::DataBase(long table_size, bool replace_incompatible){
+    black_ip_list = Black_IP_List_Table::CREATE(GARGOYLE_BLACK_IP_LIST_TABLE_NAME, GARGOYLE_BLACK_IP_LIST_TABLE_SIZE,
+            replace_incompatible);
+    detected_hosts = Detected_Hosts_Table::CREATE(GARGOYLE_DETECTED_HOSTS_TABLE_NAME, GARGOYLE_DETECTED_HOSTS_TABLE_SIZE,
+            replace_incompatible);
+    hosts_ports_hits = Hosts_Ports_Hits_Table::CREATE(GARGOYLE_HOSTS_PORTS_HITS_TABLE_NAME,
+            table_size > 0 ? table_size : GARGOYLE_HOSTS_PORTS_HITS_TABLE_SIZE, replace_incompatible);
+    hosts = Hosts_Table::CREATE(GARGOYLE_HOSTS_TABLE_NAME, table_size > 0 ? table_size : GARGOYLE_HOSTS_TABLE_SIZE,
+            replace_incompatible);
+    ignore_ip_list = Ignore_IP_List_Table::CREATE(GARGOYLE_IGNORE_IP_LIST_TABLE_NAME, GARGOYLE_IGNORE_IP_LIST_TABLE_SIZE,
+            replace_incompatible);
 }
 
 DataBase::~DataBase(){
@@ -73,8 +107,14 @@ DataBase::~DataBase(){
     }
 }
 
-DataBase *DataBase::create(){
-    DataBase *config = new DataBase();
+DataBase *DataBase::create(long table_size, bool replace_incompatible){
+    DataBase *config = new DataBase(table_size, replace_incompatible);
+    // a table that could not be attached, most likely one of another layout
+    if(config->black_ip_list == nullptr || config->detected_hosts == nullptr || config->hosts_ports_hits == nullptr ||
+            config->hosts == nullptr || config->ignore_ip_list == nullptr){
+        delete config;
+        config = nullptr;
+    }
     return config;
 }
 
@@ -100,6 +140,36 @@ void DataBase::cleanTables(const string &tables){
     }
 }
 
+int32_t DataBase::saveSnapshots(const string &prefix){
+    int32_t status = 0;
+    status |= black_ip_list->saveSnapshot(prefix + "." + TABLES_NAME[black_ip_list_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    status |= detected_hosts->saveSnapshot(prefix + "." + TABLES_NAME[detected_hosts_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    status |= hosts_ports_hits->saveSnapshot(prefix + "." + TABLES_NAME[hosts_ports_hits_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    status |= hosts->saveSnapshot(prefix + "." + TABLES_NAME[hosts_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    status |= ignore_ip_list->saveSnapshot(prefix + "." + TABLES_NAME[ignore_ip_list_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    return status == 0 ? 0 : -1;
+}
+
+int32_t DataBase::loadSnapshots(const string &prefix){
+    int32_t loaded[TABLES_NUMBER];
+    loaded[black_ip_list_table] = black_ip_list->loadSnapshot(prefix + "." + TABLES_NAME[black_ip_list_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    loaded[detected_hosts_table] = detected_hosts->loadSnapshot(prefix + "." + TABLES_NAME[detected_hosts_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    loaded[hosts_ports_hits_table] = hosts_ports_hits->loadSnapshot(prefix + "." + TABLES_NAME[hosts_ports_hits_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    loaded[hosts_table] = hosts->loadSnapshot(prefix + "." + TABLES_NAME[hosts_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+    loaded[ignore_ip_list_table] = ignore_ip_list->loadSnapshot(prefix + "." + TABLES_NAME[ignore_ip_list_table] + GARGOYLE_SHM_SNAPSHOT_SUFFIX);
+
+    if(std::find(loaded, loaded + TABLES_NUMBER, -1) == loaded + TABLES_NUMBER){
+        return 0;
+    }
+    // the tables reference each other by ix, so none of them or all of them
+    for(int table = 0; table < TABLES_NUMBER; table++){
+        if(loaded[table] == 0){
+            cleanTables(TABLES_NAME[table]);
+        }
+    }
+    return -1;
+}
+
 /*
  * CREATE TABLE black_ip_list (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
  * host_ix INTEGER NOT NULL UNIQUE, timestamp INTEGER NOT NULL, FOREIGN KEY(host_ix)
@@ -107,9 +177,9 @@ void DataBase::cleanTables(const string &tables){
  */
 Black_IP_List_Table::Black_IP_List_Table(string name, size_t size):SharedMemoryTable(name, size){}
 
-Black_IP_List_Table *Black_IP_List_Table::CREATE(string name, size_t size){
+Black_IP_List_Table *Black_IP_List_Table::CREATE(string name, size_t size, bool replace_incompatible){
     Black_IP_List_Table *config = new Black_IP_List_Table(name, size);
-    if(config->init() < 0){
+    if(config->init(replace_incompatible) < 0){
         delete config;
         config = nullptr;
         syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [CREATE in black_ip_list_table]");
@@ -123,10 +193,10 @@ int32_t Black_IP_List_Table::INSERT(Black_IP_List_Record entry){
         if(compareAndExpand() < 0){
             status = -1;
         }else{
-            Black_IP_List_Record *match = std::find_if(begin(), end(), [entry](const Black_IP_List_Record &record){return record.host_ix == entry.host_ix;});
+            Black_IP_List_Record *match = findByKey(entry.host_ix);
             if(!isIn(match)){
                 if(entry.ix == 0){
-                    entry.ix = size() == 0 ? 1 : size() + 1;
+                    entry.ix = nextIx();
                 }
                 status = pushBack(entry);
             }else{
@@ -141,19 +211,13 @@ int32_t Black_IP_List_Table::INSERT(Black_IP_List_Record entry){
 
 int32_t Black_IP_List_Table::DELETE(const string &query){
     int32_t status = 0;
-    if(query.find("DELETE FROM black_ip_list WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t host_ix = atol(value.c_str());
-        if(lock() == 0){
-            Black_IP_List_Record *match = std::find_if(begin(), end(), [host_ix](Black_IP_List_Record record){return record.host_ix == host_ix;});
-            if(isIn(match)){
-                status = deleteRecordByPos(getPositionByKey(match->ix));
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in black_ip_list_table]");
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "DELETE FROM black_ip_list WHERE host_ix=%u", &host_ix) == 1){
+        int32_t deleted = deleteByHostIx(host_ix);
+        if(deleted <= 0){
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in black_ip_list_table]");
         }
+        status = deleted < 0 ? -1 : 0;
     }
 
     if(query == "DELETE FROM black_ip_list"){
@@ -172,49 +236,40 @@ int32_t Black_IP_List_Table::SELECT(char *result, const string &query){
     *result = '\0';
 
     if(query == "SELECT host_ix FROM black_ip_list"){
-        Black_IP_List_Record record;
-        if(lock() == 0){
-            for(int i=1; i<=size(); i++){
-                status = getRecordByPos(record, i);
-                sprintf(result, "%s%u>", result, record.host_ix);
-                if(status == -1){
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
-                    break;
-                }
+        vector<Black_IP_List_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Black_IP_List_Record &record : records){
+                len += sprintf(result + len, "%u>", record.host_ix);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
         }
     }
 
-    if(query.find("SELECT host_ix FROM black_ip_list WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string host_ix_str(query, ++pos, query.length() - pos);
-        int host_ix = atol(host_ix_str.c_str());
-        if(lock() == 0){
-            Black_IP_List_Record *match = std::find_if(begin(), end(), [host_ix](Black_IP_List_Record record){return record.host_ix == host_ix;});
-            if(isIn(match)){
-                sprintf(result, "%u", match->host_ix);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "SELECT host_ix FROM black_ip_list WHERE host_ix=%u", &host_ix) == 1){
+        if(findByHostIx(host_ix) > 0){
+            sprintf(result, "%u", host_ix);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
         }
     }
 
     if(query == "SELECT * FROM black_ip_list"){
-        Black_IP_List_Record record;
-        if(lock() == 0){
-            for(int i=1; i<=size(); i++){
-                status = getRecordByPos(record, i);
-                if(status == -1){
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
-                    break;
-                }else{
-                    sprintf(result, "%s%u:%u:%lu>", result, record.ix, record.host_ix, record.timestamp);
-                }
+        vector<Black_IP_List_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Black_IP_List_Record &record : records){
+                len += sprintf(result + len, "%u:%u:%ld>", record.ix, record.host_ix, (long)record.timestamp);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in black_ip_list_table]");
         }
     }
 
@@ -241,15 +296,54 @@ uint32_t Black_IP_List_Table::getPositionByKey(const uint32_t key){
     return position;
 }
 
+uint64_t Black_IP_List_Table::indexKey(const Black_IP_List_Record &record) const{
+    return record.host_ix;
+}
+
+uint64_t Black_IP_List_Table::schema() const{
+    uint64_t hash = schemaField(SHARED_MEM_HASH_SEED, "key host_ix", 0, 0);
+    hash = SCHEMA_FIELD(hash, Black_IP_List_Record, ix);
+    hash = SCHEMA_FIELD(hash, Black_IP_List_Record, host_ix);
+    hash = SCHEMA_FIELD(hash, Black_IP_List_Record, timestamp);
+    return hash;
+}
+
+int32_t Black_IP_List_Table::findByHostIx(uint32_t host_ix){
+    int32_t ix = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            Black_IP_List_Record *match = findByKey(host_ix);
+            ix = isIn(match) ? match->ix : 0;
+        }
+        unlock();
+    }
+    return ix;
+}
+
+int32_t Black_IP_List_Table::deleteByHostIx(uint32_t host_ix){
+    int32_t deleted = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            Black_IP_List_Record *match = findByKey(host_ix);
+            deleted = 0;
+            if(isIn(match) && deleteRecordByPos(match - begin() + 1) == 0){
+                deleted = 1;
+            }
+        }
+        unlock();
+    }
+    return deleted;
+}
+
 /*
  * CREATE TABLE detected_hosts (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL UNIQUE,
- *  timestamp TEXT NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table (ix));
+ *  timestamp INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table (ix));
  */
 Detected_Hosts_Table::Detected_Hosts_Table(string name, size_t size):SharedMemoryTable(name, size){}
 
-Detected_Hosts_Table *Detected_Hosts_Table::CREATE(string name, size_t size){
+Detected_Hosts_Table *Detected_Hosts_Table::CREATE(string name, size_t size, bool replace_incompatible){
     Detected_Hosts_Table *config = new Detected_Hosts_Table(name, size);
-    if(config->init() < 0){
+    if(config->init(replace_incompatible) < 0){
         delete config;
         config = nullptr;
         syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [CREATE in detected_hosts_table]");
@@ -264,10 +358,10 @@ int32_t Detected_Hosts_Table::INSERT(Detected_Hosts_Record entry){
             status = -1;
         }else{
             // host_ix is UNIQUE
-            Detected_Hosts_Record *match = std::find_if(begin(), end(), [entry](const Detected_Hosts_Record &record){return record.host_ix == entry.host_ix;});
+            Detected_Hosts_Record *match = findByKey(entry.host_ix);
             if(!isIn(match)){
                 if(entry.ix == 0){
-                    entry.ix = size() == 0 ? 1 : size() + 1;
+                    entry.ix = nextIx();
                 }
                 status = pushBack(entry);
             }else{
@@ -282,14 +376,10 @@ int32_t Detected_Hosts_Table::INSERT(Detected_Hosts_Record entry){
 
 int32_t Detected_Hosts_Table::DELETE(const string &query){
     int32_t status = 0;
-    if(query.find("DELETE FROM detected_hosts WHERE ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t ix = atol(value.c_str());
-        if(lock() == 0){
-            status = deleteRecordByPos(getPositionByKey(ix));
-            unlock();
-        }else{
+    uint32_t ix;
+    if(sscanf(query.c_str(), "DELETE FROM detected_hosts WHERE ix=%u", &ix) == 1){
+        if(deleteByIx(ix) <= 0){
+            status = -1;
             syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in detected_hosts_table]");
         }
     }
@@ -309,35 +399,28 @@ int32_t Detected_Hosts_Table::SELECT(char *result, const string &query){
     int32_t status = -1;
     *result = '\0';
 
-    if(query.find("SELECT ix FROM detected_hosts WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string host_ix_str(query, ++pos, query.length() - pos);
-        int host_ix = atol(host_ix_str.c_str());
-        if(lock() == 0){
-            Detected_Hosts_Record *match = std::find_if(begin(), end(), [host_ix](Detected_Hosts_Record record){return record.host_ix == host_ix;});
-            if(isIn(match)){
-                sprintf(result, "%u", match->ix);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in detected_hosts_table]");
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "SELECT ix FROM detected_hosts WHERE host_ix=%u", &host_ix) == 1){
+        int32_t ix = findByHostIx(host_ix);
+        if(ix > 0){
+            sprintf(result, "%d", ix);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in detected_hosts_table]");
         }
     }
 
     if(query == "SELECT * FROM detected_hosts"){
-        Detected_Hosts_Record record;
-        if(lock() == 0){
-            for(int i=1; i<=size(); i++){
-                status = getRecordByPos(record, i);
-                if(status == -1){
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in detected_hosts_table]");
-                    break;
-                }else{
-                    sprintf(result, "%s%u:%u:%lu>", result, record.ix, record.host_ix, record.timestamp);
-                }
+        vector<Detected_Hosts_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Detected_Hosts_Record &record : records){
+                len += sprintf(result + len, "%u:%u:%ld>", record.ix, record.host_ix, (long)record.timestamp);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in detected_hosts_table]");
         }
     }
 
@@ -365,15 +448,54 @@ uint32_t Detected_Hosts_Table::getPositionByKey(const uint32_t key){
     return position;
 }
 
+uint64_t Detected_Hosts_Table::indexKey(const Detected_Hosts_Record &record) const{
+    return record.host_ix;
+}
+
+uint64_t Detected_Hosts_Table::schema() const{
+    uint64_t hash = schemaField(SHARED_MEM_HASH_SEED, "key host_ix", 0, 0);
+    hash = SCHEMA_FIELD(hash, Detected_Hosts_Record, ix);
+    hash = SCHEMA_FIELD(hash, Detected_Hosts_Record, host_ix);
+    hash = SCHEMA_FIELD(hash, Detected_Hosts_Record, timestamp);
+    return hash;
+}
+
+int32_t Detected_Hosts_Table::findByHostIx(uint32_t host_ix){
+    int32_t ix = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            Detected_Hosts_Record *match = findByKey(host_ix);
+            ix = isIn(match) ? match->ix : 0;
+        }
+        unlock();
+    }
+    return ix;
+}
+
+int32_t Detected_Hosts_Table::deleteByIx(uint32_t ix){
+    int32_t deleted = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            Detected_Hosts_Record *match = std::find_if(begin(), end(), [ix](const Detected_Hosts_Record &record){return record.ix == ix;});
+            deleted = 0;
+            if(isIn(match) && deleteRecordByPos(match - begin() + 1) == 0){
+                deleted = 1;
+            }
+        }
+        unlock();
+    }
+    return deleted;
+}
+
 /*
  * CREATE TABLE hosts_ports_hits(ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL,
  *  port_number INTEGER NOT NULL, hit_count INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table (ix));
  */
 Hosts_Ports_Hits_Table::Hosts_Ports_Hits_Table(string name, size_t size):SharedMemoryTable(name, size){}
 
-Hosts_Ports_Hits_Table *Hosts_Ports_Hits_Table::CREATE(string name, size_t size){
+Hosts_Ports_Hits_Table *Hosts_Ports_Hits_Table::CREATE(string name, size_t size, bool replace_incompatible){
     Hosts_Ports_Hits_Table *config = new Hosts_Ports_Hits_Table(name, size);
-    if(config->init() < 0){
+    if(config->init(replace_incompatible) < 0){
         delete config;
         config = nullptr;
         syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [CREATE in hosts_ports_hits_table]");
@@ -388,7 +510,7 @@ int32_t Hosts_Ports_Hits_Table::INSERT(Hosts_Ports_Hits_Record entry){
             status = -1;
         }else{
             if(entry.ix == 0){
-                entry.ix = size() == 0 ? 1 : size() + 1;
+                entry.ix = nextIx();
             }
             status = pushBack(entry);
         }
@@ -399,30 +521,11 @@ int32_t Hosts_Ports_Hits_Table::INSERT(Hosts_Ports_Hits_Record entry){
 
 int32_t Hosts_Ports_Hits_Table::DELETE(const string &query){
     int32_t status = 0;
-    if(query.find("DELETE FROM hosts_ports_hits WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t host_ix = atol(value.c_str());
-        if(lock() == 0){
-            uint32_t i = 1;
-            Hosts_Ports_Hits_Record record;
-            while(i <= size()){
-                if((status = getRecordByPos(record, i)) == -1){
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in detected_hosts_table]");
-                    break;
-                }
-                if(record.host_ix == host_ix){
-                    if((status = deleteRecordByPos(i)) != 0){
-                        status = -1;
-                        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in detected_hosts_table]");
-                        break;
-                    }
-                }else{
-                    i++;
-                }
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "DELETE FROM hosts_ports_hits WHERE host_ix=%u", &host_ix) == 1){
+        if(deleteByHostIx(host_ix) < 0){
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in hosts_ports_hits_table]");
         }
     }
 
@@ -439,159 +542,94 @@ int32_t Hosts_Ports_Hits_Table::SELECT(char *result, const string &query){
     *result = '\0';
 
     if(query == "SELECT * FROM hosts_ports_hits"){
-        if(lock() == 0){
-            Hosts_Ports_Hits_Record record;
-            status = 0;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    sprintf(result, "%s%u:%lu:%lu:%lu>", result, record.ix, record.host_ix, record.port_number, record.hit_count);
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
+        vector<Hosts_Ports_Hits_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Hosts_Ports_Hits_Record &record : records){
+                len += sprintf(result + len, "%u:%u:%u:%u>", record.ix, record.host_ix, record.port_number, record.hit_count);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
-    if(query.find("SELECT hit_count FROM hosts_ports_hits WHERE host_ix=") != std::string::npos){
-        if(query.find("AND port_number=") != std::string::npos){
-            size_t posFirst = query.find_first_of("=");
-            size_t posAND = query.find(" AND");
-            size_t posLast = query.find_last_of("=");
-            string host_ix_str(query, ++posFirst, --posAND - posFirst);
-            string port_number_str(query, ++posLast, query.length() - posFirst - --posAND);
-            uint32_t host_ix = stoul(host_ix_str.c_str());
-            uint32_t the_port = stoul(port_number_str.c_str());
-            if(lock() == 0){
-                Hosts_Ports_Hits_Record *match = std::find_if(begin(), end(), [host_ix, the_port](const Hosts_Ports_Hits_Record &record)
-                        {return (host_ix == record.host_ix) && (the_port == record.port_number);});
-                if(isIn(match)){
-                    sprintf(result, "%u", match->hit_count);
-                    status = 0;
-                }else{
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                }
-                unlock();
-            }
+    uint32_t host_ix;
+    uint32_t the_port;
+    if(sscanf(query.c_str(), "SELECT hit_count FROM hosts_ports_hits WHERE host_ix=%u AND port_number=%u", &host_ix, &the_port) == 2){
+        int32_t hit_count = getHitCount(host_ix, the_port);
+        if(hit_count > 0){
+            sprintf(result, "%d", hit_count);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
-    if(query.find("SELECT SUM(hit_count) FROM hosts_ports_hits WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t host_ix = stoul(value);
-        Hosts_Ports_Hits_Record record;
-        int sum = 0;
-        if(lock() == 0){
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    sum = record.host_ix == host_ix ? sum + record.hit_count : sum;
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
-            }
-            if(status == 0){
-                sprintf(result, "%d", sum);
-                status = 0;
-            }
-            unlock();
+    if(sscanf(query.c_str(), "SELECT SUM(hit_count) FROM hosts_ports_hits WHERE host_ix=%u", &host_ix) == 1){
+        int32_t sum = getHitTotal(host_ix);
+        if(sum >= 0){
+            sprintf(result, "%d", sum);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
     if(query == "SELECT DISTINCT port_number FROM hosts_ports_hits"){
-        if(lock() == 0){
-            status = 0;
-            Hosts_Ports_Hits_Record record;
-            list<uint32_t> listPorts;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    listPorts.push_back(record.port_number);
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
+        vector<Hosts_Ports_Hits_Record> records;
+        if(getAll(records) >= 0){
+            vector<uint32_t> ports;
+            for(const Hosts_Ports_Hits_Record &record : records){
+                ports.push_back(record.port_number);
             }
-            listPorts.sort();
-            listPorts.unique();
-            for(auto it=listPorts.begin(); it!=listPorts.end(); it++){
-                sprintf(result, "%s%u>", result, *it);
+            sort(ports.begin(), ports.end());
+            ports.erase(unique(ports.begin(), ports.end()), ports.end());
+            size_t len = 0;
+            for(uint32_t port : ports){
+                len += sprintf(result + len, "%u>", port);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
-    if(query.find("SELECT COUNT(*) FROM hosts_ports_hits WHERE host_ix=") != std::string::npos){
-        if(lock() == 0){
-            size_t pos = query.find_first_of("=");
-            string value(query, ++pos, query.length() - pos);
-            uint32_t host_ix = stoul(value);
-            Hosts_Ports_Hits_Record record;
-            int count = 0;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    count = record.host_ix == host_ix ? count + 1 : count;
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
-            }
+    if(sscanf(query.c_str(), "SELECT COUNT(*) FROM hosts_ports_hits WHERE host_ix=%u", &host_ix) == 1){
+        int32_t count = getPortCount(host_ix);
+        if(count >= 0){
             sprintf(result, "%d", count);
-            unlock();
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
-    if(query.find("SELECT * FROM hosts_ports_hits WHERE port_number=") != std::string::npos){
-        if(lock() == 0){
-            size_t posFirst = query.find_first_of("=");
-            size_t posAND = query.find(" AND");
-            size_t posLast = query.find_last_of("=");
-            string port_number_str(query, ++posFirst, --posAND - posFirst);
-            string hit_count_str(query, ++posLast, query.length() - posFirst - --posAND);
-            uint32_t port_number = stoul(port_number_str.c_str());
-            uint32_t hit_count = stoul(hit_count_str.c_str());
-            Hosts_Ports_Hits_Record record;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    if(record.port_number == port_number && record.hit_count >= hit_count){
-                        sprintf(result, "%s%u:%u:%u:%u>", result, record.ix, record.host_ix, record.port_number, record.hit_count);
-                    }
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
-            }
-
-            unlock();
+    uint32_t hit_count;
+    if(sscanf(query.c_str(), "SELECT * FROM hosts_ports_hits WHERE port_number=%u AND hit_count>=%u", &the_port, &hit_count) == 2){
+        size_t len = 0;
+        status = forEachOverThreshold(the_port, hit_count, [result, &len](const Hosts_Ports_Hits_Record &record){
+            len += sprintf(result + len, "%u:%u:%u:%u>", record.ix, record.host_ix, record.port_number, record.hit_count);
+            return 0;
+        });
+        if(status == -1){
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
     if(query == "SELECT DISTINCT host_ix FROM hosts_ports_hits"){
-        if(lock() == 0){
-            status = 0;
-            Hosts_Ports_Hits_Record record;
-            list<uint32_t> listPorts;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    listPorts.push_back(record.host_ix);
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
-                    break;
-                }
-            }
-            listPorts.sort();
-            listPorts.unique();
-            for(auto it=listPorts.begin(); it!=listPorts.end(); it++){
-                sprintf(result, "%s%u>", result, *it);
+        vector<uint32_t> host_ixs;
+        if(getHostIxs(host_ixs) >= 0){
+            size_t len = 0;
+            for(uint32_t host_ix : host_ixs){
+                len += sprintf(result + len, "%u>", host_ix);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_ports_hits_table]");
         }
     }
 
@@ -637,6 +675,162 @@ uint32_t Hosts_Ports_Hits_Table::getPositionByKey(const uint32_t key){
     return position;
 }
 
+uint64_t Hosts_Ports_Hits_Table::indexKey(const Hosts_Ports_Hits_Record &record) const{
+    return hit_key(record.host_ix, record.port_number);
+}
+
+uint64_t Hosts_Ports_Hits_Table::schema() const{
+    uint64_t hash = schemaField(SHARED_MEM_HASH_SEED, "key host_ix port_number", 0, 0);
+    hash = SCHEMA_FIELD(hash, Hosts_Ports_Hits_Record, ix);
+    hash = SCHEMA_FIELD(hash, Hosts_Ports_Hits_Record, host_ix);
+    hash = SCHEMA_FIELD(hash, Hosts_Ports_Hits_Record, port_number);
+    hash = SCHEMA_FIELD(hash, Hosts_Ports_Hits_Record, hit_count);
+    return hash;
+}
+
+int32_t Hosts_Ports_Hits_Table::getHitCount(uint32_t host_ix, uint32_t port){
+    int32_t hit_count = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            Hosts_Ports_Hits_Record *match = findByKey(hit_key(host_ix, port));
+            hit_count = isIn(match) ? match->hit_count : 0;
+        }
+        unlock();
+    }
+    return hit_count;
+}
+
+int32_t Hosts_Ports_Hits_Table::getHitTotal(uint32_t host_ix){
+    int32_t sum = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            sum = 0;
+            for(Hosts_Ports_Hits_Record *record = begin(); record != end(); record++){
+                if(record->host_ix == host_ix){
+                    sum += record->hit_count;
+                }
+            }
+        }
+        unlock();
+    }
+    return sum;
+}
+
+int32_t Hosts_Ports_Hits_Table::getPortCount(uint32_t host_ix){
+    int32_t count = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            count = std::count_if(begin(), end(), [host_ix](const Hosts_Ports_Hits_Record &record){return record.host_ix == host_ix;});
+        }
+        unlock();
+    }
+    return count;
+}
+
+/*
+ * bumps the (host_ix, port) row by hits, adding it when it is not
+ * there yet, under one lock. returns the new hit count
+ */
+int32_t Hosts_Ports_Hits_Table::addHits(uint32_t host_ix, uint32_t port, uint32_t hits){
+    int32_t hit_count = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            Hosts_Ports_Hits_Record *match = findByKey(hit_key(host_ix, port));
+            if(isIn(match)){
+                match->hit_count += hits;
+                hit_count = match->hit_count;
+            }else{
+                Hosts_Ports_Hits_Record record;
+                record.ix = nextIx();
+                record.host_ix = host_ix;
+                record.port_number = port;
+                record.hit_count = hits;
+                if(pushBack(record) == 0){
+                    hit_count = hits;
+                }
+            }
+        }
+        unlock();
+    }
+    if(hit_count == -1){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [addHits in hosts_ports_hits_table]");
+    }
+    return hit_count;
+}
+
+int32_t Hosts_Ports_Hits_Table::deleteByHostIx(uint32_t host_ix){
+    return deleteByHostIxs(vector<uint32_t>(1, host_ix));
+}
+
+/*
+ * rows are not indexed by host_ix, so removing many hosts one at a
+ * time rescans the table for each of them. this takes them all out
+ * in one pass, the swap-remove re-checks the same position
+ */
+int32_t Hosts_Ports_Hits_Table::deleteByHostIxs(const vector<uint32_t> &host_ixs){
+    vector<uint32_t> wanted(host_ixs);
+    sort(wanted.begin(), wanted.end());
+    wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+
+    int32_t deleted = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            uint32_t i = 1;
+            deleted = 0;
+            while(i <= size()){
+                if(binary_search(wanted.begin(), wanted.end(), (begin() + i - 1)->host_ix)){
+                    deleteRecordByPos(i);
+                    deleted++;
+                }else{
+                    i++;
+                }
+            }
+        }
+        unlock();
+    }
+    return deleted;
+}
+
+int32_t Hosts_Ports_Hits_Table::forEachOverThreshold(uint32_t port, uint32_t min_hits, const Hosts_Ports_Hits_Visitor &fn){
+    vector<Hosts_Ports_Hits_Record> matches;
+    int32_t status = readConsistent([&matches, port, min_hits](const Hosts_Ports_Hits_Record *first, const Hosts_Ports_Hits_Record *last){
+        matches.clear();
+        for(const Hosts_Ports_Hits_Record *record = first; record != last; record++){
+            if(record->port_number == port && record->hit_count >= min_hits){
+                matches.push_back(*record);
+            }
+        }
+    });
+    if(status != 0){
+        return -1;
+    }
+
+    for(auto it = matches.begin(); it != matches.end(); it++){
+        if(fn(*it) != 0){
+            break;
+        }
+    }
+    return 0;
+}
+
+int32_t Hosts_Ports_Hits_Table::getHostIxs(vector<uint32_t> &host_ixs){
+    int32_t status = readConsistent([&host_ixs](const Hosts_Ports_Hits_Record *first, const Hosts_Ports_Hits_Record *last){
+        host_ixs.clear();
+        host_ixs.reserve(last - first);
+        for(const Hosts_Ports_Hits_Record *record = first; record != last; record++){
+            host_ixs.push_back(record->host_ix);
+        }
+    });
+    if(status != 0){
+        host_ixs.clear();
+        return -1;
+    }
+
+    sort(host_ixs.begin(), host_ixs.end());
+    host_ixs.erase(unique(host_ixs.begin(), host_ixs.end()), host_ixs.end());
+    return host_ixs.size();
+}
+
 
 /*
  * CREATE TABLE hosts_table (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT,
@@ -644,9 +838,9 @@ uint32_t Hosts_Ports_Hits_Table::getPositionByKey(const uint32_t key){
  */
 Hosts_Table::Hosts_Table(string name, size_t size):SharedMemoryTable(name, size){}
 
-Hosts_Table *Hosts_Table::CREATE(string name, size_t size){
+Hosts_Table *Hosts_Table::CREATE(string name, size_t size, bool replace_incompatible){
     Hosts_Table *config = new Hosts_Table(name, size);
-    if(config->init() < 0){
+    if(config->init(replace_incompatible) < 0){
         delete config;
         config = nullptr;
         syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [CREATE in hosts_table]");
@@ -661,11 +855,10 @@ int32_t Hosts_Table::INSERT(Hosts_Record entry){
             status = -1;
         }else{
             // host is UNIQUE
-            Hosts_Record *match = std::find_if(begin(), end(), [entry](const Hosts_Record &record)
-                    {return !strcmp(record.host, entry.host);});
+            Hosts_Record *match = findHost(entry.host);
             if(!isIn(match)){
                 if(entry.ix == 0){
-                    entry.ix = size() == 0 ? 1 : size() + 1;
+                    entry.ix = nextIx();
                 }
                 status = pushBack(entry);
             }else{
@@ -679,14 +872,17 @@ int32_t Hosts_Table::INSERT(Hosts_Record entry){
 }
 
 int32_t Hosts_Table::DELETE(const string &query){
-    int32_t status = -1;
+    int32_t status = 0;
     if(query == "DELETE FROM hosts_table"){
         if(lock() == 0){
             deleteAll();
             unlock();
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in hosts_table]");
         }
     }
-    return 0;
+    return status;
 }
 
 int32_t Hosts_Table::SELECT(char *result, const string &query){
@@ -694,66 +890,48 @@ int32_t Hosts_Table::SELECT(char *result, const string &query){
     *result = '\0';
 
     if(query == "SELECT * FROM hosts_table"){
-        if(lock() == 0){
-            Hosts_Record record;
-            status = 0;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    sprintf(result, "%s%u:%s:%lu:%lu>", result, record.ix, record.host, record.first_seen, record.last_seen);
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
-                    break;
-                }
+        vector<Hosts_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Hosts_Record &record : records){
+                len += sprintf(result + len, "%u:%s:%ld:%ld>", record.ix, record.host, (long)record.first_seen, (long)record.last_seen);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
         }
     }
 
-    if(query.find("SELECT ix FROM hosts_table WHERE host=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string ip(query, ++pos, query.length() - pos);
-        if(lock() == 0){
-            Hosts_Record *match = std::find_if(begin(), end(), [ip](Hosts_Record record){return !strcmp(record.host, ip.c_str());});
-            if(isIn(match)){
-                sprintf(result, "%u", match->ix);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
-            }
-            unlock();
+    const string by_host = "SELECT ix FROM hosts_table WHERE host=";
+    if(query.compare(0, by_host.length(), by_host) == 0){
+        int32_t ix = findHostIx(query.c_str() + by_host.length());
+        if(ix > 0){
+            sprintf(result, "%d", ix);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
         }
     }
 
-    if(query.find("SELECT host FROM hosts_table WHERE ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t ix = stoul(value);
-        if(lock() == 0){
-            Hosts_Record *match = std::find_if(begin(), end(), [ix](Hosts_Record record){return record.ix == ix;});
-            if(isIn(match)){
-                sprintf(result, "%s", match->host);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
-            }
-            unlock();
+    uint32_t ix;
+    if(sscanf(query.c_str(), "SELECT host FROM hosts_table WHERE ix=%u", &ix) == 1){
+        Hosts_Record record;
+        if(getHost(ix, record) == 1){
+            sprintf(result, "%s", record.host);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
         }
     }
 
-    if(query.find("SELECT * FROM hosts_table WHERE ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t ix = stoul(value);
-        if(lock() == 0){
-            Hosts_Record record;
-            if((status = getRecordByPos(record, ix)) != -1){
-                sprintf(result, "%u:%s:%lu:%lu", record.ix, record.host, record.first_seen, record.last_seen);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
-            }
-            unlock();
+    if(sscanf(query.c_str(), "SELECT * FROM hosts_table WHERE ix=%u", &ix) == 1){
+        Hosts_Record record;
+        if(getHost(ix, record) == 1){
+            sprintf(result, "%u:%s:%lu:%lu", record.ix, record.host, record.first_seen, record.last_seen);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in hosts_table]");
         }
     }
 
@@ -763,12 +941,12 @@ int32_t Hosts_Table::SELECT(char *result, const string &query){
 int32_t Hosts_Table::UPDATE(const Hosts_Record &entry){
     int32_t status = -1;
     if(lock() == 0){
-        Hosts_Record *match = std::find_if(begin(), end(), [entry](const Hosts_Record &record)
-                        {return entry.ix == record.ix;});
+        Hosts_Record *match = compareAndExpand() == 0 ? std::find_if(begin(), end(), [entry](const Hosts_Record &record)
+                        {return entry.ix == record.ix;}) : end();
         if(isIn(match)){
             status = 0;
+            // in place, ix is not the position once rows have been deleted
             match->last_seen = entry.last_seen;
-            insertById(*match, match->ix);
         }else{
             syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [UPDATE in hosts_table]");
         }
@@ -793,15 +971,82 @@ uint32_t Hosts_Table::getPositionByKey(const uint32_t key){
     return position;
 }
 
+uint64_t Hosts_Table::indexKey(const Hosts_Record &record) const{
+    return host_key(record.host);
+}
+
+uint64_t Hosts_Table::schema() const{
+    uint64_t hash = schemaField(SHARED_MEM_HASH_SEED, "key host", 0, 0);
+    hash = SCHEMA_FIELD(hash, Hosts_Record, ix);
+    hash = SCHEMA_FIELD(hash, Hosts_Record, host);
+    hash = SCHEMA_FIELD(hash, Hosts_Record, first_seen);
+    hash = SCHEMA_FIELD(hash, Hosts_Record, last_seen);
+    return hash;
+}
+
+/*
+ * addrs key on their own value so only a host that is not a
+ * dotted quad can share a key, those get checked and scanned for
+ */
+Hosts_Record *Hosts_Table::findHost(const char *host) const{
+    Hosts_Record *match = findByKey(host_key(host));
+    if(isIn(match) && strcmp(match->host, host) != 0){
+        match = std::find_if(begin(), end(), [host](const Hosts_Record &record){return !strcmp(record.host, host);});
+    }
+    return match;
+}
+
+int32_t Hosts_Table::findHostIx(const char *host){
+    int32_t ix = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            Hosts_Record *match = findHost(host);
+            ix = isIn(match) ? match->ix : 0;
+        }
+        unlock();
+    }
+    return ix;
+}
+
+int32_t Hosts_Table::findHostIx(in_addr_t addr){
+    char host[INET_ADDRSTRLEN];
+    struct in_addr in;
+    in.s_addr = addr;
+    if(inet_ntop(AF_INET, &in, host, sizeof(host)) == nullptr){
+        return -1;
+    }
+    return findHostIx(host);
+}
+
+int32_t Hosts_Table::getHost(uint32_t ix, Hosts_Record &record){
+    int32_t found = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            // rows are only ever appended so ix is normally the position
+            Hosts_Record *match = begin() + ix - 1;
+            if(ix == 0 || !isIn(match) || match->ix != ix){
+                match = std::find_if(begin(), end(), [ix](const Hosts_Record &record){return record.ix == ix;});
+            }
+            found = 0;
+            if(isIn(match)){
+                memcpy(&record, match, sizeof(Hosts_Record));
+                found = 1;
+            }
+        }
+        unlock();
+    }
+    return found;
+}
+
 /*
  * CREATE TABLE ignore_ip_list(ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL UNIQUE,
  *  timestamp INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table (ix));
  */
 Ignore_IP_List_Table::Ignore_IP_List_Table(string name, size_t size):SharedMemoryTable(name, size){}
 
-Ignore_IP_List_Table *Ignore_IP_List_Table::CREATE(string name, size_t size){
+Ignore_IP_List_Table *Ignore_IP_List_Table::CREATE(string name, size_t size, bool replace_incompatible){
     Ignore_IP_List_Table *config = new Ignore_IP_List_Table(name, size);
-    if(config->init() < 0){
+    if(config->init(replace_incompatible) < 0){
         delete config;
         config = nullptr;
         syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [CREATE in ignore_ip_list_table]");
@@ -816,10 +1061,10 @@ int32_t Ignore_IP_List_Table::INSERT(Ignore_IP_List_Record entry){
             status = -1;
         }else{
             // host_ix is UNIQUE
-            Ignore_IP_List_Record *match = std::find_if(begin(), end(), [entry](const Ignore_IP_List_Record &record){return record.host_ix == entry.host_ix;});
+            Ignore_IP_List_Record *match = findByKey(entry.host_ix);
             if(!isIn(match)){
                 if(entry.ix == 0){
-                    entry.ix = size() == 0 ? 1 : size() + 1;
+                    entry.ix = nextIx();
                 }
                 status = pushBack(entry);
             }else{
@@ -834,19 +1079,13 @@ int32_t Ignore_IP_List_Table::INSERT(Ignore_IP_List_Record entry){
 
 int32_t Ignore_IP_List_Table::DELETE(const string &query){
     int32_t status = 0;
-    if(query.find("DELETE FROM ignore_ip_list WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string value(query, ++pos, query.length() - pos);
-        uint32_t host_ix = atol(value.c_str());
-        if(lock() == 0){
-            Ignore_IP_List_Record *match = std::find_if(begin(), end(), [host_ix](Ignore_IP_List_Record record){return record.host_ix == host_ix;});
-            if(isIn(match)){
-                status = deleteRecordByPos(getPositionByKey(match->ix));
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in ignore_ip_list_table]");
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "DELETE FROM ignore_ip_list WHERE host_ix=%u", &host_ix) == 1){
+        int32_t deleted = deleteByHostIx(host_ix);
+        if(deleted <= 0){
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [DELETE in ignore_ip_list_table]");
         }
+        status = deleted < 0 ? -1 : 0;
     }
 
     if(query == "DELETE FROM ignore_ip_list"){
@@ -855,7 +1094,7 @@ int32_t Ignore_IP_List_Table::DELETE(const string &query){
             unlock();
         }
     }
-    return 0;
+    return status;
 }
 
 int32_t Ignore_IP_List_Table::SELECT(char *result, const string &query){
@@ -863,50 +1102,40 @@ int32_t Ignore_IP_List_Table::SELECT(char *result, const string &query){
     *result = '\0';
 
     if(query == "SELECT * FROM ignore_ip_list"){
-        if(lock() == 0){
-            Ignore_IP_List_Record record;
-            status = 0;
-            for(int i=1; i<=size(); i++){
-                if((status = getRecordByPos(record, i)) != -1){
-                    sprintf(result, "%s%lu:%lu:%lu>", result, record.ix, record.host_ix, record.timestamp);
-                }else{
-                    status = -1;
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
-                    break;
-                }
+        vector<Ignore_IP_List_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Ignore_IP_List_Record &record : records){
+                len += sprintf(result + len, "%u:%u:%ld>", record.ix, record.host_ix, (long)record.timestamp);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
         }
     }
 
     if(query == "SELECT host_ix FROM ignore_ip_list"){
-        Ignore_IP_List_Record record;
-        if(lock() == 0){
-            for(int i=1; i<=size(); i++){
-                status = getRecordByPos(record, i);
-                sprintf(result, "%s%u>", result, record.host_ix);
-                if(status == -1){
-                    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
-                    break;
-                }
+        vector<Ignore_IP_List_Record> records;
+        if(getAll(records) >= 0){
+            size_t len = 0;
+            for(const Ignore_IP_List_Record &record : records){
+                len += sprintf(result + len, "%u>", record.host_ix);
             }
-            unlock();
+            status = 0;
+        }else{
+            status = -1;
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
         }
     }
 
-    if(query.find("SELECT host_ix FROM ignore_ip_list WHERE host_ix=") != std::string::npos){
-        size_t pos = query.find_first_of("=");
-        string host_ix_str(query, ++pos, query.length() - pos);
-        int host_ix = atol(host_ix_str.c_str());
-        if(lock() == 0){
-            Ignore_IP_List_Record *match = std::find_if(begin(), end(), [host_ix](Ignore_IP_List_Record record){return record.host_ix == host_ix;});
-            if(isIn(match)){
-                sprintf(result, "%u", match->host_ix);
-                status = 0;
-            }else{
-                syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
-            }
-            unlock();
+    uint32_t host_ix;
+    if(sscanf(query.c_str(), "SELECT host_ix FROM ignore_ip_list WHERE host_ix=%u", &host_ix) == 1){
+        if(findByHostIx(host_ix) > 0){
+            sprintf(result, "%u", host_ix);
+            status = 0;
+        }else{
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [SELECT in ignore_ip_list_table]");
         }
     }
 
@@ -932,3 +1161,42 @@ uint32_t Ignore_IP_List_Table::getPositionByKey(const uint32_t key){
     }
     return position;
 }
+
+uint64_t Ignore_IP_List_Table::indexKey(const Ignore_IP_List_Record &record) const{
+    return record.host_ix;
+}
+
+uint64_t Ignore_IP_List_Table::schema() const{
+    uint64_t hash = schemaField(SHARED_MEM_HASH_SEED, "key host_ix", 0, 0);
+    hash = SCHEMA_FIELD(hash, Ignore_IP_List_Record, ix);
+    hash = SCHEMA_FIELD(hash, Ignore_IP_List_Record, host_ix);
+    hash = SCHEMA_FIELD(hash, Ignore_IP_List_Record, timestamp);
+    return hash;
+}
+
+int32_t Ignore_IP_List_Table::findByHostIx(uint32_t host_ix){
+    int32_t ix = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            Ignore_IP_List_Record *match = findByKey(host_ix);
+            ix = isIn(match) ? match->ix : 0;
+        }
+        unlock();
+    }
+    return ix;
+}
+
+int32_t Ignore_IP_List_Table::deleteByHostIx(uint32_t host_ix){
+    int32_t deleted = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            Ignore_IP_List_Record *match = findByKey(host_ix);
+            deleted = 0;
+            if(isIn(match) && deleteRecordByPos(match - begin() + 1) == 0){
+                deleted = 1;
+            }
+        }
+        unlock();
+    }
+    return deleted;
+}
@@ -32,7 +32,9 @@
 #define DATA_BASE_H
 
 #include "shared_memory_table.h"
+#include <functional>
 #include <string>
+#include <netinet/in.h>
 #include <time.h>
 
 #define LENGTH_IPV4    16
@@ -69,38 +71,78 @@ struct Ignore_IP_List_Record{
     time_t timestamp;
 }__attribute__((packed));
 
+/*
+ * typed queries
+ *
+ * lookups return the value asked for, 0 when there is no such row
+ * and -1 when the table could not be locked. deletes return the
+ * number of rows removed or -1. lookups only take the mutex for
+ * reading, which leaves signals alone. visitors copy the matching
+ * rows out without holding the mutex unless writers keep getting in,
+ * and call fn afterwards, so fn may query the tables again, and stop
+ * early when fn returns non 0. getAll copies a whole table out the
+ * same way, for callers that walk every row
+ *
+ * the string based SELECT and DELETE are kept for older callers and
+ * parse the query into one of these
+ */
+typedef std::function<int(const Hosts_Ports_Hits_Record &)> Hosts_Ports_Hits_Visitor;
+
 
 class Black_IP_List_Table : public SharedMemoryTable<Black_IP_List_Record>{
+    protected:
+        uint64_t indexKey(const Black_IP_List_Record &record) const;
+        uint64_t schema() const;
     public:
         Black_IP_List_Table(std::string name, size_t size);
-        static Black_IP_List_Table *CREATE(std::string name, size_t size);
+        static Black_IP_List_Table *CREATE(std::string name, size_t size, bool replace_incompatible = false);
         int32_t INSERT(Black_IP_List_Record entry);
         int32_t DELETE(const std::string &query);
         int32_t SELECT(char * result, const std::string &query);
         int32_t UPDATE(const Black_IP_List_Record &entry);
         uint32_t getPositionByKey(const uint32_t key);
+        int32_t findByHostIx(uint32_t host_ix);
+        int32_t deleteByHostIx(uint32_t host_ix);
 };
 
 class Detected_Hosts_Table : public SharedMemoryTable<Detected_Hosts_Record>{
+    protected:
+        uint64_t indexKey(const Detected_Hosts_Record &record) const;
+        uint64_t schema() const;
     public:
         Detected_Hosts_Table(std::string name, size_t size);
-        static Detected_Hosts_Table *CREATE(std::string name, size_t size);
+        static Detected_Hosts_Table *CREATE(std::string name, size_t size, bool replace_incompatible = false);
         int32_t INSERT(Detected_Hosts_Record entry);
         int32_t DELETE(const std::string &query);
         int32_t SELECT(char * result, const std::string &query);
         int32_t UPDATE(const Detected_Hosts_Record &entry);
         uint32_t getPositionByKey(const uint32_t key);
+        int32_t findByHostIx(uint32_t host_ix);
+        int32_t deleteByIx(uint32_t ix);
 };
 
 class Hosts_Ports_Hits_Table : public SharedMemoryTable<Hosts_Ports_Hits_Record>{
+    protected:
+        uint64_t indexKey(const Hosts_Ports_Hits_Record &record) const;
+        uint64_t schema() const;
     public:
         Hosts_Ports_Hits_Table(std::string name, size_t size);
-        static Hosts_Ports_Hits_Table *CREATE(std::string name, size_t size);
+        static Hosts_Ports_Hits_Table *CREATE(std::string name, size_t size, bool replace_incompatible = false);
         int32_t INSERT(Hosts_Ports_Hits_Record entry);
         int32_t DELETE(const std::string &query);
         int32_t SELECT(char * result, const std::string &query);
         int32_t UPDATE(const Hosts_Ports_Hits_Record &entry);
         uint32_t getPositionByKey(const uint32_t key);
+        int32_t getHitCount(uint32_t host_ix, uint32_t port);
+        int32_t getHitTotal(uint32_t host_ix);
+        int32_t getPortCount(uint32_t host_ix);
+        int32_t addHits(uint32_t host_ix, uint32_t port, uint32_t hits);
+        int32_t deleteByHostIx(uint32_t host_ix);
+        // rows of every host_ix listed, in one pass over the table
+        int32_t deleteByHostIxs(const std::vector<uint32_t> &host_ixs);
+        int32_t forEachOverThreshold(uint32_t port, uint32_t min_hits, const Hosts_Ports_Hits_Visitor &fn);
+        // every host_ix with hits, sorted and without repeats
+        int32_t getHostIxs(std::vector<uint32_t> &host_ixs);
 };
 
 class Hosts_Table : public SharedMemoryTable<Hosts_Record>{
@@ -108,25 +150,38 @@ class Hosts_Table : public SharedMemoryTable<Hosts_Record>{
         static const unsigned NUMBER_FIELDS_TABLE {4};
         enum {ix, host, first_seen, last_seen};
         const std::string FIELDS[NUMBER_FIELDS_TABLE] = {"ix", "host", "first_seen", "last_seen"};
+        Hosts_Record *findHost(const char *host) const;
+    protected:
+        uint64_t indexKey(const Hosts_Record &record) const;
+        uint64_t schema() const;
     public:
         Hosts_Table(std::string name, size_t size);
-        static Hosts_Table *CREATE(std::string name, size_t size);
+        static Hosts_Table *CREATE(std::string name, size_t size, bool replace_incompatible = false);
         int32_t INSERT(Hosts_Record entry);
         int32_t DELETE(const std::string &query);
         int32_t SELECT(char * result, const std::string &query);
         int32_t UPDATE(const Hosts_Record &entry);
         uint32_t getPositionByKey(const uint32_t key);
+        int32_t findHostIx(const char *host);
+        int32_t findHostIx(in_addr_t addr);
+        // 1 = found, fills record
+        int32_t getHost(uint32_t ix, Hosts_Record &record);
 };
 
 class Ignore_IP_List_Table : public SharedMemoryTable<Ignore_IP_List_Record>{
+    protected:
+        uint64_t indexKey(const Ignore_IP_List_Record &record) const;
+        uint64_t schema() const;
     public:
         Ignore_IP_List_Table(std::string name, size_t size);
-        static Ignore_IP_List_Table *CREATE(std::string name, size_t size);
+        static Ignore_IP_List_Table *CREATE(std::string name, size_t size, bool replace_incompatible = false);
         int32_t INSERT(Ignore_IP_List_Record entry);
         int32_t DELETE(const std::string &query);
         int32_t SELECT(char * result, const std::string &query);
         int32_t UPDATE(const Ignore_IP_List_Record &entry);
         uint32_t getPositionByKey(const uint32_t key);
+        int32_t findByHostIx(uint32_t host_ix);
+        int32_t deleteByHostIx(uint32_t host_ix);
 };
 
 struct DataBase{
@@ -135,15 +190,30 @@ struct DataBase{
     static const int TABLES_NUMBER = 5;
     const std::string TABLES_NAME[TABLES_NUMBER] = {"black_ip_list_table", "detected_hosts_table",
             "hosts_ports_hits_table", "hosts_table", "ignore_ip_list_table"};
-    DataBase();
+    DataBase(long table_size, bool replace_incompatible);
     ~DataBase();
     Black_IP_List_Table *black_ip_list;
     Detected_Hosts_Table *detected_hosts;
     Hosts_Ports_Hits_Table *hosts_ports_hits;
     Hosts_Table *hosts;
     Ignore_IP_List_Table *ignore_ip_list;
-    static DataBase *create();
+    /*
+     * table_size is the number of records reserved up front in hosts_table
+     * and hosts_ports_hits, <= 0 for the defaults. Only the process that
+     * creates the tables decides, the others map whatever is there.
+     * A table left by a build with another layout is replaced when
+     * replace_incompatible is set, otherwise create fails (nullptr),
+     * see SharedMemoryTable::init
+     */
+    static DataBase *create(long table_size = -1, bool replace_incompatible = false);
     void cleanTables(const std::string &);
+    /*
+     * every table to or from its own file, prefix.<table>.shm, see
+     * SharedMemoryTable::saveSnapshot. loading is all or nothing,
+     * tables that already have rows are left alone. return 0 = ok
+     */
+    int32_t saveSnapshots(const std::string &prefix);
+    int32_t loadSnapshots(const std::string &prefix);
 };
 
 #endif
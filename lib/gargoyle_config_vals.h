@@ -92,6 +92,46 @@ extern "C" {
 #define GARGOYLE_HOSTS_TABLE_SIZE 250
 #define GARGOYLE_IGNORE_IP_LIST_TABLE_NAME "/gargoyle_ignore_ip_list_table_shm"
 #define GARGOYLE_IGNORE_IP_LIST_TABLE_SIZE 250
+#define GARGOYLE_AGGREGATED_SHM_NAME "/gargoyle_aggregated_shm"
+#define GARGOYLE_AGGREGATED_SHM_SZ 250
+
+// enforcement worker (block_action_queue.h)
+#define GARGOYLE_BLOCK_QUEUE_MAX_PENDING 4096
+#define GARGOYLE_BLOCK_QUEUE_MAX_BATCH 64
+#define GARGOYLE_BLOCK_QUEUE_LINGER_MS 50
+
+// subnet aggregation of chain rules (block_aggregator.h)
+#define GARGOYLE_AGGREGATE_PREFIX_LEN 24
+#define GARGOYLE_AGGREGATE_MIN_PREFIX_LEN 16
+#define GARGOYLE_AGGREGATE_LOCK_FILE "/run/gargoyle_aggregate.lock"
+
+// XDP drop backend (bpf_drop.h)
+#define GARGOYLE_BPF_MAP_PIN "/sys/fs/bpf/gargoyle_blocked"
+#define GARGOYLE_BPF_LINK_PIN "/sys/fs/bpf/gargoyle_xdp_link"
+#define GARGOYLE_BPF_MAP_MAX_ENTRIES 65536
+
+// SQLite write-behind (hit_write_behind.h)
+#define GARGOYLE_WRITE_BEHIND_INTERVAL_MS 1000
+#define GARGOYLE_WRITE_BEHIND_MAX_DIRTY 4096
+#define GARGOYLE_WRITE_BEHIND_MAX_RETRIES 5
+
+// SQLite retention (sqlite_apply_retention), 30 days
+#define GARGOYLE_RETENTION_DELETE_AFTER 2592000
+#define GARGOYLE_RETENTION_BATCH 500
+#define GARGOYLE_RETENTION_VACUUM_PAGES 1024
+
+// hosts_hits_history bucket retention (sqlite_compact_hit_history)
+#define GARGOYLE_HIT_HISTORY_MINUTES_FOR 7200
+#define GARGOYLE_HIT_HISTORY_HOURS_FOR 172800
+#define GARGOYLE_HIT_HISTORY_DAYS_FOR 2592000
+
+// read-only DB snapshot (sqlite_publish_snapshot)
+#define GARGOYLE_SNAPSHOT_SUFFIX ".snapshot"
+#define GARGOYLE_SNAPSHOT_PAGES_PER_STEP 64
+#define GARGOYLE_SNAPSHOT_STEP_SLEEP_MS 5
+
+// binary shared memory table snapshots, the DB path plus ".<table>" plus this
+#define GARGOYLE_SHM_SNAPSHOT_SUFFIX ".shm"
 
 
 #ifdef __cplusplus
@@ -0,0 +1,400 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * in-process iptables backend on top of libiptc
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef USE_LIBIPTC
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/file.h>
+
+#include <libiptc/libiptc.h>
+#include <linux/netfilter/xt_NFLOG.h>
+
+#include "iptables_direct.h"
+#include "gargoyle_config_vals.h"
+
+/*
+ * same lock file "iptables -w" waits on, without it a concurrent
+ * iptables command and our commit can each replace the table
+ * and silently drop the other's change
+ */
+#define XTABLES_LOCK_FILE "/run/xtables.lock"
+#define FILTER_TABLE "filter"
+
+
+static int xtables_lock(size_t use_xlock) {
+
+	if (!use_xlock)
+		return -1;
+
+	int fd = open(XTABLES_LOCK_FILE, O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -1;
+
+	while (flock(fd, LOCK_EX) != 0) {
+		if (errno != EINTR) {
+			int saved = errno;
+			close(fd);
+			errno = saved;
+			return -1;
+		}
+	}
+	return fd;
+}
+
+
+static void xtables_unlock(int fd) {
+
+	if (fd >= 0)
+		close(fd);
+}
+
+
+static struct xtc_handle *direct_begin(const char *fname, size_t use_xlock, int *lock_fd) {
+
+	*lock_fd = xtables_lock(use_xlock);
+	// committing without the lock is what use_xlock is there to prevent
+	if (use_xlock && *lock_fd < 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR xtables lock from function [%s]: %s %s", fname, XTABLES_LOCK_FILE, strerror(errno));
+		return NULL;
+	}
+
+	struct xtc_handle *h = iptc_init(FILTER_TABLE);
+	if (!h) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR libiptc init from function [%s]: %s", fname, iptc_strerror(errno));
+		xtables_unlock(*lock_fd);
+	}
+	return h;
+}
+
+
+/*
+ * commits when ok is set, always releases the handle and the lock
+ */
+static size_t direct_end(const char *fname, struct xtc_handle *h, int ok, int lock_fd) {
+
+	size_t rc = 1;
+
+	if (ok) {
+		if (iptc_commit(h))
+			rc = 0;
+		else
+			syslog(LOG_INFO | LOG_LOCAL6, "ERROR libiptc commit from function [%s]: %s", fname, iptc_strerror(errno));
+	} else {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR libiptc from function [%s]: %s", fname, iptc_strerror(errno));
+	}
+
+	iptc_free(h);
+	xtables_unlock(lock_fd);
+	return rc;
+}
+
+
+/*
+ * one rule with no matches, just the ip header part
+ * and a standard target (DROP, ACCEPT or a chain name)
+ */
+static struct ipt_entry *build_standard_entry(const char *target, in_addr_t src, in_addr_t smsk) {
+
+	size_t target_sz = XT_ALIGN(sizeof(struct xt_standard_target));
+	size_t entry_sz = XT_ALIGN(sizeof(struct ipt_entry)) + target_sz;
+
+	struct ipt_entry *e = (struct ipt_entry *) calloc(1, entry_sz);
+	if (!e)
+		return NULL;
+
+	e->ip.src.s_addr = src;
+	e->ip.smsk.s_addr = smsk;
+	e->target_offset = XT_ALIGN(sizeof(struct ipt_entry));
+	e->next_offset = entry_sz;
+
+	struct xt_standard_target *t = (struct xt_standard_target *) e->elems;
+	t->target.u.user.target_size = target_sz;
+	snprintf(t->target.u.user.name, sizeof(t->target.u.user.name), "%s", target);
+
+	return e;
+}
+
+
+static void format_addr(struct in_addr addr, struct in_addr msk, char *dst, size_t sz_dst) {
+
+	char a[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr, a, sizeof(a));
+
+	uint32_t m = ntohl(msk.s_addr);
+	if (m == 0xffffffff) {
+		snprintf(dst, sz_dst, "%s", a);
+	} else {
+		int bits = 0;
+		while (m & 0x80000000) {
+			bits++;
+			m <<= 1;
+		}
+		snprintf(dst, sz_dst, "%s/%d", a, bits);
+	}
+}
+
+
+size_t iptables_direct_create_new_chain(const char *chain_name, size_t use_xlock) {
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h)
+		return 1;
+
+	// iptables -N on an existing chain is a no-op for our purposes
+	if (iptc_is_chain(chain_name, h)) {
+		iptc_free(h);
+		xtables_unlock(lock_fd);
+		return 0;
+	}
+	return direct_end(__func__, h, iptc_create_chain(chain_name, h), lock_fd);
+}
+
+
+size_t iptables_direct_flush_chain(const char *chain_name, size_t use_xlock) {
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h)
+		return 1;
+
+	return direct_end(__func__, h, iptc_flush_entries(chain_name, h), lock_fd);
+}
+
+
+size_t iptables_direct_delete_chain(const char *chain_name, size_t use_xlock) {
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h)
+		return 1;
+
+	return direct_end(__func__, h, iptc_delete_chain(chain_name, h), lock_fd);
+}
+
+
+size_t iptables_direct_delete_rule_from_chain(const char *chain_name, size_t rule_index, size_t use_xlock) {
+
+	// iptables rule numbers are 1 based, libiptc's are 0 based
+	if (rule_index == 0)
+		return 1;
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h)
+		return 1;
+
+	return direct_end(__func__, h, iptc_delete_num_entry(chain_name, rule_index - 1, h), lock_fd);
+}
+
+
+/*
+ * "a.b.c.d" or "a.b.c.d/len", the same source forms iptables -s takes
+ */
+static int parse_source(const char *the_src, struct in_addr *addr, struct in_addr *msk) {
+
+	char a[INET_ADDRSTRLEN];
+	unsigned long bits = 32;
+
+	const char *slash = strchr(the_src, '/');
+	if (slash) {
+		char *end;
+		size_t a_len = slash - the_src;
+		if (a_len >= sizeof(a))
+			return 1;
+		bits = strtoul(slash + 1, &end, 10);
+		if (*end != '\0' || end == slash + 1 || bits > 32)
+			return 1;
+		memcpy(a, the_src, a_len);
+		a[a_len] = '\0';
+	} else {
+		snprintf(a, sizeof(a), "%s", the_src);
+	}
+
+	if (inet_pton(AF_INET, a, addr) != 1)
+		return 1;
+
+	msk->s_addr = bits ? htonl(0xffffffffu << (32 - bits)) : 0;
+	addr->s_addr &= msk->s_addr;
+	return 0;
+}
+
+
+size_t iptables_direct_add_drop_rule_to_chain(const char *chain_name, const char *the_ip, size_t use_xlock) {
+
+	struct in_addr src, smsk;
+	if (parse_source(the_ip, &src, &smsk) != 0)
+		return 1;
+
+	struct ipt_entry *e = build_standard_entry(IPTC_LABEL_DROP, src.s_addr, smsk.s_addr);
+	if (!e)
+		return 1;
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h) {
+		free(e);
+		return 1;
+	}
+
+	size_t rc = direct_end(__func__, h, iptc_append_entry(chain_name, e, h), lock_fd);
+	free(e);
+	return rc;
+}
+
+
+size_t iptables_direct_delete_drop_rule_by_source(const char *chain_name, const char *the_src, size_t use_xlock) {
+
+	struct in_addr src, smsk;
+	if (parse_source(the_src, &src, &smsk) != 0)
+		return 1;
+
+	struct ipt_entry *e = build_standard_entry(IPTC_LABEL_DROP, src.s_addr, smsk.s_addr);
+	if (!e)
+		return 1;
+
+	// compare every byte of the entry, what iptables -D does too
+	unsigned char *matchmask = (unsigned char *) malloc(e->next_offset);
+	if (!matchmask) {
+		free(e);
+		return 1;
+	}
+	memset(matchmask, 0xff, e->next_offset);
+
+	size_t rc = 1;
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (h)
+		rc = direct_end(__func__, h, iptc_delete_entry(chain_name, e, matchmask, h), lock_fd);
+
+	free(matchmask);
+	free(e);
+	return rc;
+}
+
+
+size_t iptables_direct_insert_chain_rule_to_chain_at_index(const char *chain_name, size_t ix_pos, const char *chain_to_add, size_t use_xlock) {
+
+	if (ix_pos == 0)
+		return 1;
+
+	struct ipt_entry *e = build_standard_entry(chain_to_add, 0, 0);
+	if (!e)
+		return 1;
+
+	int lock_fd;
+	struct xtc_handle *h = direct_begin(__func__, use_xlock, &lock_fd);
+	if (!h) {
+		free(e);
+		return 1;
+	}
+
+	size_t rc = direct_end(__func__, h, iptc_insert_entry(chain_name, e, ix_pos - 1, h), lock_fd);
+	free(e);
+	return rc;
+}
+
+
+/*
+ * walks the chain from a snapshot of the table, the text handed
+ * out in entry->line mimics "iptables -L -n --line-numbers" so
+ * callers matching on it behave the same with either backend
+ */
+size_t iptables_direct_for_each_rule_in_chain(const char *chain_name, iptables_rule_cb cb, void *ctx, size_t use_xlock) {
+
+	if (!chain_name || !cb)
+		return 1;
+
+	struct xtc_handle *h = iptc_init(FILTER_TABLE);
+	if (!h) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR libiptc init from function [%s]: %s", __func__, iptc_strerror(errno));
+		return 1;
+	}
+
+	if (!iptc_is_chain(chain_name, h)) {
+		iptc_free(h);
+		return 0;
+	}
+
+	struct iptables_rule_entry entry;
+	char line[IPTABLES_LINE_SZ];
+	char dest[IPTABLES_ADDR_SZ];
+	char proto[8];
+	char extra[32];
+
+	const struct ipt_entry *e;
+	size_t n = 0;
+	for (e = iptc_first_rule(chain_name, h); e; e = iptc_next_rule(e, h)) {
+
+		n++;
+		entry.line_number = n;
+		snprintf(entry.target, IPTABLES_TARGET_SZ, "%s", iptc_get_target(e, h));
+		format_addr(e->ip.src, e->ip.smsk, entry.source, IPTABLES_ADDR_SZ);
+		format_addr(e->ip.dst, e->ip.dmsk, dest, sizeof(dest));
+
+		switch (e->ip.proto) {
+			case 0: snprintf(proto, sizeof(proto), "all"); break;
+			case IPPROTO_TCP: snprintf(proto, sizeof(proto), "tcp"); break;
+			case IPPROTO_UDP: snprintf(proto, sizeof(proto), "udp"); break;
+			case IPPROTO_ICMP: snprintf(proto, sizeof(proto), "icmp"); break;
+			default: snprintf(proto, sizeof(proto), "%u", e->ip.proto); break;
+		}
+
+		*extra = 0;
+		if (strcmp(entry.target, NFLOG) == 0) {
+			const struct xt_entry_target *t = ipt_get_target((struct ipt_entry *) e);
+			const struct xt_nflog_info *info = (const struct xt_nflog_info *) t->data;
+			snprintf(extra, sizeof(extra), "nflog-group %u", info->group);
+		}
+
+		snprintf(line, sizeof(line), "%-4zu %-10s %-4s --  %-20s %-20s %s\n",
+				n, entry.target, proto, entry.source, dest, extra);
+		entry.line = line;
+
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	iptc_free(h);
+	return 0;
+}
+
+#endif // USE_LIBIPTC
@@ -0,0 +1,66 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * in-process iptables backend on top of libiptc
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef __gargoyleiptablesdirect__H_
+#define __gargoyleiptablesdirect__H_
+
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "iptables_wrapper_api.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Same semantics and return codes as their iptables_* counterparts
+ * (0 = ok, 1 = not ok) but the filter table is read and committed
+ * through libiptc instead of fork/exec'ing the iptables binary.
+ *
+ * libiptc only drives the legacy x_tables backend, iptables_wrapper_api
+ * checks "iptables -V" and stays on exec where iptables is iptables-nft.
+ */
+size_t iptables_direct_create_new_chain(const char *, size_t);
+size_t iptables_direct_flush_chain(const char *, size_t);
+size_t iptables_direct_delete_chain(const char *, size_t);
+size_t iptables_direct_delete_rule_from_chain(const char *, size_t, size_t);
+size_t iptables_direct_add_drop_rule_to_chain(const char *, const char *, size_t);
+size_t iptables_direct_delete_drop_rule_by_source(const char *, const char *, size_t);
+size_t iptables_direct_insert_chain_rule_to_chain_at_index(const char *, size_t, const char *, size_t);
+size_t iptables_direct_for_each_rule_in_chain(const char *, iptables_rule_cb, void *, size_t);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // __gargoyleiptablesdirect__H_
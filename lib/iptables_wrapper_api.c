@@ -27,12 +27,19 @@
  * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  *****************************************************************************/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <syslog.h>
 
 #include "iptables_wrapper_api.h"
+#include "iptables_direct.h"
+#include "bpf_drop.h"
 #include "gargoyle_config_vals.h"
 
 /*
@@ -43,6 +50,25 @@
  * return 1 = not ok
  */
 
+#ifdef USE_LIBIPTC
+// picked on first use, see current_backend
+static int iptables_backend = -1;
+#else
+static int iptables_backend = IPTABLES_BACKEND_EXEC;
+#endif
+
+#ifdef USE_BPF
+/*
+ * while gargoyle_pscand has its XDP program loaded the drop rules
+ * of GARGOYLE_CHAIN_NAME go in the pinned bpf map too, and are
+ * listed and numbered from there. the chain keeps its copy for
+ * the interfaces the program is not attached to
+ */
+static int chain_in_bpf(const char *chain_name) {
+	return strcmp(chain_name, GARGOYLE_CHAIN_NAME) == 0 && bpf_drop_is_active();
+}
+#endif
+
 /*
 size_t is_integer (char *the_str) {
 
@@ -61,8 +87,127 @@ size_t is_integer (char *the_str) {
 }
 */
 
+/*
+ * runs cmd and copies its output straight into dst,
+ * returns 1 if the pipe could not be opened or the
+ * output did not fit in sz_dst (dst still holds what
+ * did fit)
+ */
+static size_t iptables_read_cmd_output(const char *cmd, char *dst, size_t sz_dst) {
+
+	if (!dst || sz_dst == 0)
+		return 1;
+
+	FILE *in;
+	extern FILE *popen();
+	char buff[IPTABLES_LINE_SZ];
+
+	*dst = 0;
+	if(!(in = popen(cmd, "r"))) {
+		return 1;
+	}
+
+	size_t rc = 0;
+	size_t dst_len = 0;
+	while(fgets(buff, sizeof(buff), in)!=NULL) {
+		size_t buff_len = strlen(buff);
+		if (dst_len + buff_len + 1 > sz_dst) {
+			rc = 1;
+			break;
+		}
+		memcpy(dst + dst_len, buff, buff_len);
+		dst_len += buff_len;
+	}
+	dst[dst_len] = '\0';
+
+	pclose(in);
+	return rc;
+}
+
+
+/*
+ * breaks one listing line into its columns, header
+ * lines ("Chain ...", "num  target ...") do not start
+ * with a rule number and return 1
+ *
+ * num  target     prot opt source               destination
+ * 1    DROP       all  --  1.2.3.4              0.0.0.0/0
+ *
+ * a rule without a jump has an empty target column so
+ * the opt column (-- / -f / !f) shifts one token left
+ */
+static size_t iptables_parse_rule_line(const char *line, struct iptables_rule_entry *entry) {
+
+	char num[24];
+	char col[4][IPTABLES_ADDR_SZ];
+
+	int cnt = sscanf(line, "%23s %47s %47s %47s %47s", num, col[0], col[1], col[2], col[3]);
+	if (cnt < 4 || !isdigit((unsigned char)num[0]))
+		return 1;
+
+	entry->line_number = strtoul(num, NULL, 10);
+	if (entry->line_number == 0)
+		return 1;
+
+	if (col[1][0] == '-' || col[1][0] == '!') {
+		entry->target[0] = '\0';
+		snprintf(entry->source, IPTABLES_ADDR_SZ, "%s", col[2]);
+	} else {
+		if (cnt < 5)
+			return 1;
+		// a column is wider than any target name, cut rather than overflow
+		strncpy(entry->target, col[0], sizeof(entry->target) - 1);
+		entry->target[sizeof(entry->target) - 1] = '\0';
+		snprintf(entry->source, IPTABLES_ADDR_SZ, "%s", col[3]);
+	}
+	entry->line = line;
+	return 0;
+}
+
+
+#ifdef USE_LIBIPTC
+/*
+ * libiptc only drives the legacy x_tables. on an iptables-nft host
+ * a chain it creates would be invisible to the iptables binary,
+ * which everything that does not go through libiptc still runs
+ */
+static int iptables_is_nft() {
+
+	char cmd[CMD_BUF_SZ];
+	char out[IPTABLES_LINE_SZ];
+
+	snprintf(cmd, CMD_BUF_SZ, "%s %s", IPTABLES, "-V 2>/dev/null");
+	iptables_read_cmd_output(cmd, out, sizeof(out));
+
+	// "iptables v1.8.7 (nf_tables)" vs "(legacy)", older ones say neither
+	return strstr(out, "nf_tables") != NULL;
+}
+#endif
+
+
+static int current_backend() {
+
+#ifdef USE_LIBIPTC
+	if (iptables_backend < 0) {
+		if (iptables_is_nft()) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_ERROR, "iptables is the nf_tables variant, not using libiptc");
+			iptables_backend = IPTABLES_BACKEND_EXEC;
+		} else {
+			iptables_backend = IPTABLES_BACKEND_LIBIPTC;
+		}
+	}
+#endif
+	return iptables_backend;
+}
+
+
 size_t iptables_create_new_chain(const char *chain_name, size_t use_xlock) {
 
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_create_new_chain(chain_name, use_xlock);
+#endif
+
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -85,6 +230,17 @@ size_t iptables_create_new_chain(const char *chain_name, size_t use_xlock) {
 
 size_t iptables_flush_chain(const char *chain_name, size_t use_xlock) {
 
+#ifdef USE_BPF
+	// the chain itself still gets flushed below
+	if (chain_in_bpf(chain_name))
+		bpf_drop_flush();
+#endif
+
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_flush_chain(chain_name, use_xlock);
+#endif
+
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -108,8 +264,6 @@ size_t iptables_flush_chain(const char *chain_name, size_t use_xlock) {
 size_t iptables_list_chain_with_line_numbers(const char *chain_name, char *dst, size_t sz_dst, size_t use_xlock) {
 
 	char cmd[CMD_BUF_SZ];
-	//char dest[DEST_BUF_SZ];
-    char *dest = (char*) malloc (DEST_BUF_SZ);
 
 	// construct iptables cmd
     if (use_xlock)
@@ -117,42 +271,13 @@ size_t iptables_list_chain_with_line_numbers(const char *chain_name, char *dst,
     else
     	snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s", IPTABLES, "-L", chain_name, "-n --line-numbers");
 
-	FILE *in;
-	extern FILE *popen();
-	char buff[512];
-
-	if(!(in = popen(cmd, "r"))) {
-		free(dest);
-		return 1;
-	}
-
-	// populate results from iptables cmd
-	*dest = 0;
-	while(fgets(buff, sizeof(buff), in)!=NULL) {
-		strncat(dest, buff, DEST_BUF_SZ-strlen(dest)-1);
-	}
-
-	size_t rc = 0;
-	size_t dest_len = strlen(dest);
-	dest[dest_len] = '\0';
-	//strcpy(dst, dest);
-	if (dest_len+1 > sz_dst) {
-		rc = 1;
-	} else {
-		memcpy (dst, dest, dest_len+1);
-	}
-
-	free(dest);
-	pclose(in);
-	return rc;
+	return iptables_read_cmd_output(cmd, dst, sz_dst);
 }
 
 
 size_t iptables_list_chain(const char *chain_name, char *dst, size_t sz_dst, size_t use_xlock) {
 
 	char cmd[CMD_BUF_SZ];
-	//char dest[DEST_BUF_SZ];
-    char *dest = (char*) malloc (DEST_BUF_SZ);
 
 	// construct iptables cmd
     if (use_xlock)
@@ -160,42 +285,13 @@ size_t iptables_list_chain(const char *chain_name, char *dst, size_t sz_dst, siz
     else
     	snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s", IPTABLES, "-L", chain_name, "-n");
 
-	FILE *in;
-	extern FILE *popen();
-	char buff[512];
-
-	if(!(in = popen(cmd, "r"))){
-		free(dest);
-		return 1;
-	}
-
-	// populate results from iptables cmd
-	*dest = 0;
-	while(fgets(buff, sizeof(buff), in)!=NULL){
-		strncat(dest, buff, DEST_BUF_SZ-strlen(dest)-1);
-	}
-
-	size_t rc = 0;
-	size_t dest_len = strlen(dest);
-	dest[dest_len] = '\0';
-	//strcpy(dst, dest);
-	if (dest_len+1 > sz_dst) {
-		rc = 1;
-	} else {
-		memcpy (dst, dest, dest_len+1);
-	}
-
-	free(dest);
-	pclose(in);
-	return rc;
+	return iptables_read_cmd_output(cmd, dst, sz_dst);
 }
 
 
 size_t iptables_list_all_with_line_numbers(char *dst, size_t sz_dst, size_t use_xlock) {
 
 	char cmd[CMD_BUF_SZ];
-	//char dest[DEST_BUF_SZ];
-    char *dest = (char*) malloc (DEST_BUF_SZ);
 
 	// construct iptables cmd
     if (use_xlock)
@@ -203,34 +299,7 @@ size_t iptables_list_all_with_line_numbers(char *dst, size_t sz_dst, size_t use_
     else
     	snprintf(cmd, CMD_BUF_SZ, "%s %s", IPTABLES, "-L -n --line-numbers");
 
-	FILE *in;
-	extern FILE *popen();
-	char buff[512];
-
-	if(!(in = popen(cmd, "r"))){
-		free(dest);
-		return 1;
-	}
-
-	// populate results from iptables cmd
-	*dest = 0;
-	while(fgets(buff, sizeof(buff), in)!=NULL){
-		strncat(dest, buff, DEST_BUF_SZ-strlen(dest)-1);
-	}
-
-	size_t rc = 0;
-	size_t dest_len = strlen(dest);
-	dest[dest_len] = '\0';
-	//strcpy(dst, dest);
-	if (dest_len+1 > sz_dst) {
-		rc = 1;
-	} else {
-		memcpy (dst, dest, dest_len+1);
-	}
-
-	free(dest);
-	pclose(in);
-	return rc;
+	return iptables_read_cmd_output(cmd, dst, sz_dst);
 }
 
 
@@ -238,8 +307,6 @@ size_t iptables_list_all(char *dst, size_t sz_dst, size_t use_xlock) {
 
 
 	char cmd[CMD_BUF_SZ];
-	//char dest[DEST_BUF_SZ];
-    char *dest = (char*) malloc (DEST_BUF_SZ);
 
 	// construct iptables cmd
     if (use_xlock)
@@ -247,46 +314,52 @@ size_t iptables_list_all(char *dst, size_t sz_dst, size_t use_xlock) {
     else
     	snprintf(cmd, CMD_BUF_SZ, "%s %s", IPTABLES, "-L -n");
 
+	return iptables_read_cmd_output(cmd, dst, sz_dst);
+}
+
+
+size_t iptables_delete_chain(const char *chain_name, size_t use_xlock) {
+
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_delete_chain(chain_name, use_xlock);
+#endif
+
+	char cmd[CMD_BUF_SZ];
+
+	// construct iptables cmd
+	if (use_xlock)
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s", IPTABLES, "-w -X", chain_name);
+	else
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s", IPTABLES, "-X", chain_name);
+
 	FILE *in;
 	extern FILE *popen();
-	char buff[512];
 
 	if(!(in = popen(cmd, "r"))){
-		free(dest);
 		return 1;
 	}
 
-	// populate results from iptables cmd
-	*dest = 0;
-	while(fgets(buff, sizeof(buff), in)!=NULL){
-		strncat(dest, buff, DEST_BUF_SZ-strlen(dest)-1);
-	}
-
-	size_t rc = 0;
-	size_t dest_len = strlen(dest);
-	dest[dest_len] = '\0';
-	//strcpy(dst, dest);
-	if (dest_len+1 > sz_dst) {
-		rc = 1;
-	} else {
-		memcpy (dst, dest, dest_len+1);
-	}
-
-	free(dest);
 	pclose(in);
-	return rc;
+	return 0;
 }
 
 
-size_t iptables_delete_chain(const char *chain_name, size_t use_xlock) {
+// iptables_delete_drop_rule_by_source without the bpf map
+static size_t chain_delete_drop_rule_by_source(const char *chain_name, const char *the_src, size_t use_xlock) {
+
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_delete_drop_rule_by_source(chain_name, the_src, use_xlock);
+#endif
 
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
 	if (use_xlock)
-		snprintf(cmd, CMD_BUF_SZ, "%s %s %s", IPTABLES, "-w -X", chain_name);
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s %s %s", IPTABLES, "-w -D", chain_name, "-s", the_src, "-j DROP");
 	else
-		snprintf(cmd, CMD_BUF_SZ, "%s %s %s", IPTABLES, "-X", chain_name);
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s %s %s", IPTABLES, "-D", chain_name, "-s", the_src, "-j DROP");
 
 	FILE *in;
 	extern FILE *popen();
@@ -302,6 +375,21 @@ size_t iptables_delete_chain(const char *chain_name, size_t use_xlock) {
 
 size_t iptables_delete_rule_from_chain(const char *chain_name, size_t rule_index, size_t use_xlock) {
 
+#ifdef USE_BPF
+	if (chain_in_bpf(chain_name)) {
+		char the_src[IPTABLES_ADDR_SZ];
+		if (bpf_drop_delete_at(rule_index, the_src, sizeof(the_src)) != 0)
+			return 1;
+		// the number was the map's, the chain's copy goes by source
+		return chain_delete_drop_rule_by_source(chain_name, the_src, use_xlock);
+	}
+#endif
+
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_delete_rule_from_chain(chain_name, rule_index, use_xlock);
+#endif
+
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -324,6 +412,16 @@ size_t iptables_delete_rule_from_chain(const char *chain_name, size_t rule_index
 
 size_t iptables_add_drop_rule_to_chain(const char *chain_name, const char *the_ip, size_t use_xlock) {
 
+#ifdef USE_BPF
+	if (chain_in_bpf(chain_name) && bpf_drop_add(the_ip) != 0)
+		return 1;
+#endif
+
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_add_drop_rule_to_chain(chain_name, the_ip, use_xlock);
+#endif
+
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -344,8 +442,25 @@ size_t iptables_add_drop_rule_to_chain(const char *chain_name, const char *the_i
 }
 
 
+size_t iptables_delete_drop_rule_by_source(const char *chain_name, const char *the_src, size_t use_xlock) {
+
+#ifdef USE_BPF
+	// gone from the map already is fine, the chain may still have it
+	if (chain_in_bpf(chain_name))
+		bpf_drop_delete(the_src);
+#endif
+
+	return chain_delete_drop_rule_by_source(chain_name, the_src, use_xlock);
+}
+
+
 size_t iptables_insert_chain_rule_to_chain_at_index(const char *chain_name, const char *ix_pos, const char *chain_to_add, size_t use_xlock) {
 
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_insert_chain_rule_to_chain_at_index(chain_name, atoi(ix_pos), chain_to_add, use_xlock);
+#endif
+
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -388,58 +503,34 @@ size_t iptables_insert_nfqueue_rule_to_chain_at_index(const char *chain_name, si
 }
 
 
-size_t iptables_find_rule_in_chain(const char *chain_name, const char *criteria_one, size_t use_xlock) {
+struct iptables_find_criteria {
+	const char *criteria_one;
+	const char *criteria_two;
+	size_t found_ix;
+};
 
-	char *token;
-	char *token_save;
-	//char index_substr[10];
 
-	//char *space;
-	//int space_index;
+static int iptables_match_criteria(const struct iptables_rule_entry *entry, void *ctx) {
 
-	const char *s = "\n";
+	struct iptables_find_criteria *fc = (struct iptables_find_criteria *) ctx;
+
+	if (strstr(entry->line, fc->criteria_one) == NULL)
+		return 0;
+	if (fc->criteria_two && strstr(entry->line, fc->criteria_two) == NULL)
+		return 0;
+
+	fc->found_ix = entry->line_number;
+	return 1;
+}
+
+
+size_t iptables_find_rule_in_chain(const char *chain_name, const char *criteria_one, size_t use_xlock) {
 
 	if (chain_name && criteria_one) {
 
-		//char results[DEST_BUF_SZ];
-		size_t d_buf_sz = DEST_BUF_SZ;
-		char *results = (char*) malloc (d_buf_sz+1);
-		*results = 0;
-		size_t x;
-
-		if (iptables_list_chain_with_line_numbers(chain_name, results, d_buf_sz, use_xlock) == 0) {
-
-			token = strtok_r(results, s, &token_save);
-
-			x = 0;
-			// walk through other tokens
-			while( token != NULL )
-			{
-				/*
-				space = strchr(token, ' ');
-				space_index = (int)(space - token);
-
-				strncpy(index_substr, token, space_index);
-				index_substr[space_index] = '\0';
-
-				if(is_integer(index_substr) == 0) {
-					if(strstr(token, criteria_one) != NULL) {
-						free(results);
-						return atoi(index_substr);
-					}
-				}
-				*/
-				x = atoi (token);
-				if (x > 0) {
-					if(strstr(token, criteria_one) != NULL) {
-						free(results);
-						return x;
-					}
-				}
-				token = strtok_r(NULL, s, &token_save);
-			}
-		}
-		free(results);
+		struct iptables_find_criteria fc = { criteria_one, NULL, 0 };
+		iptables_for_each_rule_in_chain(chain_name, iptables_match_criteria, &fc, use_xlock);
+		return fc.found_ix;
 	}
 	return 0;
 }
@@ -447,65 +538,11 @@ size_t iptables_find_rule_in_chain(const char *chain_name, const char *criteria_
 
 size_t iptables_find_rule_in_chain_two_criteria(const char *chain_name, const char *criteria_one, const char *criteria_two, size_t use_xlock) {
 
-	char *token;
-	char *token_save;
-	//char index_substr[10];
-
-	//char *space;
-	//int space_index;
-
-	const char *s = "\n";
-
 	if (chain_name && criteria_one && criteria_two) {
 
-		//char results[DEST_BUF_SZ];
-		size_t d_buf_sz = DEST_BUF_SZ;
-		char *results = (char*) malloc (d_buf_sz+1);
-		*results = 0;
-		size_t x;
-
-		if (iptables_list_chain_with_line_numbers(chain_name, results, d_buf_sz, use_xlock) == 0) {
-
-			//printf("\n\nRESULTS: %s\n", results);
-
-
-			//char *token = strtok_r(results, s, &token_save);
-			token = strtok_r(results, s, &token_save);
-
-			//int x = atoi (token);
-
-			x = 0;
-			// walk through other tokens
-			while( token != NULL ) {
-				/*
-				space = strchr(token, ' ');
- 				space_index = (int)(space - token);
-
-				//printf("SPACE_IX: %d\n", space_index);
-
-				strncpy(index_substr, token, space_index);
-				index_substr[space_index] = '\0';
-
-				//printf("IX_SUBSTR: %s\n", index_substr);
-
-				if(is_integer(index_substr) == 0) {
-					if((strstr(token, criteria_one) != NULL) && (strstr(token, criteria_two) != NULL)) {
-						free(results);
-						return atoi(index_substr);
-					}
-				}
-				*/
-				x = atoi (token);
-				if (x > 0) {
-					if((strstr(token, criteria_one) != NULL) && (strstr(token, criteria_two) != NULL)) {
-						free(results);
-						return x;
-					}
-				}
-				token = strtok_r(NULL, s, &token_save);
-			}
-		}
-		free(results);
+		struct iptables_find_criteria fc = { criteria_one, criteria_two, 0 };
+		iptables_for_each_rule_in_chain(chain_name, iptables_match_criteria, &fc, use_xlock);
+		return fc.found_ix;
 	}
 	return 0;
 }
@@ -518,6 +555,13 @@ size_t iptables_supports_xlock() {
 	 *  false is represented by 0, 1 = xlock is supported
 	 */
 	size_t ret = 0;
+
+	/*
+	 * the libiptc backend takes the xtables lock itself,
+	 * no need to exec iptables just to ask
+	 */
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return 1;
 	char cmd[CMD_BUF_SZ];
 
 	// construct iptables cmd
@@ -534,8 +578,6 @@ size_t iptables_supports_xlock() {
 size_t iptables_list_chain_table(const char *chain_name, const char *table_name, char *dst, size_t sz_dst, size_t use_xlock) {
 
 	char cmd[CMD_BUF_SZ];
-	//char dest[DEST_BUF_SZ];
-    char *dest = (char*) malloc (DEST_BUF_SZ);
 
 	// construct iptables cmd
     if (use_xlock)
@@ -543,57 +585,116 @@ size_t iptables_list_chain_table(const char *chain_name, const char *table_name,
     else
     	snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s %s", IPTABLES, "-L", chain_name, "-n -t", table_name);
 
+	return iptables_read_cmd_output(cmd, dst, sz_dst);
+}
+
+
+
+size_t iptables_insert_nflog_rule_to_chain_at_index(const char *chain_name, size_t ix_pos, size_t use_xlock) {
+
+	char cmd[CMD_BUF_SZ];
+
+	//iptables -A INPUT -j NFLOG –nflog-group 10
+
+	// construct iptables cmd
+	if (use_xlock)
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %zu %s %s %s", IPTABLES, "-w -I", chain_name, ix_pos, "-j", NFLOG, NFLOG_NUM_LINE);
+	else
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %zu %s %s %s", IPTABLES, "-I", chain_name, ix_pos, "-j", NFLOG, NFLOG_NUM_LINE);
+
 	FILE *in;
 	extern FILE *popen();
-	char buff[512];
 
 	if(!(in = popen(cmd, "r"))){
-		free(dest);
 		return 1;
 	}
 
-	// populate results from iptables cmd
-	*dest = 0;
-	while(fgets(buff, sizeof(buff), in)!=NULL){
-		strncat(dest, buff, DEST_BUF_SZ-strlen(dest)-1);
-	}
+	pclose(in);
+	return 0;
+}
 
-	size_t rc = 0;
-	size_t dest_len = strlen(dest);
-	dest[dest_len] = '\0';
 
-	if (dest_len+1 > sz_dst) {
-		rc = 1;
-	} else {
-		memcpy (dst, dest, dest_len+1);
-	}
 
-	free(dest);
-	pclose(in);
-	return rc;
-}
+/*
+ * streams "iptables -L <chain> -n --line-numbers" and hands
+ * each rule line to cb as it is read off the pipe, nothing
+ * is buffered beyond the current line so large chains are
+ * neither truncated nor copied around
+ */
+size_t iptables_for_each_rule_in_chain(const char *chain_name, iptables_rule_cb cb, void *ctx, size_t use_xlock) {
 
+	if (!chain_name || !cb)
+		return 1;
 
+#ifdef USE_BPF
+	if (chain_in_bpf(chain_name))
+		return bpf_drop_for_each(cb, ctx);
+#endif
 
-size_t iptables_insert_nflog_rule_to_chain_at_index(const char *chain_name, size_t ix_pos, size_t use_xlock) {
+#ifdef USE_LIBIPTC
+	if (current_backend() == IPTABLES_BACKEND_LIBIPTC)
+		return iptables_direct_for_each_rule_in_chain(chain_name, cb, ctx, use_xlock);
+#endif
 
 	char cmd[CMD_BUF_SZ];
 
-	//iptables -A INPUT -j NFLOG –nflog-group 10
-
 	// construct iptables cmd
 	if (use_xlock)
-		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %zu %s %s %s", IPTABLES, "-w -I", chain_name, ix_pos, "-j", NFLOG, NFLOG_NUM_LINE);
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s", IPTABLES, "-w -L", chain_name, "-n --line-numbers");
 	else
-		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %zu %s %s %s", IPTABLES, "-I", chain_name, ix_pos, "-j", NFLOG, NFLOG_NUM_LINE);
+		snprintf(cmd, CMD_BUF_SZ, "%s %s %s %s", IPTABLES, "-L", chain_name, "-n --line-numbers");
 
 	FILE *in;
 	extern FILE *popen();
+	char buff[IPTABLES_LINE_SZ];
+	struct iptables_rule_entry entry;
 
-	if(!(in = popen(cmd, "r"))){
+	if(!(in = popen(cmd, "r"))) {
 		return 1;
 	}
 
+	while(fgets(buff, sizeof(buff), in)!=NULL) {
+		/*
+		 * a line longer than buff comes through in pieces,
+		 * only the first piece starts with a rule number
+		 */
+		size_t buff_len = strlen(buff);
+		int partial = (buff_len > 0 && buff[buff_len-1] != '\n');
+
+		if (iptables_parse_rule_line(buff, &entry) == 0) {
+			if (cb(&entry, ctx) != 0)
+				break;
+		}
+
+		while (partial && fgets(buff, sizeof(buff), in)!=NULL) {
+			buff_len = strlen(buff);
+			partial = (buff_len > 0 && buff[buff_len-1] != '\n');
+		}
+	}
+
 	pclose(in);
 	return 0;
 }
+
+
+
+size_t iptables_set_backend(int backend) {
+
+	if (backend == IPTABLES_BACKEND_EXEC) {
+		iptables_backend = backend;
+		return 0;
+	}
+#ifdef USE_LIBIPTC
+	if (backend == IPTABLES_BACKEND_LIBIPTC && !iptables_is_nft()) {
+		iptables_backend = backend;
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+
+int iptables_get_backend() {
+
+	return current_backend();
+}
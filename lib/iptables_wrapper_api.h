@@ -36,11 +36,37 @@
 
 #define DEST_BUF_SZ 524288
 #define CMD_BUF_SZ 100
+#define IPTABLES_LINE_SZ 512
+#define IPTABLES_TARGET_SZ 32
+#define IPTABLES_ADDR_SZ 48
+
+/*
+ * how rules get to the kernel, exec runs the iptables binary,
+ * libiptc is only available when built --with-libiptc
+ */
+#define IPTABLES_BACKEND_EXEC 0
+#define IPTABLES_BACKEND_LIBIPTC 1
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*
+ * one parsed rule line from "iptables -L <chain> -n --line-numbers",
+ * line points at the raw text and is only valid inside the callback
+ */
+struct iptables_rule_entry {
+	size_t line_number;
+	char target[IPTABLES_TARGET_SZ];
+	char source[IPTABLES_ADDR_SZ];
+	const char *line;
+};
+
+/*
+ * return 0 to keep iterating, anything else stops the walk
+ */
+typedef int (*iptables_rule_cb)(const struct iptables_rule_entry *, void *);
+
 
 size_t iptables_create_new_chain(const char *, size_t);
 size_t iptables_flush_chain(const char *, size_t);
@@ -51,6 +77,8 @@ size_t iptables_list_all(char *, size_t, size_t);
 size_t iptables_delete_chain(const char *, size_t);
 size_t iptables_delete_rule_from_chain(const char *, size_t, size_t);
 size_t iptables_add_drop_rule_to_chain(const char *, const char *, size_t);
+// deletes the "-s <src> -j DROP" rule, unlike a rule number it cannot go stale
+size_t iptables_delete_drop_rule_by_source(const char *, const char *, size_t);
 size_t iptables_insert_chain_rule_to_chain_at_index(const char *, const char *, const char *, size_t);
 size_t iptables_find_rule_in_chain(const char *, const char *, size_t);
 size_t iptables_find_rule_in_chain_two_criteria(const char *, const char *, const char *, size_t);
@@ -58,6 +86,9 @@ size_t iptables_insert_nfqueue_rule_to_chain_at_index(const char *, size_t, size
 size_t iptables_supports_xlock();
 size_t iptables_list_chain_table(const char *, const char *, char *, size_t, size_t);
 size_t iptables_insert_nflog_rule_to_chain_at_index(const char *, size_t, size_t);
+size_t iptables_for_each_rule_in_chain(const char *, iptables_rule_cb, void *, size_t);
+size_t iptables_set_backend(int);
+int iptables_get_backend();
 
 
 #ifdef __cplusplus
@@ -35,6 +35,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <syslog.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -48,25 +49,64 @@ string InAddrToString(in_addr_t a) {
 /*
  * The region we are observing may be resized periodically by other processes
  * If we see the capacity in the region changes, then initialize a new region with
- * the new size
+ * the new size. Nothing has been resized as long as the generation is the one
+ * we last saw
  */
 int32_t SharedIpConfig::compareAndExpand() {
+    uint32_t generation = hdr->generation;
+    if(generation == local_generation)
+        return 0;
+
     if(local_capacity < hdr->capacity) {
 
         //printf("Resizing: local capacity %ld to %ld\n", local_capacity, hdr->capacity);
-        local_capacity = hdr->capacity;
-        if(region->Resize(sizeof(Header) + local_capacity * sizeof(in_addr_t)) < 0)
+        size_t capacity = hdr->capacity;
+        if(region->Resize(sizeof(Header) + capacity * sizeof(in_addr_t)) < 0)
             return -1;
+        local_capacity = capacity;
         loadHeader();
     }
 
+    local_generation = generation;
+    return 0;
+}
+
+/*
+ * Called holding the mutex of a process that died with it locked. The
+ * addresses cannot be checked, a Remove cut short can leave one twice,
+ * but the header is brought back in line with the region: capacity is
+ * never below what we have mapped, next_ix stays within it and the
+ * generation is bumped so every process remaps.
+ *
+ * returns 0 with the mutex held, or unlocks and returns non 0
+ */
+int32_t SharedIpConfig::recoverOwnerDeath() {
+    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared ip config [owner died in %s, repairing]", my_name.c_str());
+    if(pthread_mutex_consistent(&hdr->mutex) != 0) {
+        pthread_mutex_unlock(&hdr->mutex);
+        return -1;
+    }
+
+    if(hdr->capacity < local_capacity)
+        hdr->capacity = local_capacity;
+    // it may have died between setting the capacity and the generation
+    hdr->generation++;
+    if(compareAndExpand() < 0) {
+        pthread_mutex_unlock(&hdr->mutex);
+        return -1;
+    }
+
+    if(hdr->next_ix < 0)
+        hdr->next_ix = 0;
+    else if((size_t)hdr->next_ix > hdr->capacity)
+        hdr->next_ix = hdr->capacity;
+
+    local_generation = ++hdr->generation;
     return 0;
 }
 
 int32_t SharedIpConfig::lock() {
-    int count = 0;
     int result;
-    bool first = true;
     const sigset_t sigs = {SIGINT};
 
     /*
@@ -79,29 +119,23 @@ int32_t SharedIpConfig::lock() {
     sigprocmask(SIG_BLOCK, &sigs, &old_sigs);
 
     /*
-     * We may not be the creator, so wait for the mutex lock to be initialized
-     * which signals for us to start working.
-     *
-     * This loop should run for no more than TIMEOUT_MS * MAX_TRIES milliseconds
+     * Sleep in the kernel until the holder lets go rather than polling,
+     * for no more than TIMEOUT_MS * MAX_TRIES milliseconds
      */
-    do {
-        result = pthread_mutex_trylock(&hdr->mutex);
-        if(result == 0)
-            break;
-
-        if(count)
-            usleep(TIMEOUT_MS * 1000);
-
-        if(result != EBUSY)
-            count++;
+    result = pthread_mutex_trylock(&hdr->mutex);
+    if(result == EBUSY) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (TIMEOUT_MS * MAX_TRIES) / 1000;
+        result = pthread_mutex_timedlock(&hdr->mutex, &deadline);
+    }
 
-    } while(count < MAX_TRIES);
+    // we hold the mutex, but whoever held it before died with it
+    if(result == EOWNERDEAD)
+        result = recoverOwnerDeath();
 
-    /*
-     * For some reason, we tried and failed to see an initialized lock,
-     * so return an error.
-     */
-    if(count == MAX_TRIES) {
+    if(result != 0) {
+        sigprocmask(SIG_SETMASK, &old_sigs, NULL);
         return -1;
     }
     return 0;
@@ -113,10 +147,50 @@ int32_t SharedIpConfig::unlock() {
     return 0;
 }
 
-int32_t SharedIpConfig::init() {
-    step = local_capacity;
+uint64_t SharedIpConfig::schema() {
+    uint64_t placement[2] = {0, sizeof(in_addr_t)};
+    uint64_t hash = shared_mem_hash(SHARED_MEM_HASH_SEED, "in_addr_t", sizeof("in_addr_t"));
+    return shared_mem_hash(hash, placement, sizeof(placement));
+}
+
+/*
+ * returns the SharedMemLayoutStatus of a region someone else created,
+ * logging what was found against what we expected when it does not fit
+ */
+int32_t SharedIpConfig::checkLayout() {
+    const SharedMemLayout &layout = hdr->layout;
+    int32_t status = layout.Check(SHARED_IP_CONFIG_LAYOUT_VERSION, sizeof(Header), sizeof(in_addr_t), schema());
+    if(status != SHARED_MEM_LAYOUT_OK)
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared ip config [init in %s]: %s, found version %u header %u record %u schema %016llx, "
+               "expected version %u header %zu record %zu schema %016llx", my_name.c_str(), SharedMemLayout::StatusString(status),
+               layout.version, layout.header_size, layout.record_size, (unsigned long long)layout.schema,
+               SHARED_IP_CONFIG_LAYOUT_VERSION, sizeof(Header), sizeof(in_addr_t), (unsigned long long)schema());
+    return status;
+}
+
+int32_t SharedIpConfig::init(bool replace_incompatible) {
     region = SharedMemRegion::Create(my_name.c_str(),
-                                     local_capacity * sizeof(in_addr_t));
+                                     sizeof(Header) + local_capacity * sizeof(in_addr_t));
+
+    /*
+     * A region left by a build with another layout is refused or, if we
+     * were asked to, unlinked and made again. Processes still attached to
+     * it keep the old one, and if another process replaced it since we
+     * looked we attach to theirs
+     */
+    for(int attempt = 0; region && !region->IsCreator(); attempt++) {
+        loadHeader();
+        if(checkLayout() == SHARED_MEM_LAYOUT_OK)
+            break;
+        int32_t unlinked = (attempt == 0 && replace_incompatible) ? region->Unlink() : -1;
+        delete region;
+        region = NULL;
+        if(unlinked == 0)
+            syslog(LOG_INFO | LOG_LOCAL6, "shared ip config [init in %s]: replacing the incompatible region", my_name.c_str());
+        if(unlinked == 0 || unlinked == 1)
+            region = SharedMemRegion::Create(my_name.c_str(),
+                                             sizeof(Header) + local_capacity * sizeof(in_addr_t));
+    }
     if(!region)
         return -1;
 
@@ -131,12 +205,23 @@ int32_t SharedIpConfig::init() {
          * to observe
          */
         hdr->capacity = local_capacity;
+        hdr->generation = 0;
 
         assert(!pthread_mutexattr_init(&attrmutex));
         assert(!pthread_mutexattr_setpshared(&attrmutex, PTHREAD_PROCESS_SHARED));
+        // so a process dying with the region locked does not lock everybody else out
+        assert(!pthread_mutexattr_setrobust(&attrmutex, PTHREAD_MUTEX_ROBUST));
         assert(!pthread_mutex_init(&hdr->mutex, &attrmutex));
+        // last, nobody attaches before this
+        hdr->layout.Publish(SHARED_IP_CONFIG_LAYOUT_VERSION, sizeof(Header), sizeof(in_addr_t), schema());
     }
 
+    /*
+     * The creator may have reserved more than we mapped, so the first
+     * compareAndExpand has to look whatever the generation is
+     */
+    local_generation = hdr->generation - 1;
+
     return 0;
 }
 
@@ -144,25 +229,29 @@ int32_t SharedIpConfig::init() {
  * SharedIpConfig::Create
  *
  * Given a region name, creates a shared memory configuration. The 'size' parameter
- * specifies the initial capacity of IP addresses for the region. 'size' is also
- * used as the 'step' when resizing the memory region. For instance, if the
- * initial size is 100 IP elements and an expansion is needed, then the new size
- * would be 200 elements.
+ * specifies the initial capacity of IP addresses for the region. The capacity
+ * doubles every time the region needs to grow. For instance, if the initial size
+ * is 100 IP elements, expansions take it to 200, 400, 800 elements and so on.
  *
  * N.B. for nearly all operations in this object, an inter-process lock
- * is maintained. If a failure or some other signal (e.g., SIGINT) occurs while
- * one of these global locks is held and the process exits, then other processes
- * accessing the inter-process lock *will* deadlock. It is therefore the responsibility
- * of the caller to provide signal handling capabilities if required and delete
- * the reference to this object in order to release the lock.
+ * is maintained. The lock is robust: if a process exits while holding it, the
+ * next process to lock it repairs the header and carries on (see
+ * recoverOwnerDeath). A process killed half way through an Add or Remove can
+ * still leave the address list off by one entry, so callers should keep
+ * providing signal handling if required and delete the reference to this
+ * object in order to release the lock.
+ *
+ * A region of the same name made by a build with another layout (see
+ * SharedMemLayout) gets NULL back, or is unlinked and made again empty
+ * when 'replace_incompatible' is set.
  *
  */
-SharedIpConfig *SharedIpConfig::Create(string name, size_t size) {
+SharedIpConfig *SharedIpConfig::Create(string name, size_t size, bool replace_incompatible) {
     SharedIpConfig *config = new SharedIpConfig(name, size);
     if(!config)
         return NULL;
 
-    if(config->init() < 0) {
+    if(config->init(replace_incompatible) < 0) {
         delete config;
         return NULL;
     }
@@ -202,13 +291,12 @@ int32_t SharedIpConfig::Add(string ip4_addr) {
      */
     if(!hasCapacity()) {
         //printf("Capacity not available. Resizing. Old: %ld New: %ld\n",
-        //       hdr->capacity, hdr->capacity + step);
-        hdr->capacity += step;
-        local_capacity = hdr->capacity;
+        //       hdr->capacity, 2 * hdr->capacity);
+        size_t capacity = 2 * hdr->capacity;
 
         // Do the resize
-        if(region->Resize(sizeof(Header) + local_capacity * sizeof(in_addr_t)) < 0)
-            return -1;
+        if(region->Resize(sizeof(Header) + capacity * sizeof(in_addr_t)) < 0)
+            goto error_exit;
 
         /*
          * The address of the header may have changed after the resize, so
@@ -216,8 +304,9 @@ int32_t SharedIpConfig::Add(string ip4_addr) {
          */
         loadHeader();
 
-        // Do we really need this? Didn't we just set it?
-        local_capacity = hdr->capacity;
+        hdr->capacity = capacity;
+        local_capacity = capacity;
+        local_generation = ++hdr->generation;
     }
 
     ipVectorPtr()[hdr->next_ix] = inet_addr(ip4_addr.c_str());
@@ -294,11 +383,11 @@ exit:
  * SharedIpConfig::Remove
  *
  * Given IPv4 address in dotted quad notation, removes the address from the config.
+ * The last address is moved into its place, so the order of the set is not kept.
  * Returns -1 if a fatal error occurs. Otherwise, returns 0.
  */
 int32_t SharedIpConfig::Remove(string ip4_addr) {
     int32_t ret = 0;
-    uint32_t tmp = 0;
     int64_t ix = -1;
 
     in_addr_t *vec_ptr = NULL;
@@ -317,11 +406,7 @@ int32_t SharedIpConfig::Remove(string ip4_addr) {
     }
 
     if(ix >= 0) {
-        for(int64_t i = Size() - 1; i >= ix; i--) {
-            uint32_t tmp2 = vec_ptr[i];
-            vec_ptr[i] = tmp;
-            tmp = tmp2;
-        }
+        vec_ptr[ix] = vec_ptr[Size() - 1];
         hdr->next_ix--;
     }
 
@@ -355,3 +440,31 @@ int32_t SharedIpConfig::ToString(stringstream &ss) {
     unlock();
     return ret;
 }
+
+/*
+ * SharedIpConfig::GetAll
+ *
+ * Copies every address in the set (network byte order) into addrs under a
+ * single lock, for callers that need the whole set rather than one lookup.
+ * Returns -1 if a fatal error occurs. Otherwise, returns 0.
+ */
+int32_t SharedIpConfig::GetAll(vector<in_addr_t> &addrs) {
+    int32_t ret = 0;
+    in_addr_t *vec_ptr = NULL;
+
+    if(lock() < 0)
+        return -1;
+
+    if(compareAndExpand() < 0)
+        goto error_exit;
+
+    vec_ptr = ipVectorPtr();
+    addrs.assign(vec_ptr, vec_ptr + Size());
+
+    goto exit;
+error_exit:
+    ret = -1;
+exit:
+    unlock();
+    return ret;
+}
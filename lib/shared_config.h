@@ -40,6 +40,7 @@
 
 #include <stdint.h>
 #include <sstream>
+#include <vector>
 #include <string>
 using namespace std;
 
@@ -47,11 +48,17 @@ using namespace std;
 
 const int MAX_TRIES = 100;
 const int TIMEOUT_MS = 100;
+// of Header, bump it when the fields change
+const uint32_t SHARED_IP_CONFIG_LAYOUT_VERSION = 1;
 
 struct Header {
+    // first, whatever else changes
+    SharedMemLayout layout;
     pthread_mutex_t mutex;
     volatile size_t capacity;
     volatile int32_t next_ix;
+    // bumped whenever the region is resized
+    volatile uint32_t generation;
 };
 
 class SharedIpConfig {
@@ -59,13 +66,13 @@ class SharedIpConfig {
     string my_name;
     size_t local_capacity;
     SharedMemRegion *region;
-    uint32_t step;
+    uint32_t local_generation;
     Header *hdr;
     pthread_mutexattr_t attrmutex;
     sigset_t old_sigs;
 
     SharedIpConfig(string name, size_t starting_num)
-        : my_name(name), local_capacity(starting_num), region(NULL), step(0), hdr(NULL) { }
+        : my_name(name), local_capacity(starting_num), region(NULL), local_generation(0), hdr(NULL) { }
 
     in_addr_t *ipVectorPtr() const {
         assert(region);
@@ -82,11 +89,14 @@ class SharedIpConfig {
 
 
     int32_t compareAndExpand();
-    int32_t init();
+    int32_t recoverOwnerDeath();
+    static uint64_t schema();
+    int32_t checkLayout();
+    int32_t init(bool replace_incompatible);
     int32_t lock();
     int32_t unlock();
 public:
-    static SharedIpConfig *Create(string name, size_t size);
+    static SharedIpConfig *Create(string name, size_t size, bool replace_incompatible = false);
     ~SharedIpConfig() {
         /*
          * Do not delete the shared mutex, even if we are the creator. This
@@ -102,4 +112,5 @@ public:
     int32_t Remove(string ip4_addr);
     int64_t Size() const { return hdr->next_ix; }
     int32_t ToString(stringstream &ss);
+    int32_t GetAll(vector<in_addr_t> &addrs);
 };
@@ -41,6 +41,12 @@
 
 #include <stdio.h>
 
+#include <atomic>
+
+// how long a process attaching waits for the creator to finish setting a region up
+#define LAYOUT_WAIT_TRIES 100
+#define LAYOUT_WAIT_USECONDS 10000
+
 void abort_errno(const char *msg) {
 #ifdef DEBUG
     printf("Error: '%s'. errno '%s'", msg, strerror(errno));
@@ -66,10 +72,39 @@ SharedMemRegion *SharedMemRegion::Create(const char *name, size_t initial_size)
     return region;
 }
 
+int32_t SharedMemRegion::Remove(const char *name) {
+    if(shm_unlink(name) < 0 && errno != ENOENT) {
+        abort_errno("shm_unlink failed");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Whether the name still refers to the object we have open, it may
+ * have been removed and made again since (see Remove)
+ */
+bool SharedMemRegion::IsCurrent() const {
+    struct stat ours, named;
+    int named_fd = shm_open(my_name, O_RDONLY, 0);
+    if(named_fd < 0)
+        return false;
+    bool current = fstat(fd, &ours) == 0 && fstat(named_fd, &named) == 0 &&
+                   ours.st_dev == named.st_dev && ours.st_ino == named.st_ino;
+    close(named_fd);
+    return current;
+}
+
+int32_t SharedMemRegion::Unlink() {
+    if(!IsCurrent())
+        return 1;
+    return Remove(my_name);
+}
+
 SharedMemRegion::~SharedMemRegion() {
     if (BaseAddr())
         munmap(BaseAddr(), Size());
-    if(IsCreator())
+    if(IsCreator() && IsCurrent())
         shm_unlink(my_name);
     if (-1!=fd)
         close(fd);
@@ -94,6 +129,19 @@ int32_t SharedMemRegion::Init() {
         return -1;
     }
 
+    /*
+     * The creator may not have sized it yet, and touching a page past
+     * the end of the object is a SIGBUS
+     */
+    if(!IsCreator()) {
+        struct stat st;
+        for(int tries = 0; fstat(fd, &st) == 0 && st.st_size == 0; tries++) {
+            if(tries == LAYOUT_WAIT_TRIES)
+                return -1;
+            usleep(LAYOUT_WAIT_USECONDS);
+        }
+    }
+
     /*
      * The region cannot be re-sized using this operation unless we are the creator
      *
@@ -113,7 +161,8 @@ int32_t SharedMemRegion::Init() {
                      fd,
                      0);
 
-    if(!base_addr) {
+    if(base_addr == MAP_FAILED) {
+        base_addr = NULL;
         abort_errno("mmap failed");
         return -1;
     }
@@ -121,25 +170,105 @@ int32_t SharedMemRegion::Init() {
     return 0;
 }
 
+/*
+ * Grows the mapping in place when the kernel can, otherwise it is moved,
+ * either way the pages already faulted in stay mapped and nothing is
+ * copied. On failure the old mapping is left as it was.
+ */
 int32_t SharedMemRegion::Resize(size_t new_size) {
-    munmap(base_addr, my_size);
-    my_size = new_size;
+    struct stat st;
 
-    if(ftruncate(fd, my_size) < 0) {
+    /*
+     * Only ever grow the object, another process may still have
+     * everything up to its current size mapped
+     */
+    if(fstat(fd, &st) < 0) {
+        abort_errno("fstat failed");
+        return -1;
+    }
+    if((size_t)st.st_size < new_size && ftruncate(fd, new_size) < 0) {
         abort_errno("ftruncate failed");
         return -1;
     }
 
-    base_addr = mmap(NULL,
-                     Size(),
-                     PROT_READ|PROT_WRITE,
-                     MAP_SHARED,
-                     fd,
-                     0);
-
-    if(!base_addr) {
-        abort_errno("mmap failed");
+    void *addr = mremap(base_addr, my_size, new_size, MREMAP_MAYMOVE);
+    if(addr == MAP_FAILED) {
+        abort_errno("mremap failed");
         return -1;
     }
+
+    base_addr = addr;
+    my_size = new_size;
     return 0;
 }
+
+uint64_t shared_mem_hash(uint64_t hash, const void *data, size_t len) {
+    const unsigned char *byte = (const unsigned char *)data;
+    for(size_t i = 0; i < len; i++)
+        hash = (hash ^ byte[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+/*
+ * Called by the creator once the rest of the header is in place. The
+ * magic goes in last, a process that sees it sees everything else too
+ */
+void SharedMemLayout::Publish(uint32_t version, size_t header_size, size_t record_size, uint64_t schema) {
+    this->byte_order = SHARED_MEM_LAYOUT_BYTE_ORDER;
+    this->version = version;
+    this->header_size = header_size;
+    this->record_size = record_size;
+    this->schema = schema;
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(magic, SHARED_MEM_LAYOUT_MAGIC, sizeof(magic));
+}
+
+/*
+ * Compares what the creator published with what the caller was built
+ * with. While the magic is all zeros the creator may still be setting
+ * the region up, so that is waited out for a while before giving up
+ */
+int32_t SharedMemLayout::Check(uint32_t version, size_t header_size, size_t record_size, uint64_t schema) const {
+    static const char unset[sizeof(magic)] = {0};
+
+    for(int tries = 0; memcmp(magic, unset, sizeof(magic)) == 0; tries++) {
+        if(tries == LAYOUT_WAIT_TRIES)
+            return SHARED_MEM_LAYOUT_UNKNOWN;
+        usleep(LAYOUT_WAIT_USECONDS);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    if(memcmp(magic, SHARED_MEM_LAYOUT_MAGIC, sizeof(magic)) != 0)
+        return SHARED_MEM_LAYOUT_UNKNOWN;
+    if(this->byte_order != SHARED_MEM_LAYOUT_BYTE_ORDER)
+        return SHARED_MEM_LAYOUT_BYTE_ORDER_MISMATCH;
+    if(this->version != version)
+        return SHARED_MEM_LAYOUT_VERSION_MISMATCH;
+    if(this->header_size != header_size)
+        return SHARED_MEM_LAYOUT_HEADER_SIZE_MISMATCH;
+    if(this->record_size != record_size)
+        return SHARED_MEM_LAYOUT_RECORD_SIZE_MISMATCH;
+    if(this->schema != schema)
+        return SHARED_MEM_LAYOUT_SCHEMA_MISMATCH;
+    return SHARED_MEM_LAYOUT_OK;
+}
+
+const char *SharedMemLayout::StatusString(int32_t status) {
+    switch(status) {
+    case SHARED_MEM_LAYOUT_OK:
+        return "compatible";
+    case SHARED_MEM_LAYOUT_UNKNOWN:
+        return "no layout header";
+    case SHARED_MEM_LAYOUT_BYTE_ORDER_MISMATCH:
+        return "byte order mismatch";
+    case SHARED_MEM_LAYOUT_VERSION_MISMATCH:
+        return "layout version mismatch";
+    case SHARED_MEM_LAYOUT_HEADER_SIZE_MISMATCH:
+        return "header size mismatch";
+    case SHARED_MEM_LAYOUT_RECORD_SIZE_MISMATCH:
+        return "record size mismatch";
+    case SHARED_MEM_LAYOUT_SCHEMA_MISMATCH:
+        return "schema mismatch";
+    }
+    return "unknown status";
+}
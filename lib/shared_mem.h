@@ -33,6 +33,48 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define SHARED_MEM_LAYOUT_MAGIC "GARGLYT"
+// reads back as written only on a machine with the same byte order
+#define SHARED_MEM_LAYOUT_BYTE_ORDER 0x01020304
+#define SHARED_MEM_HASH_SEED 0xcbf29ce484222325ULL
+
+// FNV-1a, start from SHARED_MEM_HASH_SEED or carry on from a previous result
+uint64_t shared_mem_hash(uint64_t hash, const void *data, size_t len);
+
+enum SharedMemLayoutStatus {
+    SHARED_MEM_LAYOUT_OK = 0,
+    // no layout at all, written by an older build or its creator died before finishing
+    SHARED_MEM_LAYOUT_UNKNOWN,
+    SHARED_MEM_LAYOUT_BYTE_ORDER_MISMATCH,
+    SHARED_MEM_LAYOUT_VERSION_MISMATCH,
+    SHARED_MEM_LAYOUT_HEADER_SIZE_MISMATCH,
+    SHARED_MEM_LAYOUT_RECORD_SIZE_MISMATCH,
+    SHARED_MEM_LAYOUT_SCHEMA_MISMATCH
+};
+
+/*
+ * Says how the rest of a region is laid out, so it goes first in the
+ * region, before anything whose size or meaning can change between
+ * builds. The creator publishes it once the region is set up and
+ * every other process checks it against its own before touching
+ * anything else, a process built with a different layout gets a
+ * SharedMemLayoutStatus back instead of reading garbage.
+ */
+struct SharedMemLayout {
+    char magic[8];
+    uint32_t byte_order;
+    // of the header, bumped by hand when its fields change
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    // of the record fields, see shared_mem_hash
+    uint64_t schema;
+
+    void Publish(uint32_t version, size_t header_size, size_t record_size, uint64_t schema);
+    int32_t Check(uint32_t version, size_t header_size, size_t record_size, uint64_t schema) const;
+    static const char *StatusString(int32_t status);
+};
+
 class SharedMemRegion {
 
     const char *my_name;
@@ -48,6 +90,7 @@ class SharedMemRegion {
     SharedMemRegion(const char *name, size_t initial_size) :
         my_name(name), my_size(initial_size), fd(-1), base_addr(NULL), is_created(false) {}
     int32_t Init();
+    bool IsCurrent() const;
 public:
     ~SharedMemRegion();
 
@@ -57,6 +100,16 @@ public:
      * Caller is responsible for releasing the SharedMemRegion object
      */
     static SharedMemRegion *Create(const char *name, size_t initial_size);
+    /*
+     * Unlinks the name so the next Create makes a new region, processes
+     * that have the old one mapped keep it until they let go
+     */
+    static int32_t Remove(const char *name);
+    /*
+     * Unlinks the name only while it still refers to this region, 1 if
+     * someone already removed or replaced it (see Remove)
+     */
+    int32_t Unlink();
 
     void *BaseAddr() const { return base_addr; }
 
@@ -33,46 +33,167 @@
 #include "shared_mem.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <signal.h>
+#include <stdio.h>
+#include <syslog.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
 #include <string>
+#include <vector>
 #include <cstdint>
 #include <cstring>
 #include <iostream>
 
 #define MAXIMUM_TRIES    100
 #define TIMEOUT_MILISECONDS   100
+#define INDEX_MIN_SLOTS    16
+// lock free passes a copy gets before it waits for the mutex
+#define OPTIMISTIC_TRIES    4
+#define SNAPSHOT_MAGIC    "GARGSHM"
+#define SNAPSHOT_VERSION    2
+/*
+ * of Header and IndexHeader, bump it when either changes or when the
+ * index slots are placed differently (hashKey), the record fields are
+ * covered by schema()
+ */
+#define SHARED_MEMORY_TABLE_LAYOUT_VERSION    1
+
+/*
+ * Kept in the table header, so they add up over every process using
+ * the table. Times are in nanoseconds
+ */
+struct SharedMemoryTableLockStats{
+    uint64_t locks;
+    // locks that found the mutex taken and had to wait
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t max_wait_ns;
+    uint64_t hold_ns;
+    uint64_t max_hold_ns;
+    // whole table copies made without the mutex
+    uint64_t optimistic_reads;
+    // passes thrown away because a writer got in during the copy
+    uint64_t optimistic_retries;
+    // times a process died holding the mutex and the next one repaired the table
+    uint64_t owner_deaths;
+};
 
 template <typename TypeRecord>
 class SharedMemoryTable{
     private:
         struct Header{
+            // first, whatever else changes
+            SharedMemLayout layout;
             pthread_mutex_t mutex;
             volatile size_t capacity;
             volatile int32_t next_ix;
+            // bumped whenever the table or its index is resized
+            volatile uint32_t generation;
+            /*
+             * odd while a writer holds the mutex, so a reader that
+             * sees the same even value before and after a copy knows
+             * nothing changed under it
+             */
+            volatile uint32_t sequence;
+            /*
+             * highest ix stored since the table was last emptied, new
+             * rows get the next one so deletes never make an ix come
+             * round twice
+             */
+            volatile uint32_t last_ix;
+            SharedMemoryTableLockStats stats;
+        };
+        /*
+         * open addressing hash index over the records, in a region of
+         * its own next to the table and guarded by the table mutex.
+         * slots hold the 1-based position of a record, 0 = empty, so
+         * it means the same thing wherever a process has it mapped
+         */
+        struct IndexHeader{
+            SharedMemLayout layout;
+            volatile uint32_t slots;
+        };
+        /*
+         * on disk image of the table, see saveSnapshot. the records
+         * follow the header as they are laid out in memory
+         */
+        struct SnapshotHeader{
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            uint64_t count;
+            uint32_t last_ix;
+            uint32_t reserved;
+            int64_t written;
+            // FNV-1a over the records
+            uint64_t checksum;
+            uint64_t schema;
         };
         std::string my_name;
         size_t local_capacity;
         SharedMemRegion *region;
-        uint32_t step;
+        uint32_t local_generation;
         Header *hdr;
         pthread_mutexattr_t attrmutex;
         sigset_t old_sigs;
         bool islocked;
+        bool writing;
+        bool replace_incompatible;
+        uint64_t locked_at;
+        std::string index_name;
+        SharedMemRegion *index_region;
+        uint32_t local_slots;
+        IndexHeader *ihdr;
 
         void loadHeader();
         bool hasCapacity();
+        static uint32_t slotsFor(size_t capacity);
+        static uint64_t hashKey(uint64_t key);
+        uint32_t *indexSlots() const;
+        bool hasIndex() const;
+        int32_t checkLayout(const SharedMemLayout &layout, size_t header_size, size_t record_size, const std::string &name);
+        int32_t initIndex();
+        int32_t remapIndex(uint32_t slots);
+        void indexPut(uint32_t position);
+        uint32_t *indexSlotOf(uint32_t position) const;
+        int32_t indexErase(uint32_t position);
+        void rebuildIndex();
+        static uint64_t nowNs();
+        static uint64_t checksum(const void *data, size_t len);
+        int32_t reserve(size_t capacity);
+        int32_t acquire();
+        int32_t recoverOwnerDeath();
     protected:
+        // the key the index is built on, see findByKey
+        virtual uint64_t indexKey(const TypeRecord &) const = 0;
+        /*
+         * hash of the record fields, names, offsets and sizes, so a
+         * build that packs TypeRecord differently cannot attach
+         */
+        virtual uint64_t schema() const = 0;
+        static uint64_t schemaField(uint64_t hash, const char *name, size_t offset, size_t size);
+        TypeRecord *findByKey(uint64_t key) const;
         size_t size() const;
+        uint32_t nextIx() const;
         TypeRecord *begin() const;
         TypeRecord *end() const;
         bool isIn(TypeRecord *) const;
         int32_t compareAndExpand();
         int32_t lock();
+        int32_t lockRead();
         void unlock();
-        int32_t init();
+        template <typename Copy>
+        int32_t readConsistent(Copy copy);
+        int32_t init(bool replace_incompatible = false);
         int32_t pushBack(const TypeRecord &);
         void insertById(const TypeRecord &, const uint32_t);
         int32_t getRecordByPos(TypeRecord &, uint32_t);
@@ -88,11 +209,17 @@ class SharedMemoryTable{
         virtual int32_t UPDATE(const TypeRecord &entry) = 0;
         virtual uint32_t getPositionByKey(const uint32_t) = 0;
         void TRUNCATE();
+        int32_t getAll(std::vector<TypeRecord> &records);
+        int32_t saveSnapshot(const std::string &path);
+        int32_t loadSnapshot(const std::string &path);
+        void getLockStats(SharedMemoryTableLockStats &stats) const;
 };
 
 template <typename TypeRecord>
 SharedMemoryTable<TypeRecord>::SharedMemoryTable(std::string name, size_t starting_num):
-    my_name(name), local_capacity(starting_num), region(nullptr), step(0), hdr(nullptr), islocked(false){}
+    my_name(name), local_capacity(starting_num), region(nullptr), local_generation(0), hdr(nullptr), islocked(false),
+    writing(false), replace_incompatible(false), locked_at(0),
+    index_name(name + "_index"), index_region(nullptr), local_slots(0), ihdr(nullptr){}
 
 template <typename TypeRecord>
 SharedMemoryTable<TypeRecord>::~SharedMemoryTable(){
@@ -110,16 +237,42 @@ SharedMemoryTable<TypeRecord>::~SharedMemoryTable(){
         pthread_mutex_unlock(&hdr->mutex);
     }
 
+    if(index_region != nullptr){
+        delete index_region;
+    }
+
     if(region != nullptr){
         delete region;
     }
 }
 
 template <typename TypeRecord>
-int32_t SharedMemoryTable<TypeRecord>::init() {
+int32_t SharedMemoryTable<TypeRecord>::init(bool replace) {
     int32_t initialization = 0;
-    step = local_capacity;
-    region = SharedMemRegion::Create(my_name.c_str(), local_capacity * sizeof(TypeRecord));
+    replace_incompatible = replace;
+    region = SharedMemRegion::Create(my_name.c_str(), sizeof(Header) + local_capacity * sizeof(TypeRecord));
+
+    /*
+     * a table left by a build with another layout is refused or, if we
+     * were asked to, unlinked along with its index and made again. the
+     * processes still attached to it keep the old one. if another
+     * process replaced it since we looked, we attach to theirs
+     */
+    for(int attempt = 0; region != nullptr && !region->IsCreator(); attempt++){
+        loadHeader();
+        if(checkLayout(hdr->layout, sizeof(Header), sizeof(TypeRecord), my_name) == SHARED_MEM_LAYOUT_OK){
+            break;
+        }
+        int32_t unlinked = (attempt == 0 && replace_incompatible) ? region->Unlink() : -1;
+        delete region;
+        region = nullptr;
+        if(unlinked == 0 && SharedMemRegion::Remove(index_name.c_str()) == 0){
+            syslog(LOG_INFO | LOG_LOCAL6, "shared memory database [init in %s]: replacing the incompatible table", my_name.c_str());
+            region = SharedMemRegion::Create(my_name.c_str(), sizeof(Header) + local_capacity * sizeof(TypeRecord));
+        }else if(unlinked == 1){
+            region = SharedMemRegion::Create(my_name.c_str(), sizeof(Header) + local_capacity * sizeof(TypeRecord));
+        }
+    }
 
     if(region == nullptr){
         initialization = -1;
@@ -135,40 +288,256 @@ int32_t SharedMemoryTable<TypeRecord>::init() {
              */
             hdr->next_ix = 0;
             hdr->capacity = local_capacity;
+            hdr->generation = 0;
+            hdr->sequence = 0;
+            hdr->last_ix = 0;
+            memset(&hdr->stats, 0, sizeof(hdr->stats));
             assert(!pthread_mutexattr_init(&attrmutex));
             assert(!pthread_mutexattr_setpshared(&attrmutex, PTHREAD_PROCESS_SHARED));
+            // so a process dying with the table locked does not lock everybody else out
+            assert(!pthread_mutexattr_setrobust(&attrmutex, PTHREAD_MUTEX_ROBUST));
             assert(!pthread_mutex_init(&hdr->mutex, &attrmutex));
+            // last, nobody attaches before this
+            hdr->layout.Publish(SHARED_MEMORY_TABLE_LAYOUT_VERSION, sizeof(Header), sizeof(TypeRecord), schema());
+        }
+        /*
+         * the creator may have reserved more than we mapped, so the
+         * first compareAndExpand has to look whatever the generation is
+         */
+        local_generation = hdr->generation - 1;
+        /*
+         * without an index every lookup falls back to a scan,
+         * slower but still right
+         */
+        if(initIndex() < 0){
+            syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [no index for %s]", my_name.c_str());
         }
     }
     return initialization;
 }
 
+/*
+ * returns the SharedMemLayoutStatus of a region someone else created,
+ * logging what was found against what we expected when it does not fit
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::checkLayout(const SharedMemLayout &layout, size_t header_size, size_t record_size, const std::string &name){
+    uint64_t expected = schema();
+    int32_t status = layout.Check(SHARED_MEMORY_TABLE_LAYOUT_VERSION, header_size, record_size, expected);
+    if(status != SHARED_MEM_LAYOUT_OK){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [init in %s]: %s, found version %u header %u record %u schema %016llx, "
+                "expected version %u header %zu record %zu schema %016llx", name.c_str(), SharedMemLayout::StatusString(status),
+                layout.version, layout.header_size, layout.record_size, (unsigned long long)layout.schema,
+                SHARED_MEMORY_TABLE_LAYOUT_VERSION, header_size, record_size, (unsigned long long)expected);
+    }
+    return status;
+}
+
+template <typename TypeRecord>
+uint64_t SharedMemoryTable<TypeRecord>::schemaField(uint64_t hash, const char *name, size_t offset, size_t size){
+    uint64_t placement[2] = {offset, size};
+    hash = shared_mem_hash(hash, name, strlen(name) + 1);
+    return shared_mem_hash(hash, placement, sizeof(placement));
+}
+
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::initIndex() {
+    local_slots = slotsFor(local_capacity);
+    index_region = SharedMemRegion::Create(index_name.c_str(), sizeof(IndexHeader) + local_slots * sizeof(uint32_t));
+
+    /*
+     * checked before taking the lock, the creator publishes the layout
+     * holding it. an index is only ever rebuilt from the table, so one
+     * that does not fit can always go when replacing is allowed
+     */
+    for(int attempt = 0; index_region != nullptr && !index_region->IsCreator(); attempt++){
+        ihdr = reinterpret_cast<IndexHeader *>(index_region->BaseAddr());
+        if(checkLayout(ihdr->layout, sizeof(IndexHeader), sizeof(uint32_t), index_name) == SHARED_MEM_LAYOUT_OK){
+            break;
+        }
+        int32_t unlinked = (attempt == 0 && replace_incompatible) ? index_region->Unlink() : -1;
+        delete index_region;
+        index_region = nullptr;
+        if(unlinked == 0 || unlinked == 1){
+            index_region = SharedMemRegion::Create(index_name.c_str(), sizeof(IndexHeader) + local_slots * sizeof(uint32_t));
+        }
+    }
+    if(index_region == nullptr){
+        ihdr = nullptr;
+        return -1;
+    }
+    ihdr = reinterpret_cast<IndexHeader *>(index_region->BaseAddr());
+
+    if(lock() != 0){
+        return -1;
+    }
+    int32_t status = 0;
+    if(index_region->IsCreator()){
+        /*
+         * the table can be older than the index (and bigger than
+         * local_capacity says), size and fill it from what is there
+         */
+        if(compareAndExpand() == 0 && remapIndex(slotsFor(hdr->capacity)) == 0){
+            ihdr->slots = local_slots;
+            local_generation = ++hdr->generation;
+            rebuildIndex();
+            ihdr->layout.Publish(SHARED_MEMORY_TABLE_LAYOUT_VERSION, sizeof(IndexHeader), sizeof(uint32_t), schema());
+        }else{
+            status = -1;
+        }
+    }else{
+        status = compareAndExpand();
+    }
+    unlock();
+    return status;
+}
+
 /*
  * The region we are observing may be resized periodically by other processes
  * If we see the capacity in the region changes, then initialize a new region with
- * the new size
+ * the new size. Nothing has been resized as long as the generation is the one
+ * we last saw, which is the common case
  */
 template <typename TypeRecord>
 int32_t SharedMemoryTable<TypeRecord>::compareAndExpand() {
+    uint32_t generation = hdr->generation;
+    if(generation == local_generation){
+        return 0;
+    }
+
     int32_t comparation = 0;
     if(local_capacity < hdr->capacity){
-        local_capacity = hdr->capacity;
-        if(region->Resize(sizeof(Header) + local_capacity * sizeof(TypeRecord)) < 0){
+        size_t capacity = hdr->capacity;
+        if(region->Resize(sizeof(Header) + capacity * sizeof(TypeRecord)) < 0){
             comparation = -1;
+        }else{
+            local_capacity = capacity;
         }
         loadHeader();
     }
 
+    // the index is grown along with the table, by whoever grew it
+    if(index_region != nullptr && local_slots < ihdr->slots){
+        if(remapIndex(ihdr->slots) < 0){
+            comparation = -1;
+        }
+    }
+
+    if(comparation == 0){
+        local_generation = generation;
+    }
     return comparation;
 }
 
+template <typename TypeRecord>
+uint64_t SharedMemoryTable<TypeRecord>::nowNs(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Blocks in the kernel until the mutex is free instead of polling it,
+ * for no more than TIMEOUT_MILISECONDS * MAXIMUM_TRIES milliseconds.
+ * Everything between here and unlock is timed into the table stats
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::acquire(){
+    uint64_t waited = 0;
+    int result = pthread_mutex_trylock(&hdr->mutex);
+    if(result == EBUSY){
+        struct timespec deadline;
+        uint64_t start = nowNs();
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += (TIMEOUT_MILISECONDS * MAXIMUM_TRIES) / 1000;
+        result = pthread_mutex_timedlock(&hdr->mutex, &deadline);
+        waited = nowNs() - start;
+    }
+    // we hold the mutex, but whoever held it before died with it
+    if(result == EOWNERDEAD){
+        result = recoverOwnerDeath();
+    }
+    if(result != 0){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [lock in %s]", my_name.c_str());
+        return -1;
+    }
+
+    locked_at = nowNs();
+    hdr->stats.locks++;
+    if(waited){
+        hdr->stats.contended++;
+        hdr->stats.wait_ns += waited;
+        hdr->stats.max_wait_ns = std::max(hdr->stats.max_wait_ns, waited);
+    }
+    return 0;
+}
+
+/*
+ * Called holding the mutex of a process that died with it locked,
+ * possibly half way through a write. Records themselves cannot be
+ * checked, but the header and the index can be made to agree with
+ * the region again:
+ *
+ * - capacity is never below what we have mapped, the file is at least
+ *   that big, and the mapping is brought up to whatever capacity says
+ * - next_ix is kept within capacity and last_ix covers every row
+ * - the index is sized for the capacity and rebuilt from the records
+ * - the generation is bumped so every process remaps, and the sequence
+ *   is left even again
+ *
+ * returns 0 with the mutex held, or unlocks and returns non 0
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::recoverOwnerDeath(){
+    syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [owner died in %s, repairing]", my_name.c_str());
+    if(pthread_mutex_consistent(&hdr->mutex) != 0){
+        pthread_mutex_unlock(&hdr->mutex);
+        return -1;
+    }
+
+    if(hdr->capacity < local_capacity){
+        hdr->capacity = local_capacity;
+    }
+    // it may have died between setting the capacity and the generation
+    hdr->generation++;
+    if(compareAndExpand() != 0){
+        pthread_mutex_unlock(&hdr->mutex);
+        return -1;
+    }
+    if(hdr->next_ix < 0){
+        hdr->next_ix = 0;
+    }else if((size_t)hdr->next_ix > hdr->capacity){
+        hdr->next_ix = hdr->capacity;
+    }
+    for(TypeRecord *record = begin(); record != end(); record++){
+        if(record->ix > hdr->last_ix){
+            hdr->last_ix = record->ix;
+        }
+    }
+
+    if(index_region != nullptr){
+        uint32_t slots = std::max(slotsFor(hdr->capacity), (uint32_t)ihdr->slots);
+        if(slots == local_slots || remapIndex(slots) == 0){
+            ihdr->slots = local_slots;
+            rebuildIndex();
+        }
+    }
+
+    local_generation = ++hdr->generation;
+    if(hdr->sequence & 1){
+        hdr->sequence++;
+    }
+    hdr->stats.owner_deaths++;
+    return 0;
+}
+
+/*
+ * For anything that changes the table. Readers copying it without the
+ * mutex see the sequence go odd here and even again in unlock
+ */
 template <typename TypeRecord>
 int32_t SharedMemoryTable<TypeRecord>::lock(){
     islocked = true;
-    int32_t loocked = 0;
-    int count = 0;
-    int result;
-    bool first = true;
     const sigset_t sigs = {SIGINT};
 
     /*
@@ -180,39 +549,94 @@ int32_t SharedMemoryTable<TypeRecord>::lock(){
      */
     sigprocmask(SIG_BLOCK, &sigs, &old_sigs);
 
-    /*
-     * We may not be the creator, so wait for the mutex lock to be initialized
-     * which signals for us to start working.
-     *
-     * This loop should run for no more than TIMEOUT_MILISECONDS * MAXIMUM_TRIES milliseconds
-     */
-    do {
-        result = pthread_mutex_trylock(&hdr->mutex);
-        if(result == 0){
-            break;
-        }
-        if(count){
-            usleep(TIMEOUT_MILISECONDS * 1000);
-        }
-        if(result == EBUSY){
-            count++;
-        }
-    } while(count < MAXIMUM_TRIES);
-
+    if(acquire() != 0){
+        sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+        islocked = false;
+        return -1;
+    }
+    writing = true;
+    hdr->sequence |= 1;
+    std::atomic_thread_fence(std::memory_order_release);
+    return 0;
+}
 
-    if(count == MAXIMUM_TRIES) {
-        loocked = -1;
+/*
+ * For lookups that leave the table as it is. Nothing is half written
+ * if the process exits under this one, the destructor releases the
+ * mutex, so signals are left alone
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::lockRead(){
+    islocked = true;
+    if(acquire() != 0){
+        islocked = false;
+        return -1;
     }
-    return loocked;
+    writing = false;
+    return 0;
 }
 
 template <typename TypeRecord>
 void SharedMemoryTable<TypeRecord>::unlock() {
+    uint64_t held = nowNs() - locked_at;
+    hdr->stats.hold_ns += held;
+    hdr->stats.max_hold_ns = std::max(hdr->stats.max_hold_ns, held);
+    if(writing){
+        std::atomic_thread_fence(std::memory_order_release);
+        hdr->sequence++;
+    }
     pthread_mutex_unlock(&hdr->mutex);
-    sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+    if(writing){
+        sigprocmask(SIG_SETMASK, &old_sigs, NULL);
+        writing = false;
+    }
     islocked = false;
 }
 
+/*
+ * Hands copy the records as [first, last) without taking the mutex,
+ * and keeps what it made of them only if no writer held the mutex
+ * meanwhile. copy has to start over on every call and must only read,
+ * the records can be half written when the pass is thrown away. After
+ * OPTIMISTIC_TRIES passes it gives up and copies under the mutex, so
+ * a steady stream of writers cannot keep a reader out for good.
+ *
+ * Writers never shrink the region, a mapping stays good for as many
+ * records as local_capacity says, which bounds the copy when the
+ * table grew since we last looked
+ */
+template <typename TypeRecord>
+template <typename Copy>
+int32_t SharedMemoryTable<TypeRecord>::readConsistent(Copy copy){
+    for(int tries = 0; tries < OPTIMISTIC_TRIES; tries++){
+        uint32_t sequence = hdr->sequence;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if((sequence & 1) == 0){
+            if(compareAndExpand() != 0){
+                break;
+            }
+            TypeRecord *first = begin();
+            copy(first, first + std::min(size(), local_capacity));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(hdr->sequence == sequence){
+                __atomic_fetch_add(&hdr->stats.optimistic_reads, 1, __ATOMIC_RELAXED);
+                return 0;
+            }
+        }
+        __atomic_fetch_add(&hdr->stats.optimistic_retries, 1, __ATOMIC_RELAXED);
+    }
+
+    int32_t status = -1;
+    if(lockRead() == 0){
+        if(compareAndExpand() == 0){
+            copy(begin(), end());
+            status = 0;
+        }
+        unlock();
+    }
+    return status;
+}
+
 template<typename TypeRecord>
 bool SharedMemoryTable<TypeRecord>::hasCapacity(){
     return (hdr->next_ix) < (hdr->capacity);
@@ -228,12 +652,167 @@ size_t SharedMemoryTable<TypeRecord>::size() const{
     return hdr->next_ix;
 }
 
+// call with the lock held
+template <typename TypeRecord>
+uint32_t SharedMemoryTable<TypeRecord>::nextIx() const{
+    return hdr->last_ix + 1;
+}
+
 template <typename TypeRecord>
 void SharedMemoryTable<TypeRecord>::TRUNCATE(){
     if(lock() == 0){
-        hdr->next_ix = 0;
+        if(compareAndExpand() == 0){
+            deleteAll();
+        }
+        unlock();
+    }
+}
+
+/*
+ * copies every record out as of one moment, see readConsistent, returns
+ * how many or -1. the order is the table's, which deletes do not keep
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::getAll(std::vector<TypeRecord> &records){
+    int32_t status = readConsistent([&records](const TypeRecord *first, const TypeRecord *last){
+        records.assign(first, last);
+    });
+    if(status != 0){
+        records.clear();
+        return -1;
+    }
+    return records.size();
+}
+
+template <typename TypeRecord>
+uint64_t SharedMemoryTable<TypeRecord>::checksum(const void *data, size_t len){
+    return shared_mem_hash(SHARED_MEM_HASH_SEED, data, len);
+}
+
+/*
+ * Writes the table as of one moment (see readConsistent) to path. The
+ * image is built in path.tmp, synced and renamed over path, so a crash
+ * at any point leaves either the previous snapshot or this one, never
+ * a mix. returns 0 = ok, -1 and the previous snapshot left in place
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::saveSnapshot(const std::string &path){
+    std::vector<TypeRecord> records;
+    if(getAll(records) < 0){
+        return -1;
+    }
+
+    SnapshotHeader snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    memcpy(snapshot.magic, SNAPSHOT_MAGIC, sizeof(snapshot.magic));
+    snapshot.version = SNAPSHOT_VERSION;
+    snapshot.record_size = sizeof(TypeRecord);
+    snapshot.count = records.size();
+    // an ix handed out and deleted since must not come round again after a load
+    snapshot.last_ix = hdr->last_ix;
+    for(typename std::vector<TypeRecord>::const_iterator it = records.begin(); it != records.end(); ++it){
+        snapshot.last_ix = std::max(snapshot.last_ix, (uint32_t)it->ix);
+    }
+    snapshot.written = time(nullptr);
+    snapshot.checksum = checksum(records.data(), records.size() * sizeof(TypeRecord));
+    snapshot.schema = schema();
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if(fd < 0){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [saveSnapshot in %s]: cannot open %s", my_name.c_str(), tmp.c_str());
+        return -1;
+    }
+    bool written = write(fd, &snapshot, sizeof(snapshot)) == (ssize_t)sizeof(snapshot);
+    size_t len = records.size() * sizeof(TypeRecord);
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(records.data());
+    while(written && len > 0){
+        ssize_t n = write(fd, data, len);
+        if(n <= 0){
+            written = false;
+            break;
+        }
+        data += n;
+        len -= n;
+    }
+    written = written && fsync(fd) == 0;
+    close(fd);
+    if(!written || rename(tmp.c_str(), path.c_str()) != 0){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [saveSnapshot in %s]: cannot write %s", my_name.c_str(), path.c_str());
+        unlink(tmp.c_str());
+        return -1;
+    }
+
+    // and the rename itself
+    std::string dir = path.substr(0, path.find_last_of('/') + 1);
+    if((fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY)) >= 0){
+        fsync(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+ * Fills an empty table from a snapshot written by saveSnapshot. The
+ * file is mapped, checked (magic, version, record size, schema, length
+ * and checksum) and copied in with the index rebuilt, nothing is parsed.
+ * returns 0 = loaded, 1 = the table already has rows and is left as
+ * it is, -1 = no usable snapshot
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::loadSnapshot(const std::string &path){
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return -1;
+    }
+    struct stat st;
+    void *image = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader)){
+        image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(image == MAP_FAILED){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [loadSnapshot in %s]: cannot map %s", my_name.c_str(), path.c_str());
+        return -1;
+    }
+
+    const SnapshotHeader *snapshot = static_cast<const SnapshotHeader *>(image);
+    const TypeRecord *records = reinterpret_cast<const TypeRecord *>(snapshot + 1);
+    if(memcmp(snapshot->magic, SNAPSHOT_MAGIC, sizeof(snapshot->magic)) != 0 || snapshot->version != SNAPSHOT_VERSION ||
+            snapshot->record_size != sizeof(TypeRecord) || snapshot->schema != schema() ||
+            (size_t)st.st_size != sizeof(SnapshotHeader) + snapshot->count * sizeof(TypeRecord) ||
+            snapshot->checksum != checksum(records, snapshot->count * sizeof(TypeRecord))){
+        syslog(LOG_INFO | LOG_LOCAL6, "ERROR shared memory database [loadSnapshot in %s]: %s is not a valid snapshot", my_name.c_str(), path.c_str());
+        munmap(image, st.st_size);
+        return -1;
+    }
+
+    int32_t status = -1;
+    if(lock() == 0){
+        if(compareAndExpand() == 0){
+            if(size() != 0){
+                status = 1;
+            }else if(reserve(std::max((size_t)snapshot->count, (size_t)hdr->capacity)) == 0){
+                memcpy(begin(), records, snapshot->count * sizeof(TypeRecord));
+                hdr->next_ix = snapshot->count;
+                hdr->last_ix = snapshot->last_ix;
+                rebuildIndex();
+                status = 0;
+            }
+        }
         unlock();
     }
+    munmap(image, st.st_size);
+    return status;
+}
+
+/*
+ * a snapshot of the stats without the mutex, the counters can be a
+ * lock or two apart from each other
+ */
+template <typename TypeRecord>
+void SharedMemoryTable<TypeRecord>::getLockStats(SharedMemoryTableLockStats &stats) const{
+    memcpy(&stats, &hdr->stats, sizeof(stats));
 }
 
 template <typename TypeRecord>
@@ -253,19 +832,47 @@ bool SharedMemoryTable<TypeRecord>::isIn(TypeRecord *record) const{
     return (record >= begin()) && (record < end());
 }
 
+/*
+ * Grows the table to hold capacity records, along with its index, and
+ * makes every process remap. Call with the lock held
+ */
 template <typename TypeRecord>
-int32_t SharedMemoryTable<TypeRecord>::pushBack(const TypeRecord &record){
-    if(!hasCapacity()) {
-        hdr->capacity += step;
-        local_capacity = hdr->capacity;
-        if(region->Resize(sizeof(Header) + local_capacity * sizeof(TypeRecord)) < 0){
-            return -1;
-        }else{
-            loadHeader();
+int32_t SharedMemoryTable<TypeRecord>::reserve(size_t capacity){
+    if(capacity <= hdr->capacity){
+        return 0;
+    }
+    if(region->Resize(sizeof(Header) + capacity * sizeof(TypeRecord)) < 0){
+        return -1;
+    }
+    loadHeader();
+    hdr->capacity = capacity;
+    local_capacity = capacity;
+    // keep the index at most half full
+    if(hasIndex() && slotsFor(local_capacity) > ihdr->slots){
+        if(remapIndex(slotsFor(local_capacity)) == 0){
+            ihdr->slots = local_slots;
+            rebuildIndex();
         }
     }
+    local_generation = ++hdr->generation;
+    return 0;
+}
+
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::pushBack(const TypeRecord &record){
+    /*
+     * double, so filling the table costs a logarithmic number of
+     * resizes and the copies come to O(1) per record
+     */
+    if(!hasCapacity() && reserve(2 * hdr->capacity) < 0) {
+        return -1;
+    }
     memcpy(end(), &record, sizeof(TypeRecord));
     hdr->next_ix++;
+    if(record.ix > hdr->last_ix){
+        hdr->last_ix = record.ix;
+    }
+    indexPut(size());
     return 0;
 }
 
@@ -285,12 +892,31 @@ int32_t SharedMemoryTable<TypeRecord>::getRecordByPos(TypeRecord &record, uint32
     return status;
 }
 
+/*
+ * The last record is moved into the hole, so a delete costs the same
+ * wherever it is and deleting n records costs O(n). Records do not
+ * keep their order, a caller walking positions while deleting should
+ * look at index again after a delete rather than step past it
+ */
 template <typename TypeRecord>
 int32_t SharedMemoryTable<TypeRecord>::deleteRecordByPos(uint32_t index){
     int32_t status = 0;
-    if(index <= size()){
-        memmove(begin() + index - 1, begin() + index, sizeof(TypeRecord)*(size() - index));
+    if(index >= 1 && index <= size()){
+        uint32_t *last = nullptr;
+        bool stale = indexErase(index) < 0;
+        if(index < size()){
+            if(hasIndex() && (last = indexSlotOf(size())) != nullptr){
+                *last = index;
+            }else{
+                stale = true;
+            }
+            memcpy(begin() + index - 1, end() - 1, sizeof(TypeRecord));
+        }
         hdr->next_ix--;
+        // only when the index was missing a record to begin with
+        if(stale){
+            rebuildIndex();
+        }
     }else{
         status = -1;
     }
@@ -300,6 +926,150 @@ int32_t SharedMemoryTable<TypeRecord>::deleteRecordByPos(uint32_t index){
 template <typename TypeRecord>
 void SharedMemoryTable<TypeRecord>::deleteAll(){
     hdr->next_ix = 0;
+    hdr->last_ix = 0;
+    if(hasIndex()){
+        memset(indexSlots(), 0, ihdr->slots * sizeof(uint32_t));
+    }
+}
+
+/*
+ * power of 2 at least twice the capacity, the table can only
+ * fill the index half way
+ */
+template <typename TypeRecord>
+uint32_t SharedMemoryTable<TypeRecord>::slotsFor(size_t capacity){
+    uint32_t slots = INDEX_MIN_SLOTS;
+    while(slots < 2 * capacity){
+        slots <<= 1;
+    }
+    return slots;
+}
+
+template <typename TypeRecord>
+uint64_t SharedMemoryTable<TypeRecord>::hashKey(uint64_t key){
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+template <typename TypeRecord>
+uint32_t *SharedMemoryTable<TypeRecord>::indexSlots() const{
+    return reinterpret_cast<uint32_t *>((unsigned char *)index_region->BaseAddr() + sizeof(IndexHeader));
+}
+
+template <typename TypeRecord>
+bool SharedMemoryTable<TypeRecord>::hasIndex() const{
+    return index_region != nullptr && ihdr->slots == local_slots;
+}
+
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::remapIndex(uint32_t slots){
+    if(index_region->Resize(sizeof(IndexHeader) + slots * sizeof(uint32_t)) < 0){
+        delete index_region;
+        index_region = nullptr;
+        ihdr = nullptr;
+        return -1;
+    }
+    ihdr = reinterpret_cast<IndexHeader *>(index_region->BaseAddr());
+    local_slots = slots;
+    return 0;
+}
+
+template <typename TypeRecord>
+void SharedMemoryTable<TypeRecord>::indexPut(uint32_t position){
+    if(!hasIndex()){
+        return;
+    }
+    uint32_t *slots = indexSlots();
+    uint32_t mask = ihdr->slots - 1;
+    uint32_t i = hashKey(indexKey(begin()[position - 1])) & mask;
+    for(uint32_t probes = 0; probes <= mask; probes++, i = (i + 1) & mask){
+        if(slots[i] == 0){
+            slots[i] = position;
+            return;
+        }
+    }
+}
+
+// the slot holding position, found by probing from its record's key
+template <typename TypeRecord>
+uint32_t *SharedMemoryTable<TypeRecord>::indexSlotOf(uint32_t position) const{
+    uint32_t *slots = indexSlots();
+    uint32_t mask = ihdr->slots - 1;
+    uint32_t i = hashKey(indexKey(begin()[position - 1])) & mask;
+    for(uint32_t probes = 0; probes <= mask && slots[i] != 0; probes++, i = (i + 1) & mask){
+        if(slots[i] == position){
+            return slots + i;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * empties the slot of position and shifts back whatever later in the
+ * run would no longer be reachable past the gap, no tombstones left
+ */
+template <typename TypeRecord>
+int32_t SharedMemoryTable<TypeRecord>::indexErase(uint32_t position){
+    if(!hasIndex()){
+        return 0;
+    }
+    uint32_t *slots = indexSlots();
+    uint32_t mask = ihdr->slots - 1;
+    uint32_t *slot = indexSlotOf(position);
+    if(slot == nullptr){
+        return -1;
+    }
+    uint32_t gap = slot - slots;
+    slots[gap] = 0;
+    for(uint32_t i = (gap + 1) & mask; slots[i] != 0; i = (i + 1) & mask){
+        uint32_t home = hashKey(indexKey(begin()[slots[i] - 1])) & mask;
+        // move it if its home is not in (gap, i], cyclically
+        if(((i - home) & mask) >= ((i - gap) & mask)){
+            slots[gap] = slots[i];
+            slots[i] = 0;
+            gap = i;
+        }
+    }
+    return 0;
+}
+
+template <typename TypeRecord>
+void SharedMemoryTable<TypeRecord>::rebuildIndex(){
+    if(!hasIndex()){
+        return;
+    }
+    memset(indexSlots(), 0, ihdr->slots * sizeof(uint32_t));
+    for(uint32_t position = 1; position <= size(); position++){
+        indexPut(position);
+    }
+}
+
+/*
+ * first record whose indexKey is key, end() when there is none.
+ * call with the lock held
+ */
+template <typename TypeRecord>
+TypeRecord *SharedMemoryTable<TypeRecord>::findByKey(uint64_t key) const{
+    if(!hasIndex()){
+        TypeRecord *record = begin();
+        while(record != end() && indexKey(*record) != key){
+            record++;
+        }
+        return record;
+    }
+    uint32_t *slots = indexSlots();
+    uint32_t mask = ihdr->slots - 1;
+    uint32_t i = hashKey(key) & mask;
+    for(uint32_t probes = 0; probes <= mask && slots[i] != 0; probes++, i = (i + 1) & mask){
+        if(slots[i] <= size() && indexKey(begin()[slots[i] - 1]) == key){
+            return begin() + slots[i] - 1;
+        }
+    }
+    return end();
 }
 
 #endif
@@ -0,0 +1,460 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * Per-process SQLite connection and prepared statement cache
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "sqlite_handle.h"
+#include "sqlite_wrapper_api.h"
+
+
+struct sqlite_stmt_entry {
+	char *sql;
+	sqlite3_stmt *stmt;
+	unsigned long last_used;
+};
+
+struct sqlite_handle {
+	char path[SQL_CMD_MAX+1];
+	sqlite3 *db;
+	pid_t pid;
+	pthread_mutex_t lock;
+	struct sqlite_stmt_entry stmts[SQLITE_STMT_CACHE_SZ];
+	size_t stmt_cnt;
+	unsigned long tick;
+	int txn_depth;
+	// an inner scope asked for a rollback, the outermost end honours it
+	int txn_rollback;
+};
+
+static struct sqlite_handle handles[SQLITE_HANDLE_MAX];
+static size_t handle_cnt = 0;
+// guards the handles table itself, each handle has its own lock for the connection
+static pthread_mutex_t handles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static long busy_timeout_ms = SQLITE_HANDLE_BUSY_TIMEOUT_MS;
+static long mmap_sz = SQLITE_HANDLE_MMAP_SZ;
+static long cache_kb = SQLITE_HANDLE_CACHE_KB;
+
+
+static void init_handle_lock(struct sqlite_handle *h) {
+
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&h->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+
+static void apply_options(sqlite3 *conn, const char *db_path) {
+
+	char sql[128];
+	char *err = NULL;
+
+	sqlite3_busy_timeout(conn, (int)busy_timeout_ms);
+
+	/*
+	 * WAL lets the analysis, monitor and ssh daemons keep reading
+	 * while gargoyle_pscand writes, synchronous=NORMAL only syncs
+	 * at checkpoints which is plenty for this data
+	 */
+	if (sqlite3_exec(conn, "PRAGMA journal_mode=WAL", NULL, NULL, &err) != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR enabling WAL on SQLite DB '%s': %s", db_path, err ? err : "unknown");
+		sqlite3_free(err);
+		err = NULL;
+	}
+	sqlite3_exec(conn, "PRAGMA synchronous=NORMAL", NULL, NULL, NULL);
+
+	snprintf(sql, sizeof(sql), "PRAGMA mmap_size=%ld", mmap_sz);
+	sqlite3_exec(conn, sql, NULL, NULL, NULL);
+	// negative means KiB rather than pages
+	snprintf(sql, sizeof(sql), "PRAGMA cache_size=-%ld", cache_kb);
+	sqlite3_exec(conn, sql, NULL, NULL, NULL);
+}
+
+
+static struct sqlite_handle *handle_for_db(sqlite3 *db) {
+
+	struct sqlite_handle *h = NULL;
+	size_t i;
+
+	if (!db)
+		return NULL;
+
+	pthread_mutex_lock(&handles_lock);
+	for (i = 0; i < handle_cnt; i++) {
+		if (handles[i].db == db) {
+			h = &handles[i];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&handles_lock);
+
+	return h;
+}
+
+
+static void clear_stmts(struct sqlite_handle *h, int finalize) {
+
+	size_t i;
+
+	for (i = 0; i < h->stmt_cnt; i++) {
+		if (finalize)
+			sqlite3_finalize(h->stmts[i].stmt);
+		free(h->stmts[i].sql);
+		h->stmts[i].sql = NULL;
+		h->stmts[i].stmt = NULL;
+	}
+	h->stmt_cnt = 0;
+}
+
+
+/*
+ * returns SQLITE_OK with *db set to the locked connection for
+ * db_path, opening it on first use
+ */
+int sqlite_handle_acquire(const char *db_path, sqlite3 **db) {
+
+	struct sqlite_handle *h = NULL;
+	pid_t me = getpid();
+	size_t i;
+	int rc;
+
+	*db = NULL;
+	if (!db_path || strlen(db_path) > SQL_CMD_MAX)
+		return SQLITE_MISUSE;
+
+	pthread_mutex_lock(&handles_lock);
+
+	for (i = 0; i < handle_cnt; i++) {
+		if (strcmp(handles[i].path, db_path) == 0) {
+			h = &handles[i];
+			break;
+		}
+	}
+
+	if (h && h->pid != me) {
+		/*
+		 * inherited across fork(), a SQLite connection must not be
+		 * used by the child so the parent's copy is abandoned here
+		 * without being closed
+		 */
+		clear_stmts(h, 0);
+		h->db = NULL;
+		h->txn_depth = 0;
+		h->pid = me;
+		init_handle_lock(h);
+	}
+
+	if (!h) {
+		if (handle_cnt >= SQLITE_HANDLE_MAX) {
+			pthread_mutex_unlock(&handles_lock);
+			syslog(LOG_INFO | LOG_LOCAL6, "ERROR too many SQLite DB handles open, cannot open '%s'", db_path);
+			return SQLITE_FULL;
+		}
+		h = &handles[handle_cnt++];
+		memset(h, 0, sizeof(*h));
+		snprintf(h->path, sizeof(h->path), "%s", db_path);
+		h->pid = me;
+		init_handle_lock(h);
+	}
+
+	if (!h->db) {
+		sqlite3 *conn = NULL;
+
+		rc = sqlite3_open(db_path, &conn);
+		if (rc != SQLITE_OK) {
+			sqlite3_close(conn);
+			pthread_mutex_unlock(&handles_lock);
+			return rc;
+		}
+		apply_options(conn, db_path);
+		h->db = conn;
+		h->txn_depth = 0;
+	}
+
+	pthread_mutex_unlock(&handles_lock);
+
+	pthread_mutex_lock(&h->lock);
+	*db = h->db;
+
+	return SQLITE_OK;
+}
+
+
+/*
+ * returns a cached prepared statement for sql, compiling it on first
+ * use, the least recently used statement is finalized when the cache
+ * is full
+ */
+int sqlite_handle_prepare(sqlite3 *db, const char *sql, sqlite3_stmt **stmt) {
+
+	struct sqlite_handle *h = handle_for_db(db);
+	sqlite3_stmt *new_stmt = NULL;
+	size_t i;
+	size_t slot;
+	int rc;
+
+	*stmt = NULL;
+	if (!h || !sql)
+		return SQLITE_MISUSE;
+
+	pthread_mutex_lock(&h->lock);
+
+	for (i = 0; i < h->stmt_cnt; i++) {
+		if (strcmp(h->stmts[i].sql, sql) == 0) {
+			/*
+			 * still being stepped further up this thread's stack (a
+			 * row visitor whose callback runs the same query), hand
+			 * out a private copy that release_stmt finalizes
+			 */
+			if (sqlite3_stmt_busy(h->stmts[i].stmt)) {
+				rc = sqlite3_prepare_v2(db, sql, -1, stmt, NULL);
+				pthread_mutex_unlock(&h->lock);
+				return rc;
+			}
+			h->stmts[i].last_used = ++h->tick;
+			*stmt = h->stmts[i].stmt;
+			pthread_mutex_unlock(&h->lock);
+			return SQLITE_OK;
+		}
+	}
+
+	rc = sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &new_stmt, NULL);
+	if (rc != SQLITE_OK) {
+		pthread_mutex_unlock(&h->lock);
+		return rc;
+	}
+
+	if (h->stmt_cnt < SQLITE_STMT_CACHE_SZ) {
+		slot = h->stmt_cnt++;
+	} else {
+		// never evict a statement somebody is still stepping
+		slot = h->stmt_cnt;
+		for (i = 0; i < h->stmt_cnt; i++) {
+			if (sqlite3_stmt_busy(h->stmts[i].stmt))
+				continue;
+			if (slot == h->stmt_cnt || h->stmts[i].last_used < h->stmts[slot].last_used)
+				slot = i;
+		}
+		if (slot == h->stmt_cnt) {
+			*stmt = new_stmt;
+			pthread_mutex_unlock(&h->lock);
+			return SQLITE_OK;
+		}
+		sqlite3_finalize(h->stmts[slot].stmt);
+		free(h->stmts[slot].sql);
+	}
+
+	h->stmts[slot].sql = strdup(sql);
+	h->stmts[slot].stmt = new_stmt;
+	h->stmts[slot].last_used = ++h->tick;
+	if (!h->stmts[slot].sql) {
+		// can't be looked up again so don't keep it
+		h->stmt_cnt--;
+		h->stmts[slot] = h->stmts[h->stmt_cnt];
+		sqlite3_finalize(new_stmt);
+		pthread_mutex_unlock(&h->lock);
+		return SQLITE_NOMEM;
+	}
+
+	*stmt = new_stmt;
+	pthread_mutex_unlock(&h->lock);
+
+	return SQLITE_OK;
+}
+
+
+void sqlite_handle_release_stmt(sqlite3_stmt *stmt) {
+
+	struct sqlite_handle *h;
+	size_t i;
+
+	if (!stmt)
+		return;
+
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	h = handle_for_db(sqlite3_db_handle(stmt));
+	if (!h)
+		return;
+
+	pthread_mutex_lock(&h->lock);
+	for (i = 0; i < h->stmt_cnt; i++) {
+		if (h->stmts[i].stmt == stmt) {
+			pthread_mutex_unlock(&h->lock);
+			return;
+		}
+	}
+	// one of the private copies handed out by sqlite_handle_prepare
+	sqlite3_finalize(stmt);
+	pthread_mutex_unlock(&h->lock);
+}
+
+
+void sqlite_handle_release(sqlite3 *db) {
+
+	struct sqlite_handle *h = handle_for_db(db);
+
+	if (h)
+		pthread_mutex_unlock(&h->lock);
+}
+
+
+/*
+ * finalizes every cached statement and closes every connection this
+ * process opened, handles are reopened on the next acquire
+ */
+void sqlite_handle_close_all() {
+
+	pid_t me = getpid();
+	size_t cnt;
+	size_t i;
+
+	pthread_mutex_lock(&handles_lock);
+	cnt = handle_cnt;
+	pthread_mutex_unlock(&handles_lock);
+
+	/*
+	 * lock order is always a handle's lock before handles_lock,
+	 * same as a holder of the connection calling sqlite_handle_release
+	 */
+	for (i = 0; i < cnt; i++) {
+		struct sqlite_handle *h = &handles[i];
+
+		if (h->pid != me)
+			continue;
+
+		pthread_mutex_lock(&h->lock);
+		pthread_mutex_lock(&handles_lock);
+		if (h->db) {
+			clear_stmts(h, 1);
+			sqlite3_close(h->db);
+			h->db = NULL;
+			h->txn_depth = 0;
+		}
+		pthread_mutex_unlock(&handles_lock);
+		pthread_mutex_unlock(&h->lock);
+	}
+}
+
+
+/*
+ * busy timeout in ms, mmap_size in bytes and cache size in KiB for
+ * connections opened after this call, a negative value keeps the
+ * current setting
+ */
+void sqlite_handle_set_options(long busy_ms, long mmap_bytes, long cache_kib) {
+
+	pthread_mutex_lock(&handles_lock);
+	if (busy_ms >= 0)
+		busy_timeout_ms = busy_ms;
+	if (mmap_bytes >= 0)
+		mmap_sz = mmap_bytes;
+	if (cache_kib >= 0)
+		cache_kb = cache_kib;
+	pthread_mutex_unlock(&handles_lock);
+}
+
+
+/*
+ * caller holds the connection from sqlite_handle_acquire
+ *
+ * return 0 = ok
+ * return 1 = not ok
+ */
+int sqlite_handle_begin(sqlite3 *db) {
+
+	struct sqlite_handle *h = handle_for_db(db);
+	char *err = NULL;
+
+	if (!h)
+		return 1;
+
+	if (h->txn_depth == 0) {
+		h->txn_rollback = 0;
+		if (sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, &err) != SQLITE_OK) {
+			syslog(LOG_INFO | LOG_LOCAL6, "ERROR starting transaction on SQLite DB '%s': %s", h->path, err ? err : "unknown");
+			sqlite3_free(err);
+			return 1;
+		}
+	}
+	h->txn_depth++;
+
+	return 0;
+}
+
+
+/*
+ * commit != 0 commits the outermost transaction, otherwise it is
+ * rolled back, as is one where any nested scope asked for a rollback
+ * or whose COMMIT failed
+ *
+ * return 0 = ok
+ * return 1 = not ok, the transaction was rolled back
+ * return -1 = not ok, no transaction was open
+ */
+int sqlite_handle_end(sqlite3 *db, int commit) {
+
+	struct sqlite_handle *h = handle_for_db(db);
+	char *err = NULL;
+	int ret = 0;
+
+	if (!h || h->txn_depth == 0)
+		return -1;
+
+	if (!commit)
+		h->txn_rollback = 1;
+	if (--h->txn_depth > 0)
+		return 0;
+	if (h->txn_rollback && commit) {
+		commit = 0;
+		ret = 1;
+	}
+
+	if (commit) {
+		if (sqlite3_exec(db, "COMMIT", NULL, NULL, &err) != SQLITE_OK) {
+			syslog(LOG_INFO | LOG_LOCAL6, "ERROR committing transaction on SQLite DB '%s': %s", h->path, err ? err : "unknown");
+			sqlite3_free(err);
+			commit = 0;
+			ret = 1;
+		}
+	}
+	if (!commit)
+		sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+	return ret;
+}
@@ -0,0 +1,92 @@
+/*****************************************************************************
+ *
+ * GARGOYLE_PSCAND: Gargoyle - Protection for Linux
+ *
+ * Per-process SQLite connection and prepared statement cache
+ *
+ * Copyright (c) 2016 - 2018, Bayshore Networks, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that
+ * the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the
+ * following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the
+ * following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote
+ * products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *****************************************************************************/
+#ifndef __gargoylesqlitehandle__H_
+#define __gargoylesqlitehandle__H_
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+
+// distinct DB files a process may have open at once
+#define SQLITE_HANDLE_MAX 4
+// prepared statements kept per connection, least recently used is finalized
+#define SQLITE_STMT_CACHE_SZ 64
+// how long a statement waits on another process's lock before SQLITE_BUSY
+#define SQLITE_HANDLE_BUSY_TIMEOUT_MS 5000
+// 0 = no memory mapped I/O
+#define SQLITE_HANDLE_MMAP_SZ 0
+// page cache per connection in KiB
+#define SQLITE_HANDLE_CACHE_KB 2000
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * One connection per DB path is opened lazily and then kept for the
+ * life of the process, along with the prepared statements run against it.
+ *
+ * Usage:
+ *
+ *   sqlite_handle_acquire(path, &db)   - returns SQLITE_OK and a locked connection
+ *   sqlite_handle_prepare(db, sql, &stmt) - cached statement, reset with no bindings
+ *   sqlite_handle_release_stmt(stmt)   - resets the statement for the next caller
+ *   sqlite_handle_release(db)          - unlocks the connection
+ *
+ * The connection lock is recursive so a caller may hold a connection
+ * across several wrapper API calls on the same thread. A statement
+ * that is still being stepped is never handed out twice or evicted,
+ * a nested caller gets a private copy that release_stmt finalizes.
+ *
+ * Connections run in WAL mode so readers in the other daemons don't
+ * block on a writer, and wait up to the busy timeout for a lock instead
+ * of failing straight away.
+ *
+ * sqlite_handle_begin/sqlite_handle_end nest, only the outermost pair
+ * issues BEGIN IMMEDIATE and COMMIT (or ROLLBACK).
+ */
+int sqlite_handle_acquire(const char *, sqlite3 **);
+int sqlite_handle_prepare(sqlite3 *, const char *, sqlite3_stmt **);
+void sqlite_handle_release_stmt(sqlite3_stmt *);
+void sqlite_handle_release(sqlite3 *);
+void sqlite_handle_close_all();
+void sqlite_handle_set_options(long, long, long);
+int sqlite_handle_begin(sqlite3 *);
+int sqlite_handle_end(sqlite3 *, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif // __gargoylesqlitehandle__H_
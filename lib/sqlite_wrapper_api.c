@@ -36,6 +36,7 @@
 #include <unistd.h>
 
 #include "sqlite_wrapper_api.h"
+#include "sqlite_handle.h"
 #include "gargoyle_config_vals.h"
 
 
@@ -74,24 +75,19 @@ int sqlite_get_host_by_ix(int the_ix, char *dst, size_t sz_dst, const char *db_l
 		}
     }
 
-    char *dest = (char*) malloc (LOCAL_BUF_SZ);
-    char *l_buf = (char*) malloc (LOCAL_BUF_SZ);
-    char *sql = (char*) malloc (SQL_CMD_MAX);
+    char dest[LOCAL_BUF_SZ];
+    char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
 
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_by_ix]: %s", DB_LOCATION, sqlite3_errmsg(db));
-
-		free(l_buf);
-		free(sql);
-		free(dest);
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_by_ix]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s WHERE ix = ?1", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, the_ix);
 
 	*dest = 0;
@@ -102,22 +98,14 @@ int sqlite_get_host_by_ix(int the_ix, char *dst, size_t sz_dst, const char *db_l
 	size_t dest_set_len = strlen(dest);
 	dest[dest_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	if (dest_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
-		free(dest);
-
         return 1;
 	}
     memcpy (dst, dest, dest_set_len+1);
 
-	free(l_buf);
-	free(sql);
-	free(dest);
-
 	return 0;
 }
 
@@ -143,14 +131,14 @@ int sqlite_get_host_all_by_ix(int the_ix, char *dst, size_t sz_dst, const char *
 	char dest[LOCAL_BUF_SZ];
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_all_by_ix]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_all_by_ix]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s WHERE ix = ?1", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, the_ix);
 
 	*dest = 0;
@@ -161,8 +149,8 @@ int sqlite_get_host_all_by_ix(int the_ix, char *dst, size_t sz_dst, const char *
 	size_t dest_set_len = strlen(dest);
 	dest[dest_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	if (dest_set_len+1 > sz_dst) {
 
@@ -196,22 +184,22 @@ int sqlite_get_total_hit_count_one_host_by_ix(int the_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_total_hit_count_one_host_by_ix]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_total_hit_count_one_host_by_ix]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT COUNT(*) FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, the_ix);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		return_val = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return return_val;
 }
@@ -239,22 +227,22 @@ int sqlite_get_one_host_hit_count_all_ports(int ip_addr_ix, const char *db_loc)
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_one_host_hit_count_all_ports]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_one_host_hit_count_all_ports]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT hit_count FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		return_val += sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return return_val;
 }
@@ -282,22 +270,22 @@ int sqlite_get_host_ix(const char *the_ip, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_ix]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_ix]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT ix FROM %s WHERE host = ?1", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_text(stmt, 1, the_ip, -1, 0);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		ret = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -325,14 +313,14 @@ int sqlite_get_host_port_hit(int ip_addr_ix, int the_port, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_port_hit]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_port_hit]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT hit_count FROM %s WHERE host_ix = ?1 AND port_number = ?2", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 	sqlite3_bind_int(stmt, 2, the_port);
 
@@ -340,8 +328,8 @@ int sqlite_get_host_port_hit(int ip_addr_ix, int the_port, const char *db_loc) {
 		ret = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -366,14 +354,14 @@ int sqlite_add_host_port_hit(int ip_addr_ix, int the_port, int add_cnt, const ch
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_port_hit]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_port_hit]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix,port_number,hit_count) VALUES (?1,?2,?3)", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 	sqlite3_bind_int(stmt, 2, the_port);
 	sqlite3_bind_int(stmt, 3, add_cnt);
@@ -382,14 +370,14 @@ int sqlite_add_host_port_hit(int ip_addr_ix, int the_port, int add_cnt, const ch
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [sqlite_add_host_port_hit] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -414,14 +402,15 @@ int sqlite_add_host_port_hit_all(int ix, int ip_addr_ix, int the_port, int add_c
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_port_hit]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_port_hit]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
-	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host_ix,port_number,hit_count) VALUES (?1,?2,?3,?4)", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host_ix,port_number,hit_count) VALUES (?1,?2,?3,?4) "
+			"ON CONFLICT(ix) DO UPDATE SET host_ix = excluded.host_ix, port_number = excluded.port_number, hit_count = excluded.hit_count", HOSTS_PORTS_HITS_TABLE);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ix);
 	sqlite3_bind_int(stmt, 2, ip_addr_ix);
 	sqlite3_bind_int(stmt, 3, the_port);
@@ -431,14 +420,14 @@ int sqlite_add_host_port_hit_all(int ix, int ip_addr_ix, int the_port, int add_c
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [sqlite_add_host_port_hit] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -467,14 +456,14 @@ int sqlite_add_host(const char *the_ip, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host,first_seen,last_seen) VALUES (?1,?2,?3)", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_text(stmt, 1, the_ip, -1, 0);
 	now = (int)time(NULL);
 	sqlite3_bind_int(stmt, 2, now);
@@ -485,16 +474,16 @@ int sqlite_add_host(const char *the_ip, const char *db_loc) {
 		//printf("ERROR inserting data from function [add_host]: %s\n", sqlite3_errmsg(db));
 		//syslog(LOG_INFO | LOG_LOCAL6, "ERROR inserting data from function [add_host]: %s", sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return -1;
 	}
 
 	ret = sqlite3_last_insert_rowid(db);
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -521,13 +510,14 @@ int sqlite_add_host_all(uint32_t ix, const char *the_ip, time_t first_seen, time
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
-	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host,first_seen,last_seen) VALUES (?1,?2,?3,?4)", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host,first_seen,last_seen) VALUES (?1,?2,?3,?4) "
+			"ON CONFLICT(ix) DO UPDATE SET host = excluded.host, first_seen = excluded.first_seen, last_seen = excluded.last_seen", HOSTS_TABLE);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ix);
 	sqlite3_bind_text(stmt, 2, the_ip, -1, 0);
 	sqlite3_bind_int(stmt, 3, first_seen);
@@ -538,14 +528,14 @@ int sqlite_add_host_all(uint32_t ix, const char *the_ip, time_t first_seen, time
 		//printf("ERROR inserting data from function [add_host]: %s\n", sqlite3_errmsg(db));
 		//syslog(LOG_INFO | LOG_LOCAL6, "ERROR inserting data from function [add_host]: %s", sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -570,14 +560,14 @@ size_t sqlite_add_detected_host(size_t ip_addr_ix, size_t tstamp, const char *db
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_detected_host]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_detected_host]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix,timestamp) VALUES (?1,?2)", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 	sqlite3_bind_int(stmt, 2, tstamp);
 
@@ -585,14 +575,14 @@ size_t sqlite_add_detected_host(size_t ip_addr_ix, size_t tstamp, const char *db
 	if (rc != SQLITE_DONE) {
 		//syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [add_detected_host] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -616,28 +606,28 @@ size_t sqlite_remove_detected_host(size_t row_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_detected_host]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_detected_host]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE ix = ?1", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, row_ix);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_detected_host] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -663,27 +653,27 @@ size_t sqlite_remove_detected_hosts_all(const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_detected_hosts_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_detected_hosts_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_detected_hosts_all] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -709,28 +699,28 @@ size_t sqlite_remove_host_ports_all(size_t ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_ports_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_ports_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_host_ports_all] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -756,14 +746,14 @@ size_t sqlite_add_host_to_ignore(size_t ip_addr_ix, size_t tstamp, const char *d
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [add_host_to_ignore]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [add_host_to_ignore]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix,timestamp) VALUES (?1,?2)", IGNORE_IP_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 	sqlite3_bind_int(stmt, 2, tstamp);
 
@@ -771,14 +761,14 @@ size_t sqlite_add_host_to_ignore(size_t ip_addr_ix, size_t tstamp, const char *d
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [sqlite_add_host_to_ignore] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -803,28 +793,28 @@ size_t sqlite_remove_host(size_t ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE ix = ?1", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_host] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 
@@ -852,14 +842,14 @@ int sqlite_update_host_port_hit(int ip_addr_ix, int the_port, int add_cnt, const
 
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_update_host_port_hit]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_update_host_port_hit]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "UPDATE %s SET hit_count = ?1 WHERE host_ix = ?2 AND port_number = ?3", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, add_cnt);
 	sqlite3_bind_int(stmt, 2, ip_addr_ix);
 	sqlite3_bind_int(stmt, 3, the_port);
@@ -868,14 +858,14 @@ int sqlite_update_host_port_hit(int ip_addr_ix, int the_port, int add_cnt, const
 	if (rc != SQLITE_DONE) {
 		//syslog(LOG_INFO | LOG_LOCAL6, "%s updating data from function [update_host_port_hit] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -905,14 +895,14 @@ size_t sqlite_update_host_last_seen(size_t ip_addr_ix, const char *db_loc) {
 	int now = (int)time(NULL);
 	int minus_48 = now - 172800;
 	*/
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_update_host_last_seen]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_update_host_last_seen]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "UPDATE %s SET last_seen = ?1 WHERE ix = ?2", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	// 01/01/1972 00:00:00 UTC
 	sqlite3_bind_int(stmt, 1, 63072000);
 	sqlite3_bind_int(stmt, 2, ip_addr_ix);
@@ -921,14 +911,14 @@ size_t sqlite_update_host_last_seen(size_t ip_addr_ix, const char *db_loc) {
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s updating data from function [sqlite_update_host_last_seen] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 
@@ -960,24 +950,20 @@ int sqlite_get_all_host_one_port_threshold(int the_port, int threshold, char *ds
 
 	char *final_set;
 	final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_all_host_one_port_threshold]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_all_host_one_port_threshold]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s WHERE port_number = ?1 AND hit_count >= ?2", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, the_port);
 	sqlite3_bind_int(stmt, 2, threshold);
 
@@ -989,21 +975,17 @@ int sqlite_get_all_host_one_port_threshold(int the_port, int threshold, char *ds
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1034,24 +1016,20 @@ int sqlite_get_one_host_all_ports(int ip_addr_ix, char *dst, size_t sz_dst, cons
 
 	char *final_set;
 	final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_one_host_all_ports]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_one_host_all_ports]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	*final_set = 0;
@@ -1063,21 +1041,17 @@ int sqlite_get_one_host_all_ports(int ip_addr_ix, char *dst, size_t sz_dst, cons
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-    	free(l_buf);
-    	free(sql);
     	free(final_set);
 
         return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1108,24 +1082,20 @@ int sqlite_get_hosts_all(char *dst, size_t sz_dst, const char *db_loc) {
 
 	char *final_set;
 	final_set = (char*) malloc (MEDIUM_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s", HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1135,21 +1105,17 @@ int sqlite_get_hosts_all(char *dst, size_t sz_dst, const char *db_loc) {
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-    	free(l_buf);
-    	free(sql);
     	free(final_set);
 
         return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1180,24 +1146,20 @@ int sqlite_get_unique_list_of_ports(char *dst, size_t sz_dst, const char *db_loc
 
 	char *final_set;
 	final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_unique_list_of_ports]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_unique_list_of_ports]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT DISTINCT port_number FROM  %s", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1207,21 +1169,17 @@ int sqlite_get_unique_list_of_ports(char *dst, size_t sz_dst, const char *db_loc
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-    	free(l_buf);
-    	free(sql);
     	free(final_set);
 
         return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1247,22 +1205,20 @@ size_t sqlite_get_detected_hosts_all(char *dst, size_t sz_dst, const char *db_lo
 	int rc;
 
 	char *final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_detected_hosts_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_detected_hosts_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1272,21 +1228,17 @@ size_t sqlite_get_detected_hosts_all(char *dst, size_t sz_dst, const char *db_lo
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	if (final_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1312,30 +1264,26 @@ size_t sqlite_get_detected_hosts_row_ix_by_host_ix(size_t ip_addr_ix, const char
 	int rc;
 	size_t return_val = 0;
 
-	char *sql = (char*) malloc (SQL_CMD_MAX);
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_detected_hosts_row_ix_by_host_ix]: %s", DB_LOCATION, sqlite3_errmsg(db));
-
-		free(sql);
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_detected_hosts_row_ix_by_host_ix]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
 		return 1;
 	}
 
 	//snprintf (sql, SQL_CMD_MAX, "SELECT ix FROM %s WHERE host_ix = ?1 AND active = 1 AND processed = 0", DETECTED_HOSTS_TABLE);
 	snprintf (sql, SQL_CMD_MAX, "SELECT ix FROM %s WHERE host_ix = ?1", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		return_val = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
-
-	free(sql);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return return_val;
 }
@@ -1360,22 +1308,20 @@ size_t sqlite_get_hosts_to_ignore_all(char *dst, size_t sz_dst, const char *db_l
 	int rc;
 
 	char *final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_to_ignore_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_to_ignore_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT host_ix FROM %s", IGNORE_IP_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1385,21 +1331,17 @@ size_t sqlite_get_hosts_to_ignore_all(char *dst, size_t sz_dst, const char *db_l
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	if (final_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1426,24 +1368,20 @@ int sqlite_get_all_ignore_or_black_ip_list(char *dst, size_t sz_dst, const char
 
 	char *final_set;
 	final_set = (char*) malloc (MEDIUM_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_all_ignore_or_black_ip_list]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_all_ignore_or_black_ip_list]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s", table);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1453,21 +1391,17 @@ int sqlite_get_all_ignore_or_black_ip_list(char *dst, size_t sz_dst, const char
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-    	free(l_buf);
-    	free(sql);
     	free(final_set);
 
         return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 	return 0;
 }
@@ -1492,24 +1426,20 @@ size_t sqlite_get_unique_list_of_hosts_ix(char *dst, size_t sz_dst, const char *
 
 	char *final_set;
 	final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_unique_list_of_ports]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_unique_list_of_ports]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT DISTINCT host_ix FROM  %s", HOSTS_PORTS_HITS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1519,21 +1449,17 @@ size_t sqlite_get_unique_list_of_hosts_ix(char *dst, size_t sz_dst, const char *
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	if (final_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1568,22 +1494,22 @@ int sqlite_is_host_ignored(int ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_ignored]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_ignored]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT host_ix FROM %s WHERE host_ix = ?1", IGNORE_IP_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		ret = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -1611,22 +1537,22 @@ int sqlite_is_host_detected(int ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_detected]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_detected]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT ix FROM %s WHERE host_ix = ?1", DETECTED_HOSTS_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		ret = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -1651,28 +1577,28 @@ int sqlite_remove_host_to_ignore(int ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_to_ignore]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_to_ignore]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE host_ix = ?1", IGNORE_IP_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_host_to_ignore] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -1697,14 +1623,14 @@ size_t sqlite_add_host_to_blacklist(size_t ip_addr_ix, size_t tstamp, const char
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_to_blacklist]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_host_to_blacklist]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix,timestamp) VALUES (?1,?2)", BLACK_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 	sqlite3_bind_int(stmt, 2, tstamp);
 
@@ -1712,14 +1638,14 @@ size_t sqlite_add_host_to_blacklist(size_t ip_addr_ix, size_t tstamp, const char
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [sqlite_add_host_to_blacklist] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -1744,22 +1670,20 @@ size_t sqlite_get_hosts_blacklist_all(char *dst, size_t sz_dst, const char *db_l
 	int rc;
 
 	char *final_set = (char*) malloc (SMALL_DEST_BUF);
-	char *l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_blacklist_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_hosts_blacklist_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT host_ix FROM %s", BLACK_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1769,21 +1693,17 @@ size_t sqlite_get_hosts_blacklist_all(char *dst, size_t sz_dst, const char *db_l
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	if (final_set_len+1 > sz_dst) {
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 
 	return 0;
@@ -1812,22 +1732,22 @@ int sqlite_is_host_blacklisted(int ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_blacklisted]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_is_host_blacklisted]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT host_ix FROM %s WHERE host_ix = ?1", BLACK_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
 		ret = sqlite3_column_int(stmt, 0);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return ret;
 }
@@ -1852,28 +1772,28 @@ int sqlite_remove_host_from_blacklist(int ip_addr_ix, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_from_blacklist]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_host_from_blacklist]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return -1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE host_ix = ?1", BLACK_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ip_addr_ix);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_host_from_blacklist] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -1899,24 +1819,20 @@ int sqlite_get_black_ip_list_all(char *dst, size_t sz_dst, const char *db_loc){
 
 	char *final_set;
 	final_set = (char*) malloc (MEDIUM_DEST_BUF);
-	char *l_buf;
-	l_buf = (char*) malloc (LOCAL_BUF_SZ);
-	char *sql;
-	sql = (char*) malloc (SQL_CMD_MAX);
+	char l_buf[LOCAL_BUF_SZ];
+	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_black_ip_list_all]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_black_ip_list_all]: %s", DB_LOCATION, sqlite3_errstr(rc));
 
-		free(l_buf);
-		free(sql);
 		free(final_set);
 
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "SELECT * FROM %s", BLACK_LIST_TABLE);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	*final_set = 0;
 	while ( (rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1926,21 +1842,17 @@ int sqlite_get_black_ip_list_all(char *dst, size_t sz_dst, const char *db_loc){
 	size_t final_set_len = strlen(final_set);
 	final_set[final_set_len] = '\0';
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 	//strcpy(dst, final_set);
 	if (final_set_len+1 > sz_dst) {
 
-    	free(l_buf);
-    	free(sql);
     	free(final_set);
 
         return 1;
 	}
 	memcpy (dst, final_set, final_set_len+1);
 
-	free(l_buf);
-	free(sql);
 	free(final_set);
 	return 0;
 }
@@ -1964,26 +1876,26 @@ void sqlite_reset_autoincrement(const char *table_name, const char *db_loc) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_reset_autoincrement]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_reset_autoincrement]: %s", DB_LOCATION, sqlite3_errstr(rc));
 	}
 
 	// UPDATE SQLITE_SEQUENCE SET SEQ= 'value' WHERE NAME='table_name';
 	snprintf (sql, SQL_CMD_MAX, "UPDATE sqlite_sequence SET seq = 0 WHERE name = ?1");
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_text(stmt, 1, table_name, -1, 0);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s reset auto-increment from function [sqlite_reset_autoincrement] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 }
 
 
@@ -2006,27 +1918,75 @@ size_t sqlite_remove_all(const char *db_loc, const char *table) {
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_all]: %s with the table %s", DB_LOCATION, sqlite3_errmsg(db), table);
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_all]: %s with the table %s", DB_LOCATION, sqlite3_errstr(rc), table);
 		return 1;
 	}
 
 	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s", table);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	sqlite_handle_prepare(db, sql, &stmt);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_all] failed with this msg: %s for the table %s", INFO_SYSLOG, sqlite3_errmsg(db), table);
 
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
+
+		return 2;
+	}
+
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
+
+	return 0;
+}
+
+/*
+ * return 0 = ok, whether or not the row was there
+ */
+size_t sqlite_remove_ix_by_table(uint32_t ix, const char *db_loc, const char *table) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	int rc;
+	char sql[SQL_CMD_MAX];
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_remove_ix_by_table]: %s with the table %s", DB_LOCATION, sqlite3_errstr(rc), table);
+		return 1;
+	}
+
+	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE ix = ?1", table);
+	sqlite_handle_prepare(db, sql, &stmt);
+	sqlite3_bind_int(stmt, 1, ix);
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s deleting data from function [sqlite_remove_ix_by_table] failed with this msg: %s for the table %s", INFO_SYSLOG, sqlite3_errmsg(db), table);
+
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 
 		return 2;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
 
 	return 0;
 }
@@ -2052,26 +2012,1411 @@ size_t sqlite_add_all_by_table(uint32_t ix, uint32_t host_ix, time_t timestamp,
 	int rc;
 	char sql[SQL_CMD_MAX];
 
-	rc = sqlite3_open(DB_LOCATION, &db);
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
 	if (rc != SQLITE_OK) {
-		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_all_by_table]: %s", DB_LOCATION, sqlite3_errmsg(db));
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_add_all_by_table]: %s", DB_LOCATION, sqlite3_errstr(rc));
 		return 1;
 	}
-	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host_ix, timestamp) VALUES (?1,?2,?3)", table);
-	sqlite3_prepare_v2(db, sql, strlen(sql), &stmt, NULL);
+	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (ix, host_ix, timestamp) VALUES (?1,?2,?3) "
+			"ON CONFLICT(ix) DO UPDATE SET host_ix = excluded.host_ix, timestamp = excluded.timestamp", table);
+	sqlite_handle_prepare(db, sql, &stmt);
 	sqlite3_bind_int(stmt, 1, ix);
 	sqlite3_bind_int(stmt, 2, host_ix);
 	sqlite3_bind_int(stmt, 3, timestamp);
 
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
-		sqlite3_finalize(stmt);
-		sqlite3_close(db);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
 		return -1;
 	}
 
-	sqlite3_finalize(stmt);
-	sqlite3_close(db);
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * the connection for db_loc stays locked to the calling thread from
+ * sqlite_begin_transaction until the matching commit/rollback, every
+ * wrapper call in between becomes part of one transaction
+ */
+static int end_transaction(const char *db_loc, int commit) {
+
+	sqlite3 *db;
+	int rc;
+	int ret;
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [end_transaction]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	ret = sqlite_handle_end(db, commit);
+	if (ret != -1) {
+		// drop the hold taken by sqlite_begin_transaction
+		sqlite_handle_release(db);
+	}
+	sqlite_handle_release(db);
+
+	return ret == 0 ? 0 : 1;
+}
+
+
+int sqlite_begin_transaction(const char *db_loc) {
+
+	sqlite3 *db;
+	int rc;
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_begin_transaction]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	if (sqlite_handle_begin(db) != 0) {
+		sqlite_handle_release(db);
+		return 1;
+	}
+
+	// the connection stays held until end_transaction
+	return 0;
+}
+
+
+int sqlite_commit_transaction(const char *db_loc) {
+
+	return end_transaction(db_loc, 1);
+}
+
+
+int sqlite_rollback_transaction(const char *db_loc) {
+
+	return end_transaction(db_loc, 0);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * caller holds db, returns the ix of the_ip in hosts_table adding
+ * it first if needed, 0 = not ok
+ */
+static int upsert_host(sqlite3 *db, const char *the_ip) {
+
+	sqlite3_stmt *stmt;
+	char sql[SQL_CMD_MAX];
+	int now;
+	int rc;
+	int ret = 0;
+	int attempt;
+
+	/*
+	 * look first, an INSERT that hits the conflict still burns an
+	 * AUTOINCREMENT value and this runs for every packet, the second
+	 * pass only matters when another process adds the host in between
+	 */
+	for (attempt = 0; attempt < 2 && ret == 0; attempt++) {
+
+		snprintf (sql, SQL_CMD_MAX, "SELECT ix FROM %s WHERE host = ?1", HOSTS_TABLE);
+		sqlite_handle_prepare(db, sql, &stmt);
+		sqlite3_bind_text(stmt, 1, the_ip, -1, SQLITE_STATIC);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			ret = sqlite3_column_int(stmt, 0);
+		sqlite_handle_release_stmt(stmt);
+
+		if (ret > 0 || attempt > 0)
+			break;
+
+		snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host,first_seen,last_seen) VALUES (?1,?2,?2) ON CONFLICT(host) DO NOTHING", HOSTS_TABLE);
+		if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s preparing upsert from function [upsert_host] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+			return 0;
+		}
+		sqlite3_bind_text(stmt, 1, the_ip, -1, SQLITE_STATIC);
+		now = (int)time(NULL);
+		sqlite3_bind_int(stmt, 2, now);
+
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_DONE && sqlite3_changes(db) == 1)
+			ret = (int) sqlite3_last_insert_rowid(db);
+		sqlite_handle_release_stmt(stmt);
+
+		if (rc != SQLITE_DONE) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [upsert_host] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+			return 0;
+		}
+	}
+
+	return ret;
+}
+
+
+/*
+ * returns the ix of the_ip in hosts_table, adding it if it
+ * is not there yet
+ *
+ * return > 0 = ok
+ * return 0 = not ok
+ */
+int sqlite_upsert_host(const char *the_ip, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 0;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	int rc;
+	int ret;
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_upsert_host]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 0;
+	}
+
+	ret = upsert_host(db, the_ip);
+
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+/*
+ * adds add_cnt hits on the_port for the_ip, creating the host and
+ * the host/port row as needed, relies on the unique index over
+ * (host_ix, port_number) from sqlite_migrate_schema
+ *
+ * return > 0 = ok, the host ix
+ * return 0 = not ok
+ */
+int sqlite_upsert_host_port_hit(const char *the_ip, int the_port, int add_cnt, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 0;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	int rc;
+	int host_ix;
+	char sql[SQL_CMD_MAX];
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_upsert_host_port_hit]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 0;
+	}
+
+	host_ix = upsert_host(db, the_ip);
+	if (host_ix <= 0 || the_port <= 0 || add_cnt <= 0) {
+		sqlite_handle_release(db);
+		return host_ix;
+	}
+
+	/*
+	 * bump an existing row with a plain UPDATE, the upsert below
+	 * would do it too but burns an AUTOINCREMENT value every time
+	 */
+	snprintf (sql, SQL_CMD_MAX, "UPDATE %s SET hit_count = hit_count + ?3 WHERE host_ix = ?1 AND port_number = ?2", HOSTS_PORTS_HITS_TABLE);
+	sqlite_handle_prepare(db, sql, &stmt);
+	sqlite3_bind_int(stmt, 1, host_ix);
+	sqlite3_bind_int(stmt, 2, the_port);
+	sqlite3_bind_int(stmt, 3, add_cnt);
+	rc = sqlite3_step(stmt);
+	sqlite_handle_release_stmt(stmt);
+
+	if (rc == SQLITE_DONE && sqlite3_changes(db) > 0) {
+		sqlite_handle_release(db);
+		return host_ix;
+	}
+
+	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix,port_number,hit_count) VALUES (?1,?2,?3) ON CONFLICT(host_ix, port_number) DO UPDATE SET hit_count = hit_count + excluded.hit_count", HOSTS_PORTS_HITS_TABLE);
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s preparing upsert from function [sqlite_upsert_host_port_hit] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+		sqlite_handle_release(db);
+		return 0;
+	}
+	sqlite3_bind_int(stmt, 1, host_ix);
+	sqlite3_bind_int(stmt, 2, the_port);
+	sqlite3_bind_int(stmt, 3, add_cnt);
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s inserting data from function [sqlite_upsert_host_port_hit] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+		host_ix = 0;
+	}
+
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
+
+	return host_ix;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * schema changes applied to existing DB files, in order, tracked
+ * with PRAGMA user_version, append new ones with the next version
+ */
+struct schema_migration {
+	int version;
+	const char *desc;
+	const char *sql;
+};
+
+static const struct schema_migration schema_migrations[] = {
+	/*
+	 * the hit upsert needs a unique (host_ix, port_number), duplicate
+	 * rows are first merged into the oldest one (the update trigger
+	 * bumps last_seen for those hosts)
+	 */
+	{1, "unique index on " HOSTS_PORTS_HITS_TABLE " (host_ix, port_number)",
+		"UPDATE " HOSTS_PORTS_HITS_TABLE " SET hit_count = (SELECT SUM(h.hit_count) FROM " HOSTS_PORTS_HITS_TABLE " h "
+			"WHERE h.host_ix = " HOSTS_PORTS_HITS_TABLE ".host_ix AND h.port_number = " HOSTS_PORTS_HITS_TABLE ".port_number) "
+			"WHERE ix IN (SELECT MIN(ix) FROM " HOSTS_PORTS_HITS_TABLE " GROUP BY host_ix, port_number HAVING COUNT(*) > 1);"
+		"DELETE FROM " HOSTS_PORTS_HITS_TABLE " WHERE ix NOT IN (SELECT MIN(ix) FROM " HOSTS_PORTS_HITS_TABLE " GROUP BY host_ix, port_number);"
+		"CREATE UNIQUE INDEX IF NOT EXISTS hosts_ports_hits_host_port ON " HOSTS_PORTS_HITS_TABLE " (host_ix, port_number);"
+	},
+	/*
+	 * port/threshold lookups in the analysis daemon, ix rides along
+	 * as the rowid so SELECT * is answered from the index alone
+	 */
+	{2, "analysis indexes on " HOSTS_PORTS_HITS_TABLE " (port_number, hit_count) and " HOSTS_TABLE " (last_seen)",
+		"CREATE INDEX IF NOT EXISTS hosts_ports_hits_port_hits ON " HOSTS_PORTS_HITS_TABLE " (port_number, hit_count, host_ix);"
+		"CREATE INDEX IF NOT EXISTS hosts_table_last_seen ON " HOSTS_TABLE " (last_seen);"
+	},
+	// detected_hosts.timestamp was declared TEXT but always holds epoch seconds
+	{3, DETECTED_HOSTS_TABLE ".timestamp as INTEGER",
+		"CREATE TABLE " DETECTED_HOSTS_TABLE "_v3 ("
+			"`ix` INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, "
+			"`host_ix` INTEGER NOT NULL UNIQUE, "
+			"`timestamp` INTEGER NOT NULL, "
+			"FOREIGN KEY(`host_ix`) REFERENCES `" HOSTS_TABLE "`(`ix`));"
+		"INSERT INTO " DETECTED_HOSTS_TABLE "_v3 (ix, host_ix, timestamp) "
+			"SELECT ix, host_ix, CAST(timestamp AS INTEGER) FROM " DETECTED_HOSTS_TABLE ";"
+		"DROP TABLE " DETECTED_HOSTS_TABLE ";"
+		"ALTER TABLE " DETECTED_HOSTS_TABLE "_v3 RENAME TO " DETECTED_HOSTS_TABLE ";"
+	},
+	// per host totals that outlive the hosts_ports_hits rows (sqlite_apply_retention)
+	{4, HOSTS_HITS_ROLLUP_TABLE " table",
+		"CREATE TABLE IF NOT EXISTS " HOSTS_HITS_ROLLUP_TABLE " ("
+			"`host_ix` INTEGER NOT NULL PRIMARY KEY, "
+			"`port_count` INTEGER NOT NULL, "
+			"`hit_total` INTEGER NOT NULL, "
+			"`max_port_hits` INTEGER NOT NULL, "
+			"`rolled_up` INTEGER NOT NULL, "
+			"FOREIGN KEY(`host_ix`) REFERENCES `" HOSTS_TABLE "`(`ix`));"
+		"CREATE TRIGGER IF NOT EXISTS " HOSTS_HITS_ROLLUP_TABLE "_on_host_delete AFTER DELETE ON " HOSTS_TABLE " "
+			"BEGIN DELETE FROM " HOSTS_HITS_ROLLUP_TABLE " WHERE host_ix = OLD.ix; END;"
+	},
+	/*
+	 * per host hits in minute, hour and day buckets, only fed once
+	 * sqlite_set_hit_history turns its triggers on
+	 */
+	{5, HOSTS_HITS_HISTORY_TABLE " table",
+		"CREATE TABLE IF NOT EXISTS " HOSTS_HITS_HISTORY_TABLE " ("
+			"`host_ix` INTEGER NOT NULL, "
+			"`span` INTEGER NOT NULL, "
+			"`bucket` INTEGER NOT NULL, "
+			"`hits` INTEGER NOT NULL, "
+			"PRIMARY KEY(`host_ix`, `span`, `bucket`)) WITHOUT ROWID;"
+		"CREATE INDEX IF NOT EXISTS " HOSTS_HITS_HISTORY_TABLE "_bucket ON " HOSTS_HITS_HISTORY_TABLE " (bucket, span);"
+		"CREATE TRIGGER IF NOT EXISTS " HOSTS_HITS_HISTORY_TABLE "_on_host_delete AFTER DELETE ON " HOSTS_TABLE " "
+			"BEGIN DELETE FROM " HOSTS_HITS_HISTORY_TABLE " WHERE host_ix = OLD.ix; END;"
+	},
+};
+
+
+static int get_user_version(sqlite3 *db) {
+
+	sqlite3_stmt *stmt;
+	int ret = -1;
+
+	sqlite_handle_prepare(db, "PRAGMA user_version", &stmt);
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		ret = sqlite3_column_int(stmt, 0);
+	sqlite_handle_release_stmt(stmt);
 
 	return ret;
 }
+
+
+/*
+ * brings an existing DB file up to the newest schema_migrations
+ * entry, each step commits on its own along with its user_version
+ * so a failure leaves the DB at the last good version, safe to run
+ * on every start and from several daemons at once
+ *
+ * return 0 = ok
+ * return 1 = not ok
+ */
+int sqlite_migrate_schema(const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	int rc;
+	int ret = 0;
+	size_t i;
+	char *err = NULL;
+	char sql[SQL_CMD_MAX];
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_migrate_schema]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(schema_migrations) / sizeof(schema_migrations[0]); i++) {
+
+		const struct schema_migration *m = &schema_migrations[i];
+
+		if (get_user_version(db) >= m->version)
+			continue;
+
+		if (sqlite_handle_begin(db) != 0) {
+			ret = 1;
+			break;
+		}
+		// another daemon may have got here first
+		if (get_user_version(db) >= m->version) {
+			sqlite_handle_end(db, 1);
+			continue;
+		}
+
+		snprintf (sql, SQL_CMD_MAX, "PRAGMA user_version = %d", m->version);
+		rc = sqlite3_exec(db, m->sql, NULL, NULL, &err);
+		if (rc == SQLITE_OK)
+			rc = sqlite3_exec(db, sql, NULL, NULL, &err);
+		if (rc != SQLITE_OK) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s schema migration %d (%s) from function [sqlite_migrate_schema] failed with this msg: %s", INFO_SYSLOG, m->version, m->desc, err ? err : sqlite3_errstr(rc));
+			sqlite3_free(err);
+			sqlite_handle_end(db, 0);
+			ret = 1;
+			break;
+		}
+		if (sqlite_handle_end(db, 1) != 0) {
+			ret = 1;
+			break;
+		}
+		syslog(LOG_INFO | LOG_LOCAL6, "%s '%s' migrated to schema version %d: %s", DB_FILE_SYSLOG, DB_LOCATION, m->version, m->desc);
+	}
+
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * retention
+ *
+ * hosts are picked batch_size at a time and each batch commits on
+ * its own, so the other daemons only ever wait on one batch
+ */
+static void read_host_entry(sqlite3_stmt *, struct sqlite_host_entry *);
+
+
+// first column of the first row of a PRAGMA or aggregate query
+static long get_single_long(sqlite3 *db, const char *sql) {
+
+	sqlite3_stmt *stmt;
+	long ret = -1;
+
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK)
+		return -1;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		ret = (long) sqlite3_column_int64(stmt, 0);
+	sqlite_handle_release_stmt(stmt);
+
+	return ret;
+}
+
+
+// bytes in use, pages on the freelist are about to be handed back
+static long get_live_size(sqlite3 *db) {
+
+	return (get_single_long(db, "PRAGMA page_count") - get_single_long(db, "PRAGMA freelist_count")) *
+			get_single_long(db, "PRAGMA page_size");
+}
+
+
+/*
+ * fills ixs with up to max host ix's from sql (bound to ?1 and
+ * ?2 = max), returns how many or -1
+ */
+static int pick_hosts(sqlite3 *db, const char *sql, int older_than, int *ixs, int max) {
+
+	sqlite3_stmt *stmt;
+	int cnt = 0;
+
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK)
+		return -1;
+	sqlite3_bind_int(stmt, 1, older_than);
+	sqlite3_bind_int(stmt, 2, max);
+	while (cnt < max && sqlite3_step(stmt) == SQLITE_ROW)
+		ixs[cnt++] = sqlite3_column_int(stmt, 0);
+	sqlite_handle_release_stmt(stmt);
+
+	return cnt;
+}
+
+
+static int run_for_host(sqlite3 *db, const char *sql, int host_ix, int tstamp) {
+
+	sqlite3_stmt *stmt;
+	int rc;
+
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK)
+		return -1;
+	sqlite3_bind_int(stmt, 1, host_ix);
+	if (sqlite3_bind_parameter_count(stmt) > 1)
+		sqlite3_bind_int(stmt, 2, tstamp);
+	rc = sqlite3_step(stmt);
+	sqlite_handle_release_stmt(stmt);
+	if (rc != SQLITE_DONE) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s step from function [sqlite_apply_retention] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+		return -1;
+	}
+
+	return sqlite3_changes(db);
+}
+
+
+static int rollup_hosts(sqlite3 *db, int older_than, int *ixs, int batch_size, struct sqlite_retention_stats *stats) {
+
+	char pick_sql[SQL_CMD_MAX];
+	char rollup_sql[SQL_CMD_MAX];
+	char delete_sql[SQL_CMD_MAX];
+	int now = (int) time(NULL);
+	int cnt;
+	int i;
+	int ok;
+
+	snprintf (pick_sql, SQL_CMD_MAX, "SELECT ix FROM %s h WHERE last_seen < ?1 AND EXISTS "
+			"(SELECT 1 FROM %s p WHERE p.host_ix = h.ix) LIMIT ?2", HOSTS_TABLE, HOSTS_PORTS_HITS_TABLE);
+	snprintf (rollup_sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix, port_count, hit_total, max_port_hits, rolled_up) "
+			"SELECT host_ix, COUNT(*), SUM(hit_count), MAX(hit_count), ?2 FROM %s WHERE host_ix = ?1 GROUP BY host_ix "
+			"ON CONFLICT(host_ix) DO UPDATE SET port_count = port_count + excluded.port_count, hit_total = hit_total + excluded.hit_total, "
+			"max_port_hits = MAX(max_port_hits, excluded.max_port_hits), rolled_up = excluded.rolled_up",
+			HOSTS_HITS_ROLLUP_TABLE, HOSTS_PORTS_HITS_TABLE);
+	snprintf (delete_sql, SQL_CMD_MAX, "DELETE FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
+
+	do {
+		if (sqlite_handle_begin(db) != 0)
+			return 1;
+
+		ok = 1;
+		cnt = pick_hosts(db, pick_sql, older_than, ixs, batch_size);
+		for (i = 0; i < cnt && ok; i++) {
+			int rows;
+			ok = (run_for_host(db, rollup_sql, ixs[i], now) >= 0 && (rows = run_for_host(db, delete_sql, ixs[i], 0)) >= 0);
+			if (ok) {
+				stats->hosts_rolled_up++;
+				stats->rows_rolled_up += rows;
+			}
+		}
+
+		if (sqlite_handle_end(db, ok && cnt >= 0) != 0 || !ok || cnt < 0)
+			return 1;
+	} while (cnt == batch_size);
+
+	return 0;
+}
+
+
+static int delete_hosts(sqlite3 *db, int older_than, int *ixs, int batch_size, sqlite_host_cb cb, void *ctx, struct sqlite_retention_stats *stats) {
+
+	char pick_sql[SQL_CMD_MAX];
+	char hits_sql[SQL_CMD_MAX];
+	char host_sql[SQL_CMD_MAX];
+	char entry_sql[SQL_CMD_MAX];
+	int cnt;
+	int i;
+	int ok;
+
+	// oldest first so a size_target pass stops as early as it can
+	snprintf (pick_sql, SQL_CMD_MAX, "SELECT ix FROM %s h WHERE last_seen < ?1 "
+			"AND ix NOT IN (SELECT host_ix FROM %s) AND ix NOT IN (SELECT host_ix FROM %s) "
+			"AND ix NOT IN (SELECT host_ix FROM %s) ORDER BY last_seen LIMIT ?2",
+			HOSTS_TABLE, DETECTED_HOSTS_TABLE, BLACK_LIST_TABLE, IGNORE_IP_LIST_TABLE);
+	snprintf (hits_sql, SQL_CMD_MAX, "DELETE FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
+	// the hosts_hits_rollup row goes with it via trigger
+	snprintf (host_sql, SQL_CMD_MAX, "DELETE FROM %s WHERE ix = ?1", HOSTS_TABLE);
+	snprintf (entry_sql, SQL_CMD_MAX, "SELECT ix, host, first_seen, last_seen FROM %s WHERE ix = ?1", HOSTS_TABLE);
+
+	do {
+		if (sqlite_handle_begin(db) != 0)
+			return 1;
+
+		ok = 1;
+		cnt = pick_hosts(db, pick_sql, older_than, ixs, batch_size);
+		for (i = 0; i < cnt && ok; i++) {
+			if (cb) {
+				sqlite3_stmt *stmt;
+				struct sqlite_host_entry entry;
+				if (sqlite_handle_prepare(db, entry_sql, &stmt) == SQLITE_OK) {
+					sqlite3_bind_int(stmt, 1, ixs[i]);
+					if (sqlite3_step(stmt) == SQLITE_ROW) {
+						read_host_entry(stmt, &entry);
+						sqlite_handle_release_stmt(stmt);
+						cb(&entry, ctx);
+					} else {
+						sqlite_handle_release_stmt(stmt);
+					}
+				}
+			}
+			ok = (run_for_host(db, hits_sql, ixs[i], 0) >= 0 && run_for_host(db, host_sql, ixs[i], 0) >= 0);
+			if (ok)
+				stats->hosts_deleted++;
+		}
+
+		if (sqlite_handle_end(db, ok && cnt >= 0) != 0 || !ok || cnt < 0)
+			return 1;
+	} while (cnt == batch_size);
+
+	return 0;
+}
+
+
+/*
+ * VACUUM once to turn on incremental vacuum on a DB file created
+ * without it, after that freed pages can be handed back a few at a
+ * time without rewriting the whole file
+ */
+static int hand_back_pages(sqlite3 *db, const char *db_loc, int vacuum_pages, struct sqlite_retention_stats *stats) {
+
+	char sql[SQL_CMD_MAX];
+	char *err = NULL;
+	long before;
+
+	if (get_single_long(db, "PRAGMA auto_vacuum") != 2) {
+		if (sqlite3_exec(db, "PRAGMA auto_vacuum = INCREMENTAL; VACUUM", NULL, NULL, &err) != SQLITE_OK) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s switching '%s' to incremental vacuum from function [sqlite_apply_retention] failed with this msg: %s", INFO_SYSLOG, db_loc, err ? err : "");
+			sqlite3_free(err);
+			return 1;
+		}
+		syslog(LOG_INFO | LOG_LOCAL6, "%s '%s' %s", DB_FILE_SYSLOG, db_loc, "switched to incremental vacuum");
+		return 0;
+	}
+
+	before = get_single_long(db, "PRAGMA freelist_count");
+	if (before <= 0)
+		return 0;
+
+	if (vacuum_pages > 0)
+		snprintf (sql, SQL_CMD_MAX, "PRAGMA incremental_vacuum(%d)", vacuum_pages);
+	else
+		snprintf (sql, SQL_CMD_MAX, "PRAGMA incremental_vacuum");
+	if (sqlite3_exec(db, sql, NULL, NULL, &err) != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s incremental vacuum from function [sqlite_apply_retention] failed with this msg: %s", INFO_SYSLOG, err ? err : "");
+		sqlite3_free(err);
+		return 1;
+	}
+	stats->pages_freed += before - get_single_long(db, "PRAGMA freelist_count");
+
+	return 0;
+}
+
+
+/*
+ * one retention pass: roll up, delete past delete_after, keep
+ * halving delete_after (down to min_age) while the DB is over
+ * size_target, then hand freed pages back. cb, when set, sees each
+ * host just before it is deleted. stats may be NULL
+ *
+ * return 0 = ok
+ * return 1 = not ok, whatever committed before the failure stays
+ */
+int sqlite_apply_retention(const struct sqlite_retention_policy *policy, struct sqlite_retention_stats *stats, sqlite_host_cb cb, void *ctx, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	int rc;
+	int ret = 0;
+	int now = (int) time(NULL);
+	int *ixs;
+	int delete_after;
+	struct sqlite_retention_stats local_stats;
+
+	if (!policy || policy->batch_size <= 0)
+		return 1;
+	if (!stats)
+		stats = &local_stats;
+	memset(stats, 0, sizeof(*stats));
+	delete_after = policy->delete_after;
+
+	ixs = (int *) malloc(policy->batch_size * sizeof(int));
+	if (!ixs)
+		return 1;
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_apply_retention]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		free(ixs);
+		return 1;
+	}
+
+	if (policy->rollup_after > 0)
+		ret |= rollup_hosts(db, now - policy->rollup_after, ixs, policy->batch_size, stats);
+
+	if (ret == 0 && delete_after > 0)
+		ret |= delete_hosts(db, now - delete_after, ixs, policy->batch_size, cb, ctx, stats);
+
+	if (ret == 0 && policy->size_target > 0) {
+		// with no delete_after start from the oldest host
+		if (delete_after <= 0)
+			delete_after = now - (int) get_single_long(db, "SELECT IFNULL(MIN(last_seen), 0) FROM " HOSTS_TABLE);
+		while (ret == 0 && get_live_size(db) > policy->size_target && delete_after / 2 >= policy->min_age) {
+			delete_after /= 2;
+			ret |= delete_hosts(db, now - delete_after, ixs, policy->batch_size, cb, ctx, stats);
+		}
+	}
+
+	if (ret == 0)
+		ret |= hand_back_pages(db, DB_LOCATION, policy->vacuum_pages, stats);
+
+	stats->db_size = get_live_size(db);
+	stats->delete_after = delete_after;
+
+	sqlite_handle_release(db);
+	free(ixs);
+
+	return ret;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * hit history
+ *
+ * hosts_hits_history holds hits per host in minute, hour and day
+ * buckets. triggers on hosts_ports_hits add every hit to the
+ * current minute bucket, so it costs one extra upsert per hit write
+ * and is off unless sqlite_set_hit_history turns it on
+ */
+#define HIT_HISTORY_BUCKET_SQL(delta) \
+	"INSERT INTO " HOSTS_HITS_HISTORY_TABLE " (host_ix, span, bucket, hits) " \
+	"VALUES (NEW.host_ix, 60, CAST(strftime('%s','now') AS INTEGER) / 60 * 60, " delta ") " \
+	"ON CONFLICT(host_ix, span, bucket) DO UPDATE SET hits = hits + excluded.hits; "
+
+static const char *hit_history_on_sql =
+	"CREATE TRIGGER IF NOT EXISTS " HOSTS_HITS_HISTORY_TABLE "_on_insert AFTER INSERT ON " HOSTS_PORTS_HITS_TABLE " "
+		"BEGIN " HIT_HISTORY_BUCKET_SQL("NEW.hit_count") "END;"
+	"CREATE TRIGGER IF NOT EXISTS " HOSTS_HITS_HISTORY_TABLE "_on_update AFTER UPDATE OF hit_count ON " HOSTS_PORTS_HITS_TABLE " "
+		"WHEN NEW.hit_count > OLD.hit_count "
+		"BEGIN " HIT_HISTORY_BUCKET_SQL("NEW.hit_count - OLD.hit_count") "END;";
+
+static const char *hit_history_off_sql =
+	"DROP TRIGGER IF EXISTS " HOSTS_HITS_HISTORY_TABLE "_on_insert;"
+	"DROP TRIGGER IF EXISTS " HOSTS_HITS_HISTORY_TABLE "_on_update;";
+
+
+/*
+ * creates (enabled != 0) or drops the triggers that feed
+ * hosts_hits_history, the buckets already there are left alone
+ *
+ * return 0 = ok
+ * return 1 = not ok
+ */
+int sqlite_set_hit_history(int enabled, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	int rc;
+	char *err = NULL;
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_set_hit_history]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	rc = sqlite3_exec(db, enabled ? hit_history_on_sql : hit_history_off_sql, NULL, NULL, &err);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s from function [sqlite_set_hit_history] failed with this msg: %s", INFO_SYSLOG, HOSTS_HITS_HISTORY_TABLE, err ? err : sqlite3_errstr(rc));
+		sqlite3_free(err);
+		sqlite_handle_release(db);
+		return 1;
+	}
+
+	sqlite_handle_release(db);
+
+	return 0;
+}
+
+
+/*
+ * folds the from_span buckets that start before cutoff into to_span
+ * buckets, cutoff is on a to_span boundary so a window never sees
+ * the same time in both widths
+ */
+static int fold_hit_history(sqlite3 *db, int from_span, int to_span, int cutoff) {
+
+	sqlite3_stmt *stmt;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	snprintf (sql, SQL_CMD_MAX, "INSERT INTO %s (host_ix, span, bucket, hits) "
+			"SELECT host_ix, ?2, bucket / ?2 * ?2, SUM(hits) FROM %s WHERE span = ?1 AND bucket < ?3 GROUP BY host_ix, bucket / ?2 "
+			"ON CONFLICT(host_ix, span, bucket) DO UPDATE SET hits = hits + excluded.hits",
+			HOSTS_HITS_HISTORY_TABLE, HOSTS_HITS_HISTORY_TABLE);
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK)
+		return 1;
+	sqlite3_bind_int(stmt, 1, from_span);
+	sqlite3_bind_int(stmt, 2, to_span);
+	sqlite3_bind_int(stmt, 3, cutoff);
+	rc = sqlite3_step(stmt);
+	sqlite_handle_release_stmt(stmt);
+	if (rc != SQLITE_DONE)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE span = ?1 AND bucket < ?2", HOSTS_HITS_HISTORY_TABLE);
+	if (sqlite_handle_prepare(db, sql, &stmt) != SQLITE_OK)
+		return 1;
+	sqlite3_bind_int(stmt, 1, from_span);
+	sqlite3_bind_int(stmt, 2, cutoff);
+	rc = sqlite3_step(stmt);
+	sqlite_handle_release_stmt(stmt);
+
+	return rc == SQLITE_DONE ? 0 : 1;
+}
+
+
+/*
+ * keeps hosts_hits_history at a fixed size per host, at most
+ * minutes_for/60 + hours_for/3600 + days_for/86400 rows (plus the
+ * partly folded hour and day at each boundary)
+ *
+ * return 0 = ok
+ * return 1 = not ok, nothing changed
+ */
+int sqlite_compact_hit_history(const struct sqlite_hit_history_policy *policy, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	char sql[SQL_CMD_MAX];
+	int rc;
+	int ret = 0;
+	int now = (int) time(NULL);
+	int cutoff;
+
+	if (!policy)
+		return 1;
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_compact_hit_history]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	if (sqlite_handle_begin(db) != 0) {
+		sqlite_handle_release(db);
+		return 1;
+	}
+
+	cutoff = now - policy->minutes_for;
+	ret |= fold_hit_history(db, HIT_HISTORY_MINUTE, HIT_HISTORY_HOUR, cutoff - cutoff % HIT_HISTORY_HOUR);
+	cutoff = now - policy->hours_for;
+	if (ret == 0)
+		ret |= fold_hit_history(db, HIT_HISTORY_HOUR, HIT_HISTORY_DAY, cutoff - cutoff % HIT_HISTORY_DAY);
+
+	if (ret == 0) {
+		snprintf (sql, SQL_CMD_MAX, "DELETE FROM %s WHERE span = ?1 AND bucket < ?2", HOSTS_HITS_HISTORY_TABLE);
+		ret = 1;
+		if (sqlite_handle_prepare(db, sql, &stmt) == SQLITE_OK) {
+			sqlite3_bind_int(stmt, 1, HIT_HISTORY_DAY);
+			sqlite3_bind_int(stmt, 2, now - policy->days_for);
+			if (sqlite3_step(stmt) == SQLITE_DONE)
+				ret = 0;
+			sqlite_handle_release_stmt(stmt);
+		}
+	}
+
+	if (ret != 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s compacting %s from function [sqlite_compact_hit_history] failed with this msg: %s", INFO_SYSLOG, HOSTS_HITS_HISTORY_TABLE, sqlite3_errmsg(db));
+
+	if (sqlite_handle_end(db, ret == 0) != 0)
+		ret = 1;
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+/*
+ * hits from host_ix in every bucket that overlaps [since, now], exact
+ * to the minute while since is within minutes_for and to the hour or
+ * day further back
+ *
+ * return -1 = not ok
+ */
+int sqlite_get_host_hits_since(int host_ix, int since, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return -1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	char sql[SQL_CMD_MAX];
+	int rc;
+	int ret = -1;
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_get_host_hits_since]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return -1;
+	}
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT IFNULL(SUM(hits), 0) FROM %s WHERE host_ix = ?1 AND bucket + span > ?2", HOSTS_HITS_HISTORY_TABLE);
+	if (sqlite_handle_prepare(db, sql, &stmt) == SQLITE_OK) {
+		sqlite3_bind_int(stmt, 1, host_ix);
+		sqlite3_bind_int(stmt, 2, since);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			ret = sqlite3_column_int(stmt, 0);
+		sqlite_handle_release_stmt(stmt);
+	}
+	if (ret < 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s step from function [sqlite_get_host_hits_since] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(db));
+
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * read-only snapshot
+ *
+ * copies the live DB to snapshot_loc with the online backup API,
+ * pages_per_step pages at a time (-1 = all at once) with a
+ * step_sleep_ms pause in between. the source is read under one read
+ * transaction, which in WAL mode holds no writer off and keeps the
+ * copy from restarting whenever another daemon commits. the copy is
+ * built in snapshot_loc.tmp and renamed over snapshot_loc when done
+ * so readers never open a half written file
+ *
+ * return 0 = ok
+ * return 1 = not ok, the previous snapshot is left in place
+ */
+int sqlite_publish_snapshot(const char *snapshot_loc, int pages_per_step, int step_sleep_ms, const char *db_loc) {
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	char TMP_LOCATION[SQL_CMD_MAX+1];
+	sqlite3 *db;
+	sqlite3 *snap;
+	sqlite3_backup *backup;
+	int own_txn;
+	int rc;
+
+	if (!snapshot_loc)
+		return 1;
+	if (pages_per_step == 0)
+		pages_per_step = -1;
+
+	snprintf (TMP_LOCATION, SQL_CMD_MAX, "%s.tmp", snapshot_loc);
+	unlink(TMP_LOCATION);
+
+	rc = sqlite_handle_acquire(DB_LOCATION, &db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_publish_snapshot]: %s", DB_LOCATION, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	rc = sqlite3_open_v2(TMP_LOCATION, &snap, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [sqlite_publish_snapshot]: %s", TMP_LOCATION, sqlite3_errstr(rc));
+		sqlite3_close(snap);
+		sqlite_handle_release(db);
+		return 1;
+	}
+
+	/*
+	 * pin one read snapshot of the source for the whole copy, the
+	 * backup only restarts when the pages it already copied change
+	 * under it. a caller already inside a transaction has pinned it
+	 */
+	own_txn = sqlite3_get_autocommit(db);
+	if (own_txn)
+		sqlite3_exec(db, "BEGIN; SELECT COUNT(*) FROM sqlite_master", NULL, NULL, NULL);
+
+	backup = sqlite3_backup_init(snap, "main", db, "main");
+	if (backup) {
+		do {
+			rc = sqlite3_backup_step(backup, pages_per_step);
+			if ((rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) && step_sleep_ms > 0)
+				sqlite3_sleep(step_sleep_ms);
+		} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+		rc = sqlite3_backup_finish(backup);
+	} else {
+		rc = sqlite3_errcode(snap);
+	}
+
+	if (own_txn)
+		sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	sqlite_handle_release(db);
+
+	// the copy carries the live DB's WAL flag, readers get a plain file
+	if (rc == SQLITE_OK)
+		rc = sqlite3_exec(snap, "PRAGMA journal_mode = DELETE", NULL, NULL, NULL);
+	if (rc != SQLITE_OK)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s backup from function [sqlite_publish_snapshot] failed with this msg: %s", INFO_SYSLOG, sqlite3_errmsg(snap));
+	sqlite3_close(snap);
+
+	if (rc != SQLITE_OK) {
+		unlink(TMP_LOCATION);
+		return 1;
+	}
+	if (rename(TMP_LOCATION, snapshot_loc) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s renaming '%s' from function [sqlite_publish_snapshot] failed", INFO_SYSLOG, TMP_LOCATION);
+		unlink(TMP_LOCATION);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////////////
+/*
+ * row visitors
+ *
+ * each row goes to the callback as a typed entry straight off
+ * sqlite3_step, nothing is formatted into or parsed back out of a
+ * result buffer. the connection stays held for the whole walk so a
+ * callback may call back into this API from the same thread
+ */
+static int visit_begin(const char *db_loc, const char *caller, const char *sql, sqlite3 **db, sqlite3_stmt **stmt) {
+
+	int rc;
+
+    char cwd[SQL_CMD_MAX/2];
+    char DB_LOCATION[SQL_CMD_MAX+1];
+    if (db_loc) {
+    	snprintf (DB_LOCATION, SQL_CMD_MAX, "%s", db_loc);
+    } else {
+		if (getcwd(cwd, sizeof(cwd)) == NULL) {
+			return 1;
+		} else {
+			snprintf (DB_LOCATION, SQL_CMD_MAX, "%s%s", cwd, DB_PATH);
+		}
+    }
+
+	rc = sqlite_handle_acquire(DB_LOCATION, db);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "ERROR opening SQLite DB '%s' from function [%s]: %s", DB_LOCATION, caller, sqlite3_errstr(rc));
+		return 1;
+	}
+
+	rc = sqlite_handle_prepare(*db, sql, stmt);
+	if (rc != SQLITE_OK) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s prepare from function [%s] failed with this msg: %s", INFO_SYSLOG, caller, sqlite3_errmsg(*db));
+		sqlite_handle_release(*db);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/*
+ * rc is what the last sqlite3_step returned, a walk the callback
+ * stopped early ends on SQLITE_ROW which is fine
+ */
+static int visit_end(sqlite3 *db, sqlite3_stmt *stmt, int rc, const char *caller) {
+
+	int ret = 0;
+
+	if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s step from function [%s] failed with this msg: %s", INFO_SYSLOG, caller, sqlite3_errmsg(db));
+		ret = 1;
+	}
+
+	sqlite_handle_release_stmt(stmt);
+	sqlite_handle_release(db);
+
+	return ret;
+}
+
+
+static void read_host_entry(sqlite3_stmt *stmt, struct sqlite_host_entry *entry) {
+
+	const unsigned char *host = sqlite3_column_text(stmt, 1);
+
+	entry->ix = sqlite3_column_int(stmt, 0);
+	snprintf(entry->host, sizeof(entry->host), "%s", host ? (const char *)host : "");
+	entry->first_seen = sqlite3_column_int(stmt, 2);
+	entry->last_seen = sqlite3_column_int(stmt, 3);
+}
+
+
+static int visit_host_port_hits(const char *db_loc, const char *caller, const char *sql, int bind1, int bind2, sqlite_host_port_hit_cb cb, void *ctx) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct sqlite_host_port_hit_entry entry;
+	int rc;
+
+	if (visit_begin(db_loc, caller, sql, &db, &stmt) != 0)
+		return 1;
+
+	sqlite3_bind_int(stmt, 1, bind1);
+	if (sqlite3_bind_parameter_count(stmt) > 1)
+		sqlite3_bind_int(stmt, 2, bind2);
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		entry.ix = sqlite3_column_int(stmt, 0);
+		entry.host_ix = sqlite3_column_int(stmt, 1);
+		entry.port_number = sqlite3_column_int(stmt, 2);
+		entry.hit_count = sqlite3_column_int(stmt, 3);
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, caller);
+}
+
+
+static int visit_ix(const char *db_loc, const char *caller, const char *sql, sqlite_ix_cb cb, void *ctx) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	int rc;
+
+	if (visit_begin(db_loc, caller, sql, &db, &stmt) != 0)
+		return 1;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (cb(sqlite3_column_int(stmt, 0), ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, caller);
+}
+
+
+static int visit_host_list(const char *db_loc, const char *caller, const char *table, sqlite_host_list_cb cb, void *ctx) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct sqlite_host_list_entry entry;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT ix, host_ix, timestamp FROM %s", table);
+	if (visit_begin(db_loc, caller, sql, &db, &stmt) != 0)
+		return 1;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		entry.ix = sqlite3_column_int(stmt, 0);
+		entry.host_ix = sqlite3_column_int(stmt, 1);
+		entry.timestamp = sqlite3_column_int(stmt, 2);
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, caller);
+}
+
+
+int sqlite_for_each_host(sqlite_host_cb cb, void *ctx, const char *db_loc) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct sqlite_host_entry entry;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT ix, host, first_seen, last_seen FROM %s", HOSTS_TABLE);
+	if (visit_begin(db_loc, "sqlite_for_each_host", sql, &db, &stmt) != 0)
+		return 1;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		read_host_entry(stmt, &entry);
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, "sqlite_for_each_host");
+}
+
+
+/*
+ * fills entry for the host at the_ix, entry->ix is left at 0
+ * when there is no such host
+ */
+int sqlite_get_host_entry_by_ix(int the_ix, struct sqlite_host_entry *entry, const char *db_loc) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	if (!entry)
+		return 1;
+	memset(entry, 0, sizeof(*entry));
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT ix, host, first_seen, last_seen FROM %s WHERE ix = ?1", HOSTS_TABLE);
+	if (visit_begin(db_loc, "sqlite_get_host_entry_by_ix", sql, &db, &stmt) != 0)
+		return 1;
+
+	sqlite3_bind_int(stmt, 1, the_ix);
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		read_host_entry(stmt, entry);
+
+	return visit_end(db, stmt, rc, "sqlite_get_host_entry_by_ix");
+}
+
+
+int sqlite_for_each_host_one_port_threshold(int the_port, int threshold, sqlite_host_port_hit_cb cb, void *ctx, const char *db_loc) {
+
+	char sql[SQL_CMD_MAX];
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT ix, host_ix, port_number, hit_count FROM %s WHERE port_number = ?1 AND hit_count >= ?2", HOSTS_PORTS_HITS_TABLE);
+	return visit_host_port_hits(db_loc, "sqlite_for_each_host_one_port_threshold", sql, the_port, threshold, cb, ctx);
+}
+
+
+int sqlite_for_each_port_one_host(int ip_addr_ix, sqlite_host_port_hit_cb cb, void *ctx, const char *db_loc) {
+
+	char sql[SQL_CMD_MAX];
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT ix, host_ix, port_number, hit_count FROM %s WHERE host_ix = ?1", HOSTS_PORTS_HITS_TABLE);
+	return visit_host_port_hits(db_loc, "sqlite_for_each_port_one_host", sql, ip_addr_ix, 0, cb, ctx);
+}
+
+
+int sqlite_for_each_unique_port(sqlite_ix_cb cb, void *ctx, const char *db_loc) {
+
+	char sql[SQL_CMD_MAX];
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT DISTINCT port_number FROM %s", HOSTS_PORTS_HITS_TABLE);
+	return visit_ix(db_loc, "sqlite_for_each_unique_port", sql, cb, ctx);
+}
+
+
+int sqlite_for_each_unique_host_ix(sqlite_ix_cb cb, void *ctx, const char *db_loc) {
+
+	char sql[SQL_CMD_MAX];
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT DISTINCT host_ix FROM %s", HOSTS_PORTS_HITS_TABLE);
+	return visit_ix(db_loc, "sqlite_for_each_unique_host_ix", sql, cb, ctx);
+}
+
+
+int sqlite_for_each_detected_host(sqlite_host_list_cb cb, void *ctx, const char *db_loc) {
+
+	if (!cb)
+		return 1;
+
+	return visit_host_list(db_loc, "sqlite_for_each_detected_host", DETECTED_HOSTS_TABLE, cb, ctx);
+}
+
+
+/*
+ * every host seen at or after seen_since together with its port
+ * and hit totals, one joined query instead of a query per port and
+ * per host. the last_seen range is answered by hosts_table_last_seen
+ * and each host's rows by the (host_ix, port_number) index
+ */
+int sqlite_for_each_host_hit_summary(int seen_since, sqlite_host_hit_summary_cb cb, void *ctx, const char *db_loc) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct sqlite_host_hit_summary entry;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	if (!cb)
+		return 1;
+
+	snprintf (sql, SQL_CMD_MAX, "SELECT h.ix, h.host, h.first_seen, h.last_seen, COUNT(p.ix), SUM(p.hit_count), MAX(p.hit_count) "
+			"FROM %s h JOIN %s p ON p.host_ix = h.ix WHERE h.last_seen >= ?1 GROUP BY h.ix", HOSTS_TABLE, HOSTS_PORTS_HITS_TABLE);
+	if (visit_begin(db_loc, "sqlite_for_each_host_hit_summary", sql, &db, &stmt) != 0)
+		return 1;
+
+	sqlite3_bind_int(stmt, 1, seen_since);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		read_host_entry(stmt, &entry.host);
+		entry.port_count = sqlite3_column_int(stmt, 4);
+		entry.hit_total = sqlite3_column_int(stmt, 5);
+		entry.max_port_hits = sqlite3_column_int(stmt, 6);
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, "sqlite_for_each_host_hit_summary");
+}
+
+
+/*
+ * every host with at least min_hits in the buckets that overlap
+ * [since, now], see sqlite_get_host_hits_since
+ */
+int sqlite_for_each_host_hits_since(int since, int min_hits, sqlite_host_hits_cb cb, void *ctx, const char *db_loc) {
+
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	struct sqlite_host_hits_entry entry;
+	char sql[SQL_CMD_MAX];
+	int rc;
+
+	if (!cb)
+		return 1;
+
+	// the first term lets hosts_hits_history_bucket narrow the range
+	snprintf (sql, SQL_CMD_MAX, "SELECT host_ix, SUM(hits) FROM %s WHERE bucket > ?1 - %d AND bucket + span > ?1 "
+			"GROUP BY host_ix HAVING SUM(hits) >= ?2", HOSTS_HITS_HISTORY_TABLE, HIT_HISTORY_DAY);
+	if (visit_begin(db_loc, "sqlite_for_each_host_hits_since", sql, &db, &stmt) != 0)
+		return 1;
+
+	sqlite3_bind_int(stmt, 1, since);
+	sqlite3_bind_int(stmt, 2, min_hits);
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		entry.host_ix = sqlite3_column_int(stmt, 0);
+		entry.hits = sqlite3_column_int(stmt, 1);
+		if (cb(&entry, ctx) != 0)
+			break;
+	}
+
+	return visit_end(db, stmt, rc, "sqlite_for_each_host_hits_since");
+}
+
+
+/*
+ * table is IGNORE_IP_LIST_TABLE or BLACK_LIST_TABLE
+ */
+int sqlite_for_each_ignore_or_black_ip(sqlite_host_list_cb cb, void *ctx, const char *db_loc, const char *table) {
+
+	if (!cb || !table)
+		return 1;
+
+	return visit_host_list(db_loc, "sqlite_for_each_ignore_or_black_ip", table, cb, ctx);
+}
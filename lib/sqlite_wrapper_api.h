@@ -41,13 +41,110 @@
 #define SMALL_DEST_BUF 2097152
 #define MEDIUM_DEST_BUF 5242880
 #define SQL_CMD_MAX 512
-#define SQL_FAIL_RETRY 5
 
 #define DETECTED_HOSTS_TABLE "detected_hosts"
 #define HOSTS_TABLE "hosts_table"
 #define HOSTS_PORTS_HITS_TABLE "hosts_ports_hits"
 #define IGNORE_IP_LIST_TABLE "ignore_ip_list"
 #define BLACK_LIST_TABLE "black_ip_list"
+#define HOSTS_HITS_ROLLUP_TABLE "hosts_hits_rollup"
+#define HOSTS_HITS_HISTORY_TABLE "hosts_hits_history"
+
+// bucket widths (seconds) in hosts_hits_history
+#define HIT_HISTORY_MINUTE 60
+#define HIT_HISTORY_HOUR 3600
+#define HIT_HISTORY_DAY 86400
+
+
+/*
+ * typed rows handed to the sqlite_for_each_* visitors
+ */
+struct sqlite_host_entry {
+	int ix;
+	char host[LOCAL_BUF_SZ];
+	int first_seen;
+	int last_seen;
+};
+
+struct sqlite_host_port_hit_entry {
+	int ix;
+	int host_ix;
+	int port_number;
+	int hit_count;
+};
+
+// detected_hosts, ignore_ip_list and black_ip_list rows
+struct sqlite_host_list_entry {
+	int ix;
+	int host_ix;
+	int timestamp;
+};
+
+// one host with its hosts_ports_hits rows folded in
+struct sqlite_host_hit_summary {
+	struct sqlite_host_entry host;
+	// hosts_ports_hits rows, i.e. distinct ports hit
+	int port_count;
+	int hit_total;
+	// hit_count of the busiest port
+	int max_port_hits;
+};
+
+/*
+ * what sqlite_apply_retention does, ages are in seconds since
+ * hosts_table.last_seen, 0 turns that part off
+ */
+struct sqlite_retention_policy {
+	// hosts_ports_hits rows of older hosts fold into one hosts_hits_rollup row
+	int rollup_after;
+	// older hosts are deleted unless detected, blacklisted or ignored
+	int delete_after;
+	// DB size in bytes over which delete_after is halved until it fits
+	long size_target;
+	// size_target never deletes hosts younger than this
+	int min_age;
+	// hosts per transaction
+	int batch_size;
+	// free pages handed back to the file system per pass, 0 = all
+	int vacuum_pages;
+};
+
+struct sqlite_retention_stats {
+	size_t hosts_rolled_up;
+	size_t rows_rolled_up;
+	size_t hosts_deleted;
+	size_t pages_freed;
+	// live bytes once the pass is done
+	long db_size;
+	// the delete_after the pass ended on, lower when size_target kicked in
+	int delete_after;
+};
+
+/*
+ * how far back (seconds) each bucket width of hosts_hits_history
+ * is kept by sqlite_compact_hit_history, minutes fold into hours,
+ * hours into days and days past days_for are dropped
+ */
+struct sqlite_hit_history_policy {
+	int minutes_for;
+	int hours_for;
+	int days_for;
+};
+
+struct sqlite_host_hits_entry {
+	int host_ix;
+	int hits;
+};
+
+/*
+ * return 0 to keep iterating, anything else stops the walk
+ */
+typedef int (*sqlite_host_cb)(const struct sqlite_host_entry *, void *);
+typedef int (*sqlite_host_port_hit_cb)(const struct sqlite_host_port_hit_entry *, void *);
+typedef int (*sqlite_host_list_cb)(const struct sqlite_host_list_entry *, void *);
+typedef int (*sqlite_ix_cb)(int, void *);
+typedef int (*sqlite_host_hit_summary_cb)(const struct sqlite_host_hit_summary *, void *);
+typedef int (*sqlite_host_hits_cb)(const struct sqlite_host_hits_entry *, void *);
 
 
 #ifdef __cplusplus
@@ -69,6 +166,7 @@ int sqlite_get_host_by_ix(int, char *, size_t, const char *);
 int sqlite_get_host_all_by_ix(int, char *, size_t, const char *);
 int sqlite_add_host(const char *, const char *);
 int sqlite_add_host_all(uint32_t, const char *, time_t, time_t, const char *);
+int sqlite_upsert_host(const char *, const char *);
 int sqlite_get_host_ix(const char *, const char *);
 size_t sqlite_update_host_last_seen(size_t, const char *);
 size_t sqlite_remove_host(size_t, const char *);
@@ -82,6 +180,7 @@ int sqlite_get_all_host_one_port_threshold(int, int, char *, size_t, const char
 int sqlite_get_host_port_hit(int, int, const char *);
 int sqlite_add_host_port_hit(int, int, int, const char *);
 int sqlite_add_host_port_hit_all(int, int, int, int, const char *);
+int sqlite_upsert_host_port_hit(const char *, int, int, const char *);
 int sqlite_update_host_port_hit(int, int, int, const char *);
 size_t sqlite_remove_host_ports_all(size_t, const char *);
 size_t sqlite_get_unique_list_of_hosts_ix(char *, size_t, const char *);
@@ -102,7 +201,33 @@ int sqlite_get_all_ignore_or_black_ip_list(char *, size_t, const char *, const c
 ///////////////////////////////////////////////////////////////////////
 void sqlite_reset_autoincrement(const char *, const char *);
 size_t sqlite_remove_all(const char *db_loc, const char *table);
+size_t sqlite_remove_ix_by_table(uint32_t, const char *, const char *);
+// the *_all adds write the row under the given ix, replacing what is there
 size_t sqlite_add_all_by_table(uint32_t, uint32_t, time_t, const char *, const char *);
+int sqlite_migrate_schema(const char *);
+int sqlite_set_hit_history(int, const char *);
+int sqlite_compact_hit_history(const struct sqlite_hit_history_policy *, const char *);
+int sqlite_get_host_hits_since(int, int, const char *);
+int sqlite_for_each_host_hits_since(int, int, sqlite_host_hits_cb, void *, const char *);
+int sqlite_apply_retention(const struct sqlite_retention_policy *, struct sqlite_retention_stats *, sqlite_host_cb, void *, const char *);
+int sqlite_publish_snapshot(const char *, int, int, const char *);
+///////////////////////////////////////////////////////////////////////
+// row visitors, the connection stays held for the walk so callbacks
+// may call back into this API from the same thread
+int sqlite_for_each_host(sqlite_host_cb, void *, const char *);
+int sqlite_get_host_entry_by_ix(int, struct sqlite_host_entry *, const char *);
+int sqlite_for_each_host_one_port_threshold(int, int, sqlite_host_port_hit_cb, void *, const char *);
+int sqlite_for_each_port_one_host(int, sqlite_host_port_hit_cb, void *, const char *);
+int sqlite_for_each_unique_port(sqlite_ix_cb, void *, const char *);
+int sqlite_for_each_unique_host_ix(sqlite_ix_cb, void *, const char *);
+int sqlite_for_each_detected_host(sqlite_host_list_cb, void *, const char *);
+int sqlite_for_each_ignore_or_black_ip(sqlite_host_list_cb, void *, const char *, const char *);
+int sqlite_for_each_host_hit_summary(int, sqlite_host_hit_summary_cb, void *, const char *);
+///////////////////////////////////////////////////////////////////////
+// transactions, these nest
+int sqlite_begin_transaction(const char *);
+int sqlite_commit_transaction(const char *);
+int sqlite_rollback_transaction(const char *);
 
 #ifdef __cplusplus
 }
@@ -45,7 +45,10 @@
 #include <netinet/in.h>
 #include <netinet/ip.h>
 
+#include "config.h"
+
 #include "sqlite_wrapper_api.h"
+#include "sqlite_handle.h"
 #include "iptables_wrapper_api.h"
 #include "packet_handler.h"
 #include "singleton.h"
@@ -55,6 +58,12 @@
 #include "ip_addr_controller.h"
 #include "system_functions.h"
 #include "data_base.h"
+#include "block_action_queue.h"
+#include "hit_write_behind.h"
+#include "block_aggregator.h"
+#ifdef USE_BPF
+#include "bpf_drop.h"
+#endif
 
 
 #ifdef __cplusplus
@@ -88,6 +97,9 @@ DataBase *gargoyle_pscand_data_base_shared_memory = nullptr;
 
 int NFLOG_BIND_GROUP = 5;
 SharedIpConfig *gargoyle_blacklist_shm = NULL;
+BlockActionQueue *gargoyle_pscand_block_queue = NULL;
+HitWriteBehind *gargoyle_pscand_write_behind = NULL;
+volatile sig_atomic_t caught_signal = 0;
 
 const char *GARG_PROGNAME = "gargoyle_pscand";
 ///////////////////////////////////////////////////////////////////////////////////
@@ -98,8 +110,10 @@ bool exists_in_ip_entries(std::string);
 void add_to_ports_entries(int);
 void add_to_ip_entries(std::string);
 void nfqueue_signal_handler(int);
+void segv_signal_handler(int);
 void graceful_exit (int);
 void handle_chain();
+void load_bpf_drop(const std::string &);
 void get_ports_to_ignore();
 void get_ephemeral_range_to_ignore();
 void get_local_ip_addrs();
@@ -114,30 +128,59 @@ void usage() {
     std::cerr << std::endl << "Usage: ./" <<  GARG_PROGNAME << " [-v | --version] [-s | --shared_memory]" << std::endl << std::endl << std::endl;
 }
 
+/*
+ * only flags the stop, the nflog loop in main winds down
+ * and runs graceful_exit on the main thread
+ */
 void nfqueue_signal_handler(int signum) {
-	graceful_exit(signum);
+	caught_signal = signum;
+}
+
+
+/*
+ * nothing can be stopped or flushed from here, the
+ * fault may well be on one of the worker threads
+ */
+void segv_signal_handler(int signum) {
+	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, signum, PROG_TERM_SYSLOG);
+	_exit(1);
 }
 
 
 void graceful_exit(int signum) {
 
+	/*
+	 * the chain gets flushed below so anything
+	 * still queued for blocking is moot
+	 */
+	if (gargoyle_pscand_block_queue) {
+		gargoyle_pscand_block_queue->Stop(false);
+		delete gargoyle_pscand_block_queue;
+		gargoyle_pscand_block_queue = NULL;
+	}
+	/*
+	 * pending hits and detections have to be on disk
+	 * before detected_hosts gets cleared below
+	 */
+	if (gargoyle_pscand_write_behind) {
+		set_write_behind(NULL);
+		delete gargoyle_pscand_write_behind;
+		gargoyle_pscand_write_behind = NULL;
+	}
+
     if(gargoyle_blacklist_shm) {
         delete gargoyle_blacklist_shm;
         //gargoyle_blacklist_shm;
     }
 
-	if (signum == 11) {
-		syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, signum, PROG_TERM_SYSLOG);
-		exit(0);
-	}
-
 	//std::cout << "Signal caught: " << signum << ", destroying queue ..." << std::endl;
 	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s %s", SIGNAL_CAUGHT_SYSLOG, signum, "destroying queue, cleaning up iptables entries and", PROG_TERM_SYSLOG);
 
 	/*
 	 * 1. delete NFLOG rule from INPUT chain
 	 * 2. delete GARGOYLE_CHAIN_NAME rule from the INPUT chain
-	 * 3. flush (delete any rules that exist in) GARGOYLE_CHAIN_NAME
+	 * 3. flush (delete any rules that exist in) GARGOYLE_CHAIN_NAME,
+	 *    the addrs only blocked by subnet rules go with it
 	 * 4. clear items in DB table detected_hosts
 	 * 5. reset auto-increment counter for table detected_hosts
 	 * 6. delete GARGOYLE_CHAIN_NAME
@@ -159,11 +202,18 @@ void graceful_exit(int signum) {
 	///////////////////////////////////////////////////
 	// 3
 	iptables_flush_chain(GARGOYLE_CHAIN_NAME, IPTABLES_SUPPORTS_XLOCK);
+	SharedIpConfig *aggregated_shm = SharedIpConfig::Create(GARGOYLE_AGGREGATED_SHM_NAME, GARGOYLE_AGGREGATED_SHM_SZ, true);
+	if (aggregated_shm) {
+		clear_aggregated(aggregated_shm);
+		delete aggregated_shm;
+	}
+#ifdef USE_BPF
+	bpf_drop_unload();
+#endif
 	///////////////////////////////////////////////////
 	// 4
 	if(gargoyle_pscand_data_base_shared_memory != nullptr){
-		string query = "DELETE FROM detected_hosts";
-		gargoyle_pscand_data_base_shared_memory->detected_hosts->DELETE(query);
+		gargoyle_pscand_data_base_shared_memory->detected_hosts->TRUNCATE();
 	}else{
 		sqlite_remove_detected_hosts_all(DB_LOCATION);
 	}
@@ -180,6 +230,7 @@ void graceful_exit(int signum) {
 	//if(gargoyleHandler.get_type_data_base() == "shared_memory"){
 	//	gargoyleHandler.cleanTables();
 	//}
+	sqlite_handle_close_all();
 
     if(gargoyle_pscand_data_base_shared_memory != nullptr){
     	delete gargoyle_pscand_data_base_shared_memory;
@@ -349,6 +400,44 @@ void add_to_ip_entries(std::string s) {
 }
 
 
+#ifdef USE_BPF
+int collect_drop_rule(const struct iptables_rule_entry *entry, void *ctx) {
+
+	if (strcmp(entry->target, "DROP") == 0 && entry->source[0])
+		((std::vector<std::string> *) ctx)->push_back(entry->source);
+	return 0;
+}
+#endif
+
+
+/*
+ * once the map pin exists every GARGOYLE_CHAIN_NAME listing comes
+ * from the map, so the DROP rules already in the chain are copied
+ * into it. the chain keeps them, it still drops on the interfaces
+ * the program is not attached to
+ */
+void load_bpf_drop(const std::string &bpf_interface) {
+
+#ifdef USE_BPF
+	std::vector<std::string> chain_drops;
+	iptables_for_each_rule_in_chain(GARGOYLE_CHAIN_NAME, collect_drop_rule, &chain_drops, IPTABLES_SUPPORTS_XLOCK);
+
+	if (bpf_drop_load(bpf_interface.c_str()) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", "Could not load XDP program on", bpf_interface.c_str(), "- using iptables");
+		return;
+	}
+	syslog(LOG_INFO | LOG_LOCAL6, "%s %s", "Dropping blocked hosts via XDP on", bpf_interface.c_str());
+
+	for (std::vector<std::string>::const_iterator i = chain_drops.begin(); i != chain_drops.end(); ++i)
+		bpf_drop_add(i->c_str());
+	if (chain_drops.size() > 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %zu %s", "Copied", chain_drops.size(), "blocked hosts from iptables to the XDP map");
+#else
+	syslog(LOG_INFO | LOG_LOCAL6, "%s", "bpf_interface is set but this build has no XDP support (--with-bpf) - using iptables");
+#endif
+}
+
+
 void get_ephemeral_range_to_ignore() {
 
 	FILE *fp;
@@ -465,82 +554,50 @@ void get_default_gateway_linux() {
 }
 
 
-void get_white_list_addrs() {
+int collect_listed_host_ix(const struct sqlite_host_list_entry *entry, void *ctx) {
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-
-
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts = (char*) malloc(dst_buf_sz);
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
+	if (entry->host_ix > 0)
+		((std::vector<int> *) ctx)->push_back(entry->host_ix);
+	return 0;
+}
 
-	size_t resp = sqlite_get_hosts_to_ignore_all(l_hosts, dst_buf_sz, DB_LOCATION);
 
-	if (resp == 0) {
+void get_white_list_addrs() {
 
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
+	struct sqlite_host_entry host;
+	std::vector<int> host_ixs;
 
-			if (atoi(token1) > 0) {
+	sqlite_for_each_ignore_or_black_ip(collect_listed_host_ix, &host_ixs, DB_LOCATION, IGNORE_IP_LIST_TABLE);
 
-				sqlite_get_host_by_ix(atoi(token1), host_ip, dst_buf_sz1, DB_LOCATION);
+	for (std::vector<int>::const_iterator it = host_ixs.begin(); it != host_ixs.end(); ++it) {
 
-				if (strcmp(host_ip, "") != 0) {
-					add_to_ip_entries(host_ip);
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
+		if (sqlite_get_host_entry_by_ix(*it, &host, DB_LOCATION) == 0 && strcmp(host.host, "") != 0) {
+			add_to_ip_entries(host.host);
 		}
 	}
-
-	free(l_hosts);
-	free(host_ip);
 }
 
 
 void get_blacklist_ip_addrs(int enforce_state) {
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-
-
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts = (char*) malloc(dst_buf_sz);
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
-
-	size_t resp = sqlite_get_hosts_blacklist_all(l_hosts, dst_buf_sz, DB_LOCATION);
+	struct sqlite_host_entry host;
+	std::vector<int> host_ixs;
 
-	if (resp == 0) {
+	// collected first, the iptables work below shouldn't hold the DB
+	sqlite_for_each_ignore_or_black_ip(collect_listed_host_ix, &host_ixs, DB_LOCATION, BLACK_LIST_TABLE);
 
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
+	for (std::vector<int>::const_iterator it = host_ixs.begin(); it != host_ixs.end(); ++it) {
 
-			int host_ix = atoi(token1);
-			if (host_ix > 0) {
+		if (sqlite_get_host_entry_by_ix(*it, &host, DB_LOCATION) == 0 && strcmp(host.host, "") != 0) {
 
-				sqlite_get_host_by_ix(host_ix, host_ip, dst_buf_sz1, DB_LOCATION);
+			do_black_list_actions(host.host,
+								(void *) gargoyle_blacklist_shm,
+								IPTABLES_SUPPORTS_XLOCK,
+								enforce_state
+								);
 
-				if (strcmp(host_ip, "") != 0) {
-
-					do_black_list_actions(host_ip,
-										(void *) gargoyle_blacklist_shm,
-										IPTABLES_SUPPORTS_XLOCK,
-										enforce_state
-										);
-
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
 		}
 	}
-
-	free(l_hosts);
-	free(host_ip);
 }
 
 
@@ -549,15 +606,24 @@ void get_blacklist_ip_addrs(int enforce_state) {
 int main(int argc, char *argv[])
 {
 
-    // Set up signal handlers
-    signal (SIGINT, nfqueue_signal_handler);
-    signal (SIGSEGV, nfqueue_signal_handler);
+    /*
+     * Set up signal handlers, SIGINT without SA_RESTART so
+     * the recv in the nflog loop returns and sees the stop
+     */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = nfqueue_signal_handler;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    signal (SIGSEGV, segv_signal_handler);
 
     if (geteuid() != 0) {
     	std::cerr << std::endl << "Root privileges are necessary for this to run ..." << std::endl << std::endl;
     	return 1;
     }
 
+    bool use_shared_memory = false;
+
     /*
      * in order to keep stuff lean and mean I
      * am doing this manually here and not
@@ -579,8 +645,7 @@ int main(int argc, char *argv[])
 			exit(0);
     	} else if ((case_insensitive_compare(arg_one.c_str(), "-c"))) {
     	} else if ((case_insensitive_compare(arg_one.c_str(), "-s")) || (case_insensitive_compare(arg_one.c_str(), "--shared_memory"))) {
-    		gargoyle_pscand_data_base_shared_memory = DataBase::create();
-    		gargoyleHandler.set_data_base_shared_memory(gargoyle_pscand_data_base_shared_memory);
+    		use_shared_memory = true;
     	} else {
 			usage();
 			exit(1);
@@ -638,6 +703,10 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (sqlite_migrate_schema(DB_LOCATION) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", DB_FILE_SYSLOG, DB_LOCATION, "could not be migrated to the current schema");
+	}
+
 	if (DEBUG) {
 		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG, "Using DB:", DB_LOCATION);
 	}
@@ -648,6 +717,12 @@ int main(int argc, char *argv[])
 	size_t single_port_scan_threshold = 0;
 	std::string ports_to_ignore;
 	std::string hot_ports;
+	size_t subnet_block_threshold = 0;
+	long sqlite_flush_interval = -1;
+	long sqlite_flush_rows = -1;
+	long shared_memory_table_size = -1;
+	long shared_memory_snapshot_interval = -1;
+	std::string bpf_interface;
 
 	const char *config_file;
 	config_file = getenv("GARGOYLE_CONFIG");
@@ -665,11 +740,39 @@ int main(int argc, char *argv[])
 		ports_to_ignore = cvv.get_ports_to_ignore();
 		hot_ports = cvv.get_hot_ports();
 
+		subnet_block_threshold = cvv.get_subnet_block_threshold();
+		sqlite_handle_set_options(cvv.get_sqlite_busy_timeout(), cvv.get_sqlite_mmap_size(), cvv.get_sqlite_cache_size());
+		sqlite_flush_interval = cvv.get_sqlite_flush_interval();
+		sqlite_flush_rows = cvv.get_sqlite_flush_rows();
+		shared_memory_table_size = cvv.get_shared_memory_table_size();
+		shared_memory_snapshot_interval = cvv.get_shared_memory_snapshot_interval();
+		bpf_interface = cvv.get_bpf_interface();
+
 	} else {
 		return 1;
 	}
 
-	gargoyle_blacklist_shm = SharedIpConfig::Create(GARGOYLE_BLACKLIST_SHM_NAME, GARGOYLE_BLACKLIST_SHM_SZ);
+	/*
+	 * created once the config is in, this process normally creates
+	 * the tables so it decides how much they reserve. it also fills
+	 * them below, so tables left by a build with another layout are
+	 * replaced rather than refused
+	 */
+	if (use_shared_memory) {
+		gargoyle_pscand_data_base_shared_memory = DataBase::create(shared_memory_table_size, true);
+		if (gargoyle_pscand_data_base_shared_memory == nullptr) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s - %s", "Cannot attach to the shared memory tables", CANNOT_CONTINUE_SYSLOG);
+			return 1;
+		}
+		gargoyleHandler.set_data_base_shared_memory(gargoyle_pscand_data_base_shared_memory);
+	}
+
+	// refilled from the DB by get_blacklist_ip_addrs
+	gargoyle_blacklist_shm = SharedIpConfig::Create(GARGOYLE_BLACKLIST_SHM_NAME, GARGOYLE_BLACKLIST_SHM_SZ, true);
+	if (!gargoyle_blacklist_shm || gargoyleHandler.attach_shared_config() < 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s - %s", "Cannot attach to the shared white/black lists", CANNOT_CONTINUE_SYSLOG);
+		return 1;
+	}
 
 	// does iptables support xlock
 	// 1 = true, 0 = false
@@ -681,6 +784,9 @@ int main(int argc, char *argv[])
 
 	handle_chain();
 
+	if (bpf_interface.size() > 0)
+		load_bpf_drop(bpf_interface);
+
 	get_ephemeral_range_to_ignore();
 	/*
 	std::cout << EPHEMERAL_LOW << std::endl;
@@ -802,7 +908,15 @@ int main(int argc, char *argv[])
 	}
 
 	if(gargoyleHandler.get_type_data_base() == "shared_memory"){
-		gargoyleHandler.sqlite_to_shared_memory();
+		/*
+		 * the binary snapshots are mapped and copied in as they are,
+		 * the DB is only read when there are none or one is damaged
+		 */
+		if (shared_memory_snapshot_interval <= 0 || gargoyle_pscand_data_base_shared_memory->loadSnapshots(DB_LOCATION) != 0) {
+			gargoyleHandler.sqlite_to_shared_memory();
+		} else if (DEBUG) {
+			syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG, "Loaded the shared memory database from its snapshot");
+		}
 	}
 
 	get_blacklist_ip_addrs(enforce_mode);
@@ -846,6 +960,22 @@ int main(int argc, char *argv[])
 		gargoyleHandler.add_to_ports_entries(*i);
 	}
 
+	if (gargoyle_pscand_data_base_shared_memory == nullptr) {
+		gargoyle_pscand_write_behind = HitWriteBehind::Create(DB_LOCATION,
+				sqlite_flush_interval < 0 ? GARGOYLE_WRITE_BEHIND_INTERVAL_MS : sqlite_flush_interval,
+				sqlite_flush_rows < 0 ? GARGOYLE_WRITE_BEHIND_MAX_DIRTY : sqlite_flush_rows);
+		set_write_behind(gargoyle_pscand_write_behind);
+	}
+
+	gargoyle_pscand_block_queue = BlockActionQueue::Create(DB_LOCATION,
+			IPTABLES_SUPPORTS_XLOCK,
+			enforce_mode,
+			gargoyle_pscand_data_base_shared_memory != nullptr,
+			DEBUG);
+	if (gargoyle_pscand_block_queue)
+		gargoyle_pscand_block_queue->SetSubnetThreshold(subnet_block_threshold);
+	gargoyleHandler.set_block_action_queue(gargoyle_pscand_block_queue);
+
 	int rv, fd;
 	char buf[4096] __attribute__ ((aligned));
 
@@ -888,12 +1018,15 @@ int main(int argc, char *argv[])
 	fd = nflog_fd(nfl_handle);
 	nflog_callback_register(qh, &GargoylePscandHandler::packet_handle, &gargoyleHandler);
 
-	// main loop to get data via nflog
+	// main loop to get data via nflog, until a signal flags the stop
 	//while ((rv = recv(fd, buf, sizeof(buf), 0)) && rv >= 0) {
-	while (TEMP_FAILURE_RETRY((rv = recv(fd, buf, sizeof(buf), 0)))) {
+	while (!caught_signal) {
+		rv = recv(fd, buf, sizeof(buf), 0);
 		// handle message in packet that just arrived
 		if (rv > 0)
 			nflog_handle_packet(nfl_handle, buf, rv);
+		else if (rv == 0)
+			break;
 	}
 
 	if (qh) {
@@ -906,7 +1039,7 @@ int main(int argc, char *argv[])
 		nflog_close(nfl_handle);
 	}
 
-	graceful_exit(SIGINT);
+	graceful_exit(caught_signal ? caught_signal : SIGINT);
 
 	return 0;
 }
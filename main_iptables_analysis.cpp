@@ -34,6 +34,7 @@
 #include <string>
 #include <sstream>
 #include <map>
+#include <set>
 
 #include <errno.h>
 #include <ctype.h>
@@ -45,12 +46,14 @@
 #include <netinet/in.h>
 
 #include "sqlite_wrapper_api.h"
+#include "sqlite_handle.h"
 #include "iptables_wrapper_api.h"
 #include "singleton.h"
 #include "gargoyle_config_vals.h"
 #include "config_variables.h"
 #include "string_functions.h"
 #include "ip_addr_controller.h"
+#include "block_action_queue.h"
 #include "shared_config.h"
 #include "system_functions.h"
 #include "data_base.h"
@@ -62,35 +65,54 @@ struct greater_val
 };
 
 
-std::vector<int> IPTABLES_ENTRIES;
+// host_ix of every ip blocked in GARGOYLE_CHAIN_NAME
+std::set<int> IPTABLES_ENTRIES;
 size_t PORT_SCAN_THRESHOLD = 15;
 size_t SINGLE_IP_SCAN_THRESHOLD = 6;
 size_t OVERALL_PORT_SCAN_THRESHOLD = 8;
 // 8 hours
 size_t LAST_SEEN_DELTA = 28800;
+size_t SUBNET_BLOCK_THRESHOLD = 0;
 bool ENFORCE = true;
 bool DEBUG = false;
 size_t IPTABLES_SUPPORTS_XLOCK;
 // 5 days
 size_t LAST_SEEN_THRESHOLD = 432000;
+// SQLite retention in seconds (MiB for the size target), -1 = default
+long SQLITE_ROLLUP_AFTER = -1;
+long SQLITE_RETENTION = -1;
+long SQLITE_SIZE_TARGET = 0;
+// 1 = keep hosts_hits_history and count overall hits over LAST_SEEN_DELTA only
+long SQLITE_HIT_HISTORY = 0;
+// seconds between read-only snapshots of the DB, 0 = none
+long SQLITE_SNAPSHOT_INTERVAL = 0;
 
 char DB_LOCATION[SQL_CMD_MAX+1];
+std::string SNAPSHOT_LOCATION;
 const char *GARG_ANALYSIS_PROGNAME_META = "Gargoyle Pscand Analysis";
 const char *GARG_ANALYSIS_PROGNAME = "gargoyle_pscand_analysis";
 SharedIpConfig *gargoyle_analysis_whitelist_shm = NULL;
 
 DataBase *data_base_shared_memory_analysis = nullptr;
+BlockActionQueue *gargoyle_analysis_block_queue = NULL;
 
 volatile sig_atomic_t stop;
 
 void handle_signal (int);
 bool exists_in_iptables_entries(int);
 void add_to_iptables_entries(int);
-void query_for_single_port_hits_last_seen();
-void query_for_multiple_ports_hits_last_seen();
+void block_ip_addr(const std::string &, int);
+
+int add_rule_to_iptables_entries(const struct iptables_rule_entry *, void *);
+int find_iptables_dupe(const struct iptables_rule_entry *, void *);
+int classify_host_hits(const struct sqlite_host_hit_summary *);
+void query_for_hosts_hits_last_seen();
 void run_analysis();
 void clean_up_stale_data();
+void apply_retention();
 void clean_up_iptables_dupe_data();
+void publish_snapshot();
+void wait_for_next_run(int);
 
 
 void usage() {
@@ -98,632 +120,444 @@ void usage() {
 }
 
 
+/*
+ * only flags the stop, the processing loop in main winds
+ * down and stops the enforcement worker itself
+ */
 void handle_signal (int signum) {
-	stop = 1;
-	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, signum, PROG_TERM_SYSLOG);
-
-    if(gargoyle_analysis_whitelist_shm) {
-        delete gargoyle_analysis_whitelist_shm;
-        //gargoyle_analysis_whitelist_shm;
-    }
-
-    if(data_base_shared_memory_analysis != nullptr){
-    	delete data_base_shared_memory_analysis;
-    }
-	exit(0);
+	stop = signum;
 }
 
 
 bool exists_in_iptables_entries(int s) {
+	return IPTABLES_ENTRIES.count(s) > 0;
+}
 
-	std::vector<int>::const_iterator iter;
 
-	iter = std::find(IPTABLES_ENTRIES.begin(), IPTABLES_ENTRIES.end(), s);
-	if (iter != IPTABLES_ENTRIES.end()) {
-		//std::cout << *iter << " is on position " << (iter - IPTABLES_ENTRIES.begin() + 1);
-		return true;
-	} else {
-		return false;
-	}
+void add_to_iptables_entries(int s) {
+	IPTABLES_ENTRIES.insert(s);
 }
 
 
-void add_to_iptables_entries(int s) {
-	if (!exists_in_iptables_entries(s))
-		IPTABLES_ENTRIES.push_back(s);
+void block_ip_addr(const std::string &ip_addr, int detection_type) {
+
+	/*
+	 * the enforcement worker does the iptables and DB
+	 * work, we only block inline if it cannot take it
+	 */
+	if (gargoyle_analysis_block_queue && gargoyle_analysis_block_queue->Enqueue(ip_addr, detection_type) == 0)
+		return;
+
+	do_block_actions(ip_addr,
+		detection_type,
+		DB_LOCATION,
+		IPTABLES_SUPPORTS_XLOCK,
+		ENFORCE,
+		(void *)gargoyle_analysis_whitelist_shm,
+		DEBUG,
+		"",
+		data_base_shared_memory_analysis
+	);
 }
 
 
-/*
- * one port, too many hits from one host
- */
-void query_for_single_port_hits_last_seen() {
+int add_rule_to_iptables_entries(const struct iptables_rule_entry *entry, void *ctx) {
 
-	int ret;
-	int row_ix;
-	int host_ix;
-	int port_num;
-	int hit_count;
-	int iter_cnt;
-	int iter_cnt2;
-	int now;
+	int added_host_ix = 0;
 
-	int first_seen;
-	int last_seen;
-
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-	char *token2;
-	char *token2_save;
-	const char *tok2 = ":";
-	char *token3;
-	char *token3_save;
-	char *token4;
-	char *token4_save;
-
-	//char list_of_ports[(size_t)SMALL_DEST_BUF];
-	size_t list_ports_dst_sz = SMALL_DEST_BUF;
-	char *list_of_ports = (char*) malloc(list_ports_dst_sz+1);
-	memset(list_of_ports, 0, list_ports_dst_sz + 1);
+	if (!entry->source[0])
+		return 0;
 
 	if(data_base_shared_memory_analysis != nullptr){
-		string query = "SELECT DISTINCT port_number FROM hosts_ports_hits";
-		ret = data_base_shared_memory_analysis->hosts_ports_hits->SELECT(list_of_ports, query.c_str());
+		added_host_ix = data_base_shared_memory_analysis->hosts->findHostIx(entry->source);
 	}else{
-		ret = sqlite_get_unique_list_of_ports(list_of_ports, list_ports_dst_sz, DB_LOCATION);
+		added_host_ix = sqlite_get_host_ix(entry->source, DB_LOCATION);
 	}
 
-	size_t list_hosts_dst_sz = SMALL_DEST_BUF;
-	char *l_hosts = (char*) malloc(list_hosts_dst_sz+1);
-	memset(l_hosts, 0, list_hosts_dst_sz+1);
-	last_seen = (int) time(NULL);
-
-	token1 = strtok_r(list_of_ports, tok1, &token1_save);
-	while (token1 != NULL) {
-
-		*l_hosts = 0;
-		if(data_base_shared_memory_analysis != nullptr){
-			char query[SQL_CMD_MAX];
-			memset(l_hosts, 0, SMALL_DEST_BUF);
-			sprintf(query, "SELECT * FROM hosts_ports_hits WHERE port_number=%d AND hit_count>=%zu", atoi(token1), PORT_SCAN_THRESHOLD);
-			data_base_shared_memory_analysis->hosts_ports_hits->SELECT(l_hosts, query);
-		}else{
-			sqlite_get_all_host_one_port_threshold(atoi(token1), PORT_SCAN_THRESHOLD, l_hosts, list_hosts_dst_sz, DB_LOCATION);
-		}
-
-		if (strlen(l_hosts) > 0) {
-			/*
-			 std::cout << std::endl << token1 << std::endl;
-			 std::cout << l_hosts << std::endl << std::endl;
-			 */
-			//std::cout << "LHOSTS: " << l_hosts << std::endl << std::endl;
-			token2 = strtok_r(l_hosts, tok1, &token2_save);
-			while (token2 != NULL) {
-				/*
-				std::cout << "TOKEN2: " << token2 << " - " << iter_cnt
-						<< std::endl;
-				*/
-				token3 = strtok_r(token2, tok2, &token3_save);
-				iter_cnt = 0;
-				while (token3 != NULL) {
-
-					if (iter_cnt == 0) {
-						row_ix = atoi(token3);
-					} else if (iter_cnt == 1) {
-						host_ix = atoi(token3);
-					} else if (iter_cnt == 2) {
-						port_num = atoi(token3);
-					} else if (iter_cnt == 3) {
-						hit_count = atoi(token3);
-					}
-					iter_cnt++;
-					token3 = strtok_r(NULL, tok2, &token3_save);
-				}
-				/*
-				std::cout << "ROW/HOST/PORT/CNT: " << row_ix << " - " << host_ix
-						<< " - " << port_num << " - " << hit_count << std::endl;
-				*/
-				if (!exists_in_iptables_entries(host_ix)) {
-
-					size_t get_all_dst_sz = LOCAL_BUF_SZ;
-					char *h_all = (char*) malloc(get_all_dst_sz+1);
-					if(data_base_shared_memory_analysis != nullptr){
-						string query = "SELECT * FROM hosts_table WHERE ix="+host_ix;
-						data_base_shared_memory_analysis->hosts->SELECT(h_all, query.c_str());
-					}else{
-						sqlite_get_host_all_by_ix(host_ix, h_all, get_all_dst_sz, DB_LOCATION);
-					}
-
-					//std::cout << h_all << std::endl;
-
-					char *host_ip = (char*) malloc(60);
-					iter_cnt2 = 0;
-					token4 = strtok_r(h_all, tok2, &token4_save);
-					while (token4 != NULL) {
-
-						if (iter_cnt2 == 0) {
-						} else if (iter_cnt2 == 1) {
-							//host_ip = atoi(token4);
-							snprintf(host_ip, 60, "%s", token4);
-						} else if (iter_cnt2 == 2) {
-							first_seen = atoi(token4);
-						} else if (iter_cnt2 == 3) {
-							last_seen = atoi(token4);
-						}
-
-						iter_cnt2++;
-						token4 = strtok_r(NULL, tok2, &token4_save);
-					}
-
-					//tmp_host_ix,host_ip,first_seen,last_seen = h_all.value.split(':')
-					/*
-					std::cout << host_ip << " - " << first_seen << " - "
-							<< last_seen << std::endl << std::endl;
-					*/
-
-					now = (int) time(NULL);
-					if ((now - last_seen) <= LAST_SEEN_DELTA) {
-						/*
-						 * !! ENFORCE
-						 * if we are here then this host violated the
-						 * acceptable number of port hits (for one port per host).
-						 * did we see this host less than LAST_SEEN_DELTA hours ago?
-						 * if so block this bitch
-						 */
-						do_block_actions(host_ip,
-                            7,
-                            DB_LOCATION,
-                            IPTABLES_SUPPORTS_XLOCK,
-                            ENFORCE,
-                            (void *)gargoyle_analysis_whitelist_shm,
-                            DEBUG,
-                            "",
-							data_base_shared_memory_analysis
-                        );
-						add_to_iptables_entries(host_ix);
-
-					}
-					free(h_all);
-					free(host_ip);
-				}
-				token2 = strtok_r(NULL, tok1, &token2_save);
-			}
-		}
-		token1 = strtok_r(NULL, tok1, &token1_save);
+	if (added_host_ix > 0) {
+		add_to_iptables_entries(added_host_ix);
 	}
-	free(list_of_ports);
-	free(l_hosts);
+	return 0;
 }
 
 
+struct iptables_dupe_ctx {
+	std::map<std::string, int> first_rule;
+	std::vector<int> dupes;
+};
 
-void query_for_multiple_ports_hits_last_seen() {
 
-	int ret;
-	int row_ix;
-	int host_ix;
-	int first_seen = 0;
-	int last_seen = 0;
-	int iter_cnt;
-	int now;
-	int hit_cnt_resp;
-	int l_count;
+int find_iptables_dupe(const struct iptables_rule_entry *entry, void *ctx) {
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-	const char *tok2 = ":";
-	char *token2;
-	char *token2_save;
+	struct iptables_dupe_ctx *dupe_ctx = (struct iptables_dupe_ctx *) ctx;
 
-	size_t dst_buf_sz = MEDIUM_DEST_BUF;
-	char *hosts_all_buf = (char*) malloc(dst_buf_sz+1);
-	char *host_ip = (char*) malloc(60);
-	memset(hosts_all_buf, 0, dst_buf_sz+1);
+	if (!entry->source[0])
+		return 0;
 
-	if(data_base_shared_memory_analysis != nullptr){
-		string query = "SELECT * FROM hosts_table";
-		data_base_shared_memory_analysis->hosts->SELECT(hosts_all_buf, query.c_str());
-	}else{
-		ret = sqlite_get_hosts_all(hosts_all_buf, dst_buf_sz, DB_LOCATION);
+	std::pair<std::map<std::string, int>::iterator, bool> ret;
+	ret = dupe_ctx->first_rule.insert(std::pair<std::string,int>(entry->source, entry->line_number));
+	if (!ret.second && ret.first->second < (int) entry->line_number) {
+		dupe_ctx->dupes.push_back(entry->line_number);
 	}
+	return 0;
+}
 
-	/*
-	std::cout << hosts_all_buf << std::endl;
-	std::cout << strlen(hosts_all_buf) << std::endl;
-	*/
-
-	if (ret == 0) {
-		token1 = strtok_r(hosts_all_buf, tok1, &token1_save);
-		while (token1 != NULL) {
-
-			iter_cnt = 0;
-			token2 = strtok_r(token1, tok2, &token2_save);
-
-			while (token2 != NULL) {
-
-				if (iter_cnt == 0) {
-					host_ix = atoi(token2);
-				} else if (iter_cnt == 1) {
-					snprintf(host_ip, 60, "%s", token2);
-				} else if (iter_cnt == 2) {
-					first_seen = atoi(token2);
-				} else if (iter_cnt == 3) {
-					last_seen = atoi(token2);
-				}
-
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
-			/*
-			std::cout << host_ix << " - " << host_ip << " - " << first_seen << " - "
-					<< last_seen << std::endl << std::endl;
-			*/
-			if (!exists_in_iptables_entries(host_ix)) {
-
-				now = (int) time(NULL);
-				if ((now - last_seen) <= LAST_SEEN_DELTA) {
-
-					hit_cnt_resp = 0;
-					if(data_base_shared_memory_analysis != nullptr){
-						char result[SMALL_DEST_BUF];
-						memset(result, 0, SMALL_DEST_BUF);
-						string query = "SELECT COUNT(*) FROM hosts_ports_hits WHERE host_ix=" + host_ix;
-						if(data_base_shared_memory_analysis->hosts_ports_hits->SELECT(result, query) != -1){
-							hit_cnt_resp = atol(result);
-						}
-					}else{
-						hit_cnt_resp = sqlite_get_total_hit_count_one_host_by_ix(host_ix, DB_LOCATION);
-					}
-					if (hit_cnt_resp >= SINGLE_IP_SCAN_THRESHOLD) {
-						/*
-						 * !! ENFORCE - if more than SINGLE_IP_SCAN_THRESHOLD ports
-						 * were scanned by this src ip then block this bitch
-						 *
-						 * do this by row count from the DB
-						 */
-						do_block_actions(host_ip,
-                            6,
-                            DB_LOCATION,
-                            IPTABLES_SUPPORTS_XLOCK,
-                            ENFORCE,
-                            (void *)gargoyle_analysis_whitelist_shm,
-                            DEBUG,
-                            "",
-							data_base_shared_memory_analysis
-                        );
-						add_to_iptables_entries(host_ix);
-
-					} else {
-						/*
-						 * !! ENFORCE - if the collective activity for
-						 * this host surpasses a threshold then block this bitch.
-						 *
-						 * we already have host_ix and host_ip
-						 * get a total count of port hits for this host
-						 */
-						l_count = 0;
-						if(data_base_shared_memory_analysis != nullptr){
-							char result[SMALL_DEST_BUF];
-							memset(result, 0, SMALL_DEST_BUF);
-							string query = "SELECT SUM(hit_count) FROM hosts_ports_hits WHERE host_ix=" + host_ix;
-							if((l_count = data_base_shared_memory_analysis->hosts_ports_hits->SELECT(hosts_all_buf, query.c_str())) != -1){
-								l_count = atol(result);
-							}
-						}else{
-							l_count = sqlite_get_one_host_hit_count_all_ports(host_ix, DB_LOCATION);
-						}
-
-
-						if (l_count >= OVERALL_PORT_SCAN_THRESHOLD) {
-
-							do_block_actions(host_ip,
-                                8,
-                                DB_LOCATION,
-                                IPTABLES_SUPPORTS_XLOCK,
-                                ENFORCE,
-                                (void *)gargoyle_analysis_whitelist_shm,
-                                DEBUG,
-                                "",
-								data_base_shared_memory_analysis
-                            );
-							add_to_iptables_entries(host_ix);
-
-						}
-					}
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-		}
-	}
-	free(hosts_all_buf);
-	free(host_ip);
+
+/*
+ * hosts found over a threshold while a table is being walked, they
+ * get blocked once the walk is done so the DB writes that come with
+ * a block never happen inside an open read
+ */
+struct analysis_offender {
+	std::string host_ip;
+	int host_ix;
+	int detection_type;
+};
+
+struct analysis_walk_ctx {
+	std::vector<analysis_offender> offenders;
+	// hits per host_ix within LAST_SEEN_DELTA, NULL without hit history
+	std::map<int, int> *window_hits;
+};
+
+
+void add_offender(struct analysis_walk_ctx *walk, const char *host_ip, int host_ix, int detection_type) {
+
+	analysis_offender offender;
+
+	offender.host_ip = host_ip;
+	offender.host_ix = host_ix;
+	offender.detection_type = detection_type;
+	walk->offenders.push_back(offender);
+	add_to_iptables_entries(host_ix);
 }
 
 
-void run_analysis() {
+void block_offenders(struct analysis_walk_ctx *walk) {
 
-	int start_time = (int) time(NULL);
-	syslog(LOG_INFO | LOG_LOCAL6, "%s %d", "analysis process commencing at", start_time);
+	for (std::vector<analysis_offender>::const_iterator it = walk->offenders.begin(); it != walk->offenders.end(); ++it) {
+		block_ip_addr(it->host_ip, it->detection_type);
+	}
+	walk->offenders.clear();
+}
 
-	IPTABLES_ENTRIES.clear();
-	//get_white_list_addrs();
 
-	const char *tok1 = "\n";
-	char *token1;
-	char *token1_save;
+/*
+ * all three rules look at one host at a time, the busiest port
+ * is checked first so a host that trips more than one rule gets
+ * the same detection type it always did
+ *
+ * return 0 = nothing to block
+ */
+int classify_host_hits(const struct sqlite_host_hit_summary *summary) {
 
-	size_t d_buf_sz = DEST_BUF_SZ * 2;
-	char *l_hosts = (char*) malloc(d_buf_sz);
+	/*
+	 * !! ENFORCE
+	 * if we are here then this host violated the
+	 * acceptable number of port hits (for one port per host)
+	 */
+	if ((size_t) summary->max_port_hits >= PORT_SCAN_THRESHOLD)
+		return 7;
+	/*
+	 * !! ENFORCE - if more than SINGLE_IP_SCAN_THRESHOLD ports
+	 * were scanned by this src ip then block this bitch
+	 *
+	 * do this by row count from the DB
+	 */
+	if ((size_t) summary->port_count >= SINGLE_IP_SCAN_THRESHOLD)
+		return 6;
+	/*
+	 * !! ENFORCE - if the collective activity for
+	 * this host surpasses a threshold then block this bitch.
+	 */
+	if ((size_t) summary->hit_total >= OVERALL_PORT_SCAN_THRESHOLD)
+		return 8;
+	return 0;
+}
 
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1+1);
-	*host_ip = 0;
 
-	const char *dash_dash = "--  ";
-	size_t dash_dash_len = 4;
-	const char *w_space = " ";
-	char *s_lchains3;
-	char *s_lchains4;
+int check_host_hits(const struct sqlite_host_hit_summary *summary, void *ctx) {
 
-	size_t added_host_ix;
-	added_host_ix = 0;
-	int tstamp;
+	struct analysis_walk_ctx *walk = (struct analysis_walk_ctx *) ctx;
+	int detection_type;
+
+	if (exists_in_iptables_entries(summary->host.ix))
+		return 0;
 
 	/*
-	 * get the latest data from iptables and
-	 * populate vector IPTABLES_ENTRIES with
-	 * the index of each ip actively blocked
-	 * via iptables
+	 * only hosts we saw less than LAST_SEEN_DELTA
+	 * seconds ago, the SQLite query filters on this
+	 * already
 	 */
-	iptables_list_chain(GARGOYLE_CHAIN_NAME, l_hosts, d_buf_sz, IPTABLES_SUPPORTS_XLOCK);
-
-	if (l_hosts) {
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
-
-			s_lchains3 = strstr (token1, dash_dash);
-			if (s_lchains3) {
-
-				size_t position1 = s_lchains3 - token1;
-				s_lchains4 = strstr (token1 + position1 + dash_dash_len, w_space);
-				size_t position2 = s_lchains4 - token1;
-
-				*host_ip = 0;
-				added_host_ix = 0;
-
-				if (bayshoresubstring(position1 + dash_dash_len, position2, token1, host_ip, 16)) {
-					if(data_base_shared_memory_analysis != nullptr){
-						char result[SMALL_DEST_BUF];
-						memset(result, 0, SMALL_DEST_BUF);
-						string query = "SELECT ix FROM hosts_table WHERE host=" + string(host_ip);
-						if((added_host_ix = data_base_shared_memory_analysis->hosts->SELECT(result, query)) != -1){
-							added_host_ix = atol(result);
-						}
-					}else{
-						added_host_ix = sqlite_get_host_ix(host_ip, DB_LOCATION);
-					}
-
-
-					if (added_host_ix > 0) {
-						add_to_iptables_entries(added_host_ix);
-					}
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-		}
+	if (((int) time(NULL) - summary->host.last_seen) > (int) LAST_SEEN_DELTA)
+		return 0;
+
+	/*
+	 * with hit history the overall count is a true sliding
+	 * window instead of every hit since the host was first seen
+	 */
+	if (walk->window_hits) {
+		struct sqlite_host_hit_summary windowed = *summary;
+		std::map<int, int>::const_iterator it = walk->window_hits->find(summary->host.ix);
+		windowed.hit_total = (it != walk->window_hits->end()) ? it->second : 0;
+		detection_type = classify_host_hits(&windowed);
+	} else {
+		detection_type = classify_host_hits(summary);
 	}
+	if (detection_type > 0)
+		add_offender(walk, summary->host.host, summary->host.ix, detection_type);
+	return 0;
+}
 
-	clean_up_stale_data();
-	query_for_single_port_hits_last_seen();
-	query_for_multiple_ports_hits_last_seen();
-	clean_up_iptables_dupe_data();
 
-	int end_time = (int) time(NULL);
-	syslog(LOG_INFO | LOG_LOCAL6, "%s %d", "analysis process finishing at", end_time);
-	syslog(LOG_INFO | LOG_LOCAL6, "%s %d %s", "analysis process took", end_time - start_time, "seconds");
+int copy_window_hits(const struct sqlite_host_hits_entry *entry, void *ctx) {
 
-	free(l_hosts);
-	free(host_ip);
+	(*(std::map<int, int> *) ctx)[entry->host_ix] = entry->hits;
+	return 0;
 }
 
 
-void clean_up_stale_data() {
+int sum_host_port_hit(const struct sqlite_host_port_hit_entry *hit, void *ctx) {
 
-	int ret;
-	int row_ix;
-	int host_ix;
-	int first_seen = 0;
-	int last_seen = 0;
-	int iter_cnt;
-	int now;
-	int hit_cnt_resp;
-	int l_count;
+	std::map<int, sqlite_host_hit_summary> *summaries = (std::map<int, sqlite_host_hit_summary> *) ctx;
+	struct sqlite_host_hit_summary &summary = (*summaries)[hit->host_ix];
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-	const char *tok2 = ":";
-	char *token2;
-	char *token2_save;
+	summary.port_count++;
+	summary.hit_total += hit->hit_count;
+	if (hit->hit_count > summary.max_port_hits)
+		summary.max_port_hits = hit->hit_count;
+	return 0;
+}
 
-	size_t dst_buf_sz = MEDIUM_DEST_BUF;
-	char *hosts_all_buf = (char*) malloc(dst_buf_sz+1);
-	char *host_ip = (char*) malloc(60);
 
-	if(data_base_shared_memory_analysis != nullptr){
-		string query = "SELECT * FROM hosts_table";
-		data_base_shared_memory_analysis->hosts->SELECT(hosts_all_buf, query.c_str());
-	}else{
-		ret = sqlite_get_hosts_all(hosts_all_buf, dst_buf_sz, DB_LOCATION);
-	}
+int join_host_entry(const struct sqlite_host_entry *host, void *ctx) {
 
-	/*
-	std::cout << hosts_all_buf << std::endl;
-	std::cout << strlen(hosts_all_buf) << std::endl;
-	*/
+	std::map<int, sqlite_host_hit_summary> *summaries = (std::map<int, sqlite_host_hit_summary> *) ctx;
+	std::map<int, sqlite_host_hit_summary>::iterator it = summaries->find(host->ix);
 
-	if (ret == 0) {
+	if (it != summaries->end())
+		it->second.host = *host;
+	return 0;
+}
 
-		token1 = strtok_r(hosts_all_buf, tok1, &token1_save);
-		while (token1 != NULL) {
 
-			iter_cnt = 0;
-			token2 = strtok_r(token1, tok2, &token2_save);
+void copy_host_record(const Hosts_Record &record, struct sqlite_host_entry *host) {
 
-			while (token2 != NULL) {
+	host->ix = record.ix;
+	snprintf(host->host, sizeof(host->host), "%s", record.host);
+	host->first_seen = (int) record.first_seen;
+	host->last_seen = (int) record.last_seen;
+}
 
-				if (iter_cnt == 0) {
-					host_ix = atoi(token2);
-				} else if (iter_cnt == 1) {
-					snprintf(host_ip, 60, "%s", token2);
-				} else if (iter_cnt == 2) {
-					first_seen = atoi(token2);
-				} else if (iter_cnt == 3) {
-					last_seen = atoi(token2);
-				}
 
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
+/*
+ * the shared memory DB has no joins, both tables are read once and
+ * folded into one summary per host in memory instead
+ */
+void for_each_host_hit_summary_shm(struct analysis_walk_ctx *walk) {
 
-			//if (!exists_in_iptables_entries(host_ix) && !is_white_listed_ip_addr(host_ip)) {
-			if (!exists_in_iptables_entries(host_ix) &&
-					!is_white_listed(host_ip, (void *) gargoyle_analysis_whitelist_shm)) {
-
-				now = (int) time(NULL);
-				if ((now - last_seen) >= LAST_SEEN_THRESHOLD) {
-					/*
-					 * the following must be done in order to
-					 * minimize the overall intensity of the
-					 * analysis process as it can peg a CPU at
-					 * close to 100% when there is a lot of data
-					 * to process
-					 *
-					 * the next steps will remove all traces of
-					 * a particular host if we havent encountered
-					 * it in over LAST_SEEN_THRESHOLD (5 days by
-					 * default)
-					 */
-
-					/*
-					// delete all records for this host_ix from hosts_ports_hits table
-					remove_host_ports_all(host_ix, DB_LOCATION);
-					// delete the host record
-					remove_host(host_ix, DB_LOCATION);
-
-					syslog(LOG_INFO | LOG_LOCAL6, "%s-%s=\"%s\" %s=\"%d\" %s=\"%d\"", "removing record",
-							VIOLATOR_SYSLOG, host_ip, "first_seen", first_seen, "last_seen", last_seen);
-					*/
-					do_host_remove_actions(host_ip, host_ix, DB_LOCATION, first_seen, last_seen, data_base_shared_memory_analysis);
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
+	std::map<int, sqlite_host_hit_summary> summaries;
+	std::vector<Hosts_Ports_Hits_Record> hits;
+
+	data_base_shared_memory_analysis->hosts_ports_hits->getAll(hits);
+	for (std::vector<Hosts_Ports_Hits_Record>::const_iterator it = hits.begin(); it != hits.end(); ++it) {
+		struct sqlite_host_port_hit_entry hit = { (int) it->ix, (int) it->host_ix, (int) it->port_number, (int) it->hit_count };
+		sum_host_port_hit(&hit, &summaries);
+	}
+
+	if (summaries.size() > 0) {
+		std::vector<Hosts_Record> hosts;
+		data_base_shared_memory_analysis->hosts->getAll(hosts);
+		for (std::vector<Hosts_Record>::const_iterator it = hosts.begin(); it != hosts.end(); ++it) {
+			struct sqlite_host_entry host;
+			copy_host_record(*it, &host);
+			join_host_entry(&host, &summaries);
 		}
 	}
-	free(hosts_all_buf);
-	free(host_ip);
+
+	for (std::map<int, sqlite_host_hit_summary>::const_iterator it = summaries.begin(); it != summaries.end(); ++it) {
+		// hits left behind by a host that is gone
+		if (it->second.host.ix == 0)
+			continue;
+		check_host_hits(&it->second, walk);
+	}
 }
 
 
-void clean_up_iptables_dupe_data() {
+/*
+ * one port with too many hits from one host, too many ports hit
+ * by one host, or too many hits overall from one host, all
+ * answered from a single pass over the hosts seen in the last
+ * LAST_SEEN_DELTA seconds
+ */
+void query_for_hosts_hits_last_seen() {
 
-	size_t dst_buf_sz = DEST_BUF_SZ;
-	char *l_chains = (char*) malloc(dst_buf_sz + 1);
-	char *l_chains2 = (char*) malloc(dst_buf_sz + 1);
+	struct analysis_walk_ctx walk;
+	std::map<int, int> window_hits;
+	int since = (int) time(NULL) - LAST_SEEN_DELTA;
 
-	const char *tok1 = "\n";
+	walk.window_hits = NULL;
+	if(data_base_shared_memory_analysis != nullptr){
+		for_each_host_hit_summary_shm(&walk);
+	}else{
+		if (SQLITE_HIT_HISTORY > 0 && sqlite_for_each_host_hits_since(since, 1, copy_window_hits, &window_hits, DB_LOCATION) == 0)
+			walk.window_hits = &window_hits;
+		sqlite_for_each_host_hit_summary(since, check_host_hits, &walk, DB_LOCATION);
+	}
+
+	block_offenders(&walk);
+}
 
-	char *token1;
-	char *token1_save;
-	char *token2;
-	char *token2_save;
 
+void run_analysis() {
 
-	const char *dash_dash = "--  ";
-	size_t dash_dash_len = 4;
-	const char *w_space = " ";
+	int start_time = (int) time(NULL);
+	syslog(LOG_INFO | LOG_LOCAL6, "%s %d", "analysis process commencing at", start_time);
 
-	char *s_lchains1;
-	char *s_lchains2;
-	char *s_lchains3;
-	char *s_lchains4;
+	IPTABLES_ENTRIES.clear();
+	//get_white_list_addrs();
 
-	char *host_ip = (char*) malloc(60);
-	char *host_ip2 = (char*) malloc(60);
+	/*
+	 * get the latest data from iptables and
+	 * populate set IPTABLES_ENTRIES with
+	 * the index of each ip actively blocked
+	 * via iptables
+	 */
+	iptables_for_each_rule_in_chain(GARGOYLE_CHAIN_NAME, add_rule_to_iptables_entries, NULL, IPTABLES_SUPPORTS_XLOCK);
 
-	int rule_ix1;
-	int rule_ix2;
+	clean_up_stale_data();
+	query_for_hosts_hits_last_seen();
+	// the dupe check has to see every block queued above
+	if (gargoyle_analysis_block_queue)
+		gargoyle_analysis_block_queue->Flush();
+	clean_up_iptables_dupe_data();
 
-	std::map<std::string, int> iptables_map;
+	int end_time = (int) time(NULL);
+	syslog(LOG_INFO | LOG_LOCAL6, "%s %d", "analysis process finishing at", end_time);
+	syslog(LOG_INFO | LOG_LOCAL6, "%s %d %s", "analysis process took", end_time - start_time, "seconds");
+}
 
-	iptables_list_chain_with_line_numbers(GARGOYLE_CHAIN_NAME, l_chains, dst_buf_sz, IPTABLES_SUPPORTS_XLOCK);
-	if (l_chains) {
-		token1 = strtok_r(l_chains, tok1, &token1_save);
-		while (token1 != NULL) {
 
-			rule_ix1 = atoi(token1);
-			s_lchains1 = strstr (token1, dash_dash);
+/*
+ * collects the ix of every host not seen in LAST_SEEN_THRESHOLD
+ * that is neither blocked nor white listed, clean_up_stale_data
+ * then drops all their hits in one pass
+ */
+int check_stale_host(const struct sqlite_host_entry *host, void *ctx) {
 
-			if (s_lchains1) {
+	std::vector<uint32_t> *stale = (std::vector<uint32_t> *) ctx;
+	int now;
 
-				size_t position1 = s_lchains1 - token1;
-				s_lchains2 = strstr (token1 + position1 + dash_dash_len, w_space);
-				size_t position2 = s_lchains2 - token1;
+	//if (!exists_in_iptables_entries(host_ix) && !is_white_listed_ip_addr(host_ip)) {
+	if (exists_in_iptables_entries(host->ix) ||
+			is_white_listed(host->host, (void *) gargoyle_analysis_whitelist_shm))
+		return 0;
 
-				bayshoresubstring(position1 + dash_dash_len, position2, token1, host_ip, 16);
-				if (host_ip) {
-					iptables_map.insert(std::pair<std::string,int>(host_ip,rule_ix1));
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-		}
+	now = (int) time(NULL);
+	if ((now - host->last_seen) >= (int) LAST_SEEN_THRESHOLD) {
+		/*
+		 * the following must be done in order to
+		 * minimize the overall intensity of the
+		 * analysis process as it can peg a CPU at
+		 * close to 100% when there is a lot of data
+		 * to process
+		 *
+		 * the next steps will remove all traces of
+		 * a particular host if we havent encountered
+		 * it in over LAST_SEEN_THRESHOLD (5 days by
+		 * default)
+		 */
+		stale->push_back(host->ix);
 	}
+	return 0;
+}
+
+
+int log_removed_host(const struct sqlite_host_entry *host, void *ctx) {
+
+	do_remove_action_output(host->host, (int) time(NULL), host->first_seen, host->last_seen, ENFORCE);
+	return 0;
+}
 
-	std::map<std::string,int>::iterator it = iptables_map.begin();
-	/*
-	for (it=iptables_map.begin(); it!=iptables_map.end(); ++it) {
 
-		std::cout << it->first << " => " << it->second << '\n';
+/*
+ * on SQLite the hits of hosts not seen in LAST_SEEN_THRESHOLD are
+ * rolled up into one hosts_hits_rollup row per host instead of being
+ * thrown away, and hosts past the retention period go altogether
+ * unless they are blocked, blacklisted or whitelisted
+ */
+void apply_retention() {
+
+	struct sqlite_retention_policy policy;
+	struct sqlite_retention_stats stats;
+
+	policy.rollup_after = SQLITE_ROLLUP_AFTER < 0 ? LAST_SEEN_THRESHOLD : SQLITE_ROLLUP_AFTER;
+	// hits the analysis still looks at are never rolled up
+	if (policy.rollup_after > 0 && policy.rollup_after < (int) LAST_SEEN_DELTA)
+		policy.rollup_after = LAST_SEEN_DELTA;
+	policy.delete_after = SQLITE_RETENTION < 0 ? GARGOYLE_RETENTION_DELETE_AFTER : SQLITE_RETENTION;
+	policy.size_target = SQLITE_SIZE_TARGET * 1024 * 1024;
+	policy.min_age = LAST_SEEN_DELTA;
+	policy.batch_size = GARGOYLE_RETENTION_BATCH;
+	policy.vacuum_pages = GARGOYLE_RETENTION_VACUUM_PAGES;
+
+	if (SQLITE_HIT_HISTORY > 0) {
+		struct sqlite_hit_history_policy history;
+		history.minutes_for = GARGOYLE_HIT_HISTORY_MINUTES_FOR;
+		history.hours_for = GARGOYLE_HIT_HISTORY_HOURS_FOR;
+		history.days_for = GARGOYLE_HIT_HISTORY_DAYS_FOR;
+		// the window has to be answered from minute buckets
+		if (history.minutes_for < (int) LAST_SEEN_DELTA)
+			history.minutes_for = LAST_SEEN_DELTA;
+		if (history.hours_for < history.minutes_for)
+			history.hours_for = history.minutes_for;
+		sqlite_compact_hit_history(&history, DB_LOCATION);
 	}
-	*/
-	std::vector<int> vec;
-	for (it=iptables_map.begin(); it!=iptables_map.end(); ++it) {
-
-	    //std::cout << it->first << " => " << it->second << '\n';
-		iptables_list_chain_with_line_numbers(GARGOYLE_CHAIN_NAME, l_chains2, dst_buf_sz, IPTABLES_SUPPORTS_XLOCK);
-
-		if (l_chains2) {
-
-			token2 = strtok_r(l_chains2, tok1, &token2_save);
-			while (token2 != NULL) {
-
-				rule_ix2 = atoi(token2);
-				s_lchains3 = strstr (token2, dash_dash);
-				if (s_lchains3) {
-
-					size_t position3 = s_lchains3 - token2;
-					s_lchains4 = strstr (token2 + position3 + dash_dash_len, w_space);
-					size_t position4 = s_lchains4 - token2;
-
-					*host_ip2 = 0;
-					if (bayshoresubstring(position3 + dash_dash_len, position4, token2, host_ip2, 16)) {
-
-						if ((strcmp((it->first).c_str(), host_ip2) == 0) && (it->second < rule_ix2)) {
-							/*
-							std::cout << it->first << " - " << host_ip2 << std::endl;
-							std::cout << it->second << " - " << rule_ix2 << std::endl << std::endl;
-							*/
-							vec.push_back(rule_ix2);
-						}
-					}
-				}
-				token2 = strtok_r(NULL, tok1, &token2_save);
-			}
+
+	if (sqlite_apply_retention(&policy, &stats, log_removed_host, NULL, DB_LOCATION) != 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s", INFO_SYSLOG, "retention pass did not complete");
+
+	if (stats.hosts_rolled_up || stats.hosts_deleted || stats.pages_freed) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %zu %s %zu %s %zu %s %zu %s %ld %s %d", INFO_SYSLOG,
+				"retention rolled up hosts:", stats.hosts_rolled_up, "rows:", stats.rows_rolled_up,
+				"deleted hosts:", stats.hosts_deleted, "freed pages:", stats.pages_freed,
+				"db bytes:", stats.db_size, "retention:", stats.delete_after);
+	}
+}
+
+
+void clean_up_stale_data() {
+
+	if(data_base_shared_memory_analysis != nullptr){
+		std::vector<Hosts_Record> hosts;
+		std::vector<uint32_t> stale;
+		data_base_shared_memory_analysis->hosts->getAll(hosts);
+		for (std::vector<Hosts_Record>::const_iterator it = hosts.begin(); it != hosts.end(); ++it) {
+			struct sqlite_host_entry host;
+			copy_host_record(*it, &host);
+			check_stale_host(&host, &stale);
 		}
+		if (stale.size() > 0)
+			data_base_shared_memory_analysis->hosts_ports_hits->deleteByHostIxs(stale);
+		return;
 	}
 
+	apply_retention();
+}
+
+
+void clean_up_iptables_dupe_data() {
+
+	/*
+	 * one pass over the chain is enough, rules are
+	 * listed in ascending order so the first hit for
+	 * an ip addr is the one to keep and any later
+	 * rule for the same addr is a dupe
+	 */
+	struct iptables_dupe_ctx dupe_ctx;
+	iptables_for_each_rule_in_chain(GARGOYLE_CHAIN_NAME, find_iptables_dupe, &dupe_ctx, IPTABLES_SUPPORTS_XLOCK);
+
+	std::vector<int> &vec = dupe_ctx.dupes;
 	if (vec.size() > 0) {
 		/*
 		 * We have to remove rules from the bottom
@@ -735,14 +569,44 @@ void clean_up_iptables_dupe_data() {
 			iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, *itv, IPTABLES_SUPPORTS_XLOCK);
 		}
 	}
-	free(l_chains);
-	free(l_chains2);
-	free(host_ip);
-	free(host_ip2);
 }
 
 
 
+/*
+ * read-only copy of the DB for status.py and the admin tools,
+ * so their reads never queue behind the daemons' writes
+ */
+void publish_snapshot() {
+
+	if (sqlite_publish_snapshot(SNAPSHOT_LOCATION.c_str(), GARGOYLE_SNAPSHOT_PAGES_PER_STEP, GARGOYLE_SNAPSHOT_STEP_SLEEP_MS, DB_LOCATION) != 0)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", DB_FILE_SYSLOG, SNAPSHOT_LOCATION.c_str(), "could not be published");
+}
+
+
+/*
+ * sleeps until the next analysis run, refreshing the
+ * snapshot every SQLITE_SNAPSHOT_INTERVAL seconds meanwhile
+ */
+void wait_for_next_run(int secs) {
+
+	if (SQLITE_SNAPSHOT_INTERVAL <= 0) {
+		sleep(secs);
+		return;
+	}
+
+	time_t next_run = time(NULL) + secs;
+	time_t now;
+	while (!stop) {
+		publish_snapshot();
+		now = time(NULL);
+		if (now >= next_run)
+			break;
+		sleep(next_run - now < SQLITE_SNAPSHOT_INTERVAL ? next_run - now : SQLITE_SNAPSHOT_INTERVAL);
+	}
+}
+
+
 int main(int argc, char *argv[]) {
 
 	signal(SIGINT, handle_signal);
@@ -773,6 +637,10 @@ int main(int argc, char *argv[]) {
     	} else if ((case_insensitive_compare(arg_one.c_str(), "-c"))) {
         } else if ((case_insensitive_compare(arg_one.c_str(), "-s")) || (case_insensitive_compare(arg_one.c_str(), "--shared_memory"))) {
     	    data_base_shared_memory_analysis = DataBase::create();
+			if (data_base_shared_memory_analysis == nullptr) {
+				std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+				return 1;
+			}
     	} else {
 			usage();
             return 0;
@@ -825,6 +693,10 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (sqlite_migrate_schema(DB_LOCATION) != 0) {
+        syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", DB_FILE_SYSLOG, DB_LOCATION, "could not be migrated to the current schema");
+    }
+
 	// Get config data
 	const char *config_file;
 	config_file = getenv("GARGOYLE_CONFIG");
@@ -839,21 +711,56 @@ int main(int argc, char *argv[]) {
 		SINGLE_IP_SCAN_THRESHOLD = cvv.get_single_ip_scan_threshold();
 		OVERALL_PORT_SCAN_THRESHOLD = cvv.get_overall_port_scan_threshold();
 		LAST_SEEN_DELTA = cvv.get_last_seen_delta();
+		SUBNET_BLOCK_THRESHOLD = cvv.get_subnet_block_threshold();
+		sqlite_handle_set_options(cvv.get_sqlite_busy_timeout(), cvv.get_sqlite_mmap_size(), cvv.get_sqlite_cache_size());
+		SQLITE_ROLLUP_AFTER = cvv.get_sqlite_rollup_after();
+		SQLITE_RETENTION = cvv.get_sqlite_retention();
+		SQLITE_SIZE_TARGET = cvv.get_sqlite_size_target();
+		SQLITE_HIT_HISTORY = cvv.get_sqlite_hit_history();
+		SQLITE_SNAPSHOT_INTERVAL = cvv.get_sqlite_snapshot_interval();
 
 	} else {
 		return 1;
 	}
 
+	if (data_base_shared_memory_analysis == nullptr)
+		sqlite_set_hit_history(SQLITE_HIT_HISTORY > 0, DB_LOCATION);
+
 	gargoyle_analysis_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
 
 	IPTABLES_SUPPORTS_XLOCK = iptables_supports_xlock();
 
+	gargoyle_analysis_block_queue = BlockActionQueue::Create(DB_LOCATION,
+			IPTABLES_SUPPORTS_XLOCK,
+			ENFORCE,
+			data_base_shared_memory_analysis != nullptr,
+			DEBUG);
+	if (gargoyle_analysis_block_queue)
+		gargoyle_analysis_block_queue->SetSubnetThreshold(SUBNET_BLOCK_THRESHOLD);
+
+	SNAPSHOT_LOCATION = std::string(DB_LOCATION) + GARGOYLE_SNAPSHOT_SUFFIX;
+
 	// processing loop
 	while (!stop) {
 		run_analysis();
 		// every 15 minutes by default
-		sleep(900);
+		wait_for_next_run(900);
+	}
+
+	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, (int)stop, PROG_TERM_SYSLOG);
+
+	// apply whatever is still queued before the handles go away
+	if (gargoyle_analysis_block_queue) {
+		delete gargoyle_analysis_block_queue;
 	}
 
+    if(gargoyle_analysis_whitelist_shm) {
+        delete gargoyle_analysis_whitelist_shm;
+    }
+
+    if(data_base_shared_memory_analysis != nullptr){
+    	delete data_base_shared_memory_analysis;
+    }
+
 	return 0;
 }
@@ -36,6 +36,7 @@
 #include <csignal>
 #include <map>
 
+#include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -51,6 +52,8 @@
 #endif
 
 #include "ip_addr_controller.h"
+#include "block_action_queue.h"
+#include "hit_write_behind.h"
 #include "sqlite_wrapper_api.h"
 #include "iptables_wrapper_api.h"
 #include "gargoyle_config_vals.h"
@@ -75,7 +78,8 @@ int BUF_SZ = 512;
  *  2 == invalid regular expression detected
  */
 volatile int ret_code = 0;
-volatile bool stop_processing = false;
+volatile sig_atomic_t stop_processing = 0;
+volatile sig_atomic_t caught_signal = 0;
 
 std::vector<std::string> sshd_regexes;
 std::map<std::string, int[2]> IP_HITMAP;
@@ -86,6 +90,8 @@ size_t ITER_CNT_MAX = 50;
 
 SharedIpConfig *gargoyle_bf_whitelist_shm = NULL;
 DataBase *data_base_shared_memory_analysis = nullptr;
+BlockActionQueue *gargoyle_bf_block_queue = NULL;
+HitWriteBehind *gargoyle_bf_write_behind = NULL;
 
 //size_t get_regexes(const char *);
 void signal_handler(int);
@@ -94,6 +100,7 @@ int handle_log_line(const std::string &, const std::string &);
 void process_iteration(int, int, const std::string &);
 std::string hunt_for_ip_addr(std::string);
 void handle_ip_addr(const std::string &);
+void block_ip_addr(const std::string &, int, const std::string &);
 void display_map();
 
 
@@ -116,22 +123,14 @@ size_t get_regexes(const char *fname) {
 #endif
 
 
+/*
+ * only flags the stop, the log tail winds down and the
+ * workers are stopped from main (see the end of main)
+ */
 void signal_handler(int signum) {
 
-	stop_processing = true;
-	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, signum, PROG_TERM_SYSLOG);
-
-    if(gargoyle_bf_whitelist_shm) {
-        delete gargoyle_bf_whitelist_shm;
-        //gargoyle_bf_whitelist_shm;
-    }
-
-	if(data_base_shared_memory_analysis != nullptr){
-		delete data_base_shared_memory_analysis;
-	}
-
-	// terminate program
-	exit(ret_code);
+	caught_signal = signum;
+	stop_processing = 1;
 
 }
 
@@ -215,16 +214,7 @@ void process_iteration(int num_seconds, int num_hits, const std::string &config_
 			// block based purely on number of hits
 			if (l_num_hits >= num_hits) {
 
-				do_block_actions(ip_addr,
-					51,
-					DB_LOCATION,
-					IPTABLES_SUPPORTS_XLOCK,
-					ENFORCE,
-					(void *) gargoyle_bf_whitelist_shm,
-					DEBUG,
-					config_file,
-					data_base_shared_memory_analysis
-				);
+				block_ip_addr(ip_addr, 51, config_file);
 				IP_HITMAP.erase(ip_addr);
 				continue;
 
@@ -235,16 +225,7 @@ void process_iteration(int num_seconds, int num_hits, const std::string &config_
 		// fuck time, if we see this many hits we block
 		if (l_num_hits >= (num_hits * 2)) {
 
-			do_block_actions(ip_addr,
-				51,
-				DB_LOCATION,
-				IPTABLES_SUPPORTS_XLOCK,
-				ENFORCE,
-				(void *) gargoyle_bf_whitelist_shm,
-				DEBUG,
-				config_file,
-				data_base_shared_memory_analysis
-			);
+			block_ip_addr(ip_addr, 51, config_file);
 			IP_HITMAP.erase(ip_addr);
 
 		}
@@ -252,6 +233,28 @@ void process_iteration(int num_seconds, int num_hits, const std::string &config_
 }
 
 
+void block_ip_addr(const std::string &ip_addr, int detection_type, const std::string &config_file) {
+
+	/*
+	 * the enforcement worker does the iptables and DB
+	 * work, we only block inline if it cannot take it
+	 */
+	if (gargoyle_bf_block_queue && gargoyle_bf_block_queue->Enqueue(ip_addr, detection_type, config_file) == 0)
+		return;
+
+	do_block_actions(ip_addr,
+		detection_type,
+		DB_LOCATION,
+		IPTABLES_SUPPORTS_XLOCK,
+		ENFORCE,
+		(void *) gargoyle_bf_whitelist_shm,
+		DEBUG,
+		config_file,
+		data_base_shared_memory_analysis
+	);
+}
+
+
 void handle_ip_addr(const std::string &ip_addr) {
 
 	std::map<std::string, int[2]>::iterator it = IP_HITMAP.find(ip_addr);
@@ -351,7 +354,7 @@ public:
 
 			//Signal error
 			ret_code = 2;
-			stop_processing = true;
+			stop_processing = 1;
 		}
 
 	}
@@ -365,9 +368,15 @@ private:
 
 int main(int argc, char *argv[]) {
 
-	// register signal SIGINT and signal handler
-	signal(SIGINT, signal_handler);
-	signal(SIGKILL, signal_handler);
+	/*
+	 * register signal SIGINT and signal handler, without
+	 * SA_RESTART so a blocking read returns to the loop
+	 */
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
 
 	std::string config_file = "";
 
@@ -378,6 +387,10 @@ int main(int argc, char *argv[]) {
 		case 3:
 			if((case_insensitive_compare(argv[1], "-s")) || (case_insensitive_compare(argv[1], "--shared_memory"))){
 				data_base_shared_memory_analysis = DataBase::create();
+				if (data_base_shared_memory_analysis == nullptr) {
+					std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+					return 1;
+				}
 				config_file = argv[2];
 				break;
 			}
@@ -453,13 +466,41 @@ int main(int argc, char *argv[]) {
 	}
 
 	gargoyle_bf_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
+	if (data_base_shared_memory_analysis == nullptr) {
+		gargoyle_bf_write_behind = HitWriteBehind::Create(DB_LOCATION);
+		set_write_behind(gargoyle_bf_write_behind);
+	}
+	gargoyle_bf_block_queue = BlockActionQueue::Create(DB_LOCATION,
+			IPTABLES_SUPPORTS_XLOCK,
+			ENFORCE,
+			data_base_shared_memory_analysis != nullptr,
+			DEBUG);
 
 	LogProcessor lp(log_entity, regex_str, config_file, num_hits, num_seconds);
-	if (lp.Initialize()) {
+	// Initialize() failed.
+	if (!lp.Initialize())
+		ret_code = 1;
+	else
 		lp.Process(stop_processing);
-		// never reached..
+
+	if (caught_signal)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, (int)caught_signal, PROG_TERM_SYSLOG);
+
+	// apply whatever is still queued before the handles go away
+	if (gargoyle_bf_block_queue) {
+		delete gargoyle_bf_block_queue;
+	}
+	if (gargoyle_bf_write_behind) {
+		set_write_behind(NULL);
+		delete gargoyle_bf_write_behind;
 	}
 
-	// Initialize() failed.
-	return 1;
+	if (gargoyle_bf_whitelist_shm)
+		delete gargoyle_bf_whitelist_shm;
+
+	if(data_base_shared_memory_analysis != nullptr){
+		delete data_base_shared_memory_analysis;
+	}
+
+	return ret_code;
 }
@@ -43,6 +43,7 @@
 #include <netinet/in.h>
 
 #include "sqlite_wrapper_api.h"
+#include "sqlite_handle.h"
 #include "iptables_wrapper_api.h"
 #include "singleton.h"
 #include "gargoyle_config_vals.h"
@@ -52,16 +53,20 @@
 #include "shared_config.h"
 #include "system_functions.h"
 #include "data_base.h"
+#include "block_aggregator.h"
 
 // 9 hours
 size_t LOCKOUT_TIME = 32400;
 size_t IPTABLES_SUPPORTS_XLOCK;
 bool ENFORCE = true;
+size_t SUBNET_BLOCK_THRESHOLD = 0;
 
 char DB_LOCATION[SQL_CMD_MAX+1];
 const char *GARG_MONITOR_PROGNAME_META = "Gargoyle Pscand Monitor";
 const char *GARG_MONITOR_PROGNAME = "gargoyle_pscand_monitor";
 SharedIpConfig *gargoyle_monitor_blacklist_shm = NULL;
+SharedIpConfig *gargoyle_monitor_whitelist_shm = NULL;
+SharedIpConfig *gargoyle_monitor_aggregated_shm = NULL;
 
 volatile sig_atomic_t stop;
 
@@ -81,6 +86,14 @@ void handle_signal (int signum) {
         //gargoyle_monitor_blacklist_shm;
     }
 
+    if(gargoyle_monitor_whitelist_shm) {
+        delete gargoyle_monitor_whitelist_shm;
+    }
+
+    if(gargoyle_monitor_aggregated_shm) {
+        delete gargoyle_monitor_aggregated_shm;
+    }
+
     if(data_base_shared_memory_analysis != nullptr){
 		delete data_base_shared_memory_analysis;
     }
@@ -90,157 +103,134 @@ void handle_signal (int signum) {
 }
 
 
-void run_monitor() {
+/*
+ * fills host for host_ix, host->ix stays 0 when there is no such host
+ *
+ * return 0 = ok
+ * return 1 = not ok
+ */
+int get_host_entry(int host_ix, struct sqlite_host_entry *host) {
+
+	memset(host, 0, sizeof(*host));
+	if(data_base_shared_memory_analysis != nullptr){
+		Hosts_Record record;
+		int found = data_base_shared_memory_analysis->hosts->getHost(host_ix, record);
+		if (found < 0)
+			return 1;
+		if (found == 1) {
+			host->ix = record.ix;
+			snprintf(host->host, sizeof(host->host), "%s", record.host);
+			host->first_seen = (int) record.first_seen;
+			host->last_seen = (int) record.last_seen;
+		}
+		return 0;
+	}
+	return sqlite_get_host_entry_by_ix(host_ix, host, DB_LOCATION);
+}
+
+
+/*
+ * detected hosts that have been in jail long enuf, the unblocking
+ * happens once the walk is done so the DB deletes never run inside
+ * an open read
+ */
+int find_expired_detected_host(const struct sqlite_host_list_entry *entry, void *ctx) {
 
-	int iter_cnt;
-	//int resp3;
-	size_t resp3;
-	int row_ix;
-	int host_ix;
-	int timestamp;
-	int active;
-	int processed;
+	std::vector<sqlite_host_list_entry> *expired = (std::vector<sqlite_host_list_entry> *) ctx;
 	int now;
-	size_t rule_ix;
-	int tstamp;
-
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-	const char *tok2 = ":";
-	char *token2;
-	char *token2_save;
-
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts3 = (char*) malloc(dst_buf_sz);
-	memset(l_hosts3, 0, dst_buf_sz);
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
+
+	if (entry->ix < 0 || entry->host_ix <= 0)
+		return 0;
+
+	now = (int) time(NULL);
+	if ((now - entry->timestamp) >= LOCKOUT_TIME)
+		expired->push_back(*entry);
+
+	return 0;
+}
+
+
+void run_monitor() {
+
+	bool unblocked_aggregated = false;
+	std::vector<sqlite_host_list_entry> expired;
 
 	if(data_base_shared_memory_analysis != nullptr){
-		string query = "SELECT * FROM detected_hosts";
-		resp3 = data_base_shared_memory_analysis->detected_hosts->SELECT(l_hosts3, query);
+		std::vector<Detected_Hosts_Record> detected;
+		data_base_shared_memory_analysis->detected_hosts->getAll(detected);
+		for (std::vector<Detected_Hosts_Record>::const_iterator it = detected.begin(); it != detected.end(); ++it) {
+			struct sqlite_host_list_entry entry;
+			entry.ix = it->ix;
+			entry.host_ix = it->host_ix;
+			entry.timestamp = (int) it->timestamp;
+			find_expired_detected_host(&entry, &expired);
+		}
 	}else{
-		resp3 = sqlite_get_detected_hosts_all(l_hosts3, dst_buf_sz, DB_LOCATION);
+		sqlite_for_each_detected_host(find_expired_detected_host, &expired, DB_LOCATION);
 	}
 
+	for (std::vector<sqlite_host_list_entry>::const_iterator it = expired.begin(); it != expired.end(); ++it) {
 
-	if (resp3 == 0) {
-
-		/*
-		 std::cout << std::endl << resp3 << std::endl;
-		 std::cout << l_hosts3 << std::endl;
-		 */
-		token1 = strtok_r(l_hosts3, tok1, &token1_save);
-		while (token1 != NULL) {
-
-			iter_cnt = 0;
-			timestamp = 0;
-			host_ix = 0;
-			//active = -1;
-			//processed = -1;
-			row_ix = -1;
-
-			//std::cout << token1 << std::endl;
-			token2 = strtok_r(token1, tok2, &token2_save);
-			while (token2 != NULL) {
-
-				//std::cout << token2 << " - " << iter_cnt << std::endl;
-				if (iter_cnt == 0) {
-					row_ix = atoi(token2);
-				} else if (iter_cnt == 1) {
-					host_ix = atoi(token2);
-				} else if (iter_cnt == 2) {
-					timestamp = atoi(token2);
-				}
-				/*
-				else if (iter_cnt == 3) {
-					active = atoi(token2);
-				} else if (iter_cnt == 4) {
-					processed = atoi(token2);
-				}
-				*/
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
+		struct sqlite_host_entry host;
+
+		// we have the host ix so get the ip addr from the DB
+		if (get_host_entry(it->host_ix, &host) != 0 || strcmp(host.host, "") == 0)
+			continue;
+
+		// if the ip is blaclisted leave it alone
+		if (is_black_listed(host.host, (void *)gargoyle_monitor_blacklist_shm))
+			continue;
 
-			//if (row_ix >= 0 && active >= 0 && processed >= 0 && host_ix > 0) {
-			if (row_ix >= 0 && host_ix > 0) {
+		int status = 0;
+		size_t row_ix = it->ix;
+		// remove DB row from when we blocked this host
+		if(data_base_shared_memory_analysis	!= nullptr){
+			if (data_base_shared_memory_analysis->detected_hosts->deleteByIx(row_ix) < 0)
+				status = 1;
+		}else{
+			status = sqlite_remove_detected_host(row_ix, DB_LOCATION);
+		}
+
+		if(status == 0){
 
-				//std::cout << row_ix << " - " << host_ix << " - " << timestamp << " - " << active << " - " << processed << std::endl;
-				now = (int) time(NULL);
-				*host_ip = 0;
-				rule_ix = 0;
+			if (is_aggregated(host.host, gargoyle_monitor_aggregated_shm)) {
 				/*
-				get_host_by_ix(host_ix, host_ip);
-				std::cout << host_ip << std::endl;
+				 * no rule of its own, a subnet rule covers it.
+				 * the aggregation pass below decides whether
+				 * that subnet rule still stands
 				 */
-				// has it been in jail long enuf?
-				if ((now - timestamp) >= LOCKOUT_TIME) {
-
-					// we have the host ix so get the ip addr from the DB
-					int status;
-					if(data_base_shared_memory_analysis != nullptr){
-						string query = "SELECT * FROM hosts_table WHERE ix=" + host_ix;
-						status = data_base_shared_memory_analysis->hosts->SELECT(host_ip, query);
-					}else{
-						status = sqlite_get_host_by_ix(host_ix, host_ip, dst_buf_sz1, DB_LOCATION);
-					}
-
-					if (status == 0) {
-						//std::cout << "HOST IP: " << host_ip << std::endl;
-
-						// we have the ip addr so get the rule ix from iptables
-						//rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, host_ip);
-						//std::cout << "RULE IX: " << rule_ix << std::endl;
-						//if (rule_ix > 0 && strcmp(host_ip, "") != 0) {
-						if (strcmp(host_ip, "") != 0) {
-							size_t row_ix;
-							// if the ip is blaclisted leave it alone
-							if (!is_black_listed(host_ip, (void *)gargoyle_monitor_blacklist_shm)) {
-								// find the row ix for this host (in detected_hosts table)
-								if(data_base_shared_memory_analysis != nullptr){
-									char result[SMALL_DEST_BUF];
-									memset(result, 0, SMALL_DEST_BUF);
-									string query = "SELECT ix FROM detected_hosts WHERE host_ix=" + host_ix;
-									if((row_ix = data_base_shared_memory_analysis->detected_hosts->SELECT(result, query)) != -1){
-										row_ix = atol(result);
-									}
-								}else{
-									row_ix = sqlite_get_detected_hosts_row_ix_by_host_ix(host_ix, DB_LOCATION);
-								}
-
-								if (row_ix > 0) {
-									int status;
-									// remove DB row from when we blocked this host
-									if(data_base_shared_memory_analysis	!= nullptr){
-										string query = "DELETE FROM detected_hosts WHERE ix=" + row_ix;
-										data_base_shared_memory_analysis->detected_hosts->DELETE(query);
-									}else{
-										status = sqlite_remove_detected_host(row_ix, DB_LOCATION);
-									}
-
-									if(status == 0){
-
-										size_t rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, host_ip, IPTABLES_SUPPORTS_XLOCK);
-										// delete rule from chain
-										iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
-
-										do_unblock_action_output(host_ip, (int) time(NULL), ENFORCE);
-
-									}
-								}
-							}
-						}
-					}
-				}
+				gargoyle_monitor_aggregated_shm->Remove(host.host);
+				unblocked_aggregated = true;
+			} else {
+				size_t rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, host.host, IPTABLES_SUPPORTS_XLOCK);
+				// delete rule from chain
+				iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
 			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
+
+			do_unblock_action_output(host.host, (int) time(NULL), ENFORCE);
+
 		}
 	}
 
-	free(l_hosts3);
-	free(host_ip);
+	/*
+	 * split subnet rules that dropped to the threshold (or all of
+	 * them if aggregation has since been turned off)
+	 */
+	if (SUBNET_BLOCK_THRESHOLD > 0 || unblocked_aggregated)
+		aggregate_chain_rules(gargoyle_monitor_aggregated_shm, gargoyle_monitor_whitelist_shm,
+				SUBNET_BLOCK_THRESHOLD, IPTABLES_SUPPORTS_XLOCK, false);
+}
+
+
+int find_orphan_host_ix(int host_ix, void *ctx) {
+
+	std::vector<int> *orphans = (std::vector<int> *) ctx;
+	struct sqlite_host_entry host;
+
+	if (get_host_entry(host_ix, &host) == 0 && strlen(host.host) == 0)
+		orphans->push_back(host_ix);
+
+	return 0;
 }
 
 
@@ -252,61 +242,29 @@ void run_orphan_cleanup() {
 	 * given host_ix existing in table hosts_ports_hits does not
 	 * exist in table hosts_table
 	 */
-	size_t resp;
-
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
+	std::vector<int> orphans;
 
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts = (char*) malloc(dst_buf_sz);
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
-	memset(host_ip, 0, dst_buf_sz1 + 1);
 	if(data_base_shared_memory_analysis != nullptr){
-		string query = "SELECT DISTINCT host_ix FROM hosts_ports_hits";
-		data_base_shared_memory_analysis->hosts_ports_hits->SELECT(l_hosts, query);
+		std::vector<uint32_t> host_ixs;
+		data_base_shared_memory_analysis->hosts_ports_hits->getHostIxs(host_ixs);
+		for (std::vector<uint32_t>::const_iterator it = host_ixs.begin(); it != host_ixs.end(); ++it)
+			find_orphan_host_ix(*it, &orphans);
 	}else{
-		resp = sqlite_get_unique_list_of_hosts_ix(l_hosts, dst_buf_sz, DB_LOCATION);
+		sqlite_for_each_unique_host_ix(find_orphan_host_ix, &orphans, DB_LOCATION);
 	}
 
-	if (resp == 0) {
-
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
-
-			//std::cout << token1 << std::endl;
-			int rep;
-
-			if(data_base_shared_memory_analysis != nullptr){
-				string query = "SELECT host FROM hosts_table WHERE ix=" + atoi(token1);
-
-				rep = data_base_shared_memory_analysis->hosts->SELECT(host_ip, query);
-
-			}else{
-				rep = sqlite_get_host_by_ix(atoi(token1), host_ip, dst_buf_sz1, DB_LOCATION);
-			}
-
-			if (rep == 0) {
-				if (strlen(host_ip) == 0) {
-					//std::cout << token1 << std::endl;
-					/*
-					 * orphan rows detected in hosts_ports_hits table
-					 * by host_ix, delete the orphaned rows
-					 */
-					if(data_base_shared_memory_analysis != nullptr){
-						string query = "DELETE FROM hosts_ports_hits WHERE host_ix="+atoi(token1);
-						data_base_shared_memory_analysis->hosts_ports_hits->DELETE(query);
-					}else{
-						sqlite_remove_host_ports_all(atoi(token1), DB_LOCATION);
-					}
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-		}
+	/*
+	 * orphan rows detected in hosts_ports_hits table
+	 * by host_ix, delete the orphaned rows
+	 */
+	if(data_base_shared_memory_analysis != nullptr){
+		if (orphans.size() > 0)
+			data_base_shared_memory_analysis->hosts_ports_hits->deleteByHostIxs(std::vector<uint32_t>(orphans.begin(), orphans.end()));
+		return;
 	}
-	free(l_hosts);
-	free(host_ip);
+
+	for (std::vector<int>::const_iterator it = orphans.begin(); it != orphans.end(); ++it)
+		sqlite_remove_host_ports_all(*it, DB_LOCATION);
 }
 
 
@@ -341,6 +299,10 @@ int main(int argc, char *argv[]) {
     	} else if ((case_insensitive_compare(arg_one.c_str(), "-c"))) {
 		} else if ((case_insensitive_compare(arg_one.c_str(), "-s")) || (case_insensitive_compare(arg_one.c_str(), "--shared_memory"))) {
 			data_base_shared_memory_analysis = DataBase::create();
+			if (data_base_shared_memory_analysis == nullptr) {
+				std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+				return 1;
+			}
 		} else {
 			usage();
 			return 0;
@@ -405,6 +367,8 @@ int main(int argc, char *argv[]) {
 
 		LOCKOUT_TIME = cvv.get_lockout_time();
 		ENFORCE = cvv.get_enforce_mode();
+		SUBNET_BLOCK_THRESHOLD = cvv.get_subnet_block_threshold();
+		sqlite_handle_set_options(cvv.get_sqlite_busy_timeout(), cvv.get_sqlite_mmap_size(), cvv.get_sqlite_cache_size());
 
 	} else {
 		return 1;
@@ -413,6 +377,8 @@ int main(int argc, char *argv[]) {
 	IPTABLES_SUPPORTS_XLOCK = iptables_supports_xlock();
 
 	gargoyle_monitor_blacklist_shm = SharedIpConfig::Create(GARGOYLE_BLACKLIST_SHM_NAME, GARGOYLE_BLACKLIST_SHM_SZ);
+	gargoyle_monitor_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
+	gargoyle_monitor_aggregated_shm = SharedIpConfig::Create(GARGOYLE_AGGREGATED_SHM_NAME, GARGOYLE_AGGREGATED_SHM_SZ);
 
 	// processing loop
 	while (!stop) {
@@ -53,14 +53,17 @@
 #include "system_functions.h"
 #include "data_base.h"
 #include "string_functions.h"
+#include "block_aggregator.h"
 
 bool DEBUG = false;
 bool ENFORCE = true;
+size_t SUBNET_BLOCK_THRESHOLD = 0;
 size_t IPTABLES_SUPPORTS_XLOCK;
 
 char DB_LOCATION[SQL_CMD_MAX+1];
 SharedIpConfig *gargoyle_monitor_blacklist_shm = NULL;
 SharedIpConfig *gargoyle_whitelist_shm = nullptr;
+SharedIpConfig *gargoyle_aggregated_shm = nullptr;
 DataBase *data_base_shared_memory_analysis = nullptr;
 
 bool validate_ip_addr(std::string ip_addr)
@@ -127,6 +130,7 @@ int main(int argc, char *argv[])
     if (cvv.get_vals(config_file) == 0) {
 
         ENFORCE = cvv.get_enforce_mode();
+        SUBNET_BLOCK_THRESHOLD = cvv.get_subnet_block_threshold();
 
     } else {
         return 1;
@@ -145,6 +149,10 @@ int main(int argc, char *argv[])
 		case 3:
 			if((case_insensitive_compare(argv[1], "-s")) || (case_insensitive_compare(argv[1], "--shared_memory"))){
 				data_base_shared_memory_analysis = DataBase::create();
+				if (data_base_shared_memory_analysis == nullptr) {
+					std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+					return 1;
+				}
 				strncpy(ip, argv[2], 15);
 				ip[strlen(argv[2])] = '\0';
 				break;
@@ -155,6 +163,7 @@ int main(int argc, char *argv[])
 	}
 
 	gargoyle_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
+	gargoyle_aggregated_shm = SharedIpConfig::Create(GARGOYLE_AGGREGATED_SHM_NAME, GARGOYLE_AGGREGATED_SHM_SZ);
 
 	if (validate_ip_addr(ip)) {
 
@@ -172,17 +181,15 @@ int main(int argc, char *argv[])
 			if (DEBUG)
 				std::cout << "RuleIX: " << rule_ix << std::endl;
 
-			if (rule_ix > 0 && strcmp(ip, "") != 0) {
+			// blocked, but by a subnet rule instead of its own
+			bool aggregated = is_aggregated(ip, gargoyle_aggregated_shm);
+
+			if ((rule_ix > 0 || aggregated) && strcmp(ip, "") != 0) {
 
 				// find the host ix for the ip
 				int host_ix;
 				if(data_base_shared_memory_analysis != nullptr){
-					char result[SMALL_DEST_BUF];
-					memset(result, 0, SMALL_DEST_BUF);
-					string query = "SELECT ix FROM hosts_table WHERE host=" + string(ip);
-					if((host_ix = data_base_shared_memory_analysis->hosts->SELECT(result, query)) != -1){
-						host_ix = atol(result);
-					}
+					host_ix = data_base_shared_memory_analysis->hosts->findHostIx(ip);
 				}else{
 					host_ix = sqlite_get_host_ix(ip, DB_LOCATION);
 				}
@@ -190,15 +197,9 @@ int main(int argc, char *argv[])
 				if (host_ix > 0) {
 
 					// find the row ix for this host (in detected_hosts table)
-					size_t row_ix;
+					int row_ix;
 					if(data_base_shared_memory_analysis != nullptr){
-						string query = "SELECT ix FROM detected_hosts WHERE host_ix=" + host_ix;
-						char result[SMALL_DEST_BUF];
-						memset(result, 0, SMALL_DEST_BUF);
-						if((row_ix = data_base_shared_memory_analysis->detected_hosts->SELECT(result, query)) != -1){
-							row_ix = atol(result);
-						}
-
+						row_ix = data_base_shared_memory_analysis->detected_hosts->findByHostIx(host_ix);
 					}else{
 						row_ix = sqlite_get_detected_hosts_row_ix_by_host_ix(host_ix, DB_LOCATION);
 					}
@@ -208,34 +209,17 @@ int main(int argc, char *argv[])
 						if (DEBUG)
 							std::cout << "Host ix: " << host_ix << std::endl;
 						// delete all records for this host_ix from hosts_ports_hits table
-						size_t rhpa;
 						if(data_base_shared_memory_analysis != nullptr){
-							string query ="DELETE FROM hosts_ports_hits WHERE host_ix=" + host_ix;
-							rhpa = data_base_shared_memory_analysis->hosts_ports_hits->DELETE(query);
+							data_base_shared_memory_analysis->hosts_ports_hits->deleteByHostIx(host_ix);
 						}else{
-							rhpa = sqlite_remove_host_ports_all(host_ix, DB_LOCATION);
-						}
-
-						if (rhpa == 2) {
-
-							int rhpa_i;
-							for (rhpa_i = 0; rhpa_i < SQL_FAIL_RETRY; rhpa_i++) {
-								rhpa = sqlite_remove_host_ports_all(host_ix, DB_LOCATION);
-								if (rhpa == 2) {
-									continue;
-								}
-								if (rhpa == 0) {
-									break;
-								}
-							}
+							sqlite_remove_host_ports_all(host_ix, DB_LOCATION);
 						}
 
 						if (DEBUG)
 							std::cout << "Row ix: " << row_ix << std::endl;
 						// delete row from detected_hosts
 						if(data_base_shared_memory_analysis != nullptr){
-							string query = "DELETE FROM detected_hosts WHERE ix=" + row_ix;
-							data_base_shared_memory_analysis->detected_hosts->DELETE(query);
+							data_base_shared_memory_analysis->detected_hosts->deleteByIx(row_ix);
 						}else{
 							sqlite_remove_detected_host(row_ix, DB_LOCATION);
 						}
@@ -248,7 +232,18 @@ int main(int argc, char *argv[])
 							// reset last_seen to 1972 01/01/1972 00:00:00 UTC -> 63072000
 							reset_last_seen_host_table(host_ix, 63072000);
 
-							iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
+							if (rule_ix > 0) {
+								iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
+							} else {
+								/*
+								 * the ip is whitelisted by now, so the
+								 * aggregation pass splits the subnet
+								 * rule around it
+								 */
+								gargoyle_aggregated_shm->Remove(string(ip));
+								aggregate_chain_rules(gargoyle_aggregated_shm, gargoyle_whitelist_shm,
+										SUBNET_BLOCK_THRESHOLD, IPTABLES_SUPPORTS_XLOCK, DEBUG);
+							}
 
 							do_unblock_action_output(ip, (int) t_now, ENFORCE);
 
@@ -279,5 +274,9 @@ int main(int argc, char *argv[])
         delete gargoyle_whitelist_shm;
     }
 
+    if(gargoyle_aggregated_shm != nullptr) {
+        delete gargoyle_aggregated_shm;
+    }
+
 	return 0;
 }
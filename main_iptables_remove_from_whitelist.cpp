@@ -106,6 +106,10 @@ int main(int argc, char *argv[])
 		case 3:
 			if((case_insensitive_compare(argv[1], "-s")) || (case_insensitive_compare(argv[1], "--shared_memory"))){
 				data_base_shared_memory_analysis = DataBase::create();
+				if (data_base_shared_memory_analysis == nullptr) {
+					std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+					return 1;
+				}
 				strncpy(ip, argv[2], 15);
 				ip[strlen(argv[2])] = '\0';
 				break;
@@ -125,25 +129,15 @@ int main(int argc, char *argv[])
 			// find the host ix for the ip
 			int host_ix;
 			if(data_base_shared_memory_analysis != nullptr){
-				char result[SMALL_DEST_BUF];
-				memset(result, 0, SMALL_DEST_BUF);
-				string query = "SELECT ix FROM hosts_table WHERE host=" + string(ip);
-				if((host_ix = data_base_shared_memory_analysis->hosts->SELECT(result, query)) != -1){
-					host_ix = atol(result);
-				}
+				host_ix = data_base_shared_memory_analysis->hosts->findHostIx(ip);
 			}else{
 				host_ix = sqlite_get_host_ix(ip, DB_LOCATION);
 			}
 
 			if (host_ix > 0) {
 				int result;
-				char buffer[SMALL_DEST_BUF];
-				memset(buffer, 0, SMALL_DEST_BUF);
 				if(data_base_shared_memory_analysis != nullptr){
-					string query = "SELECT host_ix FROM ignore_ip_list WHERE host_ix=" + host_ix;
-					if((result = data_base_shared_memory_analysis->ignore_ip_list->SELECT(buffer, query)) != -1){
-						result = atoi(buffer);
-					}
+					result = data_base_shared_memory_analysis->ignore_ip_list->findByHostIx(host_ix);
 				}else{
 					result = sqlite_is_host_ignored(host_ix, DB_LOCATION);
 				}
@@ -153,8 +147,7 @@ int main(int argc, char *argv[])
 					// remove from DB
 					// remove from DB
 					if(data_base_shared_memory_analysis != nullptr){
-						string query = "DELETE FROM ignore_ip_list WHERE host_ix=" + host_ix;
-						data_base_shared_memory_analysis->ignore_ip_list->DELETE(query);
+						data_base_shared_memory_analysis->ignore_ip_list->deleteByHostIx(host_ix);
 					}else{
 						sqlite_remove_host_to_ignore(host_ix, DB_LOCATION);
 					}
@@ -48,6 +48,7 @@
 #include <csignal>
 #include <map>
 
+#include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <arpa/inet.h>
@@ -62,6 +63,8 @@
 #endif
 
 #include "ip_addr_controller.h"
+#include "block_action_queue.h"
+#include "hit_write_behind.h"
 #include "sqlite_wrapper_api.h"
 #include "iptables_wrapper_api.h"
 #include "gargoyle_config_vals.h"
@@ -90,7 +93,8 @@ int BUF_SZ = 2048;
  *  2 == invalid regular expression detected
  */
 volatile int ret_code = 0;
-volatile bool stop_processing = false;
+volatile sig_atomic_t stop_processing = 0;
+volatile sig_atomic_t caught_signal = 0;
 
 std::vector<std::string> sshd_regexes;
 std::map<std::string, int[2]> IP_HITMAP;
@@ -99,6 +103,8 @@ size_t IPTABLES_SUPPORTS_XLOCK;
 size_t ITER_CNT_MAX = 50;
 SharedIpConfig *gargoyle_sshbf_whitelist_shm = NULL;
 DataBase *data_base_shared_memory_analysis = nullptr;
+BlockActionQueue *gargoyle_sshbf_block_queue = NULL;
+HitWriteBehind *gargoyle_sshbf_write_behind = NULL;
 
 size_t get_regexes(const char *);
 void signal_handler(int);
@@ -107,6 +113,7 @@ int handle_log_line(const std::string &);
 void process_iteration(int, int);
 std::string hunt_for_ip_addr(std::string);
 void handle_ip_addr(const std::string &);
+void block_ip_addr(const std::string &, int);
 
 
 size_t get_regexes(const char *fname) {
@@ -127,17 +134,14 @@ size_t get_regexes(const char *fname) {
 
 
 
+/*
+ * only flags the stop, the main loop winds down and the
+ * workers are stopped from main (see the end of main)
+ */
 void signal_handler(int signum) {
 
-	stop_processing = true;
-	syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, signum, PROG_TERM_SYSLOG);
-
-	if(data_base_shared_memory_analysis != nullptr){
-		delete data_base_shared_memory_analysis;
-	}
-
-	// terminate program
-	exit(ret_code);
+	caught_signal = signum;
+	stop_processing = 1;
 
 }
 
@@ -203,16 +207,7 @@ int handle_log_line(const std::string &line) {
 
 			if (validate_ip_address(ip_addr)) {
 
-				do_block_actions(ip_addr,
-					50,
-					DB_LOCATION,
-					IPTABLES_SUPPORTS_XLOCK,
-					ENFORCE,
-					(void *)gargoyle_sshbf_whitelist_shm,
-					DEBUG,
-					"",
-					data_base_shared_memory_analysis
-				);
+				block_ip_addr(ip_addr, 50);
 
 			}
 
@@ -322,16 +317,7 @@ int handle_log_line(const std::string &line) {
 
 		if (validate_ip_address(ip_addr)) {
 
-				do_block_actions(ip_addr,
-					50,
-					DB_LOCATION,
-					IPTABLES_SUPPORTS_XLOCK,
-					ENFORCE,
-					(void *)gargoyle_sshbf_whitelist_shm,
-					DEBUG,
-					"",
-					data_base_shared_memory_analysis
-				);
+				block_ip_addr(ip_addr, 50);
 
 		}
 
@@ -408,6 +394,28 @@ int handle_log_line(const std::string &line) {
 #endif
 
 
+void block_ip_addr(const std::string &ip_addr, int detection_type) {
+
+	/*
+	 * the enforcement worker does the iptables and DB
+	 * work, we only block inline if it cannot take it
+	 */
+	if (gargoyle_sshbf_block_queue && gargoyle_sshbf_block_queue->Enqueue(ip_addr, detection_type) == 0)
+		return;
+
+	do_block_actions(ip_addr,
+		detection_type,
+		DB_LOCATION,
+		IPTABLES_SUPPORTS_XLOCK,
+		ENFORCE,
+		(void *)gargoyle_sshbf_whitelist_shm,
+		DEBUG,
+		"",
+		data_base_shared_memory_analysis
+	);
+}
+
+
 void process_iteration(int num_seconds, int num_hits) {
 
 	for (const auto &p : IP_HITMAP) {
@@ -426,16 +434,7 @@ void process_iteration(int num_seconds, int num_hits) {
 		 */
 		if (l_num_hits >= (num_hits * 2)) {
 
-			do_block_actions(ip_addr,
-				50,
-				DB_LOCATION,
-				IPTABLES_SUPPORTS_XLOCK,
-				ENFORCE,
-				(void *)gargoyle_sshbf_whitelist_shm,
-				DEBUG,
-				"",
-				data_base_shared_memory_analysis
-			);
+			block_ip_addr(ip_addr, 50);
 
 			IP_HITMAP.erase(ip_addr);
 
@@ -443,16 +442,7 @@ void process_iteration(int num_seconds, int num_hits) {
 
 			if (l_num_hits >= (num_hits * 3)) {
 
-				do_block_actions(ip_addr,
-					50,
-					DB_LOCATION,
-					IPTABLES_SUPPORTS_XLOCK,
-					ENFORCE,
-					(void *)gargoyle_sshbf_whitelist_shm,
-					DEBUG,
-					"",
-					data_base_shared_memory_analysis
-				);
+				block_ip_addr(ip_addr, 50);
 
 			}
 
@@ -462,16 +452,7 @@ void process_iteration(int num_seconds, int num_hits) {
 
 			if (l_num_hits >= num_hits) {
 
-				do_block_actions(ip_addr,
-					50,
-					DB_LOCATION,
-					IPTABLES_SUPPORTS_XLOCK,
-					ENFORCE,
-					(void *)gargoyle_sshbf_whitelist_shm,
-					DEBUG,
-					"",
-					data_base_shared_memory_analysis
-				);
+				block_ip_addr(ip_addr, 50);
 
 				IP_HITMAP.erase(ip_addr);
 
@@ -556,16 +537,7 @@ public:
 
 				if (validate_ip_address(ip_addr)) {
 
-					do_block_actions(ip_addr,
-						50,
-						DB_LOCATION,
-						IPTABLES_SUPPORTS_XLOCK,
-						ENFORCE,
-						(void *)gargoyle_sshbf_whitelist_shm,
-						DEBUG,
-						"",
-						data_base_shared_memory_analysis
-					);
+					block_ip_addr(ip_addr, 50);
 
 				}
 
@@ -651,7 +623,7 @@ public:
 			std::cout << std::endl << "Regex exception: " << e.what() << std::endl;
 			std::cout << "Regex exception code is: " << e.code() << std::endl;
 			std::cout << "Cannot continue ..." << std::endl << std::endl;
-			stop_processing = true;
+			stop_processing = 1;
 
 			ret_code = 2;
 			return;
@@ -677,9 +649,15 @@ private:
 int main(int argc, char *argv[])
 {
 
-	// register signal SIGINT and signal handler
-	signal(SIGINT, signal_handler);
-	signal(SIGKILL, signal_handler);
+	/*
+	 * register signal SIGINT and signal handler, without
+	 * SA_RESTART so a blocking read returns to the loop
+	 */
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = signal_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
 
 	if (geteuid() != 0) {
     	std::cerr << std::endl << "Root privileges are necessary for this to run ..." << std::endl << std::endl;
@@ -702,6 +680,10 @@ int main(int argc, char *argv[])
     		return 0;
 		}else if ((case_insensitive_compare(arg_one.c_str(), "-s")) || (case_insensitive_compare(arg_one.c_str(), "--shared_memory"))){
 			data_base_shared_memory_analysis = DataBase::create();
+			if (data_base_shared_memory_analysis == nullptr) {
+				std::cerr << std::endl << "Cannot attach to the shared memory tables, see syslog" << std::endl << std::endl;
+				return 1;
+			}
 	 	}else if ((case_insensitive_compare(arg_one.c_str(), "-c"))) { }
 
     	else {
@@ -800,9 +782,22 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (sqlite_migrate_schema(DB_LOCATION) != 0) {
+		syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", DB_FILE_SYSLOG, DB_LOCATION, "could not be migrated to the current schema");
+	}
+
 	gargoyle_sshbf_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
 
 	IPTABLES_SUPPORTS_XLOCK = iptables_supports_xlock();
+	if (data_base_shared_memory_analysis == nullptr) {
+		gargoyle_sshbf_write_behind = HitWriteBehind::Create(DB_LOCATION);
+		set_write_behind(gargoyle_sshbf_write_behind);
+	}
+	gargoyle_sshbf_block_queue = BlockActionQueue::Create(DB_LOCATION,
+			IPTABLES_SUPPORTS_XLOCK,
+			ENFORCE,
+			data_base_shared_memory_analysis != nullptr,
+			DEBUG);
 
 
 	BASE_TIME = (int) time(NULL);
@@ -849,7 +844,7 @@ int main(int argc, char *argv[])
 	} else if (use_journalctl) {
 
 		char buff[BUF_SZ];
-		while(true) {
+		while(!stop_processing) {
 
 			int now = (int)time(NULL);
 			if ((now - BASE_TIME) >= 60) {
@@ -883,11 +878,31 @@ int main(int argc, char *argv[])
 
 			}
 
-			std::this_thread::sleep_for (std::chrono::seconds(30));
+			// cut short by a signal
+			sleep(30);
 
 		}
 
 	}
 
+	if (caught_signal)
+		syslog(LOG_INFO | LOG_LOCAL6, "%s: %d, %s", SIGNAL_CAUGHT_SYSLOG, (int)caught_signal, PROG_TERM_SYSLOG);
+
+	// apply whatever is still queued before the handles go away
+	if (gargoyle_sshbf_block_queue) {
+		delete gargoyle_sshbf_block_queue;
+	}
+	if (gargoyle_sshbf_write_behind) {
+		set_write_behind(NULL);
+		delete gargoyle_sshbf_write_behind;
+	}
+
+	if (gargoyle_sshbf_whitelist_shm)
+		delete gargoyle_sshbf_whitelist_shm;
+
+	if(data_base_shared_memory_analysis != nullptr){
+		delete data_base_shared_memory_analysis;
+	}
+
 	return ret_code;
 }
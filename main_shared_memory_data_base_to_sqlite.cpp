@@ -77,10 +77,151 @@ void handle_signal(int signum) {
     exit(0);
 }
 
-void sqlite_remove_all_by_table(const char *db, const char *table){
-    if(sqlite_remove_all(db, table) != 0){
-        cerr << "Error deleting records in " << table << endl;
-        exit(1);
+/*
+ * Brings table_name in SQLite in line with the shared memory table.
+ * synced holds the rows as last written, sorted by ix: rows no longer
+ * in the table are deleted, new and changed ones are passed to write,
+ * and the rest are left alone. Deletes go first so a row that was
+ * removed and added back under a new ix does not trip a UNIQUE column.
+ * With full the SQLite table is emptied and every row written.
+ *
+ * Runs inside the caller's transaction and leaves synced as the table
+ * is now, a caller that rolls back has to go full the next time.
+ * returns 0 = ok
+ */
+template <typename TypeRecord, typename Write>
+int sync_table(SharedMemoryTable<TypeRecord> *table, const char *table_name, bool full,
+        vector<TypeRecord> &synced, Write write, size_t &changed){
+    vector<TypeRecord> current;
+    vector<const TypeRecord *> writes;
+    changed = 0;
+
+    if(table->getAll(current) < 0){
+        return 1;
+    }
+    sort(current.begin(), current.end(), [](const TypeRecord &a, const TypeRecord &b){return a.ix < b.ix;});
+
+    if(full){
+        if(sqlite_remove_all(DB_LOCATION, table_name) != 0){
+            return 1;
+        }
+        for(typename vector<TypeRecord>::const_iterator it = current.begin(); it != current.end(); ++it){
+            writes.push_back(&*it);
+        }
+    }else{
+        typename vector<TypeRecord>::const_iterator old_it = synced.begin();
+        typename vector<TypeRecord>::const_iterator new_it = current.begin();
+        while(old_it != synced.end() || new_it != current.end()){
+            if(new_it == current.end() || (old_it != synced.end() && old_it->ix < new_it->ix)){
+                if(sqlite_remove_ix_by_table(old_it->ix, DB_LOCATION, table_name) != 0){
+                    return 1;
+                }
+                changed++;
+                ++old_it;
+            }else if(old_it == synced.end() || new_it->ix < old_it->ix){
+                writes.push_back(&*new_it);
+                ++new_it;
+            }else{
+                if(memcmp(&*old_it, &*new_it, sizeof(TypeRecord)) != 0){
+                    writes.push_back(&*new_it);
+                }
+                ++old_it;
+                ++new_it;
+            }
+        }
+    }
+
+    for(typename vector<const TypeRecord *>::const_iterator it = writes.begin(); it != writes.end(); ++it){
+        if(write(**it) != 0){
+            return 1;
+        }
+    }
+    changed += writes.size();
+    synced.swap(current);
+    return 0;
+}
+
+template <typename TypeRecord>
+void log_lock_stats(SharedMemoryTable<TypeRecord> *table, const char *table_name){
+    SharedMemoryTableLockStats stats;
+    table->getLockStats(stats);
+    syslog(LOG_INFO | LOG_LOCAL6, "%s lock stats %s: locks=%llu contended=%llu wait_ms=%llu max_wait_ms=%llu hold_ms=%llu max_hold_ms=%llu optimistic_reads=%llu optimistic_retries=%llu owner_deaths=%llu",
+            GARGOYLE_DEBUG, table_name,
+            (unsigned long long)stats.locks, (unsigned long long)stats.contended,
+            (unsigned long long)(stats.wait_ns / 1000000), (unsigned long long)(stats.max_wait_ns / 1000000),
+            (unsigned long long)(stats.hold_ns / 1000000), (unsigned long long)(stats.max_hold_ns / 1000000),
+            (unsigned long long)stats.optimistic_reads, (unsigned long long)stats.optimistic_retries,
+            (unsigned long long)stats.owner_deaths);
+}
+
+// what SQLite holds, as last written by sync_to_sqlite
+vector<Hosts_Record> synced_hosts;
+vector<Detected_Hosts_Record> synced_detected_hosts;
+vector<Hosts_Ports_Hits_Record> synced_hosts_ports_hits;
+vector<Ignore_IP_List_Record> synced_ignore_ip_list;
+vector<Black_IP_List_Record> synced_black_ip_list;
+/*
+ * nothing is known about what SQLite holds until the first pass,
+ * which rewrites every table. after that only changed rows are
+ * written, unless a pass fails and is rolled back
+ */
+bool full = true;
+
+void sync_to_sqlite(bool debug){
+    size_t changed[5] = {0, 0, 0, 0, 0};
+    int ret = 0;
+
+    if(sqlite_begin_transaction(DB_LOCATION) != 0){
+        syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG,
+                "Error in starting the periodical write of shared memory database to SQLite");
+        return;
+    }
+
+    ret = sync_table(data_base_shared_memory->hosts, HOSTS_TABLE, full, synced_hosts,
+            [](const Hosts_Record &record){
+                return sqlite_add_host_all(record.ix, record.host, record.first_seen, record.last_seen, DB_LOCATION);
+            }, changed[0]);
+    if(ret == 0){
+        ret = sync_table(data_base_shared_memory->detected_hosts, DETECTED_HOSTS_TABLE, full, synced_detected_hosts,
+                [](const Detected_Hosts_Record &record){
+                    return (int)sqlite_add_all_by_table(record.ix, record.host_ix, record.timestamp, DB_LOCATION, DETECTED_HOSTS_TABLE);
+                }, changed[1]);
+    }
+    if(ret == 0){
+        ret = sync_table(data_base_shared_memory->hosts_ports_hits, HOSTS_PORTS_HITS_TABLE, full, synced_hosts_ports_hits,
+                [](const Hosts_Ports_Hits_Record &record){
+                    return sqlite_add_host_port_hit_all(record.ix, record.host_ix, record.port_number, record.hit_count, DB_LOCATION);
+                }, changed[2]);
+    }
+    if(ret == 0){
+        ret = sync_table(data_base_shared_memory->ignore_ip_list, IGNORE_IP_LIST_TABLE, full, synced_ignore_ip_list,
+                [](const Ignore_IP_List_Record &record){
+                    return (int)sqlite_add_all_by_table(record.ix, record.host_ix, record.timestamp, DB_LOCATION, IGNORE_IP_LIST_TABLE);
+                }, changed[3]);
+    }
+    if(ret == 0){
+        ret = sync_table(data_base_shared_memory->black_ip_list, BLACK_LIST_TABLE, full, synced_black_ip_list,
+                [](const Black_IP_List_Record &record){
+                    return (int)sqlite_add_all_by_table(record.ix, record.host_ix, record.timestamp, DB_LOCATION, BLACK_LIST_TABLE);
+                }, changed[4]);
+    }
+
+    if(ret == 0 && sqlite_commit_transaction(DB_LOCATION) == 0){
+        if(debug){
+            syslog(LOG_INFO | LOG_LOCAL6, "%s Wrote %s periodical of shared memory database to SQLite: %zu %s, %zu %s, %zu %s, %zu %s, %zu %s rows",
+                    GARGOYLE_DEBUG, full ? "full" : "incremental",
+                    changed[0], HOSTS_TABLE, changed[1], DETECTED_HOSTS_TABLE, changed[2], HOSTS_PORTS_HITS_TABLE,
+                    changed[3], IGNORE_IP_LIST_TABLE, changed[4], BLACK_LIST_TABLE);
+        }
+        full = false;
+    }else{
+        if(ret == 0 || sqlite_rollback_transaction(DB_LOCATION) != 0){
+            syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG,
+                    "Error in ending the periodical write of shared memory database to SQLite");
+        }
+        syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG,
+                "Error in writing periodical of shared memory database to SQLite, the next one rewrites every table");
+        full = true;
     }
 }
 
@@ -109,6 +250,10 @@ int main(int argc, char *argv[]) {
         string arg_one = argv[1];
         if((case_insensitive_compare(arg_one.c_str(), "-s")) || (case_insensitive_compare(arg_one.c_str(), "--shared_memory"))){
             data_base_shared_memory = DataBase::create();
+            if(data_base_shared_memory == nullptr){
+                cerr << endl << "Cannot attach to the shared memory tables, see syslog" << endl << endl;
+                exit(1);
+            }
         }else{
             cerr << endl << "Usage: ./gargoyle_shared_memory_data_base_to_sqlite <-s | --shared_memory>" << endl << endl;
             exit(1);
@@ -117,7 +262,9 @@ int main(int argc, char *argv[]) {
 
     // Get config data
     bool enforce_mode = true;
-    size_t shared_memory_data_base_to_sqlite_time;
+    // the shipped .gargoyle_config value, kept when there is no config to read
+    size_t shared_memory_data_base_to_sqlite_time = 900;
+    long shared_memory_snapshot_interval = 0;
 
     const char *config_file;
     config_file = getenv("GARGOYLE_CONFIG");
@@ -128,10 +275,11 @@ int main(int argc, char *argv[]) {
     if(cvv.get_vals(config_file) == 0) {
         enforce_mode = cvv.get_enforce_mode();
         shared_memory_data_base_to_sqlite_time = cvv.get_shared_memory_data_base_to_sqlite_time();
-        if(shared_memory_data_base_to_sqlite_time == -1){
+        if(shared_memory_data_base_to_sqlite_time == (size_t) -1){
             cerr << "None shared_memory_data_base_to_sqlite_time key in " << config_file << endl;
             exit(1);
         }
+        shared_memory_snapshot_interval = cvv.get_shared_memory_snapshot_interval();
     }
 
     /*
@@ -160,192 +308,46 @@ int main(int argc, char *argv[]) {
         DEBUG = true;
     }
 
-    string query;
-    char result[DEST_BUF_SZ];
-    const char *tok1 = ">", *tok2 = ":";
-    char *token1, *token1_save, *token2, *token2_save;
-    int iter_cnt;
-    Hosts_Record host_record;
-    Detected_Hosts_Record detected_hosts_record;
-    Hosts_Ports_Hits_Record hosts_port_hit_record;
-    Ignore_IP_List_Record ignore_ip_list_record;
-    Black_IP_List_Record black_ip_list_record;
-
+    /*
+     * the SQLite write and the binary snapshot run on their own
+     * intervals, sleep until whichever is due first
+     */
+    time_t next_sync = 0;
+    time_t next_snapshot = 0;
     while(true){
-        // hosts_table
-        sqlite_remove_all_by_table(gargoyle_db_file, HOSTS_TABLE);
-        query = "SELECT * FROM hosts_table";
-        data_base_shared_memory->hosts->SELECT(result, query);
-
-        token1 = strtok_r(result, tok1, &token1_save);
-        while (token1 != NULL) {
-            iter_cnt = 0;
-            token2 = strtok_r(token1, tok2, &token2_save);
-            while (token2 != NULL) {
-                if (iter_cnt == 0) {
-                    host_record.ix = atoll(token2);
-                } else if (iter_cnt == 1) {
-                    snprintf(host_record.host, LENGTH_IPV4, "%s", token2);
-                } else if (iter_cnt == 2) {
-                    host_record.first_seen = atoll(token2);
-                } else if (iter_cnt == 3) {
-                    host_record.last_seen = atoll(token2);
-                }
-                iter_cnt++;
-                token2 = strtok_r(NULL, tok2, &token2_save);
-            }
-            token1 = strtok_r(NULL, tok1, &token1_save);
-            if(sqlite_add_host_all(host_record.ix, host_record.host, host_record.first_seen, host_record.last_seen, gargoyle_db_file) != 0){
-                syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                        "Error in writing periodical of shared memory database to SQLite table ", HOSTS_TABLE);
-                exit(1);
-            }
-        }
-
-        if(gargoyle_debug_flag){
-            syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                    "Writing periodical of shared memory database to SQLite table ", HOSTS_TABLE);
-        }
-
-        // detected_hosts
-        sqlite_remove_all_by_table(gargoyle_db_file, DETECTED_HOSTS_TABLE);
-        query = "SELECT * FROM detected_hosts";
-        data_base_shared_memory->detected_hosts->SELECT(result, query);
-
-        token1 = strtok_r(result, tok1, &token1_save);
-        while (token1 != NULL) {
-            iter_cnt = 0;
-            token2 = strtok_r(token1, tok2, &token2_save);
-            while (token2 != NULL) {
-                if (iter_cnt == 0) {
-                    detected_hosts_record.ix = atoll(token2);
-                } else if (iter_cnt == 1) {
-                    detected_hosts_record.host_ix = atoll(token2);
-                } else if (iter_cnt == 2) {
-                    detected_hosts_record.timestamp = atoll(token2);
-                }
-                iter_cnt++;
-                token2 = strtok_r(NULL, tok2, &token2_save);
-            }
-            token1 = strtok_r(NULL, tok1, &token1_save);
-            if(sqlite_add_all_by_table(detected_hosts_record.ix, detected_hosts_record.host_ix, detected_hosts_record.timestamp,
-                    gargoyle_db_file, DETECTED_HOSTS_TABLE) != 0){
-                syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                        "Error in writing periodical of shared memory database to SQLite table ", DETECTED_HOSTS_TABLE);
-                exit(1);
-            }
-        }
-
-        if(gargoyle_debug_flag){
-            syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                    "Writing periodical of shared memory database to SQLite table ", DETECTED_HOSTS_TABLE);
-        }
-
-        // hosts_ports_hits
-        sqlite_remove_all_by_table(gargoyle_db_file, HOSTS_PORTS_HITS_TABLE);
-        query = "SELECT * FROM hosts_ports_hits";
-        data_base_shared_memory->hosts_ports_hits->SELECT(result, query);
-
-        token1 = strtok_r(result, tok1, &token1_save);
-        while (token1 != NULL) {
-            iter_cnt = 0;
-            token2 = strtok_r(token1, tok2, &token2_save);
-            while (token2 != NULL) {
-                if (iter_cnt == 0) {
-                    hosts_port_hit_record.ix = atoll(token2);
-                } else if (iter_cnt == 1) {
-                    hosts_port_hit_record.host_ix = atoll(token2);
-                } else if (iter_cnt == 2) {
-                    hosts_port_hit_record.port_number = atoll(token2);
-                } else if (iter_cnt == 3){
-                    hosts_port_hit_record.hit_count = atoll(token2);
-                }
-                iter_cnt++;
-                token2 = strtok_r(NULL, tok2, &token2_save);
-            }
-            token1 = strtok_r(NULL, tok1, &token1_save);
-            if(sqlite_add_host_port_hit_all(hosts_port_hit_record.ix, hosts_port_hit_record.host_ix,
-                    hosts_port_hit_record.port_number, hosts_port_hit_record.hit_count, gargoyle_db_file) != 0){
-                syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                        "Error in writing periodical of shared memory database to SQLite table ", HOSTS_PORTS_HITS_TABLE);
-                exit(1);
+        time_t now = time(NULL);
+        if(now >= next_sync){
+            sync_to_sqlite(gargoyle_debug_flag != NULL);
+
+            if(gargoyle_debug_flag){
+                log_lock_stats(data_base_shared_memory->hosts, HOSTS_TABLE);
+                log_lock_stats(data_base_shared_memory->detected_hosts, DETECTED_HOSTS_TABLE);
+                log_lock_stats(data_base_shared_memory->hosts_ports_hits, HOSTS_PORTS_HITS_TABLE);
+                log_lock_stats(data_base_shared_memory->ignore_ip_list, IGNORE_IP_LIST_TABLE);
+                log_lock_stats(data_base_shared_memory->black_ip_list, BLACK_LIST_TABLE);
             }
+            next_sync = now + shared_memory_data_base_to_sqlite_time;
         }
 
-        if(gargoyle_debug_flag){
-            syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                    "Writing periodical of shared memory database to SQLite table ", HOSTS_PORTS_HITS_TABLE);
-        }
-
-        // ignore_ip_list
-        sqlite_remove_all_by_table(gargoyle_db_file, IGNORE_IP_LIST_TABLE);
-        query = "SELECT * FROM ignore_ip_list";
-        data_base_shared_memory->ignore_ip_list->SELECT(result, query);
-
-        token1 = strtok_r(result, tok1, &token1_save);
-        while (token1 != NULL) {
-            iter_cnt = 0;
-            token2 = strtok_r(token1, tok2, &token2_save);
-            while (token2 != NULL) {
-                if (iter_cnt == 0) {
-                    ignore_ip_list_record.ix = atoll(token2);
-                } else if (iter_cnt == 1) {
-                    ignore_ip_list_record.host_ix = atoll(token2);
-                } else if (iter_cnt == 2) {
-                    ignore_ip_list_record.timestamp = atoll(token2);
-                }
-                iter_cnt++;
-                token2 = strtok_r(NULL, tok2, &token2_save);
-            }
-            token1 = strtok_r(NULL, tok1, &token1_save);
-            if(sqlite_add_all_by_table(ignore_ip_list_record.ix, ignore_ip_list_record.host_ix,
-                    ignore_ip_list_record.timestamp, gargoyle_db_file, IGNORE_IP_LIST_TABLE) != 0){
-                syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                        "Error in writing periodical of shared memory database to SQLite table ", IGNORE_IP_LIST_TABLE);
-                exit(1);
+        if(shared_memory_snapshot_interval > 0 && now >= next_snapshot){
+            if(data_base_shared_memory->saveSnapshots(DB_LOCATION) != 0){
+                syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG,
+                        "Error in writing the shared memory database snapshot, the previous one is kept");
+            }else if(gargoyle_debug_flag){
+                syslog(LOG_INFO | LOG_LOCAL6, "%s %s", GARGOYLE_DEBUG,
+                        "Wrote the shared memory database snapshot");
             }
+            next_snapshot = now + shared_memory_snapshot_interval;
         }
 
-        if(gargoyle_debug_flag){
-            syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                    "Writing periodical of shared memory database to SQLite table ", IGNORE_IP_LIST_TABLE);
+        time_t wake = next_sync;
+        if(shared_memory_snapshot_interval > 0 && next_snapshot < wake){
+            wake = next_snapshot;
         }
-
-        // black_ip_list
-        sqlite_remove_all_by_table(gargoyle_db_file, BLACK_LIST_TABLE);
-        query = "SELECT * FROM black_ip_list";
-        data_base_shared_memory->black_ip_list->SELECT(result, query);
-
-        token1 = strtok_r(result, tok1, &token1_save);
-        while (token1 != NULL) {
-            iter_cnt = 0;
-            token2 = strtok_r(token1, tok2, &token2_save);
-            while (token2 != NULL) {
-                if (iter_cnt == 0) {
-                    black_ip_list_record.ix = atoll(token2);
-                } else if (iter_cnt == 1) {
-                    black_ip_list_record.host_ix = atoll(token2);
-                } else if (iter_cnt == 2) {
-                    black_ip_list_record.timestamp = atoll(token2);
-                }
-                iter_cnt++;
-                token2 = strtok_r(NULL, tok2, &token2_save);
-            }
-            token1 = strtok_r(NULL, tok1, &token1_save);
-            if(sqlite_add_all_by_table(black_ip_list_record.ix, black_ip_list_record.host_ix,
-                    black_ip_list_record.timestamp, gargoyle_db_file, BLACK_LIST_TABLE) != 0){
-                syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                        "Error in writing periodical of shared memory database to SQLite table ", BLACK_LIST_TABLE);
-                exit(1);
-            }
-        }
-
-        if(gargoyle_debug_flag){
-            syslog(LOG_INFO | LOG_LOCAL6, "%s %s %s", GARGOYLE_DEBUG,
-                    "Writing periodical of shared memory database to SQLite table ", BLACK_LIST_TABLE);
+        now = time(NULL);
+        if(wake > now){
+            sleep(wake - now);
         }
-
-        sleep(shared_memory_data_base_to_sqlite_time);
     }
 
     return 0;
@@ -137,6 +137,7 @@ int levenshtein(const char *s1, const char *s2) {
     }
     return(column[s1len]);
 }
+
 /////////////////////////////////////////////////////////////////////////////////
 
 GargoylePscandHandler::GargoylePscandHandler() {
@@ -152,9 +153,30 @@ GargoylePscandHandler::GargoylePscandHandler() {
 	DEBUG = false;
 	DATA_BASE_TYPE = "sqlite";
 
-	gargoyle_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ);
-	gargoyle_blacklist_shm = SharedIpConfig::Create(GARGOYLE_BLACKLIST_SHM_NAME, GARGOYLE_BLACKLIST_SHM_SZ);
+	gargoyle_whitelist_shm = NULL;
+	gargoyle_blacklist_shm = NULL;
 	gargoyle_data_base_shared_memory = nullptr;
+	block_action_queue = NULL;
+}
+
+
+/*
+ * attaches the white and black lists, called from main once
+ * it has made or replaced the shared regions. the white list
+ * is rebuilt from the local addrs and the ignore list, so one
+ * left by a build with another layout just gets replaced.
+ * -1 if either one is missing, the handler is not usable then
+ */
+int GargoylePscandHandler::attach_shared_config() {
+
+	if (!gargoyle_whitelist_shm)
+		gargoyle_whitelist_shm = SharedIpConfig::Create(GARGOYLE_WHITELIST_SHM_NAME, GARGOYLE_WHITELIST_SHM_SZ, true);
+	if (!gargoyle_blacklist_shm)
+		gargoyle_blacklist_shm = SharedIpConfig::Create(GARGOYLE_BLACKLIST_SHM_NAME, GARGOYLE_BLACKLIST_SHM_SZ);
+
+	if (!gargoyle_whitelist_shm || !gargoyle_blacklist_shm)
+		return -1;
+	return 0;
 }
 
 
@@ -534,7 +556,7 @@ bool GargoylePscandHandler::is_in_three_way_handshake(std::string s) {
 
 bool GargoylePscandHandler::is_white_listed_ip_addr(std::string s) {
 
-	bool result;
+	bool result = false;
 	gargoyle_whitelist_shm->Contains(s, &result);
 
 	if (result)
@@ -843,6 +865,18 @@ void GargoylePscandHandler::add_block_rule(std::string the_ip, int detection_typ
 			}
 		}
 
+		/*
+		 * with a worker running the chain lookup and the
+		 * block itself happen over there, the packet path
+		 * only pays for the enqueue
+		 */
+		if (block_action_queue != NULL && block_action_queue->Enqueue(the_ip, detection_type) == 0) {
+			if (is_in_black_listed_hosts(the_ip) == true) {
+				BLACK_LISTED_HOSTS.erase(the_ip);
+			}
+			return;
+		}
+
 		std::set<std::string> ip_tables_entries;
 		std::set<std::string>::iterator it;
 
@@ -851,9 +885,6 @@ void GargoylePscandHandler::add_block_rule(std::string the_ip, int detection_typ
 		char *token1;
 		char *token1_save;
 		*/
-		const char *tok1 = "\n";
-		char *token1;
-		char *token1_save;
 
 		/*
 		int resp;
@@ -866,41 +897,8 @@ void GargoylePscandHandler::add_block_rule(std::string the_ip, int detection_typ
 		int added_host_ix = 0;
 		int tstamp;
 
-		size_t d_buf_sz = DEST_BUF_SZ * 2;
-		char *l_hosts = (char*) malloc(d_buf_sz);
-
-		size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-		char *host_ip = (char*) malloc(dst_buf_sz1+1);
-
-		const char *dash_dash = "--  ";
-		size_t dash_dash_len = 4;
-		const char *w_space = " ";
-		char *s_lchains3;
-		char *s_lchains4;
-
 		// whats active in iptables?
-		iptables_list_chain(GARGOYLE_CHAIN_NAME, l_hosts, d_buf_sz, IPTABLES_SUPPORTS_XLOCK);
-		if (l_hosts) {
-			token1 = strtok_r(l_hosts, tok1, &token1_save);
-			while (token1 != NULL) {
-
-				s_lchains3 = strstr (token1, dash_dash);
-				if (s_lchains3) {
-
-					size_t position1 = s_lchains3 - token1;
-					s_lchains4 = strstr (token1 + position1 + dash_dash_len, w_space);
-					size_t position2 = s_lchains4 - token1;
-
-					*host_ip = 0;
-					if (bayshoresubstring(position1 + dash_dash_len, position2, token1, host_ip, 16)) {
-
-						ip_tables_entries.insert(host_ip);
-
-					}
-				}
-				token1 = strtok_r(NULL, tok1, &token1_save);
-			}
-		}
+		get_chain_entries(ip_tables_entries, IPTABLES_SUPPORTS_XLOCK);
 
 
 		if (ip_tables_entries.count(the_ip) == 0) {
@@ -923,13 +921,29 @@ void GargoylePscandHandler::add_block_rule(std::string the_ip, int detection_typ
 				BLACK_LISTED_HOSTS.erase(the_ip);
 			}
 		}
-		free(l_hosts);
-		free(host_ip);
 	}
 }
 
 
 
+void GargoylePscandHandler::block_ip(const std::string &the_ip, int detection_type) {
+
+	if (block_action_queue != NULL && block_action_queue->Enqueue(the_ip, detection_type) == 0)
+		return;
+
+	do_block_actions(the_ip,
+		detection_type,
+		DB_LOCATION,
+		IPTABLES_SUPPORTS_XLOCK,
+		ENFORCE,
+		(void *)gargoyle_whitelist_shm,
+		get_debug(),
+		"",
+		gargoyle_data_base_shared_memory
+	);
+}
+
+
 int GargoylePscandHandler::add_ip_to_hosts_table(std::string the_ip) {
 
 	int added_host_ix;
@@ -1138,50 +1152,20 @@ void GargoylePscandHandler::add_block_rules() {
 	char *host_ip = (char*) malloc(dst_buf_sz1+1);
 	*/
 
-	const char *tok1 = "\n";
-	char *token1;
-	char *token1_save;
-
-	size_t d_buf_sz = DEST_BUF_SZ * 2;
-	char *l_hosts = (char*) malloc(d_buf_sz);
-
-	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
-	char *host_ip = (char*) malloc(dst_buf_sz1+1);
-
-	const char *dash_dash = "--  ";
-	size_t dash_dash_len = 4;
-	const char *w_space = " ";
-	char *s_lchains3;
-	char *s_lchains4;
-
 	int added_host_ix;
 	added_host_ix = 0;
 	int tstamp;
 
 	// whats active in iptables?
-	iptables_list_chain(GARGOYLE_CHAIN_NAME, l_hosts, d_buf_sz, IPTABLES_SUPPORTS_XLOCK);
-
-	if (l_hosts) {
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
-
-			s_lchains3 = strstr (token1, dash_dash);
-			if (s_lchains3) {
+	get_chain_entries(ip_tables_entries, IPTABLES_SUPPORTS_XLOCK);
 
-				size_t position1 = s_lchains3 - token1;
-				s_lchains4 = strstr (token1 + position1 + dash_dash_len, w_space);
-				size_t position2 = s_lchains4 - token1;
-
-				*host_ip = 0;
-				if (bayshoresubstring(position1 + dash_dash_len, position2, token1, host_ip, 16)) {
-
-					ip_tables_entries.insert(host_ip);
-
-				}
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-		}
-	}
+	/*
+	 * everything this pass writes to the DB goes
+	 * out as one transaction
+	 */
+	bool in_transaction = false;
+	if (gargoyle_data_base_shared_memory == nullptr)
+		in_transaction = (sqlite_begin_transaction(DB_LOCATION.c_str()) == 0);
 
 
 
@@ -1299,16 +1283,7 @@ void GargoylePscandHandler::add_block_rules() {
 
 					if (ip_tables_entries.count(the_ip) == 0) {
 
-						do_block_actions(the_ip,
-							7,
-							DB_LOCATION,
-							IPTABLES_SUPPORTS_XLOCK,
-							ENFORCE,
-							(void *)gargoyle_whitelist_shm,
-							get_debug(),
-							"",
-							gargoyle_data_base_shared_memory
-						);
+						block_ip(the_ip, 7);
 
 						ip_tables_entries.insert(the_ip);
 					}
@@ -1359,16 +1334,7 @@ void GargoylePscandHandler::add_block_rules() {
 
 				if (ip_tables_entries.count(loc_ip_it->first) == 0) {
 
-					do_block_actions(loc_ip_it->first,
-						6,
-						DB_LOCATION,
-						IPTABLES_SUPPORTS_XLOCK,
-						ENFORCE,
-						(void *)gargoyle_whitelist_shm,
-						get_debug(),
-						"",
-						gargoyle_data_base_shared_memory
-					);
+					block_ip(loc_ip_it->first, 6);
 
 					ip_tables_entries.insert(loc_ip_it->first);
 				}
@@ -1377,11 +1343,11 @@ void GargoylePscandHandler::add_block_rules() {
 		}
 	}
 
-	free(l_hosts);
-	free(host_ip);
-
 	if (LOCAL_IP_ROW_CNT.size() > 0)
 		LOCAL_IP_ROW_CNT.clear();
+
+	if (in_transaction)
+		sqlite_commit_transaction(DB_LOCATION.c_str());
 }
 
 
@@ -1407,69 +1373,59 @@ void GargoylePscandHandler::set_single_port_scan_threshold(size_t t_val) {
 
 void GargoylePscandHandler::process_ignore_ip_list() {
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts = (char*) malloc(dst_buf_sz);
 	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
 	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
+	std::vector<sqlite_host_list_entry> ignored;
 
 	std::stringstream ss_orig;
 	gargoyle_whitelist_shm->ToString(ss_orig);
 	std::string white_list_orig = ss_orig.str();
 
 
-	size_t resp = get_hosts_to_ignore_all(l_hosts, dst_buf_sz, DB_LOCATION.c_str());
-
-	if (resp == 0) {
+	get_host_list_entries(IGNORE_IP_LIST_TABLE, ignored);
 
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
+	for (std::vector<sqlite_host_list_entry>::const_iterator it = ignored.begin(); it != ignored.end(); ++it) {
 
-			if (atoi(token1) > 0) {
+		int host_ix = it->host_ix;
+		if (host_ix <= 0)
+			continue;
 
-				int host_ix = atoi(token1);
-				get_host_by_ix(host_ix, host_ip, dst_buf_sz1, DB_LOCATION.c_str());
+		*host_ip = 0;
+		get_host_by_ix(host_ix, host_ip, dst_buf_sz1, DB_LOCATION.c_str());
 
-				if (strcmp(host_ip, "") != 0) {
+		if (strcmp(host_ip, "") != 0) {
 
-					add_to_white_listed_entries(host_ip);
+			add_to_white_listed_entries(host_ip);
 
-					/*
-					 * the ip addr in question is now being ignored
-					 * so if an entry for it exists in iptables (along
-					 * with the relevant DB data) that needs to get
-					 * cleaned up
-					 */
-					size_t rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, host_ip, IPTABLES_SUPPORTS_XLOCK);
-					if(rule_ix > 0) {
+			/*
+			 * the ip addr in question is now being ignored
+			 * so if an entry for it exists in iptables (along
+			 * with the relevant DB data) that needs to get
+			 * cleaned up
+			 */
+			size_t rule_ix = iptables_find_rule_in_chain(GARGOYLE_CHAIN_NAME, host_ip, IPTABLES_SUPPORTS_XLOCK);
+			if(rule_ix > 0) {
 
-						size_t row_ix = get_detected_hosts_row_ix_by_host_ix(host_ix, DB_LOCATION.c_str());
+				size_t row_ix = get_detected_hosts_row_ix_by_host_ix(host_ix, DB_LOCATION.c_str());
 
-						if (row_ix > 0) {
+				if (row_ix > 0) {
 
-							// delete all records for this host_ix from hosts_ports_hits table
-							remove_host_ports_all(host_ix, DB_LOCATION.c_str());
+					// delete all records for this host_ix from hosts_ports_hits table
+					remove_host_ports_all(host_ix, DB_LOCATION.c_str());
 
-							// delete row from detected_hosts
-							remove_detected_host(row_ix, DB_LOCATION.c_str());
+					// delete row from detected_hosts
+					remove_detected_host(row_ix, DB_LOCATION.c_str());
 
-							// reset last_seen to 1972
-							update_host_last_seen(host_ix, DB_LOCATION.c_str());
+					// reset last_seen to 1972
+					update_host_last_seen(host_ix, DB_LOCATION.c_str());
 
-							iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
+					iptables_delete_rule_from_chain(GARGOYLE_CHAIN_NAME, rule_ix, IPTABLES_SUPPORTS_XLOCK);
 
-							do_unblock_action_output(host_ip, (int) time(NULL), ENFORCE);
-						}
-					}
+					do_unblock_action_output(host_ip, (int) time(NULL), ENFORCE);
 				}
 			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
 		}
 	}
-	free(l_hosts);
 	free(host_ip);
 
 	std::stringstream ss;
@@ -1516,46 +1472,35 @@ void GargoylePscandHandler::add_to_hot_ports_list(int the_port) {
 
 void GargoylePscandHandler::process_blacklist_ip_list() {
 
-	const char *tok1 = ">";
-	char *token1;
-	char *token1_save;
-
-	size_t dst_buf_sz = SMALL_DEST_BUF + 1;
-	char *l_hosts = (char*) malloc(dst_buf_sz);
 	size_t dst_buf_sz1 = LOCAL_BUF_SZ;
 	char *host_ip = (char*) malloc(dst_buf_sz1 + 1);
+	std::vector<sqlite_host_list_entry> black_listed;
 
-	size_t resp = get_hosts_blacklist_all(l_hosts, dst_buf_sz, DB_LOCATION.c_str());
-
-	if (resp == 0) {
+	get_host_list_entries(BLACK_LIST_TABLE, black_listed);
 
-		token1 = strtok_r(l_hosts, tok1, &token1_save);
-		while (token1 != NULL) {
+	for (std::vector<sqlite_host_list_entry>::const_iterator it = black_listed.begin(); it != black_listed.end(); ++it) {
 
-			if (atoi(token1) > 0) {
+		if (it->host_ix <= 0)
+			continue;
 
-				int host_ix = atoi(token1);
-				get_host_by_ix(host_ix, host_ip, dst_buf_sz1, DB_LOCATION.c_str());
+		*host_ip = 0;
+		get_host_by_ix(it->host_ix, host_ip, dst_buf_sz1, DB_LOCATION.c_str());
 
-				if (strcmp(host_ip, "") != 0) {
+		if (strcmp(host_ip, "") != 0) {
 
-					if (!is_black_listed(host_ip, (void *)gargoyle_blacklist_shm)) {
+			if (!is_black_listed(host_ip, (void *)gargoyle_blacklist_shm)) {
 
-						//gargoyle_blacklist_shm->Add(host_ip);
-						do_black_list_actions(host_ip,
-											(void *)gargoyle_blacklist_shm,
-											IPTABLES_SUPPORTS_XLOCK,
-											get_enforce_mode()
-											);
+				//gargoyle_blacklist_shm->Add(host_ip);
+				do_black_list_actions(host_ip,
+									(void *)gargoyle_blacklist_shm,
+									IPTABLES_SUPPORTS_XLOCK,
+									get_enforce_mode()
+									);
 
-					}
-				}
 			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
 		}
 	}
 
-	free(l_hosts);
 	free(host_ip);
 
 }
@@ -1570,6 +1515,10 @@ void GargoylePscandHandler::set_data_base_shared_memory(DataBase *data_base){
 	gargoyle_data_base_shared_memory = data_base;
 }
 
+void GargoylePscandHandler::set_block_action_queue(BlockActionQueue *queue){
+	block_action_queue = queue;
+}
+
 string GargoylePscandHandler::get_type_data_base(){
 	return DATA_BASE_TYPE;
 }
@@ -1580,90 +1529,59 @@ void GargoylePscandHandler::cleanTables(const string &tables){
 	}
 }
 
-// Copy initial data from SQLite to shared memory
-void GargoylePscandHandler::sqlite_to_shared_memory(){
-	const char black_ip_list_table[] = "black_ip_list";
-	const char ignore_ip_list_table[] = "ignore_ip_list";
-	char *buffer = new char[MEDIUM_DEST_BUF];
-	const char *tok1 = ">", *tok2 = ":";
-	char *token1, *token1_save, *token2, *token2_save;
-	int iter_cnt;
+static int copy_host_to_shared_memory(const struct sqlite_host_entry *entry, void *ctx) {
 
-	// hosts_table
+	DataBase *data_base = (DataBase *) ctx;
 	Hosts_Record host_record;
-	int status = sqlite_get_hosts_all(buffer, MEDIUM_DEST_BUF, DB_LOCATION.c_str());
-	if(status == 0) {
-		token1 = strtok_r(buffer, tok1, &token1_save);
-		while (token1 != NULL) {
-			iter_cnt = 0;
-			token2 = strtok_r(token1, tok2, &token2_save);
-			while (token2 != NULL) {
-				if (iter_cnt == 0) {
-					host_record.ix = atoll(token2);
-				} else if (iter_cnt == 1) {
-					snprintf(host_record.host, LENGTH_IPV4, "%s", token2);
-				} else if (iter_cnt == 2) {
-					host_record.first_seen = atoll(token2);
-				} else if (iter_cnt == 3) {
-					host_record.last_seen = atoll(token2);
-				}
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-			gargoyle_data_base_shared_memory->hosts->INSERT(host_record);
-		}
-	}
 
-	// black_ip_list
+	// the shared memory table only holds dotted quads, skip anything longer
+	size_t host_len = strnlen(entry->host, sizeof(entry->host));
+	if (host_len >= LENGTH_IPV4)
+		return 0;
+
+	host_record.ix = entry->ix;
+	memcpy(host_record.host, entry->host, host_len);
+	host_record.host[host_len] = '\0';
+	host_record.first_seen = entry->first_seen;
+	host_record.last_seen = entry->last_seen;
+	data_base->hosts->INSERT(host_record);
+	return 0;
+}
+
+static int copy_black_ip_to_shared_memory(const struct sqlite_host_list_entry *entry, void *ctx) {
+
+	DataBase *data_base = (DataBase *) ctx;
 	Black_IP_List_Record black_ip_list_record;
-	status = sqlite_get_all_ignore_or_black_ip_list(buffer, MEDIUM_DEST_BUF, DB_LOCATION.c_str(), black_ip_list_table);
-	if(status == 0) {
-		token1 = strtok_r(buffer, tok1, &token1_save);
-		while (token1 != NULL) {
-			iter_cnt = 0;
-			token2 = strtok_r(token1, tok2, &token2_save);
-			while (token2 != NULL) {
-				if (iter_cnt == 0) {
-					black_ip_list_record.ix = atoll(token2);
-				} else if (iter_cnt == 1) {
-					black_ip_list_record.host_ix = atoll(token2);
-				} else if (iter_cnt == 2) {
-					black_ip_list_record.timestamp = atoll(token2);
-				}
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-			gargoyle_data_base_shared_memory->black_ip_list->INSERT(black_ip_list_record);
-		}
-	}
 
-	// ignore_ip_list
+	black_ip_list_record.ix = entry->ix;
+	black_ip_list_record.host_ix = entry->host_ix;
+	black_ip_list_record.timestamp = entry->timestamp;
+	data_base->black_ip_list->INSERT(black_ip_list_record);
+	return 0;
+}
+
+static int copy_ignore_ip_to_shared_memory(const struct sqlite_host_list_entry *entry, void *ctx) {
+
+	DataBase *data_base = (DataBase *) ctx;
 	Ignore_IP_List_Record ignore_ip_list_record;
-	status = sqlite_get_all_ignore_or_black_ip_list(buffer, MEDIUM_DEST_BUF, DB_LOCATION.c_str(), ignore_ip_list_table);
-	if(status == 0) {
-		token1 = strtok_r(buffer, tok1, &token1_save);
-		while (token1 != NULL) {
-			iter_cnt = 0;
-			token2 = strtok_r(token1, tok2, &token2_save);
-			while (token2 != NULL) {
-				if (iter_cnt == 0) {
-					ignore_ip_list_record.ix = atoll(token2);
-				} else if (iter_cnt == 1) {
-					ignore_ip_list_record.host_ix = atoll(token2);
-				} else if (iter_cnt == 2) {
-					ignore_ip_list_record.timestamp = atoll(token2);
-				}
-				iter_cnt++;
-				token2 = strtok_r(NULL, tok2, &token2_save);
-			}
-			token1 = strtok_r(NULL, tok1, &token1_save);
-			gargoyle_data_base_shared_memory->ignore_ip_list->INSERT(ignore_ip_list_record);
-		}
-	}
 
-	delete buffer;
+	ignore_ip_list_record.ix = entry->ix;
+	ignore_ip_list_record.host_ix = entry->host_ix;
+	ignore_ip_list_record.timestamp = entry->timestamp;
+	data_base->ignore_ip_list->INSERT(ignore_ip_list_record);
+	return 0;
+}
+
+// Copy initial data from SQLite to shared memory
+void GargoylePscandHandler::sqlite_to_shared_memory(){
+	// hosts_table
+	sqlite_for_each_host(copy_host_to_shared_memory, gargoyle_data_base_shared_memory, DB_LOCATION.c_str());
+
+	// black_ip_list
+	sqlite_for_each_ignore_or_black_ip(copy_black_ip_to_shared_memory, gargoyle_data_base_shared_memory, DB_LOCATION.c_str(), BLACK_LIST_TABLE);
+
+	// ignore_ip_list
+	sqlite_for_each_ignore_or_black_ip(copy_ignore_ip_to_shared_memory, gargoyle_data_base_shared_memory, DB_LOCATION.c_str(), IGNORE_IP_LIST_TABLE);
 }
 
 bool GargoylePscandHandler::get_debug () {
@@ -1699,12 +1617,7 @@ int GargoylePscandHandler::get_host_ix(const char *source_ip, const char *db_loc
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
 		status = sqlite_get_host_ix(source_ip, db_location);
 	}else{
-		char result[SMALL_DEST_BUF];
-		memset(result, 0, SMALL_DEST_BUF);
-		string query = "SELECT ix FROM hosts_table WHERE host=" + string(source_ip);
-		if((status = gargoyle_data_base_shared_memory->hosts->SELECT(result, query)) != -1){
-			status = atol(result);
-		}
+		status = gargoyle_data_base_shared_memory->hosts->findHostIx(source_ip);
 	}
 	return status;
 }
@@ -1714,33 +1627,53 @@ int GargoylePscandHandler::get_host_by_ix(int the_ix, char *dst, size_t sz_dst,
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
 		status = sqlite_get_host_by_ix(the_ix, dst, sz_dst, DB_LOCATION.c_str());
 	}else{
+		Hosts_Record record;
 		memset(dst, 0, sz_dst);
-		string query = "SELECT host FROM hosts_table WHERE ix=" + the_ix;
-		status = gargoyle_data_base_shared_memory->hosts->SELECT(dst, query);
+		if(gargoyle_data_base_shared_memory->hosts->getHost(the_ix, record) == 1){
+			snprintf(dst, sz_dst, "%s", record.host);
+			status = 0;
+		}
 	}
 	return status;
 }
 
-int GargoylePscandHandler::get_hosts_blacklist_all(char *dst, size_t sz_dst, const char *db_loc){
-	int status = -1;
-	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
-		status = sqlite_get_hosts_blacklist_all(dst, sz_dst, DB_LOCATION.c_str());
-	}else{
-		memset(dst, 0, sz_dst);
-		string query = "SELECT host_ix FROM black_ip_list";
-		status = gargoyle_data_base_shared_memory->black_ip_list->SELECT(dst, query);
+static int collect_host_list_entry(const struct sqlite_host_list_entry *entry, void *ctx) {
+
+	((std::vector<sqlite_host_list_entry> *) ctx)->push_back(*entry);
+	return 0;
+}
+
+// black_ip_list and ignore_ip_list records have the same fields
+template <typename Record>
+static int copy_host_list_entries(SharedMemoryTable<Record> *table, std::vector<sqlite_host_list_entry> &entries){
+	std::vector<Record> records;
+	if(table->getAll(records) < 0){
+		return -1;
 	}
-	return status;
+	for(typename std::vector<Record>::const_iterator it = records.begin(); it != records.end(); ++it){
+		struct sqlite_host_list_entry entry;
+		entry.ix = it->ix;
+		entry.host_ix = it->host_ix;
+		entry.timestamp = (int) it->timestamp;
+		entries.push_back(entry);
+	}
+	return 0;
 }
 
-int GargoylePscandHandler::get_hosts_to_ignore_all(char *dst, size_t sz_dst, const char *db_loc){
+/*
+ * rows of ignore_ip_list or black_ip_list, collected up front
+ * as the callers go on to write to the DB for each one
+ */
+int GargoylePscandHandler::get_host_list_entries(const char *table, std::vector<sqlite_host_list_entry> &entries){
 	int status = -1;
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
-		status = sqlite_get_hosts_to_ignore_all(dst, sz_dst, DB_LOCATION.c_str());
+		status = sqlite_for_each_ignore_or_black_ip(collect_host_list_entry, &entries, DB_LOCATION.c_str(), table);
 	}else{
-		memset(dst, 0, sz_dst);
-		string query = "SELECT host_ix FROM ignore_ip_list";
-		status = gargoyle_data_base_shared_memory->ignore_ip_list->SELECT(dst, query);
+		if(strcmp(table, BLACK_LIST_TABLE) == 0){
+			status = copy_host_list_entries(gargoyle_data_base_shared_memory->black_ip_list, entries);
+		}else{
+			status = copy_host_list_entries(gargoyle_data_base_shared_memory->ignore_ip_list, entries);
+		}
 	}
 	return status;
 }
@@ -1782,15 +1715,7 @@ int GargoylePscandHandler::get_hosts_to_ignore_all(char *dst, size_t sz_dst, con
 */
 
 int GargoylePscandHandler::get_host_port_hit(int ip_addr_ix, int the_port){
-	int hit_count;
-	char query[SQL_CMD_MAX];
-	sprintf(query, "SELECT hit_count FROM hosts_ports_hits WHERE host_ix=%d AND port_number=%d", ip_addr_ix, the_port);
-	char result[SMALL_DEST_BUF];
-	memset(result, 0, SMALL_DEST_BUF);
-	if((hit_count = gargoyle_data_base_shared_memory->hosts_ports_hits->SELECT(result, query)) != -1){
-		hit_count = atol(result);
-	}
-	return hit_count;
+	return gargoyle_data_base_shared_memory->hosts_ports_hits->getHitCount(ip_addr_ix, the_port);
 }
 
 int GargoylePscandHandler::get_detected_hosts_row_ix_by_host_ix(size_t ip_addr_ix, const char *db_loc){
@@ -1798,12 +1723,7 @@ int GargoylePscandHandler::get_detected_hosts_row_ix_by_host_ix(size_t ip_addr_i
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
 		status = sqlite_get_detected_hosts_row_ix_by_host_ix(ip_addr_ix, DB_LOCATION.c_str());
 	}else{
-		char result[SMALL_DEST_BUF];
-		memset(result, 0, SMALL_DEST_BUF);
-		string query = "SELECT ix FROM detected_hosts WHERE host_ix=" + ip_addr_ix;
-		if((status = gargoyle_data_base_shared_memory->detected_hosts->SELECT(result, query)) != -1){
-			status = atol(result);
-		}
+		status = gargoyle_data_base_shared_memory->detected_hosts->findByHostIx(ip_addr_ix);
 	}
 	return status;
 }
@@ -1813,8 +1733,7 @@ int GargoylePscandHandler::remove_host_ports_all(size_t ip_addr_ix, const char *
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
 		status = sqlite_remove_host_ports_all(ip_addr_ix, db_loc);
 	}else{
-		string query = "DELETE FROM hosts_ports_hits WHERE host_ix="+ip_addr_ix;
-		status = gargoyle_data_base_shared_memory->hosts_ports_hits->DELETE(query);
+		status = gargoyle_data_base_shared_memory->hosts_ports_hits->deleteByHostIx(ip_addr_ix) < 0 ? -1 : 0;
 	}
 	return status;
 }
@@ -1824,8 +1743,7 @@ int GargoylePscandHandler::remove_detected_host(size_t row_ix, const char *db_lo
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
 		status = sqlite_remove_detected_host(row_ix, db_loc);
 	}else{
-		string query = "DELETE FROM detected_hosts WHERE ix="+row_ix;
-		status = gargoyle_data_base_shared_memory->detected_hosts->DELETE(query);
+		status = gargoyle_data_base_shared_memory->detected_hosts->deleteByIx(row_ix) < 0 ? -1 : 0;
 	}
 	return status;
 }
@@ -1845,16 +1763,10 @@ int GargoylePscandHandler::update_host_last_seen(size_t ip_addr_ix, const char *
 }
 
 int GargoylePscandHandler::add_detected_host(size_t ip_addr_ix, size_t tstamp, const char *db_loc){
-	int status = -1;
 	if(DATA_BASE_TYPE == DATA_BASES[SQLITE]){
-		status = sqlite_add_detected_host(ip_addr_ix, tstamp, DB_LOCATION.c_str());
-	}else{
-		Detected_Hosts_Record record;
-		record.host_ix = ip_addr_ix;
-		record.timestamp = tstamp;
-		status = gargoyle_data_base_shared_memory->detected_hosts->INSERT(record);
+		return add_to_detected_hosts(ip_addr_ix, tstamp, DB_LOCATION, nullptr);
 	}
-	return status;
+	return add_to_detected_hosts(ip_addr_ix, tstamp, DB_LOCATION, gargoyle_data_base_shared_memory);
 }
 
 
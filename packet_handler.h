@@ -48,6 +48,8 @@ extern "C" {
 
 #include "shared_config.h"
 #include "data_base.h"
+#include "block_action_queue.h"
+#include "sqlite_wrapper_api.h"
 
 
 /*
@@ -77,6 +79,8 @@ class GargoylePscandHandler
 	void set_db_location(const char *);
 	void set_debug(bool);
 	void set_data_base_shared_memory(DataBase *data_base);
+	void set_block_action_queue(BlockActionQueue *);
+	int attach_shared_config();
 	std::string get_type_data_base();
 	void sqlite_to_shared_memory();
 	void cleanTables(const std::string &);
@@ -88,6 +92,7 @@ class GargoylePscandHandler
 	void add_to_scanned_ports_dict(std::string, int);
 	void add_block_rule(std::string, int);
 	void add_block_rules();
+	void block_ip(const std::string &, int);
 
 	void process_ignore_ip_list();
 	void clear_three_way_check_dat();
@@ -158,12 +163,12 @@ class GargoylePscandHandler
 	SharedIpConfig *gargoyle_whitelist_shm = NULL;
 	SharedIpConfig *gargoyle_blacklist_shm = NULL;
 	DataBase *gargoyle_data_base_shared_memory;
+	BlockActionQueue *block_action_queue;
 
 	int add_host(const char *source_ip, const char *db_location);
 	int get_host_ix(const char *source_ip, const char *db_location);
 	int get_host_by_ix(int the_ix, char *dst, size_t sz_dst, const char *db_loc);
-	int get_hosts_blacklist_all(char *dst, size_t sz_dst, const char *db_loc);
-	int get_hosts_to_ignore_all(char *dst, size_t sz_dst, const char *db_loc);
+	int get_host_list_entries(const char *table, std::vector<sqlite_host_list_entry> &entries);
 	//int add_to_hosts_port_table(const std::string &, int, int, const std::string &, bool);
 	int get_host_port_hit(int ip_addr_ix, int the_port);
 	int get_detected_hosts_row_ix_by_host_ix(size_t, const char *);
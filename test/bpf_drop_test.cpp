@@ -0,0 +1,228 @@
+/*
+ * Runs the XDP drop program from lib/bpf_drop.c against hand built
+ * frames through BPF_PROG_TEST_RUN, so it can be checked on any box
+ * (CI included) without attaching it to an interface. Then drives the
+ * pinned map API iptables_wrapper_api uses on a map pinned at
+ * GARGOYLE_BPF_MAP_PIN, which must not exist yet (a running
+ * gargoyle_pscand with bpf_interface set owns it).
+ *
+ * Needs root (or CAP_BPF) and a tree configured --with-bpf, from the
+ * top dir:
+ *
+ *   gcc -DHAVE_CONFIG_H -I. -Ilib -c lib/bpf_drop.c
+ *   g++ -std=c++11 -I. -Ilib test/bpf_drop_test.cpp bpf_drop.o -o bpf_drop_test
+ *   sudo ./bpf_drop_test
+ *
+ * Exits non zero if any case fails.
+ */
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+
+#include "bpf_drop.h"
+#include "gargoyle_config_vals.h"
+
+using namespace std;
+
+
+static vector<unsigned char> make_frame(unsigned short proto, const char *src, size_t len = 64) {
+
+	vector<unsigned char> frame(len, 0);
+	unsigned short p = htons(proto);
+	if (len >= ETH_HLEN)
+		memcpy(&frame[12], &p, sizeof(p));
+	if (len >= ETH_HLEN + 20) {
+		frame[ETH_HLEN] = 0x45;
+		in_addr a;
+		inet_pton(AF_INET, src, &a);
+		memcpy(&frame[ETH_HLEN + 12], &a, sizeof(a));
+	}
+	return frame;
+}
+
+
+static int test_run(int prog_fd, vector<unsigned char> &frame) {
+
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.test.prog_fd = prog_fd;
+	attr.test.data_in = (unsigned long) frame.data();
+	attr.test.data_size_in = frame.size();
+	attr.test.repeat = 1;
+
+	if (syscall(__NR_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr)) != 0) {
+		perror("BPF_PROG_TEST_RUN");
+		return -1;
+	}
+	return attr.test.retval;
+}
+
+
+static int failures = 0;
+
+static void expect(int prog_fd, const char *name, vector<unsigned char> frame, int want) {
+
+	int got = test_run(prog_fd, frame);
+	printf("%-40s %s\n", name, got == want ? "ok" : "FAILED");
+	if (got != want)
+		failures++;
+}
+
+
+static void check(const char *name, bool ok) {
+
+	printf("%-40s %s\n", name, ok ? "ok" : "FAILED");
+	if (!ok)
+		failures++;
+}
+
+
+struct listed_rule {
+	size_t line_number;
+	string source;
+};
+
+static int collect_rule(const struct iptables_rule_entry *entry, void *ctx) {
+
+	listed_rule r = { entry->line_number, entry->source };
+	((vector<listed_rule> *) ctx)->push_back(r);
+	return 0;
+}
+
+static vector<listed_rule> list_map() {
+
+	vector<listed_rule> rules;
+	bpf_drop_for_each(collect_rule, &rules);
+	return rules;
+}
+
+// the listed sources, in order, and numbered 1..n
+static bool listed_as(const vector<listed_rule> &rules, const vector<string> &want) {
+
+	if (rules.size() != want.size())
+		return false;
+	for (size_t i = 0; i < rules.size(); i++) {
+		if (rules[i].line_number != i + 1 || rules[i].source != want[i])
+			return false;
+	}
+	return true;
+}
+
+static string host_addr(uint32_t addr) {
+
+	in_addr a;
+	a.s_addr = htonl(addr);
+	char buf[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &a, buf, sizeof(buf));
+	return buf;
+}
+
+
+static void test_pinned_map() {
+
+	if (access(GARGOYLE_BPF_MAP_PIN, F_OK) == 0) {
+		fprintf(stderr, "%s exists, is gargoyle_pscand running? skipping the pinned map cases\n", GARGOYLE_BPF_MAP_PIN);
+		failures++;
+		return;
+	}
+
+	int map_fd = bpf_drop_create_map();
+	union bpf_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.pathname = (unsigned long) GARGOYLE_BPF_MAP_PIN;
+	attr.bpf_fd = map_fd;
+	if (map_fd < 0 || syscall(__NR_bpf, BPF_OBJ_PIN, &attr, sizeof(attr)) != 0) {
+		perror("BPF_OBJ_PIN");
+		failures++;
+		return;
+	}
+	close(map_fd);
+
+	check("pinned map is active", bpf_drop_is_active() == 1);
+
+	bpf_drop_add("10.0.0.1");
+	bpf_drop_add("10.0.0.2");
+	check("adds are listed", listed_as(list_map(), { "10.0.0.1", "10.0.0.2" }));
+
+	/*
+	 * the /24 sorts ahead of the /32's already there and renumbers
+	 * them, the aggregation pass used to trip over exactly this
+	 */
+	bpf_drop_add("10.0.0.0/24");
+	check("earlier prefix renumbers the rest", listed_as(list_map(), { "10.0.0.0/24", "10.0.0.1", "10.0.0.2" }));
+
+	char deleted[IPTABLES_ADDR_SZ] = "";
+	check("delete_at takes the current number", bpf_drop_delete_at(2, deleted, sizeof(deleted)) == 0 && string(deleted) == "10.0.0.1");
+	check("delete_at left the others", listed_as(list_map(), { "10.0.0.0/24", "10.0.0.2" }));
+	check("delete_at past the end fails", bpf_drop_delete_at(3, NULL, 0) != 0);
+	check("delete_at 0 fails", bpf_drop_delete_at(0, NULL, 0) != 0);
+
+	check("delete by source", bpf_drop_delete("10.0.0.0/24") == 0 && listed_as(list_map(), { "10.0.0.2" }));
+	check("delete of a missing source fails", bpf_drop_delete("10.0.0.0/24") != 0);
+	check("add of an existing source is ok", bpf_drop_add("10.0.0.2") == 0 && list_map().size() == 1);
+
+	check("flush", bpf_drop_flush() == 0 && list_map().empty());
+
+	// well past the 256 keys get_sorted_keys starts out with
+	vector<string> many;
+	for (uint32_t i = 0; i < 1000; i++) {
+		uint32_t addr = (10u << 24) | (1u << 16) | (i * 7 % 1000);
+		bpf_drop_add(host_addr(addr).c_str());
+	}
+	for (uint32_t i = 0; i < 1000; i++)
+		many.push_back(host_addr((10u << 24) | (1u << 16) | i));
+	check("1000 keys listed sorted", listed_as(list_map(), many));
+
+	check("delete_at among 1000 keys", bpf_drop_delete_at(500, deleted, sizeof(deleted)) == 0 && string(deleted) == many[499]);
+	many.erase(many.begin() + 499);
+	check("999 keys left", listed_as(list_map(), many));
+
+	check("flush of 999 keys", bpf_drop_flush() == 0 && list_map().empty());
+
+	unlink(GARGOYLE_BPF_MAP_PIN);
+	check("unpinned map is not active", bpf_drop_is_active() == 0);
+}
+
+
+int main() {
+
+	int map_fd = bpf_drop_create_map();
+	int prog_fd = map_fd >= 0 ? bpf_drop_create_prog(map_fd) : -1;
+	if (prog_fd < 0) {
+		fprintf(stderr, "could not load the program, see syslog\n");
+		return 1;
+	}
+
+	expect(prog_fd, "empty map passes", make_frame(ETH_P_IP, "198.18.0.1"), XDP_PASS);
+
+	bpf_drop_map_add(map_fd, "198.18.0.1");
+	bpf_drop_map_add(map_fd, "198.18.5.0/24");
+
+	expect(prog_fd, "blocked /32 drops", make_frame(ETH_P_IP, "198.18.0.1"), XDP_DROP);
+	expect(prog_fd, "neighbour of blocked /32 passes", make_frame(ETH_P_IP, "198.18.0.2"), XDP_PASS);
+	expect(prog_fd, "inside blocked /24 drops", make_frame(ETH_P_IP, "198.18.5.77"), XDP_DROP);
+	expect(prog_fd, "outside blocked /24 passes", make_frame(ETH_P_IP, "198.18.6.77"), XDP_PASS);
+	expect(prog_fd, "non ipv4 passes", make_frame(ETH_P_IPV6, "198.18.0.1"), XDP_PASS);
+	expect(prog_fd, "truncated ipv4 passes", make_frame(ETH_P_IP, "198.18.0.1", ETH_HLEN + 10), XDP_PASS);
+
+	bpf_drop_map_delete(map_fd, "198.18.0.1");
+	expect(prog_fd, "unblocked /32 passes", make_frame(ETH_P_IP, "198.18.0.1"), XDP_PASS);
+
+	close(prog_fd);
+	close(map_fd);
+
+	test_pinned_map();
+
+	printf("%s\n", failures ? "FAILED" : "all ok");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * Compares the cost of the exec (popen of the iptables binary) and
+ * libiptc backends of iptables_wrapper_api for the operations the
+ * daemons do at runtime: add a DROP rule, look a rule up, delete it.
+ *
+ * Needs root and a tree configured --with-libiptc, from the top dir:
+ *
+ *   gcc -DHAVE_CONFIG_H -I. -Ilib -c lib/iptables_wrapper_api.c lib/iptables_direct.c
+ *   g++ -std=c++11 -I. -Ilib test/iptables_backend_bench.cpp iptables_wrapper_api.o iptables_direct.o -lip4tc -o iptables_backend_bench
+ *   sudo ./iptables_backend_bench [rules]
+ *
+ * Works on a scratch chain, GARGOYLE_Input_Chain is not touched.
+ */
+#include <cstdlib>
+#include <cstdio>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "iptables_wrapper_api.h"
+
+#define BENCH_CHAIN "GARGOYLE_Bench_Chain"
+#define DEFAULT_RULES 200
+
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+
+static double usec_per_op(bench_clock::time_point start, size_t ops) {
+	double usec = chrono::duration_cast<chrono::microseconds>(bench_clock::now() - start).count();
+	return ops ? usec / ops : 0;
+}
+
+
+static int run(int backend, const char *name, const vector<string> &ips, size_t xlock) {
+
+	if (iptables_set_backend(backend) != 0) {
+		cerr << name << ": backend not available in this build" << endl;
+		return 1;
+	}
+
+	iptables_create_new_chain(BENCH_CHAIN, xlock);
+	iptables_flush_chain(BENCH_CHAIN, xlock);
+
+	bench_clock::time_point t = bench_clock::now();
+	for (size_t i = 0; i < ips.size(); i++)
+		iptables_add_drop_rule_to_chain(BENCH_CHAIN, ips[i].c_str(), xlock);
+	double add_us = usec_per_op(t, ips.size());
+
+	size_t misses = 0;
+	t = bench_clock::now();
+	for (size_t i = 0; i < ips.size(); i++) {
+		if (iptables_find_rule_in_chain(BENCH_CHAIN, ips[i].c_str(), xlock) == 0)
+			misses++;
+	}
+	double find_us = usec_per_op(t, ips.size());
+
+	// always the last rule so no renumbering is involved
+	t = bench_clock::now();
+	for (size_t i = ips.size(); i > 0; i--)
+		iptables_delete_rule_from_chain(BENCH_CHAIN, i, xlock);
+	double del_us = usec_per_op(t, ips.size());
+
+	iptables_delete_chain(BENCH_CHAIN, xlock);
+
+	printf("%-8s add %10.1f us/op   find %10.1f us/op   delete %10.1f us/op   (%zu lookups missed)\n",
+			name, add_us, find_us, del_us, misses);
+	return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+
+	size_t rules = DEFAULT_RULES;
+	if (argc > 1 && atoi(argv[1]) > 0)
+		rules = atoi(argv[1]);
+
+	// 198.18.0.0/15 is reserved for benchmarking
+	vector<string> ips;
+	for (size_t i = 0; i < rules; i++) {
+		char ip[16];
+		snprintf(ip, sizeof(ip), "198.18.%zu.%zu", (i / 250) % 250, (i % 250) + 1);
+		ips.push_back(ip);
+	}
+
+	iptables_set_backend(IPTABLES_BACKEND_EXEC);
+	size_t xlock = iptables_supports_xlock();
+
+	cout << rules << " rules in chain " << BENCH_CHAIN << endl;
+	run(IPTABLES_BACKEND_EXEC, "exec", ips, xlock);
+	run(IPTABLES_BACKEND_LIBIPTC, "libiptc", ips, xlock);
+
+	return 0;
+}
@@ -1,3 +1,5 @@
+#include <cstddef>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
 #include <csignal>
@@ -5,8 +7,16 @@
 
 #include <iostream>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "data_base.h"
+#include "gargoyle_config_vals.h"
 
 #define LENGTH_RESULT_QUERY 10000
 #define MAX_ENTRIES 11
@@ -21,6 +31,69 @@ void handler(int i){
 	}
 }
 
+/*
+ * how SharedMemoryTable starts a table region, up to last_ix, so a
+ * test can leave it the way a writer that died half way would
+ */
+struct Table_Header_Mirror{
+    SharedMemLayout layout;
+    pthread_mutex_t mutex;
+    volatile size_t capacity;
+    volatile int32_t next_ix;
+    volatile uint32_t generation;
+    volatile uint32_t sequence;
+    volatile uint32_t last_ix;
+};
+
+// how saveSnapshot starts a file, see SharedMemoryTable::SnapshotHeader
+struct Snapshot_Header_Mirror{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint32_t last_ix;
+    uint32_t reserved;
+    int64_t written;
+    uint64_t checksum;
+    uint64_t schema;
+};
+
+// adds delta to the byte at offset of a file, so calling it with -delta puts it back
+void bump_file_byte(const string &path, long offset, int delta){
+    FILE *f = fopen(path.c_str(), "r+b");
+    if(f == nullptr || fseek(f, offset, SEEK_SET) != 0){
+    	exit(1);
+    }
+    int byte = fgetc(f);
+    fseek(f, offset, SEEK_SET);
+    fputc((byte + delta) & 0xff, f);
+    fclose(f);
+}
+
+/*
+ * hosts_table with the locking opened up, so a test can hold the
+ * mutex or write rows the way a writer in another process would
+ */
+class Hosts_Table_Test : public Hosts_Table{
+    public:
+        Hosts_Table_Test(string name, size_t size) : Hosts_Table(name, size){}
+        using Hosts_Table::init;
+        using Hosts_Table::lock;
+        using Hosts_Table::unlock;
+        // first_seen all the way through before last_seen, a copy taken in between sees them differ
+        void setSeen(time_t seen){
+            if(lock() == 0){
+                for(Hosts_Record *record = begin(); record != end(); record++){
+                    record->first_seen = seen;
+                }
+                for(Hosts_Record *record = begin(); record != end(); record++){
+                    record->last_seen = seen;
+                }
+                unlock();
+            }
+        }
+};
+
 
 int main(int argc, char *argv[], char *env[]){
     int32_t status;
@@ -509,5 +582,418 @@ int main(int argc, char *argv[], char *env[]){
     	exit(1);
     }
 
+    // typed queries
+    db->hosts->TRUNCATE();
+    db->hosts_ports_hits->TRUNCATE();
+    db->detected_hosts->TRUNCATE();
+    recordHostsTable.ix = 0;
+    for(int i=1; i<MAX_ENTRIES; i++){
+    	sprintf(recordHostsTable.host, "10.0.0.%d", i);
+    	db->hosts->INSERT(recordHostsTable);
+    }
+
+    int32_t host_ix = db->hosts->findHostIx("10.0.0.7");
+    cout << "findHostIx(10.0.0.7) = " << host_ix << endl;
+    if(host_ix != 7 || db->hosts->findHostIx(inet_addr("10.0.0.7")) != 7 || db->hosts->findHostIx("10.0.0.99") != 0){
+    	exit(1);
+    }
+    if(db->hosts->getHost(host_ix, recordHostsTable) != 1 || strcmp(recordHostsTable.host, "10.0.0.7") != 0){
+    	exit(1);
+    }
+    cout << "getHost(7) = " << recordHostsTable.host << endl;
+
+    for(int i=1; i<MAX_ENTRIES; i++){
+    	db->hosts_ports_hits->addHits(host_ix, 1000 + i, i);
+    	db->hosts_ports_hits->addHits(3, 1000 + i, 1);
+    }
+    db->hosts_ports_hits->addHits(host_ix, 1005, 100);
+    cout << "getHitCount(7, 1005) = " << db->hosts_ports_hits->getHitCount(host_ix, 1005) << endl;
+    cout << "getHitTotal(7) = " << db->hosts_ports_hits->getHitTotal(host_ix) << endl;
+    cout << "getPortCount(7) = " << db->hosts_ports_hits->getPortCount(host_ix) << endl;
+    if(db->hosts_ports_hits->getHitCount(host_ix, 1005) != 105 || db->hosts_ports_hits->getHitTotal(host_ix) != 155 ||
+    		db->hosts_ports_hits->getPortCount(host_ix) != MAX_ENTRIES - 1 || db->hosts_ports_hits->getHitCount(host_ix, 99) != 0){
+    	exit(1);
+    }
+
+    int over = 0;
+    db->hosts_ports_hits->forEachOverThreshold(1005, 10, [&over](const Hosts_Ports_Hits_Record &record){
+    	cout << "forEachOverThreshold(1005, 10) host_ix " << record.host_ix << " hits " << record.hit_count << endl;
+    	over++;
+    	return 0;
+    });
+    if(over != 1){
+    	exit(1);
+    }
+
+    cout << "deleteByHostIx(7) = " << db->hosts_ports_hits->deleteByHostIx(host_ix) << endl;
+    if(db->hosts_ports_hits->getPortCount(host_ix) != 0 || db->hosts_ports_hits->getPortCount(3) != MAX_ENTRIES - 1){
+    	exit(1);
+    }
+
+    recordDetectedHostsTable.ix = 0;
+    recordDetectedHostsTable.host_ix = host_ix;
+    db->detected_hosts->INSERT(recordDetectedHostsTable);
+    int32_t row_ix = db->detected_hosts->findByHostIx(host_ix);
+    cout << "detected_hosts findByHostIx(7) = " << row_ix << endl;
+    if(row_ix <= 0 || db->detected_hosts->deleteByIx(row_ix) != 1 || db->detected_hosts->findByHostIx(host_ix) != 0){
+    	exit(1);
+    }
+    cout << endl;
+
+    // indexes, enough rows to grow the tables and indexes a few times
+    db->hosts->TRUNCATE();
+    db->hosts_ports_hits->TRUNCATE();
+    recordHostsTable.ix = 0;
+    for(int i=1; i<=5000; i++){
+    	sprintf(recordHostsTable.host, "10.1.%d.%d", i / 256, i % 256);
+    	db->hosts->INSERT(recordHostsTable);
+    	db->hosts_ports_hits->addHits(i, 22, i);
+    	db->hosts_ports_hits->addHits(i, 80, 1);
+    }
+    strcpy(recordHostsTable.host, "not.an.addr");
+    db->hosts->INSERT(recordHostsTable);
+    int misses = 0;
+    for(int i=1; i<=5000; i++){
+    	char host[16];
+    	sprintf(host, "10.1.%d.%d", i / 256, i % 256);
+    	if(db->hosts->findHostIx(host) != i || db->hosts_ports_hits->getHitCount(i, 22) != i){
+    		misses++;
+    	}
+    }
+    cout << "index lookups 5000 hosts, misses = " << misses << endl;
+    cout << "findHostIx(not.an.addr) = " << db->hosts->findHostIx("not.an.addr") << endl;
+    // swap-remove, the last record fills each hole so host 5000's rows move up front in reverse
+    db->hosts_ports_hits->deleteByHostIx(1);
+    if(misses || db->hosts->findHostIx("not.an.addr") != 5001 || db->hosts->findHostIx("not.an.addr.2") != 0 ||
+    		db->hosts_ports_hits->getHitCount(1, 22) != 0 || db->hosts_ports_hits->getHitCount(5000, 22) != 5000 ||
+    		db->hosts_ports_hits->getHitCount(2500, 80) != 1){
+    	exit(1);
+    }
+    vector<Hosts_Ports_Hits_Record> hits;
+    db->hosts_ports_hits->getAll(hits);
+    cout << "after deleteByHostIx(1) first = " << hits[0].host_ix << ":" << hits[0].port_number <<
+    		" second = " << hits[1].host_ix << ":" << hits[1].port_number << " last = " << hits.back().host_ix << ":" << hits.back().port_number << endl;
+    if(hits.size() != 9998 || hits[0].host_ix != 5000 || hits[0].port_number != 80 || hits[1].host_ix != 5000 ||
+    		hits[1].port_number != 22 || hits[2].host_ix != 2 || hits.back().host_ix != 4999 || hits.back().port_number != 80){
+    	exit(1);
+    }
+
+    for(int i=3; i<=5000; i+=2){
+    	if(db->hosts_ports_hits->deleteByHostIx(i) != 2){
+    		exit(1);
+    	}
+    }
+    misses = 0;
+    for(int i=2; i<=5000; i++){
+    	if(db->hosts_ports_hits->getHitCount(i, 22) != (i % 2 ? 0 : i)){
+    		misses++;
+    	}
+    }
+    cout << "index lookups after deleting odd hosts, misses = " << misses << endl;
+    if(misses){
+    	exit(1);
+    }
+
+    // the even hosts up to 100 in one pass, 7 has no rows left
+    vector<uint32_t> batch;
+    for(int i=100; i>=2; i-=2){
+    	batch.push_back(i);
+    }
+    batch.push_back(7);
+    batch.push_back(100);
+    cout << "deleteByHostIxs 50 hosts = " << db->hosts_ports_hits->deleteByHostIxs(batch) << endl;
+    if(db->hosts_ports_hits->getHitCount(2, 22) != 0 || db->hosts_ports_hits->getHitCount(100, 80) != 0 ||
+    		db->hosts_ports_hits->getHitCount(102, 22) != 102 || db->hosts_ports_hits->getHitCount(5000, 80) != 1){
+    	exit(1);
+    }
+
+    vector<Hosts_Record> hosts;
+    vector<uint32_t> host_ixs;
+    cout << "getAll hosts = " << db->hosts->getAll(hosts) << endl;
+    cout << "getHostIxs = " << db->hosts_ports_hits->getHostIxs(host_ixs) << endl;
+    if(hosts.size() != 5001 || host_ixs.size() != 2450 || host_ixs.front() != 102 || host_ixs.back() != 5000){
+    	exit(1);
+    }
+    cout << endl;
+
+    // lock free reads racing a writer in another mapping of the same table
+    SharedMemRegion::Remove("/gargoyle_test_seqlock");
+    SharedMemRegion::Remove("/gargoyle_test_seqlock_index");
+    Hosts_Table_Test *seq_writer = new Hosts_Table_Test("/gargoyle_test_seqlock", 64);
+    Hosts_Table *seq_reader = nullptr;
+    if(seq_writer->init() < 0 || (seq_reader = Hosts_Table::CREATE("/gargoyle_test_seqlock", 64)) == nullptr){
+    	exit(1);
+    }
+    recordHostsTable.ix = 0;
+    recordHostsTable.first_seen = recordHostsTable.last_seen = 0;
+    for(int i=1; i<=64; i++){
+    	sprintf(recordHostsTable.host, "10.2.0.%d", i);
+    	seq_writer->INSERT(recordHostsTable);
+    }
+    atomic<bool> seq_writing(true);
+    thread seq_writer_thread([seq_writer, &seq_writing](){
+    	for(int i=1; i<=20000; i++){
+    		seq_writer->setSeen(i);
+    	}
+    	seq_writing = false;
+    });
+    vector<Hosts_Record> seq_rows;
+    int torn = 0;
+    while(seq_writing){
+    	if(seq_reader->getAll(seq_rows) != 64){
+    		torn++;
+    	}
+    	for(auto it = seq_rows.begin(); it != seq_rows.end(); it++){
+    		if(it->first_seen != it->last_seen){
+    			torn++;
+    		}
+    	}
+    }
+    seq_writer_thread.join();
+    SharedMemoryTableLockStats seq_before, seq_after;
+    seq_reader->getLockStats(seq_before);
+    cout << "reads racing a writer, torn = " << torn << " retried = " << (seq_before.optimistic_retries > 0) << endl;
+    if(torn || seq_before.optimistic_retries == 0){
+    	exit(1);
+    }
+
+    // every lock free pass sees the writer in, so the read ends up waiting for the mutex
+    atomic<bool> seq_held(false);
+    thread seq_holder([seq_writer, &seq_held](){
+    	seq_writer->lock();
+    	seq_held = true;
+    	usleep(200000);
+    	seq_writer->unlock();
+    });
+    while(!seq_held){
+    	usleep(1000);
+    }
+    int seq_count = seq_reader->getAll(seq_rows);
+    seq_holder.join();
+    seq_reader->getLockStats(seq_after);
+    cout << "read under a held mutex = " << seq_count << " passes thrown away = " << seq_after.optimistic_retries - seq_before.optimistic_retries <<
+    		" waited = " << (seq_after.contended > seq_before.contended) << endl;
+    if(seq_count != 64 || seq_after.optimistic_retries - seq_before.optimistic_retries != OPTIMISTIC_TRIES ||
+    		seq_after.optimistic_reads != seq_before.optimistic_reads || seq_after.contended == seq_before.contended){
+    	exit(1);
+    }
+
+    // a writer that never lets go, the read gives up once the timed lock runs out
+    seq_held = false;
+    thread seq_stuck([seq_writer, &seq_held](){
+    	seq_writer->lock();
+    	seq_held = true;
+    	sleep(TIMEOUT_MILISECONDS * MAXIMUM_TRIES / 1000 + 2);
+    	seq_writer->unlock();
+    });
+    while(!seq_held){
+    	usleep(1000);
+    }
+    time_t seq_started = time(nullptr);
+    seq_count = seq_reader->getAll(seq_rows);
+    time_t seq_waited = time(nullptr) - seq_started;
+    seq_stuck.join();
+    cout << "read under a stuck mutex = " << seq_count << endl;
+    if(seq_count != -1 || seq_waited < TIMEOUT_MILISECONDS * MAXIMUM_TRIES / 1000 - 1){
+    	exit(1);
+    }
+    delete seq_reader;
+    delete seq_writer;
+    cout << endl;
+
+    // a process that dies holding the mutex half way through a write
+    SharedMemRegion::Remove("/gargoyle_test_owner_death");
+    SharedMemRegion::Remove("/gargoyle_test_owner_death_index");
+    Hosts_Table *owned = Hosts_Table::CREATE("/gargoyle_test_owner_death", 4);
+    SharedMemRegion *owned_raw = SharedMemRegion::Create("/gargoyle_test_owner_death", sizeof(Table_Header_Mirror));
+    if(owned == nullptr || owned_raw == nullptr){
+    	exit(1);
+    }
+    Table_Header_Mirror *owned_hdr = reinterpret_cast<Table_Header_Mirror *>(owned_raw->BaseAddr());
+    for(int i=1; i<=3; i++){
+    	sprintf(recordHostsTable.host, "10.3.0.%d", i);
+    	owned->INSERT(recordHostsTable);
+    }
+    // the mirror has to match before anything is written through it
+    if(owned_hdr->capacity != 4 || owned_hdr->next_ix != 3 || owned_hdr->last_ix != 3){
+    	exit(1);
+    }
+    pid_t dying = fork();
+    if(dying == 0){
+    	Hosts_Table_Test dying_table("/gargoyle_test_owner_death", 4);
+    	if(dying_table.init() < 0 || dying_table.lock() != 0){
+    		_exit(1);
+    	}
+    	owned_hdr->next_ix = owned_hdr->capacity + 7;
+    	owned_hdr->last_ix = 0;
+    	_exit(0);
+    }
+    int dying_status;
+    if(waitpid(dying, &dying_status, 0) != dying || !WIFEXITED(dying_status) || WEXITSTATUS(dying_status) != 0 ||
+    		(owned_hdr->sequence & 1) == 0){
+    	exit(1);
+    }
+    // the next lock gets EOWNERDEAD and repairs the header before the insert goes ahead
+    sprintf(recordHostsTable.host, "10.3.0.4");
+    int32_t owned_insert = owned->INSERT(recordHostsTable);
+    SharedMemoryTableLockStats owned_stats;
+    owned->getLockStats(owned_stats);
+    cout << "owner died holding the mutex, repairs = " << owned_stats.owner_deaths << " insert = " << owned_insert <<
+    		" size = " << owned_hdr->next_ix << " capacity = " << owned_hdr->capacity << " last_ix = " << owned_hdr->last_ix <<
+    		" sequence even = " << ((owned_hdr->sequence & 1) == 0) << endl;
+    cout << "findHostIx(10.3.0.2) = " << owned->findHostIx("10.3.0.2") << " findHostIx(10.3.0.4) = " << owned->findHostIx("10.3.0.4") << endl;
+    // capacity rows are kept, the one past the 3 written is whatever the region held
+    if(owned_stats.owner_deaths != 1 || owned_insert != 0 || owned_hdr->next_ix != 5 || owned_hdr->capacity != 8 ||
+    		owned_hdr->last_ix != 4 || (owned_hdr->sequence & 1) || owned->findHostIx("10.3.0.2") != 2 ||
+    		owned->findHostIx("10.3.0.4") != 4){
+    	exit(1);
+    }
+    delete owned_raw;
+    delete owned;
+    cout << endl;
+
+    // snapshots
+    char snap_dir[] = "/tmp/gargoyle_snapshot_XXXXXX";
+    if(mkdtemp(snap_dir) == nullptr){
+    	exit(1);
+    }
+    string snap_prefix = string(snap_dir) + "/db";
+    string snap_hosts = snap_prefix + ".hosts_table" + GARGOYLE_SHM_SNAPSHOT_SUFFIX;
+    db->cleanTables("all");
+    recordHostsTable.ix = 0;
+    for(int i=1; i<=3; i++){
+    	sprintf(recordHostsTable.host, "10.4.0.%d", i);
+    	recordHostsTable.first_seen = recordHostsTable.last_seen = 1000 + i;
+    	db->hosts->INSERT(recordHostsTable);
+    	db->hosts_ports_hits->addHits(i, 443, 10 * i);
+    }
+    // hits ix 3 is handed out and gone, it must not come round again after the load
+    db->hosts_ports_hits->deleteByHostIx(3);
+    Black_IP_List_Record snap_black;
+    memset(&snap_black, 0, sizeof(snap_black));
+    snap_black.host_ix = 2;
+    snap_black.timestamp = 1002;
+    db->black_ip_list->INSERT(snap_black);
+    int32_t snap_saved = db->saveSnapshots(snap_prefix);
+    db->cleanTables("all");
+    int32_t snap_loaded = db->loadSnapshots(snap_prefix);
+    vector<Hosts_Record> snap_host_rows;
+    vector<Hosts_Ports_Hits_Record> snap_hit_rows;
+    db->hosts->getAll(snap_host_rows);
+    db->hosts_ports_hits->addHits(4, 22, 1);
+    db->hosts_ports_hits->getAll(snap_hit_rows);
+    cout << "saveSnapshots = " << snap_saved << " loadSnapshots = " << snap_loaded << " hosts = " << snap_host_rows.size() <<
+    		" hits = " << snap_hit_rows.size() << " findHostIx(10.4.0.2) = " << db->hosts->findHostIx("10.4.0.2") <<
+    		" getHitCount(2, 443) = " << db->hosts_ports_hits->getHitCount(2, 443) << " black_ip_list(2) = " << (db->black_ip_list->findByHostIx(2) > 0) <<
+    		" new hit ix = " << snap_hit_rows.back().ix << endl;
+    if(snap_saved != 0 || snap_loaded != 0 || snap_host_rows.size() != 3 || snap_host_rows[2].last_seen != 1003 ||
+    		db->hosts->findHostIx("10.4.0.2") != 2 || db->hosts_ports_hits->getHitCount(2, 443) != 20 ||
+    		db->black_ip_list->findByHostIx(2) <= 0 || snap_hit_rows.size() != 3 || snap_hit_rows.back().ix != 4){
+    	exit(1);
+    }
+
+    // damaged or foreign files are refused, each one put back after
+    struct {
+    	const char *what;
+    	long offset;
+    } snap_damage[] = {
+    	{"checksum", (long)sizeof(Snapshot_Header_Mirror) + 5},
+    	{"version", (long)offsetof(Snapshot_Header_Mirror, version)},
+    	{"record size", (long)offsetof(Snapshot_Header_Mirror, record_size)}
+    };
+    for(size_t i=0; i<sizeof(snap_damage)/sizeof(snap_damage[0]); i++){
+    	db->hosts->TRUNCATE();
+    	bump_file_byte(snap_hosts, snap_damage[i].offset, 1);
+    	int32_t refused = db->hosts->loadSnapshot(snap_hosts);
+    	bump_file_byte(snap_hosts, snap_damage[i].offset, -1);
+    	cout << "loadSnapshot with a bad " << snap_damage[i].what << " = " << refused << endl;
+    	if(refused != -1 || db->hosts->getAll(snap_host_rows) != 0){
+    		exit(1);
+    	}
+    }
+    if(db->hosts->loadSnapshot(snap_hosts) != 0){
+    	exit(1);
+    }
+
+    // one bad table and none of them are loaded
+    db->cleanTables("all");
+    bump_file_byte(snap_hosts, sizeof(Snapshot_Header_Mirror) + 5, 1);
+    snap_loaded = db->loadSnapshots(snap_prefix);
+    vector<Black_IP_List_Record> snap_black_rows;
+    vector<Detected_Hosts_Record> snap_detected_rows;
+    vector<Ignore_IP_List_Record> snap_ignore_rows;
+    int snap_left = db->black_ip_list->getAll(snap_black_rows) + db->detected_hosts->getAll(snap_detected_rows) +
+    		db->hosts_ports_hits->getAll(snap_hit_rows) + db->hosts->getAll(snap_host_rows) + db->ignore_ip_list->getAll(snap_ignore_rows);
+    cout << "loadSnapshots with a bad hosts_table = " << snap_loaded << " rows left = " << snap_left << endl;
+    if(snap_loaded != -1 || snap_left != 0){
+    	exit(1);
+    }
+    const char *snap_tables[] = {"black_ip_list_table", "detected_hosts_table", "hosts_ports_hits_table", "hosts_table", "ignore_ip_list_table"};
+    for(size_t i=0; i<sizeof(snap_tables)/sizeof(snap_tables[0]); i++){
+    	unlink((snap_prefix + "." + snap_tables[i] + GARGOYLE_SHM_SNAPSHOT_SUFFIX).c_str());
+    }
+    rmdir(snap_dir);
+    cout << endl;
+
+    // a table whose layout header is not ours is refused, or replaced when asked
+    SharedMemRegion::Remove("/gargoyle_test_layout");
+    SharedMemRegion::Remove("/gargoyle_test_layout_index");
+    Hosts_Table *layout_old = Hosts_Table::CREATE("/gargoyle_test_layout", 8);
+    SharedMemRegion *layout_raw = SharedMemRegion::Create("/gargoyle_test_layout", sizeof(SharedMemLayout));
+    if(layout_old == nullptr || layout_raw == nullptr){
+    	exit(1);
+    }
+    sprintf(recordHostsTable.host, "10.5.0.1");
+    layout_old->INSERT(recordHostsTable);
+    SharedMemLayout *layout = reinterpret_cast<SharedMemLayout *>(layout_raw->BaseAddr());
+    const SharedMemLayout layout_good = *layout;
+    for(int i=0; i<3; i++){
+    	const char *what = i == 0 ? "magic" : i == 1 ? "version" : "schema";
+    	if(i == 0){
+    		memcpy(layout->magic, "NOTGARG", sizeof(layout->magic));
+    	}else if(i == 1){
+    		layout->version++;
+    	}else{
+    		layout->schema ^= 1;
+    	}
+    	Hosts_Table *refused = Hosts_Table::CREATE("/gargoyle_test_layout", 8);
+    	cout << "attach with a bad " << what << " = " << (refused != nullptr) << endl;
+    	if(refused != nullptr){
+    		exit(1);
+    	}
+    	*layout = layout_good;
+    }
+
+    // schema still wrong, the replacement starts empty and the old mapping keeps its rows
+    layout->schema ^= 1;
+    Hosts_Table *layout_new = Hosts_Table::CREATE("/gargoyle_test_layout", 8, true);
+    if(layout_new == nullptr){
+    	exit(1);
+    }
+    sprintf(recordHostsTable.host, "10.5.0.2");
+    layout_new->INSERT(recordHostsTable);
+    cout << "replaced, old findHostIx(10.5.0.1) = " << layout_old->findHostIx("10.5.0.1") << " new findHostIx(10.5.0.1) = " <<
+    		layout_new->findHostIx("10.5.0.1") << " new findHostIx(10.5.0.2) = " << layout_new->findHostIx("10.5.0.2") << endl;
+    if(layout_old->findHostIx("10.5.0.1") != 1 || layout_new->findHostIx("10.5.0.1") != 0 || layout_new->findHostIx("10.5.0.2") != 1){
+    	exit(1);
+    }
+
+    /*
+     * whoever still holds the old region must leave the new name alone,
+     * the old creator going away included
+     */
+    int32_t layout_unlinked = layout_raw->Unlink();
+    delete layout_raw;
+    delete layout_old;
+    Hosts_Table *layout_again = Hosts_Table::CREATE("/gargoyle_test_layout", 8, true);
+    cout << "Unlink of the replaced region = " << layout_unlinked << " attach after = " << (layout_again != nullptr) <<
+    		" findHostIx(10.5.0.2) = " << (layout_again ? layout_again->findHostIx("10.5.0.2") : -1) << endl;
+    if(layout_unlinked != 1 || layout_again == nullptr || layout_again->findHostIx("10.5.0.2") != 1){
+    	exit(1);
+    }
+    delete layout_again;
+    delete layout_new;
+    cout << endl;
+
 	return 0;
 }
@@ -0,0 +1,214 @@
+/*
+ * Times the SQLite queries the analysis daemon leans on against a
+ * synthetic DB laid out like the shipped db/gargoyle_attack_detect.db,
+ * first as shipped (no secondary indexes) and then again after
+ * sqlite_migrate_schema has brought it to the current version.
+ *
+ * From the top dir:
+ *
+ *   gcc -Ilib -c lib/sqlite_wrapper_api.c lib/sqlite_handle.c
+ *   g++ -std=c++11 -Ilib test/sqlite_schema_bench.cpp sqlite_wrapper_api.o sqlite_handle.o -lsqlite3 -lpthread -o sqlite_schema_bench
+ *   ./sqlite_schema_bench [hosts_ports_hits rows] [db file]
+ *
+ * Defaults to 10M rows in /tmp/gargoyle_schema_bench.db, which takes
+ * a few minutes to populate and about 400MB of disk. The file is
+ * removed afterwards.
+ */
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include <unistd.h>
+
+#include "sqlite_wrapper_api.h"
+#include "sqlite_handle.h"
+
+#define DEFAULT_ROWS 10000000
+#define DEFAULT_DB "/tmp/gargoyle_schema_bench.db"
+// each host hits this many ports on average
+#define PORTS_PER_HOST 10
+#define PORT_RANGE 1024
+#define LOOKUPS 100
+#define THRESHOLD_PORTS 20
+
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+
+static double msec_since(bench_clock::time_point start) {
+	return chrono::duration_cast<chrono::microseconds>(bench_clock::now() - start).count() / 1000.0;
+}
+
+
+// same tables as the shipped DB file, triggers left out to keep the load fast
+static const char *shipped_schema =
+	"CREATE TABLE hosts_table (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host TEXT NOT NULL UNIQUE, first_seen INTEGER, last_seen INTEGER);"
+	"CREATE TABLE hosts_ports_hits (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL, port_number INTEGER NOT NULL, hit_count INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table(ix));"
+	"CREATE TABLE detected_hosts (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL UNIQUE, timestamp TEXT NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table(ix));"
+	"CREATE TABLE ignore_ip_list (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL UNIQUE, timestamp INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table(ix));"
+	"CREATE TABLE black_ip_list (ix INTEGER NOT NULL PRIMARY KEY AUTOINCREMENT, host_ix INTEGER NOT NULL UNIQUE, timestamp INTEGER NOT NULL, FOREIGN KEY(host_ix) REFERENCES hosts_table(ix));";
+
+
+static int populate(const char *db_file, size_t rows) {
+
+	sqlite3 *db;
+	sqlite3_stmt *host_stmt;
+	sqlite3_stmt *hit_stmt;
+	size_t hosts = rows / PORTS_PER_HOST;
+	time_t now = time(NULL);
+	char ip[32];
+
+	if (sqlite3_open(db_file, &db) != SQLITE_OK)
+		return 1;
+
+	sqlite3_exec(db, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF;", NULL, NULL, NULL);
+	if (sqlite3_exec(db, shipped_schema, NULL, NULL, NULL) != SQLITE_OK) {
+		fprintf(stderr, "creating schema: %s\n", sqlite3_errmsg(db));
+		sqlite3_close(db);
+		return 1;
+	}
+
+	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	sqlite3_prepare_v2(db, "INSERT INTO hosts_table (host, first_seen, last_seen) VALUES (?1, ?2, ?3)", -1, &host_stmt, NULL);
+	sqlite3_prepare_v2(db, "INSERT INTO hosts_ports_hits (host_ix, port_number, hit_count) VALUES (?1, ?2, ?3)", -1, &hit_stmt, NULL);
+
+	for (size_t h = 1; h <= hosts; h++) {
+		snprintf(ip, sizeof(ip), "10.%zu.%zu.%zu", (h >> 16) & 0xff, (h >> 8) & 0xff, h & 0xff);
+		sqlite3_bind_text(host_stmt, 1, ip, -1, SQLITE_STATIC);
+		sqlite3_bind_int64(host_stmt, 2, now - 86400 * 30);
+		sqlite3_bind_int64(host_stmt, 3, now - (rand() % (86400 * 30)));
+		sqlite3_step(host_stmt);
+		sqlite3_reset(host_stmt);
+	}
+	for (size_t r = 0; r < rows; r++) {
+		size_t host_ix = (r / PORTS_PER_HOST) + 1;
+		// distinct ports per host so the unique index migration has nothing to merge
+		int port = 1 + (int)((host_ix * 7 + (r % PORTS_PER_HOST) * 97) % PORT_RANGE);
+		sqlite3_bind_int64(hit_stmt, 1, host_ix);
+		sqlite3_bind_int(hit_stmt, 2, port);
+		sqlite3_bind_int(hit_stmt, 3, 1 + rand() % 20);
+		sqlite3_step(hit_stmt);
+		sqlite3_reset(hit_stmt);
+	}
+
+	sqlite3_finalize(host_stmt);
+	sqlite3_finalize(hit_stmt);
+	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+	sqlite3_close(db);
+
+	return 0;
+}
+
+
+static int count_hit(const struct sqlite_host_port_hit_entry *entry, void *ctx) {
+
+	(*(size_t *) ctx)++;
+	return 0;
+}
+
+
+static int count_host(const struct sqlite_host_hit_summary *entry, void *ctx) {
+
+	(*(size_t *) ctx)++;
+	return 0;
+}
+
+
+static void run_queries(const char *label, const char *db_file, size_t rows) {
+
+	size_t hosts = rows / PORTS_PER_HOST;
+	size_t hits = 0;
+	bench_clock::time_point t;
+	double ms;
+
+	srand(42);
+	t = bench_clock::now();
+	for (int i = 0; i < THRESHOLD_PORTS; i++)
+		sqlite_for_each_host_one_port_threshold(1 + rand() % PORT_RANGE, 15, count_hit, &hits, db_file);
+	ms = msec_since(t);
+	printf("%-7s port/threshold scan      %10.2f ms/query\n", label, ms / THRESHOLD_PORTS);
+
+	// what one analysis run asks for, every host seen in the last 8 hours
+	hits = 0;
+	t = bench_clock::now();
+	sqlite_for_each_host_hit_summary(time(NULL) - 28800, count_host, &hits, db_file);
+	ms = msec_since(t);
+	printf("%-7s host hit summary pass    %10.2f ms (%zu hosts)\n", label, ms, hits);
+
+	t = bench_clock::now();
+	for (int i = 0; i < LOOKUPS; i++)
+		sqlite_get_host_port_hit(1 + rand() % hosts, 1 + rand() % PORT_RANGE, db_file);
+	ms = msec_since(t);
+	printf("%-7s host/port hit lookup     %10.3f ms/query\n", label, ms / LOOKUPS);
+
+	t = bench_clock::now();
+	for (int i = 0; i < LOOKUPS; i++)
+		sqlite_get_one_host_hit_count_all_ports(1 + rand() % hosts, db_file);
+	ms = msec_since(t);
+	printf("%-7s per host hit total       %10.3f ms/query\n", label, ms / LOOKUPS);
+
+	// what a retention pass asks for
+	sqlite3 *db;
+	sqlite3_stmt *stmt;
+	int stale = 0;
+	t = bench_clock::now();
+	if (sqlite_handle_acquire(db_file, &db) == SQLITE_OK) {
+		sqlite_handle_prepare(db, "SELECT COUNT(*) FROM hosts_table WHERE last_seen < ?1", &stmt);
+		sqlite3_bind_int64(stmt, 1, time(NULL) - 86400 * 29);
+		if (sqlite3_step(stmt) == SQLITE_ROW)
+			stale = sqlite3_column_int(stmt, 0);
+		sqlite_handle_release_stmt(stmt);
+		sqlite_handle_release(db);
+	}
+	ms = msec_since(t);
+	printf("%-7s last_seen range count    %10.2f ms/query (%d hosts)\n", label, ms, stale);
+}
+
+
+int main(int argc, char *argv[]) {
+
+	size_t rows = DEFAULT_ROWS;
+	const char *db_file = DEFAULT_DB;
+
+	if (argc > 1 && atol(argv[1]) > 0)
+		rows = atol(argv[1]);
+	if (argc > 2)
+		db_file = argv[2];
+
+	if (rows < PORTS_PER_HOST) {
+		fprintf(stderr, "need at least %d rows\n", PORTS_PER_HOST);
+		return 1;
+	}
+
+	unlink(db_file);
+	printf("populating %s with %zu hosts_ports_hits rows\n", db_file, rows);
+	bench_clock::time_point t = bench_clock::now();
+	if (populate(db_file, rows) != 0) {
+		fprintf(stderr, "could not populate %s\n", db_file);
+		return 1;
+	}
+	printf("populated in %.1f s\n\n", msec_since(t) / 1000);
+
+	run_queries("before", db_file, rows);
+
+	t = bench_clock::now();
+	int ret = sqlite_migrate_schema(db_file);
+	printf("\nsqlite_migrate_schema %s in %.1f s\n\n", ret == 0 ? "done" : "FAILED", msec_since(t) / 1000);
+
+	run_queries("after", db_file, rows);
+
+	sqlite_handle_close_all();
+	unlink(db_file);
+	string side = string(db_file) + "-wal";
+	unlink(side.c_str());
+	side = string(db_file) + "-shm";
+	unlink(side.c_str());
+
+	return ret;
+}
@@ -1638,6 +1638,45 @@ def get_db():
 
     return db_loc
 
+def get_read_db():
+    """ Get Read Database
+
+        Retrieves location of the database the read-only functions use. When sqlite_snapshot_interval is set in the config
+        gargoyle_pscand_analysis keeps a snapshot of the gargoyle database next to it, reading that one keeps these calls
+        from waiting on the daemons' writes. A snapshot older than 3 intervals is ignored.
+
+        Args:
+            None
+
+        Returns:
+            String value of the location of the snapshot, or of the gargoyle_attack_detect.db database when there is no fresh snapshot.
+
+        Raises:
+            No exceptions raised
+
+        Examples:
+
+        >>> get_read_db()
+        /opt/gargoyle_pscand/db/gargoyle_attack_detect.db.snapshot
+        >>> get_read_db()
+        /opt/gargoyle_pscand/db/gargoyle_attack_detect.db
+
+    """
+    SNAPSHOT_SUFFIX = ".snapshot"
+    db_loc = get_db()
+    snapshot_loc = db_loc + SNAPSHOT_SUFFIX
+
+    try:
+        interval = json.loads(get_current_config()).get('sqlite_snapshot_interval', 0)
+        age = time.time() - os.path.getmtime(snapshot_loc)
+    except (IOError, OSError, ValueError):
+        return db_loc
+
+    if interval > 0 and age < 3 * interval:
+        return snapshot_loc
+
+    return db_loc
+
 def get_current_white_list():
     """ Get Current White List
 
@@ -1659,7 +1698,7 @@ def get_current_white_list():
         >>> get_current_white_list()
         {'192.168.56.10':1504035667,'192.168.100.103':1504035712}
     """
-    db_loc = get_db()
+    db_loc = get_read_db()
     host_ix_list = {}
     white_listed_ips = {}
     print db_loc
@@ -1856,7 +1895,7 @@ def get_current_black_list():
         >>> get_current_black_list()
         {'192.168.56.10':1504035667,'192.168.100.103':1504035712}
     """
-    db_loc = get_db()
+    db_loc = get_read_db()
     host_ix_list = {}
     black_listed_ips = {}
 
@@ -2029,17 +2068,66 @@ def remove_from_black_list(ip_addr=''):
 
     return 0
 
+def get_blocked_from_bpf_map():
+    """ Get Blocked From BPF Map
+
+        Retrieves the blocked ips from the XDP drop map. While gargoyle_pscand runs with bpf_interface set the drop
+        rules of GARGOYLE_Input_Chain are kept in a pinned bpf map as well as in iptables, the map is what the daemons list.
+
+        Args:
+            None
+
+        Returns:
+            A list of the blocked ips (ip/bits for a subnet), or None when the map is not pinned and iptables holds the rules.
+
+        Raises:
+            No exceptions raised
+
+        Examples:
+
+        >>> get_blocked_from_bpf_map()
+        ['192.168.56.101', '10.1.2.0/24']
+        >>> get_blocked_from_bpf_map()
+        None
+    """
+    BPF_MAP_PIN = '/sys/fs/bpf/gargoyle_blocked'
+
+    if not os.path.exists(BPF_MAP_PIN):
+        return None
+
+    cmd = ['sudo bpftool -j map dump pinned {}'.format(BPF_MAP_PIN)]
+    p = Popen(cmd, stdout=PIPE, shell=True)
+    out,err = p.communicate()
+
+    try:
+        entries = json.loads(out)
+    except ValueError:
+        return None
+
+    blocked = []
+    for entry in entries:
+        # key is struct bpf_drop_key: host order prefixlen, network order addr
+        key = bytearray(int(b, 16) for b in entry['key'])
+        prefixlen = struct.unpack('=I', bytes(key[0:4]))[0]
+        addr = '.'.join(str(b) for b in key[4:8])
+        if prefixlen == 32:
+            blocked.append(addr)
+        else:
+            blocked.append('{}/{}'.format(addr, prefixlen))
+
+    return blocked
+
 def get_current_from_iptables():
     """ Get Current Information From Iptables
 
-        Retrieves ips in iptables
+        Retrieves ips in iptables, or in the XDP drop map while gargoyle_pscand has it loaded
 
         Args:
             ip_addr: None
 
         Returns:
             A dictionary where the keys are ips in iptables and the values are a list containing the timestamp the ip was first seen by gargoyle
-            and the timestamp the ip was last seen, with the timestamps retrieved from the database.
+            and the timestamp the ip was last seen, with the timestamps retrieved from the database. Both are None for an ip the database has no row for.
 
         Raises:
             Database Error if the path returned by db_loc() is not valid or the user doesn't have root priviledges when running the program.
@@ -2051,25 +2139,27 @@ def get_current_from_iptables():
         >>> get_current_from_iptables()
         {'192.168.56.101':[1504036871, 1504040871], '192.168.100.23':[1515436871, 1604040871]}
     """
-    ips_in_iptables = []
     blocked_ips = {}
-    first_seen = 0
-    last_seen = 0
 
-    cmd = ['sudo iptables -L GARGOYLE_Input_Chain -n']
-    p = Popen(cmd, stdout=PIPE, shell=True)
-    out,err = p.communicate()
+    ips_in_iptables = get_blocked_from_bpf_map()
+    if ips_in_iptables is None:
+        ips_in_iptables = []
 
+        cmd = ['sudo iptables -L GARGOYLE_Input_Chain -n']
+        p = Popen(cmd, stdout=PIPE, shell=True)
+        out,err = p.communicate()
 
-    lines = out.split('\n')
-    for line in lines:
-        if len(line) > 0:
-            each_line = line.split()
-            if each_line[0] == 'DROP':
-                ips_in_iptables.append(each_line[3])
 
-    host_ix = None
-    db_loc = get_db()
+        lines = out.split('\n')
+        for line in lines:
+            if len(line) > 0:
+                each_line = line.split()
+                if each_line[0] == 'DROP':
+                    ips_in_iptables.append(each_line[3])
+
+    db_loc = get_read_db()
+    live_db_loc = get_db()
+    live_table = None
 
     try:
         table = sqlite3.connect(db_loc)
@@ -2078,22 +2168,32 @@ def get_current_from_iptables():
         raise e
 
     for ip in ips_in_iptables:
-        try:
-            with table:
-                cursor.execute("SELECT first_seen FROM hosts_table WHERE host = '{}'".format(ip))
-                first_seen = cursor.fetchone()[0]
-        except TypeError:
-            pass
+        first_seen = None
+        last_seen = None
 
-        try:
-            with table:
-                cursor.execute("SELECT last_seen FROM hosts_table WHERE host = '{}'".format(ip))
-                last_seen = cursor.fetchone()[0]
-        except TypeError:
-            pass
+        with table:
+            cursor.execute("SELECT first_seen, last_seen FROM hosts_table WHERE host = ?", (ip,))
+            row = cursor.fetchone()
+
+        # the snapshot can predate the block, the live DB has the row then
+        if row is None and db_loc != live_db_loc:
+            try:
+                if live_table is None:
+                    live_table = sqlite3.connect(live_db_loc)
+                with live_table:
+                    row = live_table.execute("SELECT first_seen, last_seen FROM hosts_table WHERE host = ?", (ip,)).fetchone()
+            except sqlite3.Error:
+                row = None
+
+        if row is not None:
+            first_seen, last_seen = row
 
         blocked_ips[ip] = [first_seen,last_seen]
 
+    table.close()
+    if live_table is not None:
+        live_table.close()
+
     return blocked_ips
 
 def blocked_time():
@@ -2119,7 +2219,7 @@ def blocked_time():
     blocked_timestamps = {}
     blocked_ips = get_current_from_iptables()
     host_ix = None
-    db_loc = get_db()
+    db_loc = get_read_db()
     blocked_time = None
     daemons = daemon_stats()
     last_monitor_run = daemons['last_monitor']